@@ -0,0 +1,443 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * A check of the HPACK Huffman decoders on a corpus of real headers.
+ *
+ * Each line of the corpus is a header, and its name and value are
+ * encoded with ngx_http_huff_encode().  The encoded strings are decoded
+ * with the nibble decoder, which ngx_http_huff_decode() uses until
+ * ngx_http_huff_decode_init() builds the byte table, and then with the
+ * byte decoder.  With each decoder, the strings are decoded at once
+ * and split into two parts at every offset, the output must be the
+ * same as the original string, and the strings with a random bit
+ * flipped must give the same result with both decoders.  The decoding
+ * speed of both decoders over the corpus is reported.
+ *
+ * The program is linked with the objects of a configured nginx build:
+ *
+ *     cc -O -o objs/ngx_http_huff_check \
+ *         -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I src/http -I src/http/modules -I src/http/v2 \
+ *         -I src/event/quic -I src/http/v3 -I objs \
+ *         contrib/huff_check/ngx_http_huff_check.c \
+ *         objs/src/http/ngx_http_huff_decode.o \
+ *         objs/src/http/ngx_http_huff_encode.o
+ *
+ *     objs/ngx_http_huff_check [corpus [iterations [seed]]]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HUFF_CHECK_MAX_LINE  4096
+#define NGX_HUFF_CHECK_MUTATIONS 64
+
+
+typedef struct {
+    u_char                   *plain;
+    size_t                    plain_len;
+    u_char                   *huff;
+    size_t                    huff_len;
+
+    ngx_int_t                 rc[NGX_HUFF_CHECK_MUTATIONS];
+    size_t                    len[NGX_HUFF_CHECK_MUTATIONS];
+    u_char                   *out[NGX_HUFF_CHECK_MUTATIONS];
+} ngx_huff_check_str_t;
+
+
+static ngx_int_t ngx_huff_check_load(const char *path);
+static ngx_int_t ngx_huff_check_add(u_char *s, size_t len, ngx_uint_t lower);
+static ngx_uint_t ngx_huff_check_verify(const char *name);
+static ngx_uint_t ngx_huff_check_mutate(const char *name, ngx_uint_t record);
+static double ngx_huff_check_bench(ngx_uint_t iterations);
+static double ngx_huff_check_now(void);
+static uint32_t ngx_huff_check_random(void);
+
+
+static ngx_log_t              ngx_huff_check_log;
+static ngx_huff_check_str_t  *ngx_huff_check_strs;
+static ngx_uint_t             ngx_huff_check_nstrs;
+static ngx_uint_t             ngx_huff_check_nalloc;
+static ngx_uint_t             ngx_huff_check_plain;
+static size_t                 ngx_huff_check_bytes;
+static u_char                 ngx_huff_check_buf[NGX_HUFF_CHECK_MAX_LINE * 2];
+static uint64_t               ngx_huff_check_seed;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    double       nibbles, bytes;
+    uint64_t     seed;
+    ngx_uint_t   errors, iterations;
+    const char  *path;
+
+    path = (argc > 1) ? argv[1] : "contrib/huff_check/headers.txt";
+    iterations = (argc > 2) ? (ngx_uint_t) strtoul(argv[2], NULL, 10) : 10000;
+    seed = (argc > 3) ? strtoull(argv[3], NULL, 10) : 1;
+
+    if (ngx_huff_check_load(path) != NGX_OK) {
+        return 2;
+    }
+
+    printf("corpus: %s, strings: %lu, not encoded: %lu, encoded bytes: %lu\n",
+           path, (unsigned long) ngx_huff_check_nstrs,
+           (unsigned long) ngx_huff_check_plain,
+           (unsigned long) ngx_huff_check_bytes);
+
+    if (ngx_huff_check_bytes == 0) {
+        fprintf(stderr, "nothing to decode\n");
+        return 2;
+    }
+
+    /* the byte table is not built yet, so the nibble decoder is used */
+
+    errors = ngx_huff_check_verify("nibbles");
+
+    ngx_huff_check_seed = seed;
+    errors += ngx_huff_check_mutate("nibbles", 1);
+
+    nibbles = ngx_huff_check_bench(iterations);
+
+    ngx_http_huff_decode_init();
+
+    errors += ngx_huff_check_verify("bytes");
+
+    ngx_huff_check_seed = seed;
+    errors += ngx_huff_check_mutate("bytes", 0);
+
+    bytes = ngx_huff_check_bench(iterations);
+
+    printf("\n%-8s %12s %12s\n", "decoder", "ns/string", "MB/s");
+
+    printf("%-8s %12.1f %12.1f\n", "nibbles",
+           nibbles / ngx_huff_check_nstrs,
+           ngx_huff_check_bytes * 1e3 / nibbles);
+
+    printf("%-8s %12.1f %12.1f\n", "bytes",
+           bytes / ngx_huff_check_nstrs,
+           ngx_huff_check_bytes * 1e3 / bytes);
+
+    if (errors) {
+        printf("\n%lu errors\n", (unsigned long) errors);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_huff_check_load(const char *path)
+{
+    u_char  *p, *colon;
+    size_t   len;
+    FILE    *f;
+    char     line[NGX_HUFF_CHECK_MAX_LINE];
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "fopen(\"%s\") failed: %s\n", path, strerror(errno));
+        return NGX_ERROR;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+
+        p = (u_char *) line;
+        len = ngx_strlen(p);
+
+        while (len && (p[len - 1] == LF || p[len - 1] == CR)) {
+            len--;
+        }
+
+        if (len == 0 || p[0] == '#') {
+            continue;
+        }
+
+        /* the name is lowercased when encoded, as HPACK requires */
+
+        colon = ngx_strlchr(p, p + len, ':');
+
+        if (colon == NULL) {
+            if (ngx_huff_check_add(p, len, 0) != NGX_OK) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_huff_check_add(p, colon - p, 1) != NGX_OK) {
+            goto failed;
+        }
+
+        for (colon++; colon < p + len && *colon == ' '; colon++) {
+            /* void */
+        }
+
+        if (ngx_huff_check_add(colon, p + len - colon, 0) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    fclose(f);
+
+    return NGX_OK;
+
+failed:
+
+    fprintf(stderr, "malloc() failed\n");
+
+    fclose(f);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_huff_check_add(u_char *s, size_t len, ngx_uint_t lower)
+{
+    size_t                 hlen;
+    ngx_uint_t             i;
+    ngx_huff_check_str_t  *str;
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    hlen = ngx_http_huff_encode(s, len, ngx_huff_check_buf, lower);
+
+    if (hlen == 0) {
+        /* the string would be sent as is */
+        ngx_huff_check_plain++;
+        return NGX_OK;
+    }
+
+    if (ngx_huff_check_nstrs == ngx_huff_check_nalloc) {
+        ngx_huff_check_nalloc = ngx_huff_check_nalloc * 2 + 64;
+
+        str = realloc(ngx_huff_check_strs,
+                      ngx_huff_check_nalloc * sizeof(ngx_huff_check_str_t));
+        if (str == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_huff_check_strs = str;
+    }
+
+    str = &ngx_huff_check_strs[ngx_huff_check_nstrs];
+    ngx_memzero(str, sizeof(ngx_huff_check_str_t));
+
+    str->plain = malloc(len);
+    str->huff = malloc(hlen);
+
+    if (str->plain == NULL || str->huff == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < len; i++) {
+        str->plain[i] = lower ? ngx_tolower(s[i]) : s[i];
+    }
+
+    str->plain_len = len;
+
+    ngx_memcpy(str->huff, ngx_huff_check_buf, hlen);
+    str->huff_len = hlen;
+
+    for (i = 0; i < NGX_HUFF_CHECK_MUTATIONS; i++) {
+
+        /* the output is at most len * 8 / 5 bytes */
+
+        str->out[i] = malloc(hlen * 2);
+        if (str->out[i] == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_huff_check_nstrs++;
+    ngx_huff_check_bytes += hlen;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_huff_check_verify(const char *name)
+{
+    u_char                 state, *dst;
+    size_t                 split;
+    ngx_uint_t             i, errors;
+    ngx_huff_check_str_t  *str;
+
+    errors = 0;
+
+    for (i = 0; i < ngx_huff_check_nstrs; i++) {
+        str = &ngx_huff_check_strs[i];
+
+        /* split 0 decodes the string at once */
+
+        for (split = 0; split < str->huff_len; split++) {
+
+            state = 0;
+            dst = ngx_huff_check_buf;
+
+            if (split
+                && ngx_http_huff_decode(&state, str->huff, split, &dst, 0,
+                                        &ngx_huff_check_log)
+                   != NGX_OK)
+            {
+                goto failed;
+            }
+
+            if (ngx_http_huff_decode(&state, str->huff + split,
+                                     str->huff_len - split, &dst, 1,
+                                     &ngx_huff_check_log)
+                != NGX_OK)
+            {
+                goto failed;
+            }
+
+            if ((size_t) (dst - ngx_huff_check_buf) == str->plain_len
+                && ngx_memcmp(ngx_huff_check_buf, str->plain, str->plain_len)
+                   == 0)
+            {
+                continue;
+            }
+
+        failed:
+
+            printf("%s: string %lu split at %lu: \"%.*s\" decoded as "
+                   "\"%.*s\"\n", name, (unsigned long) i,
+                   (unsigned long) split, (int) str->plain_len, str->plain,
+                   (int) (dst - ngx_huff_check_buf), ngx_huff_check_buf);
+
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+
+static ngx_uint_t
+ngx_huff_check_mutate(const char *name, ngx_uint_t record)
+{
+    u_char                 state, *dst, save;
+    size_t                 len, n;
+    ngx_int_t              rc;
+    ngx_uint_t             i, m, errors;
+    ngx_huff_check_str_t  *str;
+
+    errors = 0;
+
+    for (i = 0; i < ngx_huff_check_nstrs; i++) {
+        str = &ngx_huff_check_strs[i];
+
+        for (m = 0; m < NGX_HUFF_CHECK_MUTATIONS; m++) {
+
+            n = ngx_huff_check_random() % str->huff_len;
+            save = str->huff[n];
+
+            str->huff[n] ^= 1 << (ngx_huff_check_random() % 8);
+
+            state = 0;
+            dst = ngx_huff_check_buf;
+
+            rc = ngx_http_huff_decode(&state, str->huff, str->huff_len, &dst,
+                                      1, &ngx_huff_check_log);
+
+            str->huff[n] = save;
+
+            /* the output decoded before an error may differ */
+
+            len = (rc == NGX_OK) ? (size_t) (dst - ngx_huff_check_buf) : 0;
+
+            if (record) {
+                str->rc[m] = rc;
+                str->len[m] = len;
+                ngx_memcpy(str->out[m], ngx_huff_check_buf, len);
+                continue;
+            }
+
+            if (rc == str->rc[m]
+                && len == str->len[m]
+                && ngx_memcmp(ngx_huff_check_buf, str->out[m], len) == 0)
+            {
+                continue;
+            }
+
+            printf("%s: string %lu with bit flipped at byte %lu: "
+                   "rc %ld, \"%.*s\", nibbles rc %ld, \"%.*s\"\n",
+                   name, (unsigned long) i, (unsigned long) n, (long) rc,
+                   (int) len, ngx_huff_check_buf, (long) str->rc[m],
+                   (int) str->len[m], str->out[m]);
+
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+
+static double
+ngx_huff_check_bench(ngx_uint_t iterations)
+{
+    u_char                 state, *dst;
+    double                 start;
+    ngx_uint_t             i, n;
+    ngx_huff_check_str_t  *str;
+
+    start = ngx_huff_check_now();
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < ngx_huff_check_nstrs; i++) {
+            str = &ngx_huff_check_strs[i];
+
+            state = 0;
+            dst = ngx_huff_check_buf;
+
+            (void) ngx_http_huff_decode(&state, str->huff, str->huff_len,
+                                        &dst, 1, &ngx_huff_check_log);
+        }
+    }
+
+    return (ngx_huff_check_now() - start) / (iterations ? iterations : 1);
+}
+
+
+static double
+ngx_huff_check_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static uint32_t
+ngx_huff_check_random(void)
+{
+    /* xorshift64* */
+
+    ngx_huff_check_seed ^= ngx_huff_check_seed >> 12;
+    ngx_huff_check_seed ^= ngx_huff_check_seed << 25;
+    ngx_huff_check_seed ^= ngx_huff_check_seed >> 27;
+
+    return (uint32_t) ((ngx_huff_check_seed * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
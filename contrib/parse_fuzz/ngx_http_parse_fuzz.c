@@ -0,0 +1,728 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * A differential fuzzer of the HTTP request line and header parsers.
+ *
+ * Random request lines and headers are split at random points and fed
+ * to ngx_http_parse_request_line() and ngx_http_parse_header_line()
+ * with the scalar, SSE4.2, and AVX2 scanning.  The return code, b->pos,
+ * the parser state, and the request fields set by the parsers must be
+ * the same after each call.  The hash and the lowercased name of each
+ * header line parsed are also checked against ngx_hash().
+ *
+ * The program is linked with the objects of a configured nginx build:
+ *
+ *     cc -O -o objs/ngx_http_parse_fuzz \
+ *         -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I src/http -I src/http/modules -I src/http/v2 \
+ *         -I src/event/quic -I src/http/v3 -I objs \
+ *         contrib/parse_fuzz/ngx_http_parse_fuzz.c \
+ *         objs/src/http/ngx_http_parse.o objs/src/core/ngx_string.o \
+ *         objs/src/core/ngx_cpuinfo.o
+ *
+ *     objs/ngx_http_parse_fuzz [iterations [seed]]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_FUZZ_MAX_INPUT   4096
+#define NGX_FUZZ_MAX_STEPS   NGX_FUZZ_MAX_INPUT
+
+
+typedef struct {
+    const char               *name;
+    size_t                    offset;
+} ngx_fuzz_field_t;
+
+
+typedef struct {
+    ngx_int_t                 rc;
+    off_t                     pos;
+    ngx_uint_t                state;
+    off_t                     fields[24];
+    ngx_uint_t                values[16];
+    u_char                    lowcase[NGX_HTTP_LC_HEADER_LEN];
+} ngx_fuzz_step_t;
+
+
+typedef struct {
+    ngx_uint_t                features;
+    const char               *name;
+    ngx_uint_t                nsteps;
+    ngx_fuzz_step_t           steps[NGX_FUZZ_MAX_STEPS];
+} ngx_fuzz_mode_t;
+
+
+static void ngx_fuzz_generate(void);
+static void ngx_fuzz_append(const char *s);
+static void ngx_fuzz_append_random(const char *alphabet, size_t n);
+static void ngx_fuzz_run(ngx_fuzz_mode_t *mode);
+static void ngx_fuzz_record(ngx_fuzz_mode_t *mode, ngx_http_request_t *r,
+    ngx_buf_t *b, ngx_int_t rc, ngx_uint_t header);
+static ngx_int_t ngx_fuzz_check_name(ngx_fuzz_mode_t *mode,
+    ngx_http_request_t *r);
+static ngx_int_t ngx_fuzz_compare(ngx_fuzz_mode_t *a, ngx_fuzz_mode_t *b);
+static void ngx_fuzz_dump(void);
+static uint32_t ngx_fuzz_random(void);
+
+
+/* stubs of the functions not used by the parsers being tested */
+
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_uint_t             ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+
+static ngx_fuzz_field_t  ngx_fuzz_fields[] = {
+    { "request_start", offsetof(ngx_http_request_t, request_start) },
+    { "request_end", offsetof(ngx_http_request_t, request_end) },
+    { "method_end", offsetof(ngx_http_request_t, method_end) },
+    { "schema_start", offsetof(ngx_http_request_t, schema_start) },
+    { "schema_end", offsetof(ngx_http_request_t, schema_end) },
+    { "host_start", offsetof(ngx_http_request_t, host_start) },
+    { "host_end", offsetof(ngx_http_request_t, host_end) },
+    { "uri_start", offsetof(ngx_http_request_t, uri_start) },
+    { "uri_end", offsetof(ngx_http_request_t, uri_end) },
+    { "uri_ext", offsetof(ngx_http_request_t, uri_ext) },
+    { "args_start", offsetof(ngx_http_request_t, args_start) },
+    { "http_protocol", offsetof(ngx_http_request_t, http_protocol.data) },
+    { "header_name_start", offsetof(ngx_http_request_t, header_name_start) },
+    { "header_name_end", offsetof(ngx_http_request_t, header_name_end) },
+    { "header_start", offsetof(ngx_http_request_t, header_start) },
+
+    /* header_end is not used until a header line ends */
+
+    { "header_end", offsetof(ngx_http_request_t, header_end) },
+    { NULL, 0 }
+};
+
+
+static const char  *ngx_fuzz_values[] = {
+    "method", "http_major", "http_minor", "http_version", "complex_uri",
+    "quoted_uri", "plus_in_uri", "empty_path_in_uri", "invalid_header",
+    "lowcase_index", "header_hash", NULL
+};
+
+
+static const char  *ngx_fuzz_methods[] = {
+    "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PROPFIND", "PATCH",
+    "MKCOL", "TRACE", "CONNECT", "LOCK", "UNLOCK", "COPY", "MOVE", "G3T",
+    "get", ""
+};
+
+
+static const char  *ngx_fuzz_headers[] = {
+    "Host", "User-Agent", "Accept", "Accept-Encoding", "Cookie",
+    "Content-Length", "X-Forwarded-For", "X_Under_Score", "If-None-Match",
+    "Transfer-Encoding", "Connection", ""
+};
+
+
+static const char  ngx_fuzz_uri_usual[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789/-_";
+
+static const char  ngx_fuzz_uri_special[] =
+    "%?#+&=;.~:@!$'()*,/\"<>[]\\^`{|}";
+
+static const char  ngx_fuzz_value_usual[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    " ;=,/.:-_()\"";
+
+static const char  ngx_fuzz_name_usual[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-";
+
+static const char  ngx_fuzz_name_long[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789--_";
+
+
+static u_char      ngx_fuzz_input[NGX_FUZZ_MAX_INPUT];
+static size_t      ngx_fuzz_len;
+static size_t      ngx_fuzz_splits[64];
+static ngx_uint_t  ngx_fuzz_nsplits;
+static ngx_uint_t  ngx_fuzz_underscores;
+static uint64_t    ngx_fuzz_seed;
+static ngx_uint_t  ngx_fuzz_calls;
+static ngx_uint_t  ngx_fuzz_lines;
+static ngx_uint_t  ngx_fuzz_errors;
+
+static ngx_fuzz_mode_t  ngx_fuzz_modes[] = {
+    { 0, "scalar", 0, { { 0 } } },
+    { NGX_CPU_SSE42, "sse4.2", 0, { { 0 } } },
+    { NGX_CPU_SSE42|NGX_CPU_AVX2, "avx2", 0, { { 0 } } }
+};
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t  i, m, n, nmodes, iterations;
+
+    iterations = (argc > 1) ? (ngx_uint_t) strtoul(argv[1], NULL, 10)
+                            : 100000;
+    ngx_fuzz_seed = (argc > 2) ? strtoull(argv[2], NULL, 10) : 1;
+
+    ngx_cpuinfo();
+
+    nmodes = 1;
+
+    for (m = 1; m < sizeof(ngx_fuzz_modes) / sizeof(ngx_fuzz_mode_t); m++) {
+        if ((ngx_fuzz_modes[m].features & ngx_cpu_features)
+            == ngx_fuzz_modes[m].features)
+        {
+            ngx_fuzz_modes[nmodes++] = ngx_fuzz_modes[m];
+        }
+    }
+
+    printf("modes:");
+
+    for (m = 0; m < nmodes; m++) {
+        printf(" %s", ngx_fuzz_modes[m].name);
+    }
+
+    printf(", iterations: %lu, seed: %llu\n",
+           (unsigned long) iterations, (unsigned long long) ngx_fuzz_seed);
+
+    if (nmodes == 1) {
+        printf("no vector scanning, nothing to compare\n");
+        return 0;
+    }
+
+    n = 0;
+
+    for (i = 0; i < iterations; i++) {
+        ngx_fuzz_generate();
+
+        for (m = 0; m < nmodes; m++) {
+            ngx_fuzz_run(&ngx_fuzz_modes[m]);
+        }
+
+        if (ngx_fuzz_errors) {
+            ngx_fuzz_errors = 0;
+            ngx_fuzz_dump();
+
+            if (++n == 10) {
+                return 1;
+            }
+
+            continue;
+        }
+
+        for (m = 1; m < nmodes; m++) {
+            if (ngx_fuzz_compare(&ngx_fuzz_modes[0], &ngx_fuzz_modes[m])
+                != NGX_OK)
+            {
+                ngx_fuzz_dump();
+
+                if (++n == 10) {
+                    return 1;
+                }
+
+                break;
+            }
+        }
+    }
+
+    printf("%lu calls, %lu lines parsed, %lu differences\n",
+           (unsigned long) ngx_fuzz_calls, (unsigned long) ngx_fuzz_lines,
+           (unsigned long) n);
+
+    return n ? 1 : 0;
+}
+
+
+static void
+ngx_fuzz_generate(void)
+{
+    size_t      len;
+    ngx_uint_t  i, n;
+
+    ngx_fuzz_len = 0;
+    ngx_fuzz_underscores = ngx_fuzz_random() % 2;
+
+    /* request line */
+
+    ngx_fuzz_append(ngx_fuzz_methods[ngx_fuzz_random()
+                                     % (sizeof(ngx_fuzz_methods)
+                                        / sizeof(char *))]);
+
+    if (ngx_fuzz_random() % 8) {
+        ngx_fuzz_append(" ");
+
+    } else {
+        ngx_fuzz_append_random("  \t", 1 + ngx_fuzz_random() % 3);
+    }
+
+    switch (ngx_fuzz_random() % 8) {
+    case 0:
+        ngx_fuzz_append("http://");
+        ngx_fuzz_append_random("abcdefghijklmnopqrstuvwxyz.-",
+                               1 + ngx_fuzz_random() % 20);
+        if (ngx_fuzz_random() % 2) {
+            ngx_fuzz_append(":8080");
+        }
+        break;
+    case 1:
+        ngx_fuzz_append("*");
+        break;
+    default:
+        break;
+    }
+
+    n = ngx_fuzz_random() % 12;
+
+    for (i = 0; i < n; i++) {
+        len = ngx_fuzz_random() % 48;
+
+        switch (ngx_fuzz_random() % 10) {
+        case 0:
+            ngx_fuzz_append_random(ngx_fuzz_uri_special, 1 + len % 4);
+            break;
+        case 1:
+            ngx_fuzz_append(ngx_fuzz_random() % 2 ? "/../" : "//./");
+            break;
+        case 2:
+            ngx_fuzz_append(ngx_fuzz_random() % 2 ? "%2F" : "%zz");
+            break;
+        case 3:
+            ngx_fuzz_input[ngx_fuzz_len++] = (u_char) ngx_fuzz_random();
+            break;
+        default:
+            ngx_fuzz_append("/");
+            ngx_fuzz_append_random(ngx_fuzz_uri_usual, len);
+            break;
+        }
+    }
+
+    switch (ngx_fuzz_random() % 8) {
+    case 0:
+        break;
+    case 1:
+        ngx_fuzz_append(" HTTP/1.0");
+        break;
+    case 2:
+        ngx_fuzz_append(" HTTP/2.15");
+        break;
+    case 3:
+        ngx_fuzz_append(" HTTP/1.1  ");
+        break;
+    default:
+        ngx_fuzz_append(" HTTP/1.1");
+        break;
+    }
+
+    ngx_fuzz_append(ngx_fuzz_random() % 8 ? "\r\n" : "\n");
+
+    /* headers */
+
+    n = ngx_fuzz_random() % 10;
+
+    for (i = 0; i < n; i++) {
+
+        switch (ngx_fuzz_random() % 8) {
+        case 0:
+            ngx_fuzz_append_random(ngx_fuzz_name_usual,
+                                   ngx_fuzz_random() % 48);
+            break;
+        case 1:
+
+            /* runs of 16 and 32 bytes, and the lowcase_header wrap */
+
+            ngx_fuzz_append_random(ngx_fuzz_name_long,
+                                   1 + ngx_fuzz_random() % 160);
+            break;
+        default:
+            ngx_fuzz_append(ngx_fuzz_headers[ngx_fuzz_random()
+                                             % (sizeof(ngx_fuzz_headers)
+                                                / sizeof(char *))]);
+            break;
+        }
+
+        if (ngx_fuzz_random() % 16 == 0) {
+            ngx_fuzz_input[ngx_fuzz_len++] = (u_char) ngx_fuzz_random();
+        }
+
+        ngx_fuzz_append(":");
+        ngx_fuzz_append_random(" \t", ngx_fuzz_random() % 3);
+
+        len = ngx_fuzz_random() % 96;
+
+        while (len) {
+            ngx_fuzz_append_random(ngx_fuzz_value_usual,
+                                   ngx_fuzz_random() % (len + 1));
+
+            switch (ngx_fuzz_random() % 6) {
+            case 0:
+                ngx_fuzz_input[ngx_fuzz_len++] = (u_char) ngx_fuzz_random();
+                break;
+            case 1:
+                ngx_fuzz_append_random(" \t", 1 + ngx_fuzz_random() % 20);
+                break;
+            default:
+                break;
+            }
+
+            len /= 2;
+        }
+
+        if (ngx_fuzz_random() % 4 == 0) {
+            ngx_fuzz_append_random(" ", 1 + ngx_fuzz_random() % 20);
+        }
+
+        ngx_fuzz_append(ngx_fuzz_random() % 8 ? "\r\n" : "\n");
+    }
+
+    ngx_fuzz_append(ngx_fuzz_random() % 8 ? "\r\n" : "\n");
+
+    /* split points, the last one is the end of input */
+
+    n = ngx_fuzz_random() % 8;
+    ngx_fuzz_nsplits = 0;
+
+    for (i = 0; i < n; i++) {
+        len = ngx_fuzz_random() % ngx_fuzz_len;
+
+        if (ngx_fuzz_nsplits == 0
+            || len > ngx_fuzz_splits[ngx_fuzz_nsplits - 1])
+        {
+            ngx_fuzz_splits[ngx_fuzz_nsplits++] = len;
+        }
+    }
+
+    ngx_fuzz_splits[ngx_fuzz_nsplits++] = ngx_fuzz_len;
+}
+
+
+static void
+ngx_fuzz_append(const char *s)
+{
+    size_t  len;
+
+    len = ngx_min(ngx_strlen(s), NGX_FUZZ_MAX_INPUT - 64 - ngx_fuzz_len);
+
+    ngx_memcpy(ngx_fuzz_input + ngx_fuzz_len, s, len);
+    ngx_fuzz_len += len;
+}
+
+
+static void
+ngx_fuzz_append_random(const char *alphabet, size_t n)
+{
+    size_t  len;
+
+    len = ngx_strlen(alphabet);
+    n = ngx_min(n, NGX_FUZZ_MAX_INPUT - 64 - ngx_fuzz_len);
+
+    while (n--) {
+        ngx_fuzz_input[ngx_fuzz_len++] = alphabet[ngx_fuzz_random() % len];
+    }
+}
+
+
+static void
+ngx_fuzz_run(ngx_fuzz_mode_t *mode)
+{
+    u_char              *data;
+    ngx_int_t            rc;
+    ngx_uint_t           split, header;
+    ngx_buf_t            b;
+    ngx_http_request_t  *r;
+
+    /*
+     * the input is copied to a buffer of its exact length,
+     * so reads past the end are caught by memory checkers
+     */
+
+    data = malloc(ngx_fuzz_len);
+    r = calloc(1, sizeof(ngx_http_request_t));
+
+    if (data == NULL || r == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        exit(2);
+    }
+
+    ngx_memcpy(data, ngx_fuzz_input, ngx_fuzz_len);
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    b.start = data;
+    b.pos = data;
+    b.last = data + ngx_fuzz_splits[0];
+    b.end = data + ngx_fuzz_len;
+
+    ngx_cpu_features = mode->features;
+    mode->nsteps = 0;
+
+    split = 0;
+    header = 0;
+
+    while (mode->nsteps < NGX_FUZZ_MAX_STEPS) {
+
+        if (header) {
+            rc = ngx_http_parse_header_line(r, &b, ngx_fuzz_underscores);
+
+        } else {
+            rc = ngx_http_parse_request_line(r, &b);
+        }
+
+        ngx_fuzz_record(mode, r, &b, rc, header);
+
+        if (rc == NGX_AGAIN) {
+            if (++split == ngx_fuzz_nsplits) {
+                break;
+            }
+
+            b.last = data + ngx_fuzz_splits[split];
+            continue;
+        }
+
+        if (rc == NGX_OK) {
+            header = 1;
+            continue;
+        }
+
+        break;
+    }
+
+    free(data);
+    free(r);
+}
+
+
+static void
+ngx_fuzz_record(ngx_fuzz_mode_t *mode, ngx_http_request_t *r, ngx_buf_t *b,
+    ngx_int_t rc, ngx_uint_t header)
+{
+    u_char           *p;
+    ngx_uint_t        i;
+    ngx_fuzz_step_t  *step;
+
+    step = &mode->steps[mode->nsteps++];
+
+    ngx_fuzz_calls++;
+
+    if (rc == NGX_OK) {
+        ngx_fuzz_lines++;
+    }
+
+    ngx_memzero(step, sizeof(ngx_fuzz_step_t));
+
+    step->rc = rc;
+    step->pos = b->pos - b->start;
+    step->state = r->state;
+
+    for (i = 0; ngx_fuzz_fields[i].name; i++) {
+
+        if (header && rc != NGX_OK
+            && ngx_fuzz_fields[i].offset
+               == offsetof(ngx_http_request_t, header_end))
+        {
+            continue;
+        }
+
+        p = *(u_char **) ((char *) r + ngx_fuzz_fields[i].offset);
+        step->fields[i] = p ? p - b->start : -1;
+    }
+
+    step->values[0] = r->method;
+    step->values[1] = r->http_major;
+    step->values[2] = r->http_minor;
+    step->values[3] = r->http_version;
+    step->values[4] = r->complex_uri;
+    step->values[5] = r->quoted_uri;
+    step->values[6] = r->plus_in_uri;
+    step->values[7] = r->empty_path_in_uri;
+    step->values[8] = r->invalid_header;
+    step->values[9] = r->lowcase_index;
+    step->values[10] = r->header_hash;
+
+    if (header && rc == NGX_OK) {
+        ngx_memcpy(step->lowcase, r->lowcase_header, NGX_HTTP_LC_HEADER_LEN);
+
+        if (ngx_fuzz_check_name(mode, r) != NGX_OK) {
+            ngx_fuzz_errors++;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_fuzz_check_name(ngx_fuzz_mode_t *mode, ngx_http_request_t *r)
+{
+    u_char      c, *p, lc[NGX_HTTP_LC_HEADER_LEN];
+    size_t      len;
+    ngx_uint_t  i, hash;
+
+    if (r->invalid_header) {
+        return NGX_OK;
+    }
+
+    /* the last NGX_HTTP_LC_HEADER_LEN characters of a long name are kept */
+
+    p = r->header_name_start;
+    len = r->header_name_end - p;
+    hash = 0;
+
+    for (i = 0; i < len; i++) {
+        c = p[i];
+
+        if (c >= 'A' && c <= 'Z') {
+            c |= 0x20;
+        }
+
+        hash = ngx_hash(hash, c);
+        lc[i & (NGX_HTTP_LC_HEADER_LEN - 1)] = c;
+    }
+
+    if (hash == r->header_hash
+        && r->lowcase_index == (len & (NGX_HTTP_LC_HEADER_LEN - 1))
+        && ngx_memcmp(lc, r->lowcase_header,
+                      ngx_min(len, NGX_HTTP_LC_HEADER_LEN))
+           == 0)
+    {
+        return NGX_OK;
+    }
+
+    printf("%s: header name \"%.*s\", hash %lu vs %lu, index %lu\n",
+           mode->name, (int) len, p, (unsigned long) r->header_hash,
+           (unsigned long) hash, (unsigned long) r->lowcase_index);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_fuzz_compare(ngx_fuzz_mode_t *a, ngx_fuzz_mode_t *b)
+{
+    ngx_uint_t        i, n;
+    ngx_fuzz_step_t  *sa, *sb;
+
+    if (a->nsteps != b->nsteps) {
+        printf("%s: %lu calls, %s: %lu calls\n", a->name,
+               (unsigned long) a->nsteps, b->name, (unsigned long) b->nsteps);
+    }
+
+    n = ngx_min(a->nsteps, b->nsteps);
+
+    for (i = 0; i < n; i++) {
+        sa = &a->steps[i];
+        sb = &b->steps[i];
+
+        if (ngx_memcmp(sa, sb, sizeof(ngx_fuzz_step_t)) == 0) {
+            continue;
+        }
+
+        printf("call %lu differs, %s vs %s:\n", (unsigned long) i,
+               a->name, b->name);
+
+        if (sa->rc != sb->rc) {
+            printf("  rc: %ld vs %ld\n", (long) sa->rc, (long) sb->rc);
+        }
+
+        if (sa->pos != sb->pos) {
+            printf("  pos: %ld vs %ld\n", (long) sa->pos, (long) sb->pos);
+        }
+
+        if (sa->state != sb->state) {
+            printf("  state: %lu vs %lu\n",
+                   (unsigned long) sa->state, (unsigned long) sb->state);
+        }
+
+        for (n = 0; ngx_fuzz_fields[n].name; n++) {
+            if (sa->fields[n] != sb->fields[n]) {
+                printf("  %s: %ld vs %ld\n", ngx_fuzz_fields[n].name,
+                       (long) sa->fields[n], (long) sb->fields[n]);
+            }
+        }
+
+        for (n = 0; ngx_fuzz_values[n]; n++) {
+            if (sa->values[n] != sb->values[n]) {
+                printf("  %s: %lu vs %lu\n", ngx_fuzz_values[n],
+                       (unsigned long) sa->values[n],
+                       (unsigned long) sb->values[n]);
+            }
+        }
+
+        if (ngx_memcmp(sa->lowcase, sb->lowcase, NGX_HTTP_LC_HEADER_LEN)
+            != 0)
+        {
+            printf("  lowcase_header: \"%.*s\" vs \"%.*s\"\n",
+                   NGX_HTTP_LC_HEADER_LEN, sa->lowcase,
+                   NGX_HTTP_LC_HEADER_LEN, sb->lowcase);
+        }
+
+        return NGX_ERROR;
+    }
+
+    return (a->nsteps == b->nsteps) ? NGX_OK : NGX_ERROR;
+}
+
+
+static void
+ngx_fuzz_dump(void)
+{
+    u_char      c;
+    size_t      i;
+    ngx_uint_t  n;
+
+    printf("  input (%lu bytes): \"", (unsigned long) ngx_fuzz_len);
+
+    for (i = 0; i < ngx_fuzz_len; i++) {
+        c = ngx_fuzz_input[i];
+
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            putchar(c);
+
+        } else {
+            printf("\\x%02x", c);
+        }
+    }
+
+    printf("\"\n  splits:");
+
+    for (n = 0; n < ngx_fuzz_nsplits; n++) {
+        printf(" %lu", (unsigned long) ngx_fuzz_splits[n]);
+    }
+
+    printf("\n");
+}
+
+
+static uint32_t
+ngx_fuzz_random(void)
+{
+    /* xorshift64* */
+
+    ngx_fuzz_seed ^= ngx_fuzz_seed >> 12;
+    ngx_fuzz_seed ^= ngx_fuzz_seed << 25;
+    ngx_fuzz_seed ^= ngx_fuzz_seed >> 27;
+
+    return (uint32_t) ((ngx_fuzz_seed * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void *
+ngx_pnalloc(ngx_pool_t *pool, size_t size)
+{
+    return malloc(size);
+}
+
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    return malloc(size);
+}
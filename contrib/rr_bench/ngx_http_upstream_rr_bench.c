@@ -0,0 +1,418 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * A contention benchmark of the round-robin peer selection in zones.
+ *
+ * The peers of an upstream are placed into a shared memory mapping, as
+ * the upstream zone module does, and N processes select and free peers
+ * with ngx_http_upstream_get_round_robin_peer() and
+ * ngx_http_upstream_free_round_robin_peer() in a loop, once with the
+ * peers rwlock and the per-peer locks, and once in the "lockless" mode.
+ * For each mode and number of processes the total number of peers
+ * selected per second is reported.  The weighted distribution of the
+ * selections and the connection counters left are checked as well.
+ *
+ * The program is linked with the objects of a configured nginx build
+ * with the upstream zone module:
+ *
+ *     cc -O -o objs/ngx_http_upstream_rr_bench \
+ *         -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I src/http -I src/http/modules -I src/http/v2 \
+ *         -I src/event/quic -I src/http/v3 -I objs \
+ *         contrib/rr_bench/ngx_http_upstream_rr_bench.c \
+ *         objs/src/http/ngx_http_upstream_round_robin.o \
+ *         objs/src/core/ngx_rwlock.o
+ *
+ *     objs/ngx_http_upstream_rr_bench [max processes [iterations]]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_md5.h>
+
+
+#define NGX_RR_BENCH_PEERS  8
+#define NGX_RR_BENCH_PROCS  64
+
+
+typedef struct {
+    ngx_atomic_t                    ready;
+    ngx_atomic_t                    go;
+
+    ngx_slab_pool_t                 shpool;
+    ngx_http_upstream_rr_peers_t    peers;
+    ngx_http_upstream_rr_peer_t     peer[NGX_RR_BENCH_PEERS];
+
+    ngx_uint_t                      selected[NGX_RR_BENCH_PROCS]
+                                            [NGX_RR_BENCH_PEERS];
+} ngx_rr_bench_zone_t;
+
+
+static void ngx_rr_bench_init(ngx_uint_t lockless);
+static double ngx_rr_bench_run(ngx_uint_t procs, ngx_uint_t iterations);
+static void ngx_rr_bench_worker(ngx_uint_t slot, ngx_uint_t iterations);
+static ngx_int_t ngx_rr_bench_check(ngx_uint_t procs, ngx_uint_t iterations);
+static double ngx_rr_bench_now(void);
+
+
+/* stubs of the globals not used by the peer selection being tested */
+
+volatile ngx_time_t  *ngx_cached_time;
+ngx_int_t             ngx_ncpu;
+ngx_module_t          ngx_http_core_module;
+
+
+static ngx_time_t            ngx_rr_bench_time;
+static ngx_log_t             ngx_rr_bench_log;
+static ngx_rr_bench_zone_t  *ngx_rr_bench_zone;
+
+static ngx_http_upstream_rr_peer_t  ngx_rr_bench_workers[NGX_RR_BENCH_PEERS];
+
+static ngx_int_t  ngx_rr_bench_weights[NGX_RR_BENCH_PEERS] = {
+    5, 3, 2, 2, 1, 1, 1, 1
+};
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    double      locked, lockless;
+    ngx_uint_t  n, max, iterations;
+
+    max = (argc > 1) ? (ngx_uint_t) strtoul(argv[1], NULL, 10) : 8;
+    iterations = (argc > 2) ? (ngx_uint_t) strtoul(argv[2], NULL, 10)
+                            : 1000000;
+
+    if (max == 0 || max > NGX_RR_BENCH_PROCS || iterations == 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 2;
+    }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    ngx_rr_bench_time.sec = time(NULL);
+    ngx_cached_time = &ngx_rr_bench_time;
+
+    ngx_rr_bench_zone = mmap(NULL, sizeof(ngx_rr_bench_zone_t),
+                             PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+
+    if (ngx_rr_bench_zone == MAP_FAILED) {
+        fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+        return 2;
+    }
+
+    printf("peers: %d, iterations: %lu per process, cpus: %ld\n\n",
+           NGX_RR_BENCH_PEERS, (unsigned long) iterations, (long) ngx_ncpu);
+
+    printf("%-10s %16s %16s %8s\n", "processes", "locked, ops/s",
+           "lockless, ops/s", "ratio");
+
+    for (n = 1; n <= max; n *= 2) {
+
+        ngx_rr_bench_init(0);
+        locked = ngx_rr_bench_run(n, iterations);
+
+        if (ngx_rr_bench_check(n, iterations) != NGX_OK) {
+            return 1;
+        }
+
+        ngx_rr_bench_init(1);
+        lockless = ngx_rr_bench_run(n, iterations);
+
+        if (ngx_rr_bench_check(n, iterations) != NGX_OK) {
+            return 1;
+        }
+
+        printf("%-10lu %16.0f %16.0f %7.2fx\n", (unsigned long) n,
+               locked, lockless, lockless / locked);
+
+        if (n < max && n * 2 > max) {
+            n = max / 2;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_rr_bench_init(ngx_uint_t lockless)
+{
+    ngx_uint_t                     i;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    ngx_memzero(ngx_rr_bench_zone, sizeof(ngx_rr_bench_zone_t));
+
+    /* as ngx_http_upstream_zone_copy_peers() does */
+
+    peers = &ngx_rr_bench_zone->peers;
+
+    peers->number = NGX_RR_BENCH_PEERS;
+    peers->shpool = &ngx_rr_bench_zone->shpool;
+    peers->lockless = lockless;
+    peers->tries = NGX_RR_BENCH_PEERS;
+    peers->weighted = 1;
+    peers->peer = ngx_rr_bench_zone->peer;
+
+    for (i = 0; i < NGX_RR_BENCH_PEERS; i++) {
+        peer = &ngx_rr_bench_zone->peer[i];
+
+        peer->weight = ngx_rr_bench_weights[i];
+        peer->effective_weight = peer->weight;
+        peer->max_fails = 1;
+        peer->fail_timeout = 10;
+
+        if (i + 1 < NGX_RR_BENCH_PEERS) {
+            peer->next = peer + 1;
+        }
+
+        peers->total_weight += peer->weight;
+
+        if (lockless) {
+            /* process memory, private to a worker after fork() */
+            ngx_rr_bench_workers[i] = *peer;
+            peer->worker = &ngx_rr_bench_workers[i];
+        }
+    }
+}
+
+
+static double
+ngx_rr_bench_run(ngx_uint_t procs, ngx_uint_t iterations)
+{
+    int         status;
+    double      start;
+    ngx_uint_t  i;
+
+    fflush(stdout);
+
+    for (i = 0; i < procs; i++) {
+
+        switch (fork()) {
+
+        case -1:
+            fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+            exit(2);
+
+        case 0:
+            ngx_rr_bench_worker(i, iterations);
+            exit(0);
+        }
+    }
+
+    while (ngx_rr_bench_zone->ready != procs) {
+        ngx_sched_yield();
+    }
+
+    start = ngx_rr_bench_now();
+
+    ngx_memory_barrier();
+    ngx_rr_bench_zone->go = 1;
+
+    for (i = 0; i < procs; i++) {
+        if (wait(&status) == -1 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "worker process failed\n");
+            exit(2);
+        }
+    }
+
+    return procs * iterations / ((ngx_rr_bench_now() - start) / 1e9);
+}
+
+
+static void
+ngx_rr_bench_worker(ngx_uint_t slot, ngx_uint_t iterations)
+{
+    uintptr_t                          tried;
+    ngx_uint_t                         i, n;
+    ngx_peer_connection_t              pc;
+    ngx_http_upstream_rr_peer_data_t   rrp;
+    ngx_uint_t                         selected[NGX_RR_BENCH_PEERS];
+
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+    ngx_memzero(&rrp, sizeof(ngx_http_upstream_rr_peer_data_t));
+    ngx_memzero(selected, sizeof(selected));
+
+    pc.log = &ngx_rr_bench_log;
+
+    rrp.tried = &tried;
+
+    (void) ngx_atomic_fetch_add(&ngx_rr_bench_zone->ready, 1);
+
+    while (!ngx_rr_bench_zone->go) {
+        ngx_cpu_pause();
+    }
+
+    for (i = 0; i < iterations; i++) {
+
+        /* as ngx_http_upstream_init_round_robin_peer() does */
+
+        rrp.peers = &ngx_rr_bench_zone->peers;
+        rrp.current = NULL;
+        tried = 0;
+
+        pc.tries = rrp.peers->tries;
+
+        if (ngx_http_upstream_get_round_robin_peer(&pc, &rrp) != NGX_OK) {
+            exit(1);
+        }
+
+        selected[rrp.current - ngx_rr_bench_zone->peer]++;
+
+        ngx_http_upstream_free_round_robin_peer(&pc, &rrp, 0);
+    }
+
+    for (n = 0; n < NGX_RR_BENCH_PEERS; n++) {
+        ngx_rr_bench_zone->selected[slot][n] = selected[n];
+    }
+}
+
+
+static ngx_int_t
+ngx_rr_bench_check(ngx_uint_t procs, ngx_uint_t iterations)
+{
+    double                         share, expected;
+    ngx_uint_t                     i, n, total;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = &ngx_rr_bench_zone->peers;
+
+    for (n = 0; n < NGX_RR_BENCH_PEERS; n++) {
+        peer = &ngx_rr_bench_zone->peer[n];
+
+        total = 0;
+
+        for (i = 0; i < procs; i++) {
+            total += ngx_rr_bench_zone->selected[i][n];
+        }
+
+        share = (double) total / (procs * iterations);
+        expected = (double) peer->weight / peers->total_weight;
+
+        if (peer->conns != 0 || share < expected * 0.99
+            || share > expected * 1.01)
+        {
+            fprintf(stderr, "%s, %lu processes: peer %lu selected %.4f "
+                    "instead of %.4f, conns %lu\n",
+                    peers->lockless ? "lockless" : "locked",
+                    (unsigned long) procs, (unsigned long) n, share, expected,
+                    (unsigned long) peer->conns);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static double
+ngx_rr_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void
+ngx_shmtx_lock(ngx_shmtx_t *mtx)
+{
+}
+
+
+void
+ngx_shmtx_unlock(ngx_shmtx_t *mtx)
+{
+}
+
+
+void
+ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+}
+
+
+void *
+ngx_palloc(ngx_pool_t *pool, size_t size)
+{
+    return NULL;
+}
+
+
+void *
+ngx_pnalloc(ngx_pool_t *pool, size_t size)
+{
+    return NULL;
+}
+
+
+void *
+ngx_pcalloc(ngx_pool_t *pool, size_t size)
+{
+    return NULL;
+}
+
+
+u_char *
+ngx_hex_dump(u_char *dst, u_char *src, size_t len)
+{
+    return dst;
+}
+
+
+void
+ngx_md5_init(ngx_md5_t *ctx)
+{
+}
+
+
+void
+ngx_md5_update(ngx_md5_t *ctx, const void *data, size_t size)
+{
+}
+
+
+void
+ngx_md5_final(u_char result[16], ngx_md5_t *ctx)
+{
+}
+
+
+size_t
+ngx_sock_ntop(struct sockaddr *sa, socklen_t socklen, u_char *text, size_t len,
+    ngx_uint_t port)
+{
+    return 0;
+}
+
+
+ngx_int_t
+ngx_inet_resolve_host(ngx_pool_t *pool, ngx_url_t *u)
+{
+    return NGX_ERROR;
+}
+
+
+void
+ngx_inet_set_port(struct sockaddr *sa, in_port_t port)
+{
+}
@@ -0,0 +1,271 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * A fragmentation check of the slab allocator page allocation policies.
+ *
+ * A pool is filled to about 85% with a random mix of slab chunks and
+ * multi-page allocations, which are then freed and allocated at random,
+ * once with the first fit and once with the best fit page allocation
+ * from the same random seed.  Every 64 steps a run of 32 pages is
+ * allocated and freed to see if large objects still fit.  For each
+ * policy the failed allocations, the large runs allocated, and the
+ * average number of free pages and largest free run are reported.
+ *
+ * The program is linked with the objects of a configured nginx build:
+ *
+ *     cc -O -o objs/ngx_slab_frag \
+ *         -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I objs \
+ *         contrib/slab_frag/ngx_slab_frag.c objs/src/core/ngx_slab.o
+ *
+ *     objs/ngx_slab_frag [zone size in megabytes [steps [seed]]]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_FRAG_LARGE    32
+
+
+typedef struct {
+    const char          *name;
+    ngx_uint_t           best_fit;
+
+    ngx_uint_t           fails;
+    ngx_uint_t           large;
+    ngx_uint_t           large_ok;
+    ngx_uint_t           samples;
+    uint64_t             pfree;
+    uint64_t             max_free;
+} ngx_frag_mode_t;
+
+
+static void ngx_frag_run(ngx_frag_mode_t *mode, size_t size,
+    ngx_uint_t steps, uint64_t seed);
+static size_t ngx_frag_size(void);
+static uint32_t ngx_frag_random(void);
+
+
+/* stubs of the functions not used by the allocator being tested */
+
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_uint_t             ngx_pagesize;
+ngx_uint_t             ngx_pagesize_shift;
+
+
+static uint64_t     ngx_frag_seed;
+static void       **ngx_frag_live;
+static ngx_uint_t   ngx_frag_nlive;
+
+static ngx_frag_mode_t  ngx_frag_modes[] = {
+    { "first fit", 0, 0, 0, 0, 0, 0, 0 },
+    { "best fit", 1, 0, 0, 0, 0, 0, 0 }
+};
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    size_t            size;
+    uint64_t          seed;
+    ngx_uint_t        m, n, steps;
+    ngx_frag_mode_t  *mode;
+
+    size = (argc > 1) ? (size_t) strtoul(argv[1], NULL, 10) : 32;
+    steps = (argc > 2) ? (ngx_uint_t) strtoul(argv[2], NULL, 10) : 1000000;
+    seed = (argc > 3) ? strtoull(argv[3], NULL, 10) : 1;
+
+    size *= 1024 * 1024;
+
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_slab_sizes_init();
+
+    ngx_frag_live = malloc(size / 16 * sizeof(void *));
+    if (ngx_frag_live == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        return 2;
+    }
+
+    printf("zone: %lum, steps: %lu, seed: %llu\n\n",
+           (unsigned long) (size / 1024 / 1024), (unsigned long) steps,
+           (unsigned long long) seed);
+
+    printf("%-10s %10s %12s %12s %12s %8s\n", "policy", "fails",
+           "large runs", "free pages", "max run", "frag");
+
+    for (m = 0; m < sizeof(ngx_frag_modes) / sizeof(ngx_frag_mode_t); m++) {
+        mode = &ngx_frag_modes[m];
+
+        ngx_frag_run(mode, size, steps, seed);
+
+        n = mode->samples ? mode->samples : 1;
+
+        printf("%-10s %10lu %5lu/%-6lu %12lu %12lu %7.1f%%\n", mode->name,
+               (unsigned long) mode->fails, (unsigned long) mode->large_ok,
+               (unsigned long) mode->large,
+               (unsigned long) (mode->pfree / n),
+               (unsigned long) (mode->max_free / n),
+               mode->pfree ? 100.0 - 100.0 * mode->max_free / mode->pfree
+                           : 0.0);
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_frag_run(ngx_frag_mode_t *mode, size_t size, ngx_uint_t steps,
+    uint64_t seed)
+{
+    void             *p;
+    u_char           *addr;
+    ngx_uint_t        i, n, pages, fill;
+    ngx_slab_pool_t  *pool;
+
+    if (posix_memalign((void **) &addr, ngx_pagesize, size) != 0) {
+        fprintf(stderr, "posix_memalign() failed\n");
+        exit(2);
+    }
+
+    /* as ngx_init_zone_pool() does */
+
+    pool = (ngx_slab_pool_t *) addr;
+
+    pool->end = addr + size;
+    pool->min_shift = 3;
+    pool->addr = addr;
+
+    ngx_slab_init(pool);
+
+    pool->log_nomem = 0;
+    pool->best_fit = mode->best_fit;
+
+    pages = pool->pfree;
+
+    ngx_frag_seed = seed;
+    ngx_frag_nlive = 0;
+
+    /* fill */
+
+    while (pool->pfree > pages * 15 / 100) {
+        p = ngx_slab_alloc_locked(pool, ngx_frag_size());
+        if (p == NULL) {
+            break;
+        }
+
+        ngx_frag_live[ngx_frag_nlive++] = p;
+    }
+
+    /* churn around the fill level */
+
+    for (i = 0; i < steps; i++) {
+
+        fill = (pool->pfree > pages * 15 / 100) ? 6 : 4;
+
+        if (ngx_frag_nlive && ngx_frag_random() % 10 >= fill) {
+            n = ngx_frag_random() % ngx_frag_nlive;
+
+            ngx_slab_free_locked(pool, ngx_frag_live[n]);
+            ngx_frag_live[n] = ngx_frag_live[--ngx_frag_nlive];
+
+        } else if (ngx_frag_nlive < size / 16) {
+            p = ngx_slab_alloc_locked(pool, ngx_frag_size());
+
+            if (p == NULL) {
+                mode->fails++;
+
+            } else {
+                ngx_frag_live[ngx_frag_nlive++] = p;
+            }
+        }
+
+        if (i % 64 == 0) {
+            mode->large++;
+
+            p = ngx_slab_alloc_locked(pool, NGX_FRAG_LARGE * ngx_pagesize);
+
+            if (p) {
+                mode->large_ok++;
+                ngx_slab_free_locked(pool, p);
+            }
+
+            mode->samples++;
+            mode->pfree += pool->pfree;
+            mode->max_free += ngx_slab_max_free_locked(pool);
+        }
+    }
+
+    free(addr);
+}
+
+
+static size_t
+ngx_frag_size(void)
+{
+    uint32_t  r;
+
+    r = ngx_frag_random() % 100;
+
+    /* chunks of slab pages, as rbtree nodes and keys */
+
+    if (r < 70) {
+        return 32 + ngx_frag_random() % 480;
+    }
+
+    /* half-page chunks */
+
+    if (r < 90) {
+        return ngx_pagesize / 4 + ngx_frag_random() % (ngx_pagesize / 4);
+    }
+
+    /* runs of pages, as cached objects and upstream peers */
+
+    return (1 + ngx_frag_random() % 16) * ngx_pagesize
+           - ngx_frag_random() % ngx_pagesize;
+}
+
+
+static uint32_t
+ngx_frag_random(void)
+{
+    /* xorshift64* */
+
+    ngx_frag_seed ^= ngx_frag_seed >> 12;
+    ngx_frag_seed ^= ngx_frag_seed << 25;
+    ngx_frag_seed ^= ngx_frag_seed >> 27;
+
+    return (uint32_t) ((ngx_frag_seed * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void
+ngx_debug_point(void)
+{
+}
+
+
+void
+ngx_shmtx_lock(ngx_shmtx_t *mtx)
+{
+}
+
+
+void
+ngx_shmtx_unlock(ngx_shmtx_t *mtx)
+{
+}
@@ -0,0 +1,248 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * A microbenchmark of the event timers, which compares the timer wheel
+ * with the rbtree at 10k, 100k and 1M timers.
+ *
+ * For each backend and number of timers, the timers with random timeouts
+ * up to a minute are added, then all of them are deleted in a random
+ * order, as the timers of the connections which complete in time are;
+ * then they are added again and the time is advanced by a millisecond
+ * at a time, as the event loop does, until all the timers have expired.
+ * The average time of an add, a delete and an expire of a timer is
+ * reported in nanoseconds, and the expire time includes the calls of
+ * ngx_event_find_timer() and ngx_event_expire_timers() which find
+ * nothing to expire.
+ *
+ * The program is linked with the objects of a configured nginx build:
+ *
+ *     cc -O -o objs/ngx_event_timer_bench \
+ *         -I src/core -I src/event -I src/event/modules -I src/os/unix \
+ *         -I objs \
+ *         contrib/timer_bench/ngx_event_timer_bench.c \
+ *         objs/src/event/ngx_event_timer.o objs/src/core/ngx_rbtree.o
+ *
+ *     objs/ngx_event_timer_bench [max timeout in milliseconds [seed]]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+typedef struct {
+    double               add;
+    double               del;
+    double               expire;
+} ngx_timer_bench_result_t;
+
+
+static void ngx_timer_bench_run(ngx_uint_t wheel, ngx_uint_t n,
+    ngx_msec_t max, uint64_t seed, ngx_timer_bench_result_t *res);
+static void ngx_timer_bench_add(ngx_uint_t n, ngx_msec_t max);
+static void ngx_timer_bench_handler(ngx_event_t *ev);
+static double ngx_timer_bench_now(void);
+static uint32_t ngx_timer_bench_random(void);
+
+
+/* stubs of the globals not used by the timers being tested */
+
+volatile ngx_msec_t  ngx_current_msec;
+
+
+static ngx_log_t     ngx_timer_bench_log;
+static ngx_event_t  *ngx_timer_bench_events;
+static ngx_uint_t   *ngx_timer_bench_order;
+static ngx_uint_t    ngx_timer_bench_expired;
+static uint64_t      ngx_timer_bench_seed;
+
+static ngx_uint_t    ngx_timer_bench_sizes[] = { 10000, 100000, 1000000 };
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    uint64_t                  seed;
+    ngx_uint_t                i, n, wheel;
+    ngx_msec_t                max;
+    ngx_timer_bench_result_t  res;
+
+    max = (argc > 1) ? (ngx_msec_t) strtoul(argv[1], NULL, 10) : 60000;
+    seed = (argc > 2) ? strtoull(argv[2], NULL, 10) : 1;
+
+    if (max == 0) {
+        fprintf(stderr, "invalid max timeout\n");
+        return 2;
+    }
+
+    n = ngx_timer_bench_sizes[sizeof(ngx_timer_bench_sizes)
+                              / sizeof(ngx_uint_t) - 1];
+
+    ngx_timer_bench_events = calloc(n, sizeof(ngx_event_t));
+    ngx_timer_bench_order = malloc(n * sizeof(ngx_uint_t));
+
+    if (ngx_timer_bench_events == NULL || ngx_timer_bench_order == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        return 2;
+    }
+
+    printf("max timeout: %lu ms, seed: %llu\n\n", (unsigned long) max,
+           (unsigned long long) seed);
+
+    printf("%-8s %8s %12s %12s %12s\n", "backend", "timers",
+           "add, ns", "delete, ns", "expire, ns");
+
+    for (i = 0; i < sizeof(ngx_timer_bench_sizes) / sizeof(ngx_uint_t); i++) {
+        for (wheel = 0; wheel < 2; wheel++) {
+
+            ngx_timer_bench_run(wheel, ngx_timer_bench_sizes[i], max, seed,
+                                &res);
+
+            printf("%-8s %8lu %12.1f %12.1f %12.1f\n",
+                   wheel ? "wheel" : "rbtree",
+                   (unsigned long) ngx_timer_bench_sizes[i],
+                   res.add, res.del, res.expire);
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_timer_bench_run(ngx_uint_t wheel, ngx_uint_t n, ngx_msec_t max,
+    uint64_t seed, ngx_timer_bench_result_t *res)
+{
+    double       start;
+    ngx_uint_t   i, j, t;
+    ngx_msec_t   timer;
+
+    ngx_use_timer_wheel = wheel;
+    ngx_current_msec = 1000;
+
+    ngx_event_timer_init(&ngx_timer_bench_log);
+
+    ngx_timer_bench_seed = seed;
+
+    for (i = 0; i < n; i++) {
+        ngx_memzero(&ngx_timer_bench_events[i], sizeof(ngx_event_t));
+
+        ngx_timer_bench_events[i].handler = ngx_timer_bench_handler;
+        ngx_timer_bench_events[i].log = &ngx_timer_bench_log;
+
+        ngx_timer_bench_order[i] = i;
+    }
+
+    /* a random order of deletion */
+
+    for (i = n - 1; i > 0; i--) {
+        j = ngx_timer_bench_random() % (i + 1);
+
+        t = ngx_timer_bench_order[i];
+        ngx_timer_bench_order[i] = ngx_timer_bench_order[j];
+        ngx_timer_bench_order[j] = t;
+    }
+
+    /* add */
+
+    start = ngx_timer_bench_now();
+
+    ngx_timer_bench_add(n, max);
+
+    res->add = (ngx_timer_bench_now() - start) / n;
+
+    /* delete */
+
+    start = ngx_timer_bench_now();
+
+    for (i = 0; i < n; i++) {
+        ngx_del_timer(&ngx_timer_bench_events[ngx_timer_bench_order[i]]);
+    }
+
+    res->del = (ngx_timer_bench_now() - start) / n;
+
+    /* expire */
+
+    ngx_timer_bench_add(n, max);
+
+    ngx_timer_bench_expired = 0;
+
+    start = ngx_timer_bench_now();
+
+    while (ngx_timer_bench_expired < n) {
+        timer = ngx_event_find_timer();
+
+        if (timer == NGX_TIMER_INFINITE) {
+            break;
+        }
+
+        ngx_current_msec++;
+
+        ngx_event_expire_timers();
+    }
+
+    res->expire = (ngx_timer_bench_now() - start) / n;
+
+    if (ngx_timer_bench_expired != n) {
+        fprintf(stderr, "%lu of %lu timers expired\n",
+                (unsigned long) ngx_timer_bench_expired, (unsigned long) n);
+        exit(1);
+    }
+}
+
+
+static void
+ngx_timer_bench_add(ngx_uint_t n, ngx_msec_t max)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&ngx_timer_bench_events[i],
+                      1 + ngx_timer_bench_random() % max);
+    }
+}
+
+
+static void
+ngx_timer_bench_handler(ngx_event_t *ev)
+{
+    ev->timedout = 0;
+
+    ngx_timer_bench_expired++;
+}
+
+
+static double
+ngx_timer_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static uint32_t
+ngx_timer_bench_random(void)
+{
+    /* xorshift64* */
+
+    ngx_timer_bench_seed ^= ngx_timer_bench_seed >> 12;
+    ngx_timer_bench_seed ^= ngx_timer_bench_seed << 25;
+    ngx_timer_bench_seed ^= ngx_timer_bench_seed >> 27;
+
+    return (uint32_t) ((ngx_timer_bench_seed * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
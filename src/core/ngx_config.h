@@ -49,6 +49,23 @@
 #endif
 
 
+#if (NGX_HAVE_SSE42 || NGX_HAVE_AVX2 || NGX_HAVE_PCLMUL)
+#include <immintrin.h>
+#endif
+
+#if (NGX_HAVE_SSE42)
+#define NGX_TARGET_SSE42         __attribute__((target("sse4.2")))
+#endif
+
+#if (NGX_HAVE_PCLMUL)
+#define NGX_TARGET_PCLMUL        __attribute__((target("sse4.2,pclmul")))
+#endif
+
+#if (NGX_HAVE_AVX2)
+#define NGX_TARGET_AVX2          __attribute__((target("avx2")))
+#endif
+
+
 #if !(NGX_WIN32)
 
 #define ngx_signal_helper(n)     SIG##n
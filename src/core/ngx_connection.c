@@ -1047,6 +1047,24 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
 
 #endif
 
+#if (NGX_HAVE_UDP_GRO && NGX_HAVE_RECVMMSG)
+
+        if (ls[i].quic) {
+            value = 1;
+
+            if (setsockopt(ls[i].fd, SOL_UDP, UDP_GRO,
+                           (const void *) &value, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(UDP_GRO) "
+                              "for %V failed, ignored",
+                              &ls[i].addr_text);
+            }
+        }
+
+#endif
+
 #if (NGX_HAVE_IP_MTU_DISCOVER)
 
         if (ls[i].quic && ls[i].sockaddr->sa_family == AF_INET) {
@@ -45,6 +45,13 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #define  NGX_ABORT      -6
 
 
+#define NGX_CPU_SSE42    0x01
+#define NGX_CPU_AVX2     0x02
+#define NGX_CPU_PCLMUL   0x04
+
+extern ngx_uint_t  ngx_cpu_features;
+
+
 #include <ngx_errno.h>
 #include <ngx_atomic.h>
 #include <ngx_thread.h>
@@ -71,6 +78,7 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_crc.h>
 #include <ngx_crc32.h>
 #include <ngx_murmurhash.h>
+#include <ngx_xxhash.h>
 #include <ngx_siphash.h>
 #if (NGX_PCRE)
 #include <ngx_regex.h>
@@ -81,6 +89,7 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_shmtx.h>
 #include <ngx_data.h>
 #include <ngx_json.h>
+#include <ngx_stat.h>
 #include <ngx_slab.h>
 #include <ngx_inet.h>
 #include <ngx_cycle.h>
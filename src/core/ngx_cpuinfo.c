@@ -9,10 +9,14 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_features;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
 static ngx_inline void ngx_cpuid(uint32_t i, uint32_t *buf);
+static void ngx_cpu_features_init(uint32_t max, uint32_t *cpu);
 
 
 #if ( __i386__ )
@@ -31,6 +35,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
     "    mov    %%ebx, %%esi;  "
 
+    "    xor    %%ecx, %%ecx;  "
     "    cpuid;                "
     "    mov    %%eax, (%1);   "
     "    mov    %%ebx, 4(%1);  "
@@ -51,11 +56,15 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 {
     uint32_t  eax, ebx, ecx, edx;
 
+    /* subleaf 0 for the leaves that have them */
+
+    ecx = 0;
+
     __asm__ (
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx) : "a" (i) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -91,6 +100,8 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    ngx_cpu_features_init(vbuf[0], cpu);
+
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
         switch ((cpu[0] & 0xf00) >> 8) {
@@ -127,6 +138,45 @@ ngx_cpuinfo(void)
     }
 }
 
+
+/* instruction set extensions used by optional fast code paths */
+
+static void
+ngx_cpu_features_init(uint32_t max, uint32_t *cpu)
+{
+    uint32_t  ext[4], eax, edx;
+
+    /* cpu[] holds leaf 1, cpu[3] is %ecx */
+
+    if (cpu[3] & (1 << 20)) {
+        ngx_cpu_features |= NGX_CPU_SSE42;
+    }
+
+    /* the PCLMUL code paths also use SSE4.1 */
+
+    if ((cpu[3] & (1 << 1)) && (cpu[3] & (1 << 19))) {
+        ngx_cpu_features |= NGX_CPU_PCLMUL;
+    }
+
+    if (max < 7 || !(cpu[3] & (1 << 27))) {
+        return;
+    }
+
+    /* AVX2 also needs the OS to save the YMM state, OSXSAVE and XCR0 */
+
+    __asm__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+
+    if ((eax & 6) != 6) {
+        return;
+    }
+
+    ngx_cpuid(7, ext);
+
+    if (ext[1] & (1 << 5)) {
+        ngx_cpu_features |= NGX_CPU_AVX2;
+    }
+}
+
 #else
 
 
@@ -200,3 +200,137 @@ ngx_crc32_table_init(void)
 
     return NGX_OK;
 }
+
+
+#if (NGX_HAVE_SSE42)
+
+NGX_TARGET_SSE42 uint32_t
+ngx_crc32c_sse42(uint32_t crc, u_char *p, size_t len)
+{
+#if (NGX_PTR_SIZE == 8)
+    uint64_t  c, v;
+
+    c = crc;
+
+    while (len >= 8) {
+        ngx_memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t) c;
+#endif
+
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+
+    return crc;
+}
+
+#endif
+
+
+#if (NGX_HAVE_PCLMUL)
+
+/*
+ * Folding with carry-less multiplication, as described in
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" by V. Gopal et al.  The constants are for the reflected
+ * CRC32 polynomial.  The length must be a multiple of 16, at least 64.
+ */
+
+NGX_TARGET_PCLMUL uint32_t
+ngx_crc32_pclmul(uint32_t crc, u_char *p, size_t len)
+{
+    __m128i  k, x1, x2, x3, x4, y1, y2, y3, y4, mask;
+
+    x1 = _mm_loadu_si128((__m128i *) p);
+    x2 = _mm_loadu_si128((__m128i *) (p + 16));
+    x3 = _mm_loadu_si128((__m128i *) (p + 32));
+    x4 = _mm_loadu_si128((__m128i *) (p + 48));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+
+    p += 64;
+    len -= 64;
+
+    /* fold by 4 */
+
+    k = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+
+    while (len >= 64) {
+        y1 = _mm_clmulepi64_si128(x1, k, 0x00);
+        y2 = _mm_clmulepi64_si128(x2, k, 0x00);
+        y3 = _mm_clmulepi64_si128(x3, k, 0x00);
+        y4 = _mm_clmulepi64_si128(x4, k, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, y1),
+                           _mm_loadu_si128((__m128i *) p));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, y2),
+                           _mm_loadu_si128((__m128i *) (p + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, y3),
+                           _mm_loadu_si128((__m128i *) (p + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, y4),
+                           _mm_loadu_si128((__m128i *) (p + 48)));
+
+        p += 64;
+        len -= 64;
+    }
+
+    /* fold into 128 bits */
+
+    k = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+
+    y1 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), y1);
+
+    y1 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), y1);
+
+    y1 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), y1);
+
+    while (len >= 16) {
+        y1 = _mm_clmulepi64_si128(x1, k, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((__m128i *) p)),
+                           y1);
+        p += 16;
+        len -= 16;
+    }
+
+    /* fold 128 bits into 64 bits */
+
+    mask = _mm_setr_epi32(-1, 0, -1, 0);
+
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    k = _mm_set_epi64x(0, 0x0163cd6124);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+
+    k = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+#endif
@@ -18,6 +18,35 @@ extern uint32_t   ngx_crc32_table256[];
 extern uint32_t   ngx_crc32c_table256[];
 
 
+#if (NGX_HAVE_PCLMUL)
+uint32_t ngx_crc32_pclmul(uint32_t crc, u_char *p, size_t len);
+#endif
+#if (NGX_HAVE_SSE42)
+uint32_t ngx_crc32c_sse42(uint32_t crc, u_char *p, size_t len);
+#endif
+
+
+/*
+ * With PCLMUL, data of 64 bytes or more are folded 64 bytes at a time,
+ * and only the tail of less than 16 bytes goes through the table.
+ */
+
+#if (NGX_HAVE_PCLMUL)
+
+#define ngx_crc32_fold(crc, p, len)                                           \
+    if (len >= 64 && (ngx_cpu_features & NGX_CPU_PCLMUL)) {                  \
+        crc = ngx_crc32_pclmul(crc, p, len & ~(size_t) 15);                  \
+        p += len & ~(size_t) 15;                                              \
+        len &= 15;                                                            \
+    }
+
+#else
+
+#define ngx_crc32_fold(crc, p, len)
+
+#endif
+
+
 static ngx_inline uint32_t
 ngx_crc32_short(u_char *p, size_t len)
 {
@@ -43,6 +72,8 @@ ngx_crc32_long(u_char *p, size_t len)
 
     crc = 0xffffffff;
 
+    ngx_crc32_fold(crc, p, len);
+
     while (len--) {
         crc = ngx_crc32_table256[(crc ^ *p++) & 0xff] ^ (crc >> 8);
     }
@@ -62,6 +93,8 @@ ngx_crc32_update(uint32_t *crc, u_char *p, size_t len)
 
     c = *crc;
 
+    ngx_crc32_fold(c, p, len);
+
     while (len--) {
         c = ngx_crc32_table256[(c ^ *p++) & 0xff] ^ (c >> 8);
     }
@@ -81,6 +114,12 @@ ngx_crc32c_long(u_char *p, size_t len)
 
     crc = 0xffffffff;
 
+#if (NGX_HAVE_SSE42)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        return ngx_crc32c_sse42(crc, p, len) ^ 0xffffffff;
+    }
+#endif
+
     while (len--) {
         crc = ngx_crc32c_table256[(crc ^ *p++) & 0xff] ^ (crc >> 8);
     }
@@ -100,6 +139,13 @@ ngx_crc32c_update(uint32_t *crc, u_char *p, size_t len)
 
     c = *crc;
 
+#if (NGX_HAVE_SSE42)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        *crc = ngx_crc32c_sse42(c, p, len);
+        return;
+    }
+#endif
+
     while (len--) {
         c = ngx_crc32c_table256[(c ^ *p++) & 0xff] ^ (c >> 8);
     }
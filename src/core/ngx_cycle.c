@@ -471,13 +471,20 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             }
 
             if (shm_zone[i].tag == oshm_zone[n].tag
-                && shm_zone[i].shm.size == oshm_zone[n].shm.size)
+                && shm_zone[i].shm.size == oshm_zone[n].shm.size
+                && shm_zone[i].shm.hugepages == oshm_zone[n].shm.hugepages)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].shm.huge = oshm_zone[n].shm.huge;
 #if (NGX_WIN32)
                 shm_zone[i].shm.handle = oshm_zone[n].shm.handle;
 #endif
 
+                /* the page allocation policy may be changed on reload */
+
+                ((ngx_slab_pool_t *) shm_zone[i].shm.addr)->best_fit =
+                                                       shm_zone[i].best_fit;
+
                 if (shm_zone[i].init(&shm_zone[i], oshm_zone[n].data)
                     != NGX_OK)
                 {
@@ -698,6 +705,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
             if (oshm_zone[i].tag == shm_zone[n].tag
                 && oshm_zone[i].shm.size == shm_zone[n].shm.size
+                && oshm_zone[i].shm.hugepages == shm_zone[n].shm.hugepages
                 && !oshm_zone[i].noreuse)
             {
                 goto live_shm_zone;
@@ -1024,6 +1032,8 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 
     ngx_slab_init(sp);
 
+    sp->best_fit = zn->best_fit;
+
     return NGX_OK;
 }
 
@@ -1368,9 +1378,12 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
     shm_zone->shm.size = size;
     shm_zone->shm.name = *name;
     shm_zone->shm.exists = 0;
+    shm_zone->shm.hugepages = 0;
+    shm_zone->shm.huge = NGX_SHM_HUGEPAGES_OFF;
     shm_zone->init = NULL;
     shm_zone->tag = tag;
     shm_zone->noreuse = 0;
+    shm_zone->best_fit = 0;
 
     return shm_zone;
 }
@@ -33,6 +33,7 @@ struct ngx_shm_zone_s {
     void                     *tag;
     void                     *sync;
     ngx_uint_t                noreuse;  /* unsigned  noreuse:1; */
+    ngx_uint_t                best_fit;  /* unsigned  best_fit:1; */
 };
 
 
@@ -310,3 +310,12 @@ ngx_data_struct_boolean_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
 
     return ngx_data_boolean_handler(value, pool, NULL);
 }
+
+
+ngx_data_item_t *
+ngx_data_stat_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_stat_t  *stat = ctx;
+
+    return ngx_data_number_handler(ngx_stat_value(stat, data), pool, NULL);
+}
@@ -98,4 +98,7 @@ ngx_data_item_t *ngx_data_struct_str_handler(uintptr_t data, ngx_pool_t *pool,
 ngx_data_item_t *ngx_data_struct_boolean_handler(uintptr_t data,
     ngx_pool_t *pool, void *ctx);
 
+ngx_data_item_t *ngx_data_stat_handler(uintptr_t data, ngx_pool_t *pool,
+    void *ctx);
+
 #endif /* _NGX_DATA_H_INCLUDED_ */
@@ -631,6 +631,151 @@ ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
 }
 
 
+void *
+ngx_hash_perfect_find(ngx_hash_perfect_t *hash, ngx_uint_t key, u_char *name,
+    size_t len)
+{
+    ngx_hash_key_t  *hk;
+
+    hk = hash->slots[ngx_hash_perfect_slot(hash, key)];
+
+    if (hk == NULL
+        || hk->key_hash != key
+        || hk->key.len != len
+        || ngx_memcmp(hk->key.data, name, len) != 0)
+    {
+        return NULL;
+    }
+
+    return hk->value;
+}
+
+
+/*
+ * A collision-free table for a small fixed set of keys: the slot is
+ * the top bits of a multiplicative hash of the key hash, and seeds are
+ * tried until every key gets a slot of its own.  A lookup is a single
+ * probe.  Names are stored lowercased.
+ */
+
+ngx_int_t
+ngx_hash_perfect_init(ngx_hash_perfect_t *hash, ngx_hash_key_t *names,
+    ngx_uint_t nelts, ngx_pool_t *pool)
+{
+    ngx_uint_t        n, k, bits, size, try;
+    ngx_hash_key_t   *hk, **slots;
+
+    for (bits = 1; ((ngx_uint_t) 1 << bits) < 2 * nelts; bits++) {
+        /* void */
+    }
+
+    for ( /* void */ ; bits <= NGX_HASH_PERFECT_MAX_BITS; bits++) {
+
+        size = (ngx_uint_t) 1 << bits;
+
+        slots = ngx_alloc(size * sizeof(ngx_hash_key_t *), pool->log);
+        if (slots == NULL) {
+            return NGX_ERROR;
+        }
+
+        hash->shift = 32 - bits;
+
+        for (try = 0; try < NGX_HASH_PERFECT_TRIES; try++) {
+
+            hash->seed = (uint32_t) (try * 0x9e3779b1) | 1;
+
+            ngx_memzero(slots, size * sizeof(ngx_hash_key_t *));
+
+            for (n = 0; n < nelts; n++) {
+                k = ngx_hash_perfect_slot(hash, names[n].key_hash);
+
+                if (slots[k]) {
+                    break;
+                }
+
+                slots[k] = &names[n];
+            }
+
+            if (n == nelts) {
+                goto found;
+            }
+        }
+
+        ngx_free(slots);
+    }
+
+    ngx_log_error(NGX_LOG_EMERG, pool->log, 0,
+                  "could not build perfect hash of %ui keys", nelts);
+
+    return NGX_ERROR;
+
+found:
+
+    hash->slots = ngx_pcalloc(pool, size * sizeof(ngx_hash_key_t *));
+    if (hash->slots == NULL) {
+        ngx_free(slots);
+        return NGX_ERROR;
+    }
+
+    for (k = 0; k < size; k++) {
+
+        if (slots[k] == NULL) {
+            continue;
+        }
+
+        hk = ngx_palloc(pool, sizeof(ngx_hash_key_t));
+        if (hk == NULL) {
+            ngx_free(slots);
+            return NGX_ERROR;
+        }
+
+        *hk = *slots[k];
+
+        hk->key.data = ngx_pnalloc(pool, hk->key.len);
+        if (hk->key.data == NULL) {
+            ngx_free(slots);
+            return NGX_ERROR;
+        }
+
+        ngx_strlow(hk->key.data, slots[k]->key.data, hk->key.len);
+
+        hash->slots[k] = hk;
+    }
+
+    ngx_free(slots);
+
+    return NGX_OK;
+}
+
+
+/* non-cryptographic key hash functions, see ngx_crc32.h and ngx_xxhash.h */
+
+ngx_str_t  ngx_hash_func_names[] = {
+    ngx_string("crc32"),
+    ngx_string("crc32c"),
+    ngx_string("xxh3"),
+    ngx_null_string
+};
+
+
+ngx_int_t
+ngx_hash_func(ngx_str_t *name)
+{
+    ngx_int_t  i;
+
+    for (i = 0; ngx_hash_func_names[i].len; i++) {
+        if (name->len == ngx_hash_func_names[i].len
+            && ngx_strncmp(name->data, ngx_hash_func_names[i].data, name->len)
+               == 0)
+        {
+            return i;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
 ngx_uint_t
 ngx_hash_key(u_char *data, size_t len)
 {
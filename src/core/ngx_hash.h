@@ -39,6 +39,13 @@ typedef struct {
 } ngx_hash_key_t;
 
 
+typedef struct {
+    ngx_hash_key_t  **slots;
+    uint32_t          seed;
+    ngx_uint_t        shift;
+} ngx_hash_perfect_t;
+
+
 typedef ngx_uint_t (*ngx_hash_key_pt) (u_char *data, size_t len);
 
 
@@ -68,6 +75,16 @@ typedef struct {
 #define NGX_HASH_LARGE_ASIZE      16384
 #define NGX_HASH_LARGE_HSIZE      10007
 
+#define NGX_HASH_PERFECT_MAX_BITS 16
+#define NGX_HASH_PERFECT_TRIES    1000
+
+#define ngx_hash_perfect_slot(hash, key)                                      \
+    ((uint32_t) ((uint32_t) (key) * (hash)->seed) >> (hash)->shift)
+
+#define NGX_HASH_FUNC_CRC32       0
+#define NGX_HASH_FUNC_CRC32C      1
+#define NGX_HASH_FUNC_XXH3        2
+
 #define NGX_HASH_WILDCARD_KEY     1
 #define NGX_HASH_READONLY_KEY     2
 
@@ -111,6 +128,15 @@ ngx_int_t ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
 ngx_int_t ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
 
+void *ngx_hash_perfect_find(ngx_hash_perfect_t *hash, ngx_uint_t key,
+    u_char *name, size_t len);
+ngx_int_t ngx_hash_perfect_init(ngx_hash_perfect_t *hash,
+    ngx_hash_key_t *names, ngx_uint_t nelts, ngx_pool_t *pool);
+
+ngx_int_t ngx_hash_func(ngx_str_t *name);
+
+extern ngx_str_t  ngx_hash_func_names[];
+
 #define ngx_hash(key, c)   ((ngx_uint_t) key * 31 + c)
 ngx_uint_t ngx_hash_key(u_char *data, size_t len);
 ngx_uint_t ngx_hash_key_lc(u_char *data, size_t len);
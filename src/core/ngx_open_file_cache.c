@@ -21,6 +21,63 @@
 #define NGX_MIN_READ_AHEAD  (128 * 1024)
 
 
+/*
+ * an optional shared memory zone keeps stat() info and errors of
+ * the files, so they are known to all workers; the file descriptors
+ * are still kept by each worker in its own cache
+ */
+
+typedef struct {
+    ngx_rbtree_node_t        node;
+    ngx_queue_t              queue;
+
+    time_t                   created;
+    time_t                   accessed;
+
+    ngx_file_uniq_t          uniq;
+    time_t                   mtime;
+    off_t                    size;
+    off_t                    fs_size;
+    ngx_err_t                err;
+    char                    *failed;
+
+#if (NGX_HAVE_OPENAT)
+    size_t                   disable_symlinks_from;
+    unsigned                 disable_symlinks:2;
+#endif
+
+    unsigned                 is_dir:1;
+    unsigned                 is_file:1;
+    unsigned                 is_link:1;
+    unsigned                 is_exec:1;
+
+    u_short                  len;
+    u_char                   name[1];
+} ngx_open_file_cache_node_t;
+
+
+#if (NGX_HAVE_INOTIFY)
+
+/*
+ * inotify watches directories of cached files, so a single watch
+ * is enough for all files of a directory; changes are reported
+ * with a file name, which is looked up in the watch's tree
+ */
+
+#define NGX_OPEN_FILE_INOTIFY_MASK                                            \
+    (IN_MODIFY|IN_ATTRIB|IN_MOVED_FROM|IN_MOVED_TO|IN_CREATE|IN_DELETE        \
+     |IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+
+typedef struct {
+    ngx_rbtree_node_t        node;
+    ngx_rbtree_t             files;
+    ngx_rbtree_node_t        sentinel;
+} ngx_open_file_watch_t;
+
+#endif
+
+
 static void ngx_open_file_cache_cleanup(void *data);
 #if (NGX_HAVE_OPENAT)
 static ngx_fd_t ngx_openat_file_owner(ngx_fd_t at_fd, const u_char *name,
@@ -51,6 +108,41 @@ static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+static ngx_int_t ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_open_and_stat_shared_file(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of, time_t *created,
+    ngx_log_t *log);
+static ngx_int_t ngx_open_file_shared_lookup(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    time_t *created);
+static void ngx_open_file_shared_update(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of);
+static ngx_open_file_cache_node_t *ngx_open_file_shared_find(
+    ngx_open_file_cache_shctx_t *ctx, ngx_str_t *name, uint32_t hash);
+static void ngx_open_file_shared_expire(ngx_open_file_cache_shctx_t *ctx,
+    ngx_uint_t n, time_t inactive);
+static void ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+#if (NGX_HAVE_INOTIFY)
+static ngx_int_t ngx_open_file_inotify_init(ngx_log_t *log);
+static ngx_int_t ngx_open_file_watch_add(ngx_open_file_cache_event_t *fev,
+    ngx_log_t *log);
+static void ngx_open_file_watch_del(ngx_open_file_cache_event_t *fev);
+static ngx_open_file_watch_t *ngx_open_file_watch_lookup(int wd);
+static void ngx_open_file_watch_notify(ngx_open_file_watch_t *watch,
+    ngx_str_t *name);
+static void ngx_open_file_watch_flush(void);
+static void ngx_open_file_inotify_handler(ngx_event_t *ev);
+
+
+static ngx_connection_t  *ngx_open_file_inotify;
+static ngx_uint_t         ngx_open_file_inotify_failed;
+static ngx_uint_t         ngx_open_file_watch_failed;
+
+static ngx_rbtree_t       ngx_open_file_watches;
+static ngx_rbtree_node_t  ngx_open_file_watches_sentinel;
+#endif
 
 
 ngx_open_file_cache_t *
@@ -72,6 +164,7 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->current = 0;
     cache->max = max;
     cache->inactive = inactive;
+    cache->shm_zone = NULL;
 
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
@@ -85,6 +178,87 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
 }
 
 
+ngx_int_t
+ngx_open_file_cache_zone(ngx_conf_t *cf, ngx_open_file_cache_t *cache,
+    ngx_str_t *name, size_t size, void *tag)
+{
+    ngx_shm_zone_t               *shm_zone;
+    ngx_open_file_cache_shctx_t  *ctx;
+
+    shm_zone = ngx_shared_memory_add(cf, name, size, tag);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        ctx = ngx_pcalloc(cf->pool, sizeof(ngx_open_file_cache_shctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        shm_zone->init = ngx_open_file_cache_init_zone;
+        shm_zone->data = ctx;
+    }
+
+    cache->shm_zone = shm_zone;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_cache_shctx_t  *octx = data;
+
+    size_t                        len;
+    ngx_open_file_cache_shctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_open_file_cache_sh_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_open_file_shared_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->queue);
+
+    len = sizeof(" in open file cache zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in open file cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    ctx->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_open_file_cache_cleanup(void *data)
 {
@@ -144,7 +318,7 @@ ngx_int_t
 ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool)
 {
-    time_t                          now;
+    time_t                          now, created;
     uint32_t                        hash;
     ngx_int_t                       rc;
     ngx_file_info_t                 fi;
@@ -204,6 +378,10 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     now = ngx_time();
 
+    /* the shared info may be older than this lookup */
+
+    created = now;
+
     hash = ngx_crc32_long(name->data, name->len);
 
     file = ngx_open_file_lookup(cache, name, hash);
@@ -218,7 +396,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
-            rc = ngx_open_and_stat_file(name, of, pool->log);
+            rc = ngx_open_and_stat_shared_file(cache, name, hash, of,
+                                               &created, pool->log);
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
                 goto failed;
@@ -286,7 +465,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         of->fd = file->fd;
         of->uniq = file->uniq;
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_and_stat_shared_file(cache, name, hash, of,
+                                           &created, pool->log);
 
         if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
             goto failed;
@@ -340,6 +520,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             goto add_event;
         }
 
+        ngx_open_file_del_event(file);
+
         ngx_rbtree_delete(&cache->rbtree, &file->node);
 
         cache->current--;
@@ -351,7 +533,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
-    rc = ngx_open_and_stat_file(name, of, pool->log);
+    rc = ngx_open_and_stat_shared_file(cache, name, hash, of,
+                                       &created, pool->log);
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
         goto failed;
@@ -421,7 +604,7 @@ update:
         }
     }
 
-    file->created = now;
+    file->created = created;
 
 found:
 
@@ -956,8 +1139,15 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 {
     ngx_open_file_cache_event_t  *fev;
 
-    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)
-        || !of->events
+#if !(NGX_HAVE_INOTIFY)
+
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+        return;
+    }
+
+#endif
+
+    if (!of->events
         || file->event
         || of->fd == NGX_INVALID_FILE
         || file->uses < of->min_uses)
@@ -994,6 +1184,23 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 
     file->event->log = ngx_cycle->log;
 
+#if (NGX_HAVE_INOTIFY)
+
+    fev->watch = NULL;
+
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+
+        if (ngx_open_file_watch_add(fev, log) != NGX_OK) {
+            ngx_free(file->event->data);
+            ngx_free(file->event);
+            file->event = NULL;
+        }
+
+        return;
+    }
+
+#endif
+
     if (ngx_add_event(file->event, NGX_VNODE_EVENT, NGX_ONESHOT_EVENT)
         != NGX_OK)
     {
@@ -1081,9 +1288,23 @@ ngx_open_file_del_event(ngx_cached_open_file_t *file)
         return;
     }
 
+#if (NGX_HAVE_INOTIFY)
+
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+        ngx_open_file_watch_del(file->event->data);
+
+    } else {
+        (void) ngx_del_event(file->event, NGX_VNODE_EVENT,
+                             file->count ? NGX_FLUSH_EVENT : NGX_CLOSE_EVENT);
+    }
+
+#else
+
     (void) ngx_del_event(file->event, NGX_VNODE_EVENT,
                          file->count ? NGX_FLUSH_EVENT : NGX_CLOSE_EVENT);
 
+#endif
+
     ngx_free(file->event->data);
     ngx_free(file->event);
     file->event = NULL;
@@ -1238,7 +1459,7 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
 
     fev->cache->current--;
 
-    /* NGX_ONESHOT_EVENT was already deleted */
+    /* NGX_ONESHOT_EVENT or inotify watch was already deleted */
     file->event = NULL;
     file->use_event = 0;
 
@@ -1251,3 +1472,706 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+static ngx_int_t
+ngx_open_and_stat_shared_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, time_t *created, ngx_log_t *log)
+{
+    ngx_int_t  rc;
+
+    if (cache->shm_zone == NULL) {
+        return ngx_open_and_stat_file(name, of, log);
+    }
+
+    rc = ngx_open_file_shared_lookup(cache, name, hash, of, created);
+
+    if (rc != NGX_DECLINED) {
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                       "shared open file: %V, e:%d", name, of->err);
+        return rc;
+    }
+
+    rc = ngx_open_and_stat_file(name, of, log);
+
+    if (rc == NGX_OK || of->err) {
+        ngx_open_file_shared_update(cache, name, hash, of);
+    }
+
+    return rc;
+}
+
+
+/*
+ * the shared info is used instead of syscalls for cached errors,
+ * directories, and existence tests; a file to be opened is still
+ * opened, but its retest is a lookup while inode is the same;
+ * the creation time of the shared info is passed to the worker's
+ * cache, so the info does not live longer than open_file_cache_valid
+ */
+
+static ngx_int_t
+ngx_open_file_shared_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, time_t *created)
+{
+    ngx_int_t                     rc;
+    ngx_open_file_cache_node_t   *fcn;
+    ngx_open_file_cache_shctx_t  *ctx;
+
+    ctx = cache->shm_zone->data;
+
+    rc = NGX_DECLINED;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    fcn = ngx_open_file_shared_find(ctx, name, hash);
+
+    if (fcn == NULL
+        || ngx_time() - fcn->created >= of->valid
+#if (NGX_HAVE_OPENAT)
+        || of->disable_symlinks != fcn->disable_symlinks
+        || of->disable_symlinks_from != fcn->disable_symlinks_from
+#endif
+       )
+    {
+        goto done;
+    }
+
+    if (fcn->err) {
+
+        if (!of->errors) {
+            goto done;
+        }
+
+        of->fd = NGX_INVALID_FILE;
+        of->err = fcn->err;
+        of->failed = fcn->failed;
+
+        rc = NGX_ERROR;
+        goto found;
+    }
+
+    if (fcn->is_dir) {
+        of->fd = NGX_INVALID_FILE;
+
+    } else if (of->fd == NGX_INVALID_FILE ? !of->test_only
+                                          : of->uniq != fcn->uniq)
+    {
+        goto done;
+    }
+
+    of->uniq = fcn->uniq;
+    of->mtime = fcn->mtime;
+    of->size = fcn->size;
+    of->fs_size = fcn->fs_size;
+    of->is_dir = fcn->is_dir;
+    of->is_file = fcn->is_file;
+    of->is_link = fcn->is_link;
+    of->is_exec = fcn->is_exec;
+
+    rc = NGX_OK;
+
+found:
+
+    *created = fcn->created;
+
+    fcn->accessed = ngx_time();
+
+    ngx_queue_remove(&fcn->queue);
+    ngx_queue_insert_head(&ctx->sh->queue, &fcn->queue);
+
+done:
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return rc;
+}
+
+
+static void
+ngx_open_file_shared_update(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of)
+{
+    size_t                        n;
+    time_t                        now;
+    ngx_open_file_cache_node_t   *fcn;
+    ngx_open_file_cache_shctx_t  *ctx;
+
+    switch (of->err) {
+
+    case 0:
+    case NGX_ENOENT:
+    case NGX_ENOTDIR:
+    case NGX_EACCES:
+    case NGX_ELOOP:
+    case NGX_EMLINK:
+    case NGX_ENAMETOOLONG:
+        break;
+
+    default:
+        /* EMFILE and the like are specific to a worker */
+        return;
+    }
+
+    if (name->len > 65535) {
+        return;
+    }
+
+    ctx = cache->shm_zone->data;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    fcn = ngx_open_file_shared_find(ctx, name, hash);
+
+    if (fcn) {
+        ngx_queue_remove(&fcn->queue);
+
+    } else {
+        ngx_open_file_shared_expire(ctx, 1, cache->inactive);
+
+        n = offsetof(ngx_open_file_cache_node_t, name) + name->len;
+
+        fcn = ngx_slab_alloc_locked(ctx->shpool, n);
+
+        if (fcn == NULL) {
+            ngx_open_file_shared_expire(ctx, 0, cache->inactive);
+
+            fcn = ngx_slab_alloc_locked(ctx->shpool, n);
+            if (fcn == NULL) {
+                ngx_shmtx_unlock(&ctx->shpool->mutex);
+                return;
+            }
+        }
+
+        fcn->node.key = hash;
+        fcn->len = (u_short) name->len;
+        ngx_memcpy(fcn->name, name->data, name->len);
+
+        ngx_rbtree_insert(&ctx->sh->rbtree, &fcn->node);
+    }
+
+    fcn->created = now;
+    fcn->accessed = now;
+
+    fcn->err = of->err;
+    fcn->failed = of->failed;
+
+#if (NGX_HAVE_OPENAT)
+    fcn->disable_symlinks = of->disable_symlinks;
+    fcn->disable_symlinks_from = of->disable_symlinks_from;
+#endif
+
+    if (of->err == 0) {
+        fcn->uniq = of->uniq;
+        fcn->mtime = of->mtime;
+        fcn->size = of->size;
+        fcn->fs_size = of->fs_size;
+        fcn->is_dir = of->is_dir;
+        fcn->is_file = of->is_file;
+        fcn->is_link = of->is_link;
+        fcn->is_exec = of->is_exec;
+    }
+
+    ngx_queue_insert_head(&ctx->sh->queue, &fcn->queue);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+}
+
+
+static ngx_open_file_cache_node_t *
+ngx_open_file_shared_find(ngx_open_file_cache_shctx_t *ctx, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_open_file_cache_node_t  *fcn;
+
+    node = ctx->sh->rbtree.root;
+    sentinel = ctx->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        fcn = (ngx_open_file_cache_node_t *) node;
+
+        rc = ngx_memn2cmp(name->data, fcn->name, name->len, fcn->len);
+
+        if (rc == 0) {
+            return fcn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_shared_expire(ngx_open_file_cache_shctx_t *ctx, ngx_uint_t n,
+    time_t inactive)
+{
+    time_t                       now;
+    ngx_queue_t                 *q;
+    ngx_open_file_cache_node_t  *fcn;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two inactive entries
+     * n == 0 deletes least recently used entry by force
+     *        and one or two inactive entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&ctx->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&ctx->sh->queue);
+
+        fcn = ngx_queue_data(q, ngx_open_file_cache_node_t, queue);
+
+        if (n++ != 0 && now - fcn->accessed <= inactive) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&ctx->sh->rbtree, &fcn->node);
+
+        ngx_slab_free_locked(ctx->shpool, fcn);
+    }
+}
+
+
+static void
+ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_open_file_cache_node_t   *fcn, *fcnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            fcn = (ngx_open_file_cache_node_t *) node;
+            fcnt = (ngx_open_file_cache_node_t *) temp;
+
+            p = (ngx_memn2cmp(fcn->name, fcnt->name, fcn->len, fcnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+#if (NGX_HAVE_INOTIFY)
+
+static ngx_int_t
+ngx_open_file_inotify_init(ngx_log_t *log)
+{
+    int                fd;
+    ngx_connection_t  *c;
+
+    if (ngx_open_file_inotify_failed) {
+        return NGX_ERROR;
+    }
+
+    ngx_open_file_inotify_failed = 1;
+
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "inotify_init1() failed");
+        return NGX_ERROR;
+    }
+
+    c = ngx_get_connection(fd, ngx_cycle->log);
+
+    if (c == NULL) {
+        if (close(fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "inotify close() failed");
+        }
+
+        return NGX_ERROR;
+    }
+
+    c->read->handler = ngx_open_file_inotify_handler;
+    c->read->log = c->log;
+    c->write->log = c->log;
+
+    /* closed by ngx_close_idle_connections() on graceful shutdown */
+
+    c->idle = 1;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&ngx_open_file_watches, &ngx_open_file_watches_sentinel,
+                    ngx_rbtree_insert_value);
+
+    ngx_open_file_inotify = c;
+    ngx_open_file_inotify_failed = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_watch_add(ngx_open_file_cache_event_t *fev, ngx_log_t *log)
+{
+    int                     wd;
+    u_char                 *name, *p;
+    ngx_file_info_t         fi;
+    ngx_open_file_watch_t  *watch;
+
+    if (ngx_open_file_inotify == NULL
+        && ngx_open_file_inotify_init(log) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    name = fev->file->name;
+
+    for (p = name + ngx_strlen(name); p > name; p--) {
+        if (*p == '/') {
+            break;
+        }
+    }
+
+    if (*p != '/' || p[1] == '\0') {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * a directory watch does not see changes of a symlink target,
+     * so such files are left to periodic retests
+     */
+
+    if (ngx_link_info(name, &fi) == NGX_FILE_ERROR || ngx_is_link(&fi)) {
+        return NGX_DECLINED;
+    }
+
+    if (p == name) {
+        wd = inotify_add_watch(ngx_open_file_inotify->fd, "/",
+                               NGX_OPEN_FILE_INOTIFY_MASK);
+
+    } else {
+        *p = '\0';
+        wd = inotify_add_watch(ngx_open_file_inotify->fd, (char *) name,
+                               NGX_OPEN_FILE_INOTIFY_MASK);
+        *p = '/';
+    }
+
+    if (wd == -1) {
+
+        /*
+         * at the watch limit every lookup fails, so only the first
+         * failure is logged, and the files are left to periodic retests
+         */
+
+        if (!ngx_open_file_watch_failed) {
+            ngx_open_file_watch_failed = 1;
+
+            ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                          "inotify_add_watch() for \"%s\" failed, "
+                          "further failures are not logged", name);
+
+        } else {
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, ngx_errno,
+                           "inotify_add_watch() for \"%s\" failed", name);
+        }
+
+        return NGX_ERROR;
+    }
+
+    watch = ngx_open_file_watch_lookup(wd);
+
+    if (watch == NULL) {
+        watch = ngx_alloc(sizeof(ngx_open_file_watch_t), log);
+        if (watch == NULL) {
+            (void) inotify_rm_watch(ngx_open_file_inotify->fd, wd);
+            return NGX_ERROR;
+        }
+
+        watch->node.key = wd;
+
+        ngx_rbtree_init(&watch->files, &watch->sentinel,
+                        ngx_str_rbtree_insert_value);
+
+        ngx_rbtree_insert(&ngx_open_file_watches, &watch->node);
+    }
+
+    fev->name.str.data = p + 1;
+    fev->name.str.len = ngx_strlen(p + 1);
+    fev->name.node.key = ngx_crc32_short(fev->name.str.data,
+                                         fev->name.str.len);
+
+    ngx_rbtree_insert(&watch->files, &fev->name.node);
+
+    fev->watch = watch;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify watch %d: %s", wd, name);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_open_file_watch_del(ngx_open_file_cache_event_t *fev)
+{
+    ngx_open_file_watch_t  *watch;
+
+    watch = fev->watch;
+
+    ngx_rbtree_delete(&watch->files, &fev->name.node);
+
+    fev->watch = NULL;
+
+    if (watch->files.root != watch->files.sentinel) {
+        return;
+    }
+
+    /* the last file of the directory, IN_IGNORED will be ignored */
+
+    (void) inotify_rm_watch(ngx_open_file_inotify->fd, (int) watch->node.key);
+
+    ngx_rbtree_delete(&ngx_open_file_watches, &watch->node);
+
+    ngx_free(watch);
+}
+
+
+static ngx_open_file_watch_t *
+ngx_open_file_watch_lookup(int wd)
+{
+    ngx_rbtree_key_t    key;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    key = wd;
+
+    node = ngx_open_file_watches.root;
+    sentinel = ngx_open_file_watches.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        return (ngx_open_file_watch_t *) node;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_watch_notify(ngx_open_file_watch_t *watch, ngx_str_t *name)
+{
+    uint32_t                      hash;
+    ngx_uint_t                    last;
+    ngx_event_t                  *ev;
+    ngx_str_node_t               *sn;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_open_file_cache_event_t  *fev;
+
+    hash = name ? ngx_crc32_short(name->data, name->len) : 0;
+
+    sentinel = watch->files.sentinel;
+
+    /*
+     * the same name may be cached by several caches; the watch
+     * is freed along with its last file
+     */
+
+    do {
+        if (name) {
+            sn = ngx_str_rbtree_lookup(&watch->files, name, hash);
+
+            if (sn == NULL) {
+                return;
+            }
+
+            node = &sn->node;
+
+        } else {
+            node = watch->files.root;
+        }
+
+        last = (node == watch->files.root
+                && node->left == sentinel
+                && node->right == sentinel);
+
+        fev = ngx_rbtree_data(node, ngx_open_file_cache_event_t, name);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "inotify invalidate: %s", fev->file->name);
+
+        ngx_open_file_watch_del(fev);
+
+        ev = fev->file->event;
+        ev->handler(ev);
+
+    } while (!last);
+}
+
+
+static void
+ngx_open_file_watch_flush(void)
+{
+    ngx_rbtree_node_t  *root;
+
+    for ( ;; ) {
+        root = ngx_open_file_watches.root;
+
+        if (root == ngx_open_file_watches.sentinel) {
+            break;
+        }
+
+        ngx_open_file_watch_notify((ngx_open_file_watch_t *) root, NULL);
+    }
+}
+
+
+static void
+ngx_open_file_inotify_handler(ngx_event_t *ev)
+{
+    u_char                 *p, *end;
+    ssize_t                 n;
+    uint32_t                buf[1024];
+    ngx_err_t               err;
+    ngx_str_t               name;
+    ngx_connection_t       *c;
+    ngx_open_file_watch_t  *watch;
+    struct inotify_event   *ie;
+
+    c = ev->data;
+
+    if (c->close) {
+
+        /* the files are left to periodic retests till the worker exits */
+
+        ngx_open_file_watch_flush();
+
+        ngx_close_connection(c);
+
+        ngx_open_file_inotify = NULL;
+        ngx_open_file_inotify_failed = 1;
+
+        return;
+    }
+
+    for ( ;; ) {
+
+        n = read(c->fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "inotify read() failed");
+            }
+
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        p = (u_char *) buf;
+        end = p + n;
+
+        while (p < end) {
+
+            ie = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + ie->len;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "inotify event: wd:%d mask:%xD len:%uD",
+                           ie->wd, ie->mask, ie->len);
+
+            if (ie->mask & IN_Q_OVERFLOW) {
+
+                ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                              "inotify queue overflow, "
+                              "flushing open file cache");
+
+                ngx_open_file_watch_flush();
+
+                continue;
+            }
+
+            watch = ngx_open_file_watch_lookup(ie->wd);
+
+            if (watch == NULL) {
+                continue;
+            }
+
+            if (ie->len == 0) {
+                /* the directory itself was removed or renamed */
+                ngx_open_file_watch_notify(watch, NULL);
+                continue;
+            }
+
+            name.data = (u_char *) ie->name;
+            name.len = ngx_strlen(ie->name);
+
+            ngx_open_file_watch_notify(watch, &name);
+        }
+    }
+}
+
+#endif
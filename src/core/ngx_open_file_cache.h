@@ -96,9 +96,24 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+    ngx_shm_zone_t          *shm_zone;
 } ngx_open_file_cache_t;
 
 
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_queue_t              queue;
+} ngx_open_file_cache_sh_t;
+
+
+typedef struct {
+    ngx_open_file_cache_sh_t  *sh;
+    ngx_slab_pool_t           *shpool;
+} ngx_open_file_cache_shctx_t;
+
+
 typedef struct {
     ngx_open_file_cache_t   *cache;
     ngx_cached_open_file_t  *file;
@@ -117,11 +132,18 @@ typedef struct {
 
     ngx_cached_open_file_t  *file;
     ngx_open_file_cache_t   *cache;
+
+#if (NGX_HAVE_INOTIFY)
+    ngx_str_node_t           name;
+    void                    *watch;
+#endif
 } ngx_open_file_cache_event_t;
 
 
 ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
     ngx_uint_t max, time_t inactive);
+ngx_int_t ngx_open_file_cache_zone(ngx_conf_t *cf,
+    ngx_open_file_cache_t *cache, ngx_str_t *name, size_t size, void *tag);
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
 
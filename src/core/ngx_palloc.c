@@ -13,6 +13,26 @@ static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_cache_get(size_t size);
+static ngx_int_t ngx_pool_cache_put(void *p, size_t size);
+
+
+/*
+ * a worker keeps free pool blocks of the sizes registered by modules,
+ * such as request_pool_size and connection_pool_size, to reuse them
+ * instead of malloc() and free() for every connection and request
+ */
+
+typedef struct {
+    size_t                size;
+    ngx_uint_t            number;
+    ngx_uint_t            max;
+    void                 *free;
+} ngx_pool_cache_t;
+
+
+static ngx_uint_t        ngx_pool_cache_n;
+static ngx_pool_cache_t  ngx_pool_cache[NGX_POOL_CACHE_SLOTS];
 
 
 ngx_pool_t *
@@ -20,9 +40,13 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_cache_get(size);
+
     if (p == NULL) {
-        return NULL;
+        p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+        if (p == NULL) {
+            return NULL;
+        }
     }
 
     p->d.last = (u_char *) p + sizeof(ngx_pool_t);
@@ -38,6 +62,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
     p->large = NULL;
     p->cleanup = NULL;
     p->log = log;
+    p->free = NULL;
 
     return p;
 }
@@ -46,6 +71,8 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 void
 ngx_destroy_pool(ngx_pool_t *pool)
 {
+    size_t               size;
+    ngx_uint_t           i;
     ngx_pool_t          *p, *n;
     ngx_pool_large_t    *l;
     ngx_pool_cleanup_t  *c;
@@ -86,8 +113,20 @@ ngx_destroy_pool(ngx_pool_t *pool)
         }
     }
 
+    if (pool->free) {
+        for (i = 0; i < NGX_POOL_LARGE_CLASSES; i++) {
+            for (l = pool->free[i]; l; l = l->next) {
+                ngx_free(l->alloc);
+            }
+        }
+    }
+
+    size = (size_t) (pool->d.end - (u_char *) pool);
+
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        if (ngx_pool_cache_put(p, size) != NGX_OK) {
+            ngx_free(p);
+        }
 
         if (n == NULL) {
             break;
@@ -99,6 +138,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
 void
 ngx_reset_pool(ngx_pool_t *pool)
 {
+    ngx_uint_t         i;
     ngx_pool_t        *p;
     ngx_pool_large_t  *l;
 
@@ -108,6 +148,14 @@ ngx_reset_pool(ngx_pool_t *pool)
         }
     }
 
+    if (pool->free) {
+        for (i = 0; i < NGX_POOL_LARGE_CLASSES; i++) {
+            for (l = pool->free[i]; l; l = l->next) {
+                ngx_free(l->alloc);
+            }
+        }
+    }
+
     for (p = pool; p; p = p->d.next) {
         p->d.last = (u_char *) p + sizeof(ngx_pool_t);
         p->d.failed = 0;
@@ -116,6 +164,9 @@ ngx_reset_pool(ngx_pool_t *pool)
     pool->current = pool;
     pool->chain = NULL;
     pool->large = NULL;
+
+    /* the free lists were allocated from the pool */
+    pool->free = NULL;
 }
 
 
@@ -183,9 +234,13 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_cache_get(psize);
+
     if (m == NULL) {
-        return NULL;
+        m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+        if (m == NULL) {
+            return NULL;
+        }
     }
 
     new = (ngx_pool_t *) m;
@@ -214,9 +269,38 @@ static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
     void              *p;
-    ngx_uint_t         n;
+    ngx_uint_t         n, sc;
     ngx_pool_large_t  *large;
 
+    sc = NGX_POOL_LARGE_CLASSES;
+
+    if (pool->free) {
+
+        for (sc = 0; sc < NGX_POOL_LARGE_CLASSES; sc++) {
+            if (size <= (size_t) NGX_POOL_LARGE_MIN << sc) {
+                break;
+            }
+        }
+
+        if (sc < NGX_POOL_LARGE_CLASSES) {
+            large = pool->free[sc];
+
+            if (large) {
+                ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                               "reuse: %p, class:%ui", large->alloc, sc);
+
+                pool->free[sc] = large->next;
+
+                large->next = pool->large;
+                pool->large = large;
+
+                return large->alloc;
+            }
+
+            size = (size_t) NGX_POOL_LARGE_MIN << sc;
+        }
+    }
+
     p = ngx_alloc(size, pool->log);
     if (p == NULL) {
         return NULL;
@@ -227,6 +311,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size_class = sc;
             return p;
         }
 
@@ -242,6 +327,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     }
 
     large->alloc = p;
+    large->size_class = sc;
     large->next = pool->large;
     pool->large = large;
 
@@ -267,6 +353,7 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
 
     large->alloc = p;
+    large->size_class = NGX_POOL_LARGE_CLASSES;
     large->next = pool->large;
     pool->large = large;
 
@@ -277,10 +364,24 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
 ngx_int_t
 ngx_pfree(ngx_pool_t *pool, void *p)
 {
-    ngx_pool_large_t  *l;
+    ngx_pool_large_t  *l, **ll;
 
-    for (l = pool->large; l; l = l->next) {
+    for (ll = &pool->large, l = *ll; l; ll = &l->next, l = *ll) {
         if (p == l->alloc) {
+
+            if (l->size_class < NGX_POOL_LARGE_CLASSES) {
+                ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                               "free: %p, class:%ui", l->alloc,
+                               l->size_class);
+
+                *ll = l->next;
+
+                l->next = pool->free[l->size_class];
+                pool->free[l->size_class] = l;
+
+                return NGX_OK;
+            }
+
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
             ngx_free(l->alloc);
@@ -294,6 +395,146 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 }
 
 
+/*
+ * with free lists, large blocks are allocated in size classes,
+ * and ngx_pfree() keeps them in the pool for the next allocations
+ * of the same class instead of free()ing; the lists are dropped
+ * by ngx_reset_pool()
+ */
+
+ngx_int_t
+ngx_pool_enable_free_lists(ngx_pool_t *pool)
+{
+#if !(NGX_DEBUG_PALLOC)
+
+    if (pool->free) {
+        return NGX_OK;
+    }
+
+    pool->free = ngx_pcalloc(pool, NGX_POOL_LARGE_CLASSES
+                                   * sizeof(ngx_pool_large_t *));
+    if (pool->free == NULL) {
+        return NGX_ERROR;
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+void
+ngx_pool_cache_add(size_t size)
+{
+#if !(NGX_DEBUG_PALLOC)
+
+    ngx_uint_t         i;
+    ngx_pool_cache_t  *pc;
+
+    for (i = 0; i < ngx_pool_cache_n; i++) {
+        if (ngx_pool_cache[i].size == size) {
+            return;
+        }
+    }
+
+    if (ngx_pool_cache_n == NGX_POOL_CACHE_SLOTS
+        || size > NGX_POOL_CACHE_SIZE)
+    {
+        return;
+    }
+
+    pc = &ngx_pool_cache[ngx_pool_cache_n++];
+
+    pc->size = size;
+    pc->number = 0;
+    pc->max = ngx_min(NGX_POOL_CACHE_MAX, NGX_POOL_CACHE_SIZE / size);
+    pc->free = NULL;
+
+#endif
+}
+
+
+void
+ngx_pool_cache_done(void)
+{
+    void              *p;
+    ngx_uint_t         i;
+    ngx_pool_cache_t  *pc;
+
+    for (i = 0; i < ngx_pool_cache_n; i++) {
+        pc = &ngx_pool_cache[i];
+
+        while (pc->free) {
+            p = pc->free;
+            pc->free = *(void **) p;
+            ngx_free(p);
+        }
+
+        pc->number = 0;
+    }
+
+    ngx_pool_cache_n = 0;
+}
+
+
+static void *
+ngx_pool_cache_get(size_t size)
+{
+    void              *p;
+    ngx_uint_t         i;
+    ngx_pool_cache_t  *pc;
+
+    for (i = 0; i < ngx_pool_cache_n; i++) {
+        pc = &ngx_pool_cache[i];
+
+        if (pc->size != size) {
+            continue;
+        }
+
+        p = pc->free;
+
+        if (p == NULL) {
+            return NULL;
+        }
+
+        pc->free = *(void **) p;
+        pc->number--;
+
+        return p;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_pool_cache_put(void *p, size_t size)
+{
+    ngx_uint_t         i;
+    ngx_pool_cache_t  *pc;
+
+    for (i = 0; i < ngx_pool_cache_n; i++) {
+        pc = &ngx_pool_cache[i];
+
+        if (pc->size != size) {
+            continue;
+        }
+
+        if (pc->number >= pc->max) {
+            return NGX_DECLINED;
+        }
+
+        *(void **) p = pc->free;
+        pc->free = p;
+        pc->number++;
+
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+
 void *
 ngx_pcalloc(ngx_pool_t *pool, size_t size)
 {
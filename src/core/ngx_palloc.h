@@ -26,6 +26,15 @@
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/* a number and total size of free pool blocks of the same size kept */
+#define NGX_POOL_CACHE_SLOTS     8
+#define NGX_POOL_CACHE_MAX       64
+#define NGX_POOL_CACHE_SIZE      (1024 * 1024)
+
+/* large allocation size classes: 4K, 8K, ... 512K */
+#define NGX_POOL_LARGE_MIN       4096
+#define NGX_POOL_LARGE_CLASSES   8
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
@@ -43,6 +52,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    ngx_uint_t            size_class;
 };
 
 
@@ -62,6 +72,7 @@ struct ngx_pool_s {
     ngx_pool_large_t     *large;
     ngx_pool_cleanup_t   *cleanup;
     ngx_log_t            *log;
+    ngx_pool_large_t    **free;
 };
 
 
@@ -82,6 +93,10 @@ void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment);
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
 
+ngx_int_t ngx_pool_enable_free_lists(ngx_pool_t *pool);
+void ngx_pool_cache_add(size_t size);
+void ngx_pool_cache_done(void);
+
 
 ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
 void ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd);
@@ -54,6 +54,51 @@ typedef struct {
 #define ngx_resolver_node(n)  ngx_rbtree_data(n, ngx_resolver_node_t, node)
 
 
+#define NGX_RESOLVER_SHARED_POLL  50
+
+/* answers depend on the address families queried */
+#if (NGX_HAVE_INET6)
+#define ngx_resolver_shared_key(r, rn)                                        \
+    ((rn)->node.key ^ ((r)->ipv4 | (r)->ipv6 << 1))
+#else
+#define ngx_resolver_shared_key(r, rn)  (rn)->node.key
+#endif
+
+
+typedef struct {
+    ngx_rbtree_node_t         node;
+    ngx_queue_t               queue;
+
+    /* answer expiration time, if any */
+    time_t                    valid;
+
+    /* query in flight from the worker pid until this time */
+    time_t                    pending;
+    ngx_pid_t                 pid;
+
+    u_short                   nlen;
+    u_short                   naddrs;
+    u_short                   naddrs6;
+    u_short                   cnlen;
+
+    /* name, IPv4 addresses, IPv6 addresses, CNAME */
+    u_char                    data[1];
+} ngx_resolver_sh_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t              rbtree;
+    ngx_rbtree_node_t         sentinel;
+    ngx_queue_t               queue;
+} ngx_resolver_sh_t;
+
+
+typedef struct {
+    ngx_resolver_sh_t        *sh;
+    ngx_slab_pool_t          *shpool;
+} ngx_resolver_shctx_t;
+
+
 static ngx_int_t ngx_udp_connect(ngx_resolver_connection_t *rec);
 static ngx_int_t ngx_tcp_connect(ngx_resolver_connection_t *rec);
 
@@ -121,6 +166,28 @@ static void ngx_resolver_resolve_srv_names(ngx_resolver_ctx_t *ctx,
 static void ngx_resolver_srv_names_handler(ngx_resolver_ctx_t *ctx);
 static ngx_int_t ngx_resolver_cmp_srvs(const void *one, const void *two);
 
+static ngx_int_t ngx_resolver_add_zone(ngx_conf_t *cf, ngx_resolver_t *r,
+    ngx_str_t *value);
+static ngx_int_t ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static void ngx_resolver_shared_handler(ngx_event_t *ev);
+static ngx_int_t ngx_resolver_shared_lookup(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_shared_store(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_shared_release(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static ngx_resolver_sh_node_t *ngx_resolver_shared_find(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static ngx_resolver_sh_node_t *ngx_resolver_shared_alloc(ngx_resolver_t *r,
+    size_t size);
+static void ngx_resolver_shared_delete(ngx_resolver_t *r,
+    ngx_resolver_sh_node_t *sn);
+static void ngx_resolver_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+
+
+static ngx_uint_t  ngx_resolver_zone_tag;
+
 #if (NGX_HAVE_INET6)
 static void ngx_resolver_rbtree_insert_addr6_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
@@ -176,6 +243,8 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     ngx_queue_init(&r->srv_expire_queue);
     ngx_queue_init(&r->addr_expire_queue);
 
+    ngx_queue_init(&r->name_shared_queue);
+
 #if (NGX_HAVE_INET6)
     r->ipv6 = 1;
 
@@ -226,6 +295,15 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+
+            if (ngx_resolver_add_zone(cf, r, &names[i]) != NGX_OK) {
+                return NULL;
+            }
+
+            continue;
+        }
+
 #if (NGX_HAVE_INET6)
         if (ngx_strncmp(names[i].data, "ipv4=", 5) == 0) {
 
@@ -309,6 +387,75 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 }
 
 
+static ngx_int_t
+ngx_resolver_add_zone(ngx_conf_t *cf, ngx_resolver_t *r, ngx_str_t *value)
+{
+    u_char                *p;
+    ssize_t                size;
+    ngx_str_t              name, s;
+    ngx_resolver_shctx_t  *ctx;
+
+    name.data = value->data + 5;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", value);
+        return NGX_ERROR;
+    }
+
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value->data + value->len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", value);
+        return NGX_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", value);
+        return NGX_ERROR;
+    }
+
+    r->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                        &ngx_resolver_zone_tag);
+    if (r->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* several resolvers may share a zone */
+
+    if (r->shm_zone->data == NULL) {
+        ctx = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_shctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        r->shm_zone->init = ngx_resolver_init_zone;
+        r->shm_zone->data = ctx;
+    }
+
+    r->shared_event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+    if (r->shared_event == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->shared_event->handler = ngx_resolver_shared_handler;
+    r->shared_event->data = r;
+    r->shared_event->log = &cf->cycle->new_log;
+    r->shared_event->cancelable = 1;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_resolver_cleanup(void *data)
 {
@@ -333,6 +480,10 @@ ngx_resolver_cleanup(void *data)
         ngx_del_timer(r->event);
     }
 
+    if (r->shared_event && r->shared_event->timer_set) {
+        ngx_del_timer(r->shared_event);
+    }
+
     rec = r->connections.elts;
 
     for (i = 0; i < r->connections.nelts; i++) {
@@ -828,6 +979,59 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         ngx_rbtree_insert(tree, &rn->node);
     }
 
+    if (r->shm_zone && ctx->service.len == 0) {
+
+        rc = ngx_resolver_shared_lookup(r, rn);
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (rc == NGX_OK) {
+            ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0,
+                           "resolve shared cached");
+
+            rn->expire = ngx_time() + r->expire;
+            rn->waiting = NULL;
+
+            ngx_queue_insert_head(expire_queue, &rn->queue);
+
+            return ngx_resolve_name_locked(r, ctx, name);
+        }
+
+        if (rc == NGX_BUSY) {
+
+            /* another worker is resolving the name, wait for its answer */
+
+            if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
+                goto failed;
+            }
+
+            if (!r->shared_event->timer_set) {
+                ngx_add_timer(r->shared_event, NGX_RESOLVER_SHARED_POLL);
+            }
+
+            ngx_queue_insert_head(&r->name_shared_queue, &rn->queue);
+
+            rn->code = 0;
+            rn->valid = 0;
+            rn->ttl = NGX_MAX_UINT32_VALUE;
+            rn->waiting = ctx;
+
+            ctx->state = NGX_AGAIN;
+            ctx->async = 1;
+
+            do {
+                ctx->node = rn;
+                ctx = ctx->next;
+            } while (ctx);
+
+            return NGX_AGAIN;
+        }
+
+        /* NGX_DECLINED: the query is sent by this worker */
+    }
+
     if (ctx->service.len) {
         rc = ngx_resolver_create_srv_query(r, rn, name);
 
@@ -2128,6 +2332,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
         }
 #endif
 
+        if (r->shm_zone) {
+            ngx_resolver_shared_release(r, rn);
+        }
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -2447,6 +2655,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (r->shm_zone) {
+            ngx_resolver_shared_store(r, rn);
+        }
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -2519,6 +2731,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (r->shm_zone) {
+            ngx_resolver_shared_store(r, rn);
+        }
+
         ngx_resolver_free(r, rn->query);
         rn->query = NULL;
 #if (NGX_HAVE_INET6)
@@ -4739,3 +4955,490 @@ ngx_resolver_cmp_srvs(const void *one, const void *two)
 
     return p1 - p2;
 }
+
+
+static ngx_int_t
+ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_shctx_t  *octx = data;
+
+    size_t                 len;
+    ngx_resolver_shctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_resolver_sh_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_resolver_shared_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->queue);
+
+    len = sizeof(" in resolver zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in resolver zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_resolver_shared_handler(ngx_event_t *ev)
+{
+    ngx_str_t             name;
+    ngx_queue_t          *q, queue;
+    ngx_resolver_t       *r;
+    ngx_resolver_ctx_t   *ctx;
+    ngx_resolver_node_t  *rn;
+
+    r = ev->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver shared poll");
+
+    /* names still waiting are requeued by ngx_resolve_name_locked() */
+
+    ngx_queue_init(&queue);
+    ngx_queue_add(&queue, &r->name_shared_queue);
+    ngx_queue_init(&r->name_shared_queue);
+
+    /* lock name mutex */
+
+    while (!ngx_queue_empty(&queue)) {
+
+        q = ngx_queue_head(&queue);
+        rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
+
+        ctx = rn->waiting;
+        rn->waiting = NULL;
+
+        if (ctx == NULL) {
+            ngx_queue_remove(q);
+            ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+            ngx_resolver_free_node(r, rn);
+            continue;
+        }
+
+        name.len = rn->nlen;
+        name.data = rn->name;
+
+        (void) ngx_resolve_name_locked(r, ctx, &name);
+    }
+
+    /* unlock name mutex */
+}
+
+
+static ngx_int_t
+ngx_resolver_shared_lookup(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                  *p;
+    time_t                   now;
+    ngx_int_t                rc;
+    ngx_resolver_shctx_t    *ctx;
+    ngx_resolver_sh_node_t  *sn;
+
+    ctx = r->shm_zone->data;
+
+    rn->naddrs = 0;
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = 0;
+#endif
+    rn->nsrvs = 0;
+    rn->cnlen = 0;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    sn = ngx_resolver_shared_find(r, rn);
+
+    if (sn && sn->valid >= now) {
+
+        ngx_queue_remove(&sn->queue);
+        ngx_queue_insert_head(&ctx->sh->queue, &sn->queue);
+
+        p = sn->data + sn->nlen;
+
+        if (sn->naddrs == 1) {
+            ngx_memcpy(&rn->u.addr, p, sizeof(in_addr_t));
+
+        } else if (sn->naddrs > 1) {
+            rn->u.addrs = ngx_resolver_dup(r, p,
+                                           sn->naddrs * sizeof(in_addr_t));
+            if (rn->u.addrs == NULL) {
+                goto failed;
+            }
+        }
+
+        rn->naddrs = sn->naddrs;
+        p += sn->naddrs * sizeof(in_addr_t);
+
+#if (NGX_HAVE_INET6)
+        if (sn->naddrs6 == 1) {
+            ngx_memcpy(&rn->u6.addr6, p, sizeof(struct in6_addr));
+
+        } else if (sn->naddrs6 > 1) {
+            rn->u6.addrs6 = ngx_resolver_dup(r, p, sn->naddrs6
+                                                   * sizeof(struct in6_addr));
+            if (rn->u6.addrs6 == NULL) {
+                goto failed;
+            }
+        }
+
+        rn->naddrs6 = sn->naddrs6;
+        p += sn->naddrs6 * sizeof(struct in6_addr);
+#endif
+
+        if (sn->cnlen) {
+            rn->u.cname = ngx_resolver_dup(r, p, sn->cnlen);
+            if (rn->u.cname == NULL) {
+                goto failed;
+            }
+
+            rn->cnlen = sn->cnlen;
+        }
+
+        rn->code = 0;
+        rn->valid = sn->valid;
+        rn->ttl = (uint32_t) (sn->valid - now);
+
+        rc = NGX_OK;
+        goto done;
+    }
+
+    if (sn && sn->pending >= now && sn->pid != ngx_pid) {
+        rc = NGX_BUSY;
+        goto done;
+    }
+
+    /* claim the name for this worker */
+
+    if (sn == NULL) {
+        sn = ngx_resolver_shared_alloc(r, offsetof(ngx_resolver_sh_node_t, data)
+                                          + rn->nlen);
+        if (sn) {
+            sn->node.key = ngx_resolver_shared_key(r, rn);
+            sn->valid = 0;
+            sn->nlen = rn->nlen;
+            sn->naddrs = 0;
+            sn->naddrs6 = 0;
+            sn->cnlen = 0;
+
+            ngx_memcpy(sn->data, rn->name, rn->nlen);
+
+            ngx_rbtree_insert(&ctx->sh->rbtree, &sn->node);
+            ngx_queue_insert_head(&ctx->sh->queue, &sn->queue);
+        }
+    }
+
+    if (sn) {
+        sn->pending = now + r->resend_timeout;
+        sn->pid = ngx_pid;
+    }
+
+    rc = NGX_DECLINED;
+    goto done;
+
+failed:
+
+    if (rn->naddrs > 1) {
+        ngx_resolver_free(r, rn->u.addrs);
+    }
+
+    rn->naddrs = 0;
+
+#if (NGX_HAVE_INET6)
+    if (rn->naddrs6 > 1) {
+        ngx_resolver_free(r, rn->u6.addrs6);
+    }
+
+    rn->naddrs6 = 0;
+#endif
+
+    rc = NGX_ERROR;
+
+done:
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver shared lookup \"%*s\": %i",
+                   (size_t) rn->nlen, rn->name, rc);
+
+    return rc;
+}
+
+
+static void
+ngx_resolver_shared_store(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                  *p;
+    size_t                   size;
+    ngx_uint_t               naddrs6;
+    ngx_resolver_shctx_t    *ctx;
+    ngx_resolver_sh_node_t  *sn;
+
+    ctx = r->shm_zone->data;
+
+#if (NGX_HAVE_INET6)
+    naddrs6 = rn->naddrs6;
+#else
+    naddrs6 = 0;
+#endif
+
+    size = offsetof(ngx_resolver_sh_node_t, data) + rn->nlen
+           + rn->naddrs * sizeof(in_addr_t)
+           + naddrs6 * sizeof(struct in6_addr)
+           + rn->cnlen;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    sn = ngx_resolver_shared_find(r, rn);
+
+    if (sn) {
+        ngx_resolver_shared_delete(r, sn);
+    }
+
+    sn = ngx_resolver_shared_alloc(r, size);
+
+    if (sn == NULL) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        return;
+    }
+
+    sn->node.key = ngx_resolver_shared_key(r, rn);
+    sn->valid = rn->valid;
+    sn->pending = 0;
+    sn->pid = ngx_pid;
+    sn->nlen = rn->nlen;
+    sn->naddrs = rn->naddrs;
+    sn->naddrs6 = (u_short) naddrs6;
+    sn->cnlen = rn->cnlen;
+
+    p = ngx_cpymem(sn->data, rn->name, rn->nlen);
+
+    if (rn->naddrs == 1) {
+        p = ngx_cpymem(p, &rn->u.addr, sizeof(in_addr_t));
+
+    } else if (rn->naddrs > 1) {
+        p = ngx_cpymem(p, rn->u.addrs, rn->naddrs * sizeof(in_addr_t));
+    }
+
+#if (NGX_HAVE_INET6)
+    if (rn->naddrs6 == 1) {
+        p = ngx_cpymem(p, &rn->u6.addr6, sizeof(struct in6_addr));
+
+    } else if (rn->naddrs6 > 1) {
+        p = ngx_cpymem(p, rn->u6.addrs6,
+                       rn->naddrs6 * sizeof(struct in6_addr));
+    }
+#endif
+
+    if (rn->cnlen) {
+        ngx_memcpy(p, rn->u.cname, rn->cnlen);
+    }
+
+    ngx_rbtree_insert(&ctx->sh->rbtree, &sn->node);
+    ngx_queue_insert_head(&ctx->sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+}
+
+
+static void
+ngx_resolver_shared_release(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_resolver_shctx_t    *ctx;
+    ngx_resolver_sh_node_t  *sn;
+
+    ctx = r->shm_zone->data;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    sn = ngx_resolver_shared_find(r, rn);
+
+    if (sn && sn->pid == ngx_pid) {
+        sn->pending = 0;
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+}
+
+
+static ngx_resolver_sh_node_t *
+ngx_resolver_shared_find(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_int_t                rc;
+    ngx_rbtree_key_t         key;
+    ngx_rbtree_node_t       *node, *sentinel;
+    ngx_resolver_shctx_t    *ctx;
+    ngx_resolver_sh_node_t  *sn;
+
+    ctx = r->shm_zone->data;
+
+    key = ngx_resolver_shared_key(r, rn);
+
+    node = ctx->sh->rbtree.root;
+    sentinel = ctx->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* key == node->key */
+
+        sn = (ngx_resolver_sh_node_t *) node;
+
+        rc = ngx_memn2cmp(rn->name, sn->data, rn->nlen, sn->nlen);
+
+        if (rc == 0) {
+            return sn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static ngx_resolver_sh_node_t *
+ngx_resolver_shared_alloc(ngx_resolver_t *r, size_t size)
+{
+    time_t                   now;
+    ngx_uint_t               n;
+    ngx_queue_t             *q;
+    ngx_resolver_shctx_t    *ctx;
+    ngx_resolver_sh_node_t  *sn;
+
+    ctx = r->shm_zone->data;
+
+    now = ngx_time();
+
+    /* free one or two expired nodes */
+
+    for (n = 0; n < 2; n++) {
+
+        if (ngx_queue_empty(&ctx->sh->queue)) {
+            break;
+        }
+
+        q = ngx_queue_last(&ctx->sh->queue);
+        sn = ngx_queue_data(q, ngx_resolver_sh_node_t, queue);
+
+        if (sn->valid >= now || sn->pending >= now) {
+            break;
+        }
+
+        ngx_resolver_shared_delete(r, sn);
+    }
+
+    for ( ;; ) {
+        sn = ngx_slab_alloc_locked(ctx->shpool, size);
+
+        if (sn) {
+            return sn;
+        }
+
+        /* evict the least recently used node */
+
+        if (ngx_queue_empty(&ctx->sh->queue)) {
+            return NULL;
+        }
+
+        q = ngx_queue_last(&ctx->sh->queue);
+        sn = ngx_queue_data(q, ngx_resolver_sh_node_t, queue);
+
+        ngx_resolver_shared_delete(r, sn);
+    }
+}
+
+
+static void
+ngx_resolver_shared_delete(ngx_resolver_t *r, ngx_resolver_sh_node_t *sn)
+{
+    ngx_resolver_shctx_t  *ctx;
+
+    ctx = r->shm_zone->data;
+
+    ngx_queue_remove(&sn->queue);
+    ngx_rbtree_delete(&ctx->sh->rbtree, &sn->node);
+    ngx_slab_free_locked(ctx->shpool, sn);
+}
+
+
+static void
+ngx_resolver_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t       **p;
+    ngx_resolver_sh_node_t   *sn, *sn_temp;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_resolver_sh_node_t *) node;
+            sn_temp = (ngx_resolver_sh_node_t *) temp;
+
+            p = (ngx_memn2cmp(sn->data, sn_temp->data, sn->nlen, sn_temp->nlen)
+                 < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
@@ -185,6 +185,11 @@ struct ngx_resolver_s {
     ngx_queue_t               addr6_expire_queue;
 #endif
 
+    /* names cached in shared memory across workers */
+    ngx_shm_zone_t           *shm_zone;
+    ngx_event_t              *shared_event;
+    ngx_queue_t               name_shared_queue;
+
     time_t                    resend_timeout;
     time_t                    tcp_timeout;
     time_t                    expire;
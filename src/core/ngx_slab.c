@@ -159,7 +159,10 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     pool->last = pool->pages + pages;
     pool->pfree = pages;
 
+    pool->fails = 0;
+
     pool->log_nomem = 1;
+    pool->best_fit = 0;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
 }
@@ -363,6 +366,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             slots[slot].next = page;
 
             pool->stats[slot].total += (ngx_pagesize >> shift) - n;
+            pool->stats[slot].pages++;
 
             p = ngx_slab_page_addr(pool, page) + (n << shift);
 
@@ -379,6 +383,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             slots[slot].next = page;
 
             pool->stats[slot].total += 8 * sizeof(uintptr_t);
+            pool->stats[slot].pages++;
 
             p = ngx_slab_page_addr(pool, page);
 
@@ -395,6 +400,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             slots[slot].next = page;
 
             pool->stats[slot].total += ngx_pagesize >> shift;
+            pool->stats[slot].pages++;
 
             p = ngx_slab_page_addr(pool, page);
 
@@ -533,6 +539,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             ngx_slab_free_pages(pool, page, 1);
 
             pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+            pool->stats[slot].pages--;
 
             goto done;
         }
@@ -571,6 +578,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             ngx_slab_free_pages(pool, page, 1);
 
             pool->stats[slot].total -= 8 * sizeof(uintptr_t);
+            pool->stats[slot].pages--;
 
             goto done;
         }
@@ -611,6 +619,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             ngx_slab_free_pages(pool, page, 1);
 
             pool->stats[slot].total -= ngx_pagesize >> shift;
+            pool->stats[slot].pages--;
 
             goto done;
         }
@@ -674,59 +683,103 @@ fail:
 }
 
 
+ngx_uint_t
+ngx_slab_max_free_locked(ngx_slab_pool_t *pool)
+{
+    ngx_uint_t        n;
+    ngx_slab_page_t  *page;
+
+    /* the largest run of free pages, a measure of fragmentation */
+
+    n = 0;
+
+    for (page = pool->free.next; page != &pool->free; page = page->next) {
+        if (page->slab > n) {
+            n = page->slab;
+        }
+    }
+
+    return n;
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
-    ngx_slab_page_t  *page, *p;
+    ngx_slab_page_t  *page, *p, *best;
+
+    best = NULL;
 
     for (page = pool->free.next; page != &pool->free; page = page->next) {
 
-        if (page->slab >= pages) {
+        if (page->slab < pages) {
+            continue;
+        }
 
-            if (page->slab > pages) {
-                page[page->slab - 1].prev = (uintptr_t) &page[pages];
+        if (!pool->best_fit || page->slab == pages) {
+            best = page;
+            break;
+        }
 
-                page[pages].slab = page->slab - pages;
-                page[pages].next = page->next;
-                page[pages].prev = page->prev;
+        /*
+         * best fit: take the smallest run that is large enough, so that
+         * single pages for small objects fill holes instead of splitting
+         * runs needed by larger allocations
+         */
 
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = &page[pages];
-                page->next->prev = (uintptr_t) &page[pages];
+        if (best == NULL || page->slab < best->slab) {
+            best = page;
+        }
+    }
 
-            } else {
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = page->next;
-                page->next->prev = page->prev;
-            }
+    page = best;
 
-            page->slab = pages | NGX_SLAB_PAGE_START;
-            page->next = NULL;
-            page->prev = NGX_SLAB_PAGE;
+    if (page == NULL) {
+        pool->fails++;
 
-            pool->pfree -= pages;
+        if (pool->log_nomem) {
+            ngx_slab_error(pool, NGX_LOG_CRIT,
+                           "ngx_slab_alloc() failed: no memory");
+        }
 
-            if (--pages == 0) {
-                return page;
-            }
+        return NULL;
+    }
 
-            for (p = page + 1; pages; pages--) {
-                p->slab = NGX_SLAB_PAGE_BUSY;
-                p->next = NULL;
-                p->prev = NGX_SLAB_PAGE;
-                p++;
-            }
+    if (page->slab > pages) {
+        page[page->slab - 1].prev = (uintptr_t) &page[pages];
 
-            return page;
-        }
+        page[pages].slab = page->slab - pages;
+        page[pages].next = page->next;
+        page[pages].prev = page->prev;
+
+        p = (ngx_slab_page_t *) page->prev;
+        p->next = &page[pages];
+        page->next->prev = (uintptr_t) &page[pages];
+
+    } else {
+        p = (ngx_slab_page_t *) page->prev;
+        p->next = page->next;
+        page->next->prev = page->prev;
+    }
+
+    page->slab = pages | NGX_SLAB_PAGE_START;
+    page->next = NULL;
+    page->prev = NGX_SLAB_PAGE;
+
+    pool->pfree -= pages;
+
+    if (--pages == 0) {
+        return page;
     }
 
-    if (pool->log_nomem) {
-        ngx_slab_error(pool, NGX_LOG_CRIT,
-                       "ngx_slab_alloc() failed: no memory");
+    for (p = page + 1; pages; pages--) {
+        p->slab = NGX_SLAB_PAGE_BUSY;
+        p->next = NULL;
+        p->prev = NGX_SLAB_PAGE;
+        p++;
     }
 
-    return NULL;
+    return page;
 }
 
 
@@ -25,6 +25,7 @@ struct ngx_slab_page_s {
 typedef struct {
     ngx_uint_t        total;
     ngx_uint_t        used;
+    ngx_uint_t        pages;
 
     ngx_uint_t        reqs;
     ngx_uint_t        fails;
@@ -43,6 +44,7 @@ typedef struct {
 
     ngx_slab_stat_t  *stats;
     ngx_uint_t        pfree;
+    ngx_uint_t        fails;
 
     u_char           *start;
     u_char           *end;
@@ -53,6 +55,7 @@ typedef struct {
     u_char            zero;
 
     unsigned          log_nomem:1;
+    unsigned          best_fit:1;
 
     void             *data;
     void             *addr;
@@ -67,6 +70,7 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+ngx_uint_t ngx_slab_max_free_locked(ngx_slab_pool_t *pool);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
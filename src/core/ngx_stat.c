@@ -0,0 +1,62 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+ngx_uint_t  ngx_stat_shard;
+
+
+size_t
+ngx_stat_size(ngx_uint_t n)
+{
+    /* the memory may be not aligned, hence an extra line */
+
+    return ngx_align(n * sizeof(ngx_atomic_t), NGX_STAT_LINE)
+           * (ngx_uint_t) ngx_ncpu + NGX_STAT_LINE;
+}
+
+
+void
+ngx_stat_init(ngx_stat_t *stat, void *data, ngx_uint_t n)
+{
+    stat->data = ngx_align_ptr(data, NGX_STAT_LINE);
+    stat->size = ngx_align(n * sizeof(ngx_atomic_t), NGX_STAT_LINE);
+    stat->nshards = (ngx_uint_t) ngx_ncpu;
+}
+
+
+ngx_atomic_uint_t
+ngx_stat_value(ngx_stat_t *stat, ngx_uint_t i)
+{
+    u_char             *p;
+    ngx_uint_t          n;
+    ngx_atomic_uint_t   value;
+
+    value = 0;
+    p = stat->data;
+
+    for (n = 0; n < stat->nshards; n++) {
+        value += *((ngx_atomic_t *) p + i);
+        p += stat->size;
+    }
+
+    return value;
+}
+
+
+void
+ngx_stat_set_shard(ngx_uint_t worker)
+{
+    /*
+     * shards are shared if there are more worker processes than CPUs,
+     * or with worker processes of the previous configuration cycle,
+     * so counters are still updated atomically
+     */
+
+    ngx_stat_shard = worker % (ngx_uint_t) ngx_ncpu;
+}
@@ -0,0 +1,48 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_STAT_H_INCLUDED_
+#define _NGX_STAT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * counters are sharded per worker process: each shard is padded
+ * to NGX_STAT_LINE, which should be equal to or greater than cache
+ * line size, so workers do not share cache lines when updating
+ * counters; readers sum up all shards
+ */
+
+#define NGX_STAT_LINE  128
+
+
+typedef struct {
+    u_char               *data;
+    size_t                size;
+    ngx_uint_t            nshards;
+} ngx_stat_t;
+
+
+#define ngx_stat_counter(stat, i)                                             \
+    ((ngx_atomic_t *) ((stat)->data + ngx_stat_shard * (stat)->size) + (i))
+
+#define ngx_stat_add(stat, i, value)                                          \
+    (void) ngx_atomic_fetch_add(ngx_stat_counter(stat, i), value)
+
+
+size_t ngx_stat_size(ngx_uint_t n);
+void ngx_stat_init(ngx_stat_t *stat, void *data, ngx_uint_t n);
+ngx_atomic_uint_t ngx_stat_value(ngx_stat_t *stat, ngx_uint_t i);
+void ngx_stat_set_shard(ngx_uint_t worker);
+
+
+extern ngx_uint_t  ngx_stat_shard;
+
+
+#endif /* _NGX_STAT_H_INCLUDED_ */
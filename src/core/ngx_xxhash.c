@@ -0,0 +1,394 @@
+
+/*
+ * Copyright (C) Yann Collet
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * XXH3 64-bit hash, see https://github.com/Cyan4973/xxHash.
+ * The result is the same as of XXH3_64bits_withSeed() with the
+ * default secret.
+ */
+
+
+#define NGX_XXH_PRIME32_1    0x9e3779b1U
+#define NGX_XXH_PRIME32_2    0x85ebca77U
+#define NGX_XXH_PRIME32_3    0xc2b2ae3dU
+
+#define NGX_XXH_PRIME64_1    0x9e3779b185ebca87ULL
+#define NGX_XXH_PRIME64_2    0xc2b2ae3d27d4eb4fULL
+#define NGX_XXH_PRIME64_3    0x165667b19e3779f9ULL
+#define NGX_XXH_PRIME64_4    0x85ebca77c2b2ae63ULL
+#define NGX_XXH_PRIME64_5    0x27d4eb2f165667c5ULL
+
+#define NGX_XXH_PRIME_MX1    0x165667919e3779f9ULL
+#define NGX_XXH_PRIME_MX2    0x9fb21c651e98df25ULL
+
+#define NGX_XXH_SECRET_SIZE  192
+#define NGX_XXH_STRIPE_LEN   64
+#define NGX_XXH_BLOCK_LEN                                                     \
+    (NGX_XXH_STRIPE_LEN * ((NGX_XXH_SECRET_SIZE - NGX_XXH_STRIPE_LEN) / 8))
+
+
+#define ngx_xxh_rotl64(x, r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+#define ngx_xxh_swap32(x)                                                     \
+    (((x) << 24) | (((x) << 8) & 0xff0000) | (((x) >> 8) & 0xff00)            \
+     | ((x) >> 24))
+
+#define ngx_xxh_swap64(x)                                                     \
+    ((uint64_t) ngx_xxh_swap32((uint32_t) (x)) << 32                          \
+     | ngx_xxh_swap32((uint32_t) ((x) >> 32)))
+
+
+static ngx_inline uint32_t ngx_xxh_read32(u_char *p);
+static ngx_inline uint64_t ngx_xxh_read64(u_char *p);
+static ngx_inline void ngx_xxh_write64(u_char *p, uint64_t v);
+static ngx_inline uint64_t ngx_xxh_mul128_fold64(uint64_t a, uint64_t b);
+static ngx_inline uint64_t ngx_xxh_mix16(u_char *p, u_char *secret,
+    uint64_t seed);
+static uint64_t ngx_xxh3_avalanche(uint64_t h);
+static uint64_t ngx_xxh3_0to16(u_char *p, size_t len, uint64_t seed);
+static uint64_t ngx_xxh3_17to240(u_char *p, size_t len, uint64_t seed);
+static uint64_t ngx_xxh3_long(u_char *p, size_t len, uint64_t seed);
+static void ngx_xxh3_accumulate(uint64_t *acc, u_char *p, u_char *secret);
+
+
+static u_char  ngx_xxh3_secret[NGX_XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe,
+    0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+    0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e,
+    0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e,
+    0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f,
+    0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3,
+    0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49,
+    0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28,
+    0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+
+uint64_t
+ngx_xxh3_64(u_char *data, size_t len, uint64_t seed)
+{
+    if (len <= 16) {
+        return ngx_xxh3_0to16(data, len, seed);
+    }
+
+    if (len <= 240) {
+        return ngx_xxh3_17to240(data, len, seed);
+    }
+
+    return ngx_xxh3_long(data, len, seed);
+}
+
+
+static ngx_inline uint32_t
+ngx_xxh_read32(u_char *p)
+{
+#if (NGX_HAVE_LITTLE_ENDIAN)
+    uint32_t  v;
+
+    ngx_memcpy(&v, p, 4);
+
+    return v;
+#else
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8
+           | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+#endif
+}
+
+
+static ngx_inline uint64_t
+ngx_xxh_read64(u_char *p)
+{
+#if (NGX_HAVE_LITTLE_ENDIAN)
+    uint64_t  v;
+
+    ngx_memcpy(&v, p, 8);
+
+    return v;
+#else
+    return (uint64_t) ngx_xxh_read32(p)
+           | (uint64_t) ngx_xxh_read32(p + 4) << 32;
+#endif
+}
+
+
+static ngx_inline void
+ngx_xxh_write64(u_char *p, uint64_t v)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = (u_char) (v >> (8 * i));
+    }
+}
+
+
+static ngx_inline uint64_t
+ngx_xxh_mul128_fold64(uint64_t a, uint64_t b)
+{
+#if (defined __SIZEOF_INT128__)
+    unsigned __int128  m;
+
+    m = (unsigned __int128) a * b;
+
+    return (uint64_t) m ^ (uint64_t) (m >> 64);
+#else
+    uint64_t  lo_lo, hi_lo, lo_hi, hi_hi, cross, lo, hi;
+
+    lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+    hi_lo = (a >> 32) * (b & 0xffffffff);
+    lo_hi = (a & 0xffffffff) * (b >> 32);
+    hi_hi = (a >> 32) * (b >> 32);
+
+    cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+    hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    lo = (cross << 32) | (lo_lo & 0xffffffff);
+
+    return lo ^ hi;
+#endif
+}
+
+
+static ngx_inline uint64_t
+ngx_xxh_mix16(u_char *p, u_char *secret, uint64_t seed)
+{
+    return ngx_xxh_mul128_fold64(
+               ngx_xxh_read64(p) ^ (ngx_xxh_read64(secret) + seed),
+               ngx_xxh_read64(p + 8) ^ (ngx_xxh_read64(secret + 8) - seed));
+}
+
+
+static uint64_t
+ngx_xxh3_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= NGX_XXH_PRIME_MX1;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+static uint64_t
+ngx_xxh3_0to16(u_char *p, size_t len, uint64_t seed)
+{
+    u_char    *s;
+    uint32_t   c;
+    uint64_t   h, lo, hi;
+
+    s = ngx_xxh3_secret;
+
+    if (len > 8) {
+        lo = ngx_xxh_read64(p)
+             ^ ((ngx_xxh_read64(s + 24) ^ ngx_xxh_read64(s + 32)) + seed);
+        hi = ngx_xxh_read64(p + len - 8)
+             ^ ((ngx_xxh_read64(s + 40) ^ ngx_xxh_read64(s + 48)) - seed);
+
+        h = len + ngx_xxh_swap64(lo) + hi + ngx_xxh_mul128_fold64(lo, hi);
+
+        return ngx_xxh3_avalanche(h);
+    }
+
+    if (len >= 4) {
+        seed ^= (uint64_t) ngx_xxh_swap32((uint32_t) seed) << 32;
+
+        h = ((uint64_t) ngx_xxh_read32(p) << 32)
+            + ngx_xxh_read32(p + len - 4);
+        h ^= (ngx_xxh_read64(s + 8) ^ ngx_xxh_read64(s + 16)) - seed;
+
+        /* rrmxmx */
+
+        h ^= ngx_xxh_rotl64(h, 49) ^ ngx_xxh_rotl64(h, 24);
+        h *= NGX_XXH_PRIME_MX2;
+        h ^= (h >> 35) + len;
+        h *= NGX_XXH_PRIME_MX2;
+        h ^= h >> 28;
+
+        return h;
+    }
+
+    if (len > 0) {
+        c = (uint32_t) p[0] << 16 | (uint32_t) p[len >> 1] << 24
+            | (uint32_t) p[len - 1] | (uint32_t) len << 8;
+
+        h = (uint64_t) c
+            ^ ((uint64_t) (ngx_xxh_read32(s) ^ ngx_xxh_read32(s + 4)) + seed);
+
+    } else {
+        h = seed ^ ngx_xxh_read64(s + 56) ^ ngx_xxh_read64(s + 64);
+    }
+
+    /* XXH64 avalanche */
+
+    h ^= h >> 33;
+    h *= NGX_XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= NGX_XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+static uint64_t
+ngx_xxh3_17to240(u_char *p, size_t len, uint64_t seed)
+{
+    u_char      *s;
+    uint64_t     h;
+    ngx_uint_t   i, n;
+
+    s = ngx_xxh3_secret;
+    h = len * NGX_XXH_PRIME64_1;
+
+    if (len <= 128) {
+
+        if (len > 32) {
+
+            if (len > 64) {
+
+                if (len > 96) {
+                    h += ngx_xxh_mix16(p + 48, s + 96, seed);
+                    h += ngx_xxh_mix16(p + len - 64, s + 112, seed);
+                }
+
+                h += ngx_xxh_mix16(p + 32, s + 64, seed);
+                h += ngx_xxh_mix16(p + len - 48, s + 80, seed);
+            }
+
+            h += ngx_xxh_mix16(p + 16, s + 32, seed);
+            h += ngx_xxh_mix16(p + len - 32, s + 48, seed);
+        }
+
+        h += ngx_xxh_mix16(p, s, seed);
+        h += ngx_xxh_mix16(p + len - 16, s + 16, seed);
+
+        return ngx_xxh3_avalanche(h);
+    }
+
+    for (i = 0; i < 8; i++) {
+        h += ngx_xxh_mix16(p + 16 * i, s + 16 * i, seed);
+    }
+
+    h = ngx_xxh3_avalanche(h);
+
+    n = len / 16;
+
+    for (i = 8; i < n; i++) {
+        h += ngx_xxh_mix16(p + 16 * i, s + 16 * (i - 8) + 3, seed);
+    }
+
+    h += ngx_xxh_mix16(p + len - 16, s + 136 - 17, seed);
+
+    return ngx_xxh3_avalanche(h);
+}
+
+
+static uint64_t
+ngx_xxh3_long(u_char *p, size_t len, uint64_t seed)
+{
+    u_char      *s, *q, secret[NGX_XXH_SECRET_SIZE];
+    uint64_t     acc[8], h, a;
+    ngx_uint_t   i, n, b, blocks;
+
+    s = ngx_xxh3_secret;
+
+    if (seed) {
+        for (i = 0; i < NGX_XXH_SECRET_SIZE; i += 16) {
+            ngx_xxh_write64(secret + i, ngx_xxh_read64(s + i) + seed);
+            ngx_xxh_write64(secret + i + 8, ngx_xxh_read64(s + i + 8) - seed);
+        }
+
+        s = secret;
+    }
+
+    acc[0] = NGX_XXH_PRIME32_3;
+    acc[1] = NGX_XXH_PRIME64_1;
+    acc[2] = NGX_XXH_PRIME64_2;
+    acc[3] = NGX_XXH_PRIME64_3;
+    acc[4] = NGX_XXH_PRIME64_4;
+    acc[5] = NGX_XXH_PRIME32_2;
+    acc[6] = NGX_XXH_PRIME64_5;
+    acc[7] = NGX_XXH_PRIME32_1;
+
+    /* full blocks, each followed by a scramble */
+
+    blocks = (len - 1) / NGX_XXH_BLOCK_LEN;
+
+    for (b = 0; b < blocks; b++) {
+        q = p + b * NGX_XXH_BLOCK_LEN;
+
+        for (n = 0; n < NGX_XXH_BLOCK_LEN / NGX_XXH_STRIPE_LEN; n++) {
+            ngx_xxh3_accumulate(acc, q + n * NGX_XXH_STRIPE_LEN, s + n * 8);
+        }
+
+        for (i = 0; i < 8; i++) {
+            a = acc[i];
+            a ^= a >> 47;
+            a ^= ngx_xxh_read64(s + NGX_XXH_SECRET_SIZE - NGX_XXH_STRIPE_LEN
+                                + 8 * i);
+            acc[i] = a * NGX_XXH_PRIME32_1;
+        }
+    }
+
+    /* the last partial block and the last stripe */
+
+    q = p + blocks * NGX_XXH_BLOCK_LEN;
+    n = (len - 1 - blocks * NGX_XXH_BLOCK_LEN) / NGX_XXH_STRIPE_LEN;
+
+    for (i = 0; i < n; i++) {
+        ngx_xxh3_accumulate(acc, q + i * NGX_XXH_STRIPE_LEN, s + i * 8);
+    }
+
+    ngx_xxh3_accumulate(acc, p + len - NGX_XXH_STRIPE_LEN,
+                        s + NGX_XXH_SECRET_SIZE - NGX_XXH_STRIPE_LEN - 7);
+
+    /* merge */
+
+    h = len * NGX_XXH_PRIME64_1;
+
+    for (i = 0; i < 4; i++) {
+        h += ngx_xxh_mul128_fold64(
+                 acc[2 * i] ^ ngx_xxh_read64(s + 11 + 16 * i),
+                 acc[2 * i + 1] ^ ngx_xxh_read64(s + 11 + 16 * i + 8));
+    }
+
+    return ngx_xxh3_avalanche(h);
+}
+
+
+static void
+ngx_xxh3_accumulate(uint64_t *acc, u_char *p, u_char *secret)
+{
+    uint64_t    v, k;
+    ngx_uint_t  i;
+
+    for (i = 0; i < 8; i++) {
+        v = ngx_xxh_read64(p + 8 * i);
+        k = v ^ ngx_xxh_read64(secret + 8 * i);
+
+        acc[i ^ 1] += v;
+        acc[i] += (k & 0xffffffff) * (k >> 32);
+    }
+}
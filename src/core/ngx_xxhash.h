@@ -0,0 +1,18 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_XXHASH_H_INCLUDED_
+#define _NGX_XXHASH_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+uint64_t ngx_xxh3_64(u_char *data, size_t len, uint64_t seed);
+
+
+#endif /* _NGX_XXHASH_H_INCLUDED_ */
@@ -0,0 +1,2322 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The user_data field of a submission queue entry is either 0 for
+ * operations whose completions are ignored, a pointer to an event
+ * tagged with NGX_IOURING_EVENT, a pointer to a socket operation
+ * tagged with NGX_IOURING_IO, or a connection poll request tagged
+ * with NGX_IOURING_POLL:
+ *
+ *     63            32 31                       2 1  0
+ *     |  generation   |   slot index             | 01 |
+ *
+ * The slots of the connections from the pool are indexed as the
+ * connections, while the connections outside of the pool, such as
+ * the connections of a previous cycle, take one of the spare slots.
+ *
+ * The generation is incremented on each poll request of a connection,
+ * so completions of the removed requests are recognized as stale
+ * regardless of connection reuse.
+ */
+
+#define NGX_IOURING_POLL      0x01
+#define NGX_IOURING_EVENT     0x02
+#define NGX_IOURING_IO        0x03
+#define NGX_IOURING_TAG       0x03
+
+#define NGX_IOURING_SPARE_SLOTS  64
+
+#define NGX_IOURING_ACCEPT    0
+#define NGX_IOURING_RECV      1
+#define NGX_IOURING_SEND      2
+
+/* the receive operations select one of the provided buffers of the group */
+
+#define NGX_IOURING_BUFFER_GROUP  0
+#define NGX_IOURING_BUFFER_SIZE   8192
+
+
+typedef struct {
+    ngx_uint_t             entries;
+} ngx_iouring_conf_t;
+
+
+typedef struct ngx_iouring_op_s  ngx_iouring_op_t;
+
+struct ngx_iouring_op_s {
+    ngx_connection_t      *connection;
+    ngx_iouring_op_t      *next;
+
+    uint32_t               sqe;
+    int32_t                res;
+    size_t                 size;
+
+    /* the data received, or the first byte sent */
+
+    u_char                *pos;
+    u_char                *last;
+
+    unsigned               type:2;
+    unsigned               active:1;
+    unsigned               done:1;
+    unsigned               buffer:1;
+    unsigned               bid:16;
+
+    ngx_sockaddr_t         sockaddr;
+    socklen_t              socklen;
+
+    struct msghdr          msg;
+    struct iovec           iovs[NGX_IOVS_PREALLOCATE];
+};
+
+
+typedef struct {
+    ngx_connection_t      *connection;
+    uint32_t               generation;
+    unsigned               level:1;
+
+    ngx_iouring_op_t      *read;
+    ngx_iouring_op_t      *write;
+} ngx_iouring_slot_t;
+
+
+typedef struct {
+    u_char                *sq_ring;
+    size_t                 sq_ring_size;
+    u_char                *cq_ring;
+    size_t                 cq_ring_size;
+
+    struct io_uring_sqe   *sqes;
+    size_t                 sqes_size;
+
+    uint32_t              *sq_head;
+    uint32_t              *sq_tail;
+    uint32_t               sq_mask;
+    uint32_t               sq_entries;
+
+    uint32_t              *cq_head;
+    uint32_t              *cq_tail;
+    uint32_t               cq_mask;
+    struct io_uring_cqe   *cqes;
+
+    uint32_t               tail;
+    ngx_uint_t             pending;
+} ngx_iouring_ring_t;
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_iouring_setup(ngx_cycle_t *cycle,
+    ngx_iouring_conf_t *iocf);
+static ngx_int_t ngx_iouring_probe(ngx_cycle_t *cycle);
+static ngx_int_t ngx_iouring_buffers_init(ngx_cycle_t *cycle,
+    ngx_iouring_conf_t *iocf);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify_init(ngx_log_t *log);
+static void ngx_iouring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static void ngx_iouring_close(ngx_log_t *log);
+static struct io_uring_sqe *ngx_iouring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_iouring_submit(ngx_uint_t min, ngx_uint_t flags,
+    void *arg, size_t size);
+static ngx_iouring_slot_t *ngx_iouring_slot(ngx_connection_t *c,
+    ngx_uint_t alloc);
+static ngx_int_t ngx_iouring_poll_add(ngx_connection_t *c,
+    ngx_iouring_slot_t *slot, uint32_t events);
+static ngx_int_t ngx_iouring_poll_remove(ngx_connection_t *c,
+    ngx_iouring_slot_t *slot);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_iouring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static void ngx_iouring_poll_event(ngx_cycle_t *cycle, uint64_t data,
+    int32_t res, uint32_t cflags, ngx_uint_t flags);
+static void ngx_iouring_event(ngx_cycle_t *cycle, uint64_t data,
+    int32_t res, uint32_t cflags, ngx_uint_t flags);
+static void ngx_iouring_io_event(ngx_cycle_t *cycle, uint64_t data,
+    int32_t res, uint32_t cflags, ngx_uint_t flags);
+
+static ngx_iouring_op_t *ngx_iouring_get_op(ngx_connection_t *c,
+    ngx_iouring_slot_t *slot, ngx_uint_t type);
+static void ngx_iouring_release_op(ngx_iouring_op_t *op, ngx_log_t *log);
+static void ngx_iouring_free_op(ngx_iouring_op_t *op, ngx_log_t *log);
+static void ngx_iouring_provide_buffer(ngx_uint_t bid, ngx_log_t *log);
+static ssize_t ngx_iouring_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_iouring_recv_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit);
+static ssize_t ngx_iouring_recv_result(ngx_connection_t *c,
+    ngx_iouring_op_t *op);
+static size_t ngx_iouring_recv_copy(ngx_iouring_op_t *op, u_char *buf,
+    size_t size, ngx_log_t *log);
+static void ngx_iouring_recv_submit(ngx_connection_t *c,
+    ngx_iouring_slot_t *slot, size_t size);
+static ssize_t ngx_iouring_send(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ngx_chain_t *ngx_iouring_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_uint_t ngx_iouring_send_done(ngx_connection_t *c,
+    ngx_iouring_op_t *op, int32_t res);
+static ssize_t ngx_iouring_send_result(ngx_connection_t *c,
+    ngx_iouring_op_t *op, u_char *buf);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+extern ngx_module_t  ngx_epoll_module;
+
+
+static int                  ring_fd = -1;
+static ngx_iouring_ring_t   ring;
+static ngx_uint_t           ring_io;
+
+static ngx_iouring_op_t    *free_ops;
+static u_char              *buffers;
+static ngx_uint_t           buffer_n;
+
+static ngx_iouring_slot_t  *slots;
+static ngx_uint_t           slot_n;
+static ngx_uint_t           connection_n;
+static ngx_connection_t    *connections;
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+#endif
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        ngx_iouring_add_connection,      /* add an connection */
+        ngx_iouring_del_connection,      /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_iouring_notify,              /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+static ngx_os_io_t  ngx_iouring_io = {
+    ngx_iouring_recv,
+    ngx_iouring_recv_chain,
+    ngx_udp_unix_recv,
+    ngx_iouring_send,
+    ngx_udp_unix_send,
+    ngx_udp_unix_sendmsg_chain,
+    ngx_iouring_send_chain,
+#if (NGX_HAVE_SENDFILE)
+    NGX_IO_SENDFILE
+#else
+    0
+#endif
+};
+
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup(), io_uring_enter(), and io_uring_register()
+ * directly as syscalls instead of liburing usage to avoid the dependency.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    void *arg, size_t size)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, size);
+}
+
+
+static int
+io_uring_register(int fd, u_int opcode, void *arg, u_int nr_args)
+{
+    return syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_iouring_conf_t  *iocf;
+    ngx_event_module_t  *module;
+
+    iocf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring_fd == -1) {
+
+        if (ngx_iouring_setup(cycle, iocf) != NGX_OK) {
+            ngx_iouring_close(cycle->log);
+
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring is not usable, using epoll instead");
+
+            module = ngx_epoll_module.ctx;
+
+            return module->actions.init(cycle, timer);
+        }
+    }
+
+    if (connection_n < cycle->connection_n) {
+        if (slots) {
+            ngx_free(slots);
+        }
+
+        slot_n = cycle->connection_n + NGX_IOURING_SPARE_SLOTS;
+
+        slots = ngx_calloc(sizeof(ngx_iouring_slot_t) * slot_n, cycle->log);
+        if (slots == NULL) {
+            return NGX_ERROR;
+        }
+
+        connection_n = cycle->connection_n;
+        connections = NULL;
+    }
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    /*
+     * the poll requests use the epoll event masks and semantics,
+     * though EPOLLEXCLUSIVE is not passed to a kernel
+     */
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT
+                      |NGX_USE_IOURING_EVENT;
+
+    if (ring_io) {
+        ngx_io = ngx_iouring_io;
+        ngx_event_flags |= NGX_USE_IOURING_IO;
+
+    } else {
+        ngx_io = ngx_os_io;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_setup(ngx_cycle_t *cycle, ngx_iouring_conf_t *iocf)
+{
+    uint32_t                i;
+    ngx_uint_t              features;
+    struct io_uring_params  p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    /* a completion queue is sized for the events of all submitted polls */
+
+    p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    p.cq_entries = 4 * iocf->entries;
+
+    ring_fd = io_uring_setup(iocf->entries, &p);
+
+    if (ring_fd == -1) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    features = IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG;
+
+    if ((p.features & features) != features) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "io_uring features %08XD are not supported",
+                      (uint32_t) (features & ~p.features));
+        return NGX_ERROR;
+    }
+
+    ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring.cq_ring_size = p.cq_off.cqes
+                        + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.sq_ring_size = ngx_max(ring.sq_ring_size, ring.cq_ring_size);
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+
+    if (ring.sq_ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        ring.sq_ring = NULL;
+        return NGX_ERROR;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+
+    } else {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ|PROT_WRITE,
+                            MAP_SHARED|MAP_POPULATE, ring_fd,
+                            IORING_OFF_CQ_RING);
+
+        if (ring.cq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            ring.cq_ring = NULL;
+            return NGX_ERROR;
+        }
+    }
+
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+    if (ring.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        ring.sqes = NULL;
+        return NGX_ERROR;
+    }
+
+    ring.sq_head = (uint32_t *) (ring.sq_ring + p.sq_off.head);
+    ring.sq_tail = (uint32_t *) (ring.sq_ring + p.sq_off.tail);
+    ring.sq_mask = *(uint32_t *) (ring.sq_ring + p.sq_off.ring_mask);
+    ring.sq_entries = p.sq_entries;
+
+    ring.cq_head = (uint32_t *) (ring.cq_ring + p.cq_off.head);
+    ring.cq_tail = (uint32_t *) (ring.cq_ring + p.cq_off.tail);
+    ring.cq_mask = *(uint32_t *) (ring.cq_ring + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (ring.cq_ring + p.cq_off.cqes);
+
+    /* entries are always submitted in order, so the array is an identity */
+
+    for (i = 0; i < p.sq_entries; i++) {
+        ((uint32_t *) (ring.sq_ring + p.sq_off.array))[i] = i;
+    }
+
+    ring.tail = *ring.sq_tail;
+    ring.pending = 0;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   ring_fd, p.sq_entries, p.cq_entries);
+
+    if (ngx_iouring_probe(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_HAVE_EVENTFD)
+    if (ngx_iouring_notify_init(cycle->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+#endif
+
+    if (ring_io && ngx_iouring_buffers_init(cycle, iocf) != NGX_OK) {
+        ring_io = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_probe(ngx_cycle_t *cycle)
+{
+    size_t                  size;
+    ngx_int_t               rc;
+    ngx_uint_t              i, op;
+    struct io_uring_probe  *probe;
+
+    static ngx_uint_t  ops[] = {
+        IORING_OP_POLL_ADD,
+        IORING_OP_POLL_REMOVE,
+        IORING_OP_READ
+    };
+
+    static ngx_uint_t  io_ops[] = {
+        IORING_OP_NOP,
+        IORING_OP_ACCEPT,
+        IORING_OP_ASYNC_CANCEL,
+        IORING_OP_RECV,
+        IORING_OP_SEND,
+        IORING_OP_SENDMSG,
+        IORING_OP_PROVIDE_BUFFERS
+    };
+
+    size = sizeof(struct io_uring_probe)
+           + 256 * sizeof(struct io_uring_probe_op);
+
+    probe = ngx_calloc(size, cycle->log);
+    if (probe == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_OK;
+
+    if (io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == -1) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                      "io_uring_register(IORING_REGISTER_PROBE) failed");
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    for (i = 0; i < sizeof(ops) / sizeof(ngx_uint_t); i++) {
+        op = ops[i];
+
+        if (op > probe->last_op
+            || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring opcode %ui is not supported", op);
+            rc = NGX_ERROR;
+            goto done;
+        }
+    }
+
+    /* without the socket operations the sockets are only polled */
+
+    ring_io = 1;
+
+    for (i = 0; i < sizeof(io_ops) / sizeof(ngx_uint_t); i++) {
+        op = io_ops[i];
+
+        if (op > probe->last_op
+            || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring opcode %ui is not supported, "
+                          "sockets are read and written directly", op);
+            ring_io = 0;
+            break;
+        }
+    }
+
+done:
+
+    ngx_free(probe);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_iouring_buffers_init(ngx_cycle_t *cycle, ngx_iouring_conf_t *iocf)
+{
+    struct io_uring_sqe  *sqe;
+
+    /*
+     * a receive operation takes a buffer only when the data arrive,
+     * so the connections waiting for data do not hold the buffers
+     */
+
+    buffer_n = ngx_min(iocf->entries, 65535);
+
+    buffers = ngx_memalign(ngx_pagesize, buffer_n * NGX_IOURING_BUFFER_SIZE,
+                           cycle->log);
+    if (buffers == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe = ngx_iouring_get_sqe(cycle->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = buffer_n;
+    sqe->addr = (uintptr_t) buffers;
+    sqe->len = NGX_IOURING_BUFFER_SIZE;
+    sqe->off = 0;
+    sqe->buf_group = NGX_IOURING_BUFFER_GROUP;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify_init(ngx_log_t *log)
+{
+    uint32_t              head, tail;
+    struct io_uring_cqe  *cqe;
+    struct io_uring_sqe  *sqe;
+
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    ngx_memzero(&notify_event, sizeof(ngx_event_t));
+
+    notify_event.handler = ngx_iouring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = notify_fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = EPOLLIN;
+    sqe->user_data = (uintptr_t) &notify_event | NGX_IOURING_EVENT;
+
+    if (ngx_iouring_submit(0, 0, NULL, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the kernels before 5.13 reject multishot poll requests at once,
+     * while an eventfd is never ready at this point
+     */
+
+    head = *ring.cq_head;
+    tail = *ring.cq_tail;
+
+    ngx_memory_barrier();
+
+    if (head != tail) {
+        cqe = &ring.cqes[head & ring.cq_mask];
+
+        ngx_log_error(NGX_LOG_NOTICE, log, -cqe->res,
+                      "io_uring multishot poll failed");
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    ngx_iouring_op_t  *op;
+
+    ngx_iouring_close(cycle->log);
+
+    while (free_ops) {
+        op = free_ops;
+        free_ops = op->next;
+        ngx_free(op);
+    }
+
+    ngx_free(slots);
+
+    slots = NULL;
+    slot_n = 0;
+    connection_n = 0;
+    connections = NULL;
+}
+
+
+static void
+ngx_iouring_close(ngx_log_t *log)
+{
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1 && close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+
+    if (ring.sqes && munmap(ring.sqes, ring.sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(IORING_OFF_SQES) failed");
+    }
+
+    if (ring.cq_ring && ring.cq_ring != ring.sq_ring
+        && munmap(ring.cq_ring, ring.cq_ring_size) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(IORING_OFF_CQ_RING) failed");
+    }
+
+    if (ring.sq_ring && munmap(ring.sq_ring, ring.sq_ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(IORING_OFF_SQ_RING) failed");
+    }
+
+    if (ring_fd != -1 && close(ring_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ngx_memzero(&ring, sizeof(ngx_iouring_ring_t));
+
+    ring_fd = -1;
+    ring_io = 0;
+
+    if (buffers) {
+        ngx_free(buffers);
+        buffers = NULL;
+    }
+}
+
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (ring.tail - *ring.sq_head == ring.sq_entries) {
+
+        /* the submission queue is full, pass the entries to a kernel */
+
+        if (ngx_iouring_submit(0, 0, NULL, 0) != NGX_OK
+            || ring.tail - *ring.sq_head == ring.sq_entries)
+        {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    sqe = &ring.sqes[ring.tail & ring.sq_mask];
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    ring.tail++;
+    ring.pending++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_iouring_submit(ngx_uint_t min, ngx_uint_t flags, void *arg, size_t size)
+{
+    int  n;
+
+    ngx_memory_barrier();
+
+    *ring.sq_tail = ring.tail;
+
+    n = io_uring_enter(ring_fd, ring.pending, min, flags, arg, size);
+
+    if (n == -1) {
+        return NGX_ERROR;
+    }
+
+    ring.pending -= ngx_min((ngx_uint_t) n, ring.pending);
+
+    return NGX_OK;
+}
+
+
+static ngx_iouring_slot_t *
+ngx_iouring_slot(ngx_connection_t *c, ngx_uint_t alloc)
+{
+    ngx_uint_t           i;
+    ngx_iouring_slot_t  *slot, *free;
+
+    /*
+     * the connections are allocated after the module initialization,
+     * and the slots stay indexed as the connections of the worker cycle
+     * even if ngx_cycle is replaced by a reconfiguration
+     */
+
+    if (connections == NULL) {
+        connections = ngx_cycle->connections;
+    }
+
+    if (c >= connections && c < connections + connection_n) {
+        slot = &slots[c - connections];
+        slot->connection = c;
+        return slot;
+    }
+
+    free = NULL;
+
+    for (i = connection_n; i < slot_n; i++) {
+        slot = &slots[i];
+
+        if (slot->connection == c) {
+            return slot;
+        }
+
+        if (slot->connection == NULL && free == NULL) {
+            free = slot;
+        }
+    }
+
+    if (!alloc) {
+        return NULL;
+    }
+
+    if (free == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "io_uring: no spare slots for connection %p", c);
+        return NULL;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring spare slot %ui for fd:%d",
+                   free - slots, c->fd);
+
+    free->connection = c;
+    free->level = 0;
+
+    return free;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_add(ngx_connection_t *c, ngx_iouring_slot_t *slot,
+    uint32_t events)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    slot->generation++;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring poll add: fd:%d ev:%08XD gen:%uD level:%d",
+                   c->fd, events, slot->generation, slot->level);
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    events = (events << 16) | (events >> 16);
+#endif
+
+    /*
+     * a multishot poll reports only the state changes, similar to EPOLLET,
+     * while the level-triggered mode is emulated with a oneshot poll,
+     * which is armed again after each notification
+     */
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->len = slot->level ? 0 : IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = events;
+    sqe->user_data = (uint64_t) slot->generation << 32
+                     | (uint64_t) (slot - slots) << 2
+                     | NGX_IOURING_POLL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_remove(ngx_connection_t *c, ngx_iouring_slot_t *slot)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring poll remove: fd:%d gen:%uD",
+                   c->fd, slot->generation);
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) slot->generation << 32
+                | (uint64_t) (slot - slots) << 2
+                | NGX_IOURING_POLL;
+    sqe->user_data = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t             events, prev;
+    ngx_event_t         *e;
+    ngx_connection_t    *c;
+    ngx_iouring_slot_t  *slot;
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+        events = EPOLLIN|EPOLLRDHUP;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN|EPOLLRDHUP;
+        events = EPOLLOUT;
+    }
+
+    slot = ngx_iouring_slot(c, 1);
+    if (slot == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the poll request is replaced, as there is no way to modify it */
+
+    if (e->active || ev->active) {
+        if (ngx_iouring_poll_remove(c, slot) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (e->active) {
+        events |= prev;
+
+    } else {
+        slot->level = (flags & NGX_CLEAR_EVENT) ? 0 : 1;
+    }
+
+    if (ngx_iouring_poll_add(c, slot, events) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t             prev;
+    ngx_event_t         *e;
+    ngx_connection_t    *c;
+    ngx_iouring_slot_t  *slot;
+
+    /*
+     * unlike epoll, the poll request holds a reference to the file,
+     * so it has to be removed even before the closing the file descriptor
+     */
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN|EPOLLRDHUP;
+    }
+
+    slot = ngx_iouring_slot(c, 1);
+    if (slot == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_iouring_poll_remove(c, slot) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (event == NGX_READ_EVENT
+        && slot->read && slot->read->type == NGX_IOURING_ACCEPT)
+    {
+        /* the accept events are disabled or the listening socket closed */
+
+        ngx_iouring_release_op(slot->read, c->log);
+        slot->read = NULL;
+    }
+
+    if (e->active && !(flags & NGX_CLOSE_EVENT)) {
+        if (ngx_iouring_poll_add(c, slot, prev) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    ev->active = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_add_connection(ngx_connection_t *c)
+{
+    ngx_iouring_slot_t  *slot;
+
+    slot = ngx_iouring_slot(c, 1);
+    if (slot == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (c->read->active || c->write->active) {
+        if (ngx_iouring_poll_remove(c, slot) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    slot->level = 0;
+
+    if (ngx_iouring_poll_add(c, slot, EPOLLIN|EPOLLOUT|EPOLLRDHUP)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_iouring_slot_t  *slot;
+
+    if (c->read->active || c->write->active) {
+
+        slot = ngx_iouring_slot(c, 1);
+        if (slot == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_iouring_poll_remove(c, slot) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    if (flags & NGX_CLOSE_EVENT) {
+
+        slot = ngx_iouring_slot(c, 0);
+
+        if (slot == NULL) {
+            return NGX_OK;
+        }
+
+        if (slot->read) {
+            ngx_iouring_release_op(slot->read, c->log);
+            slot->read = NULL;
+        }
+
+        if (slot->write) {
+            ngx_iouring_release_op(slot->write, c->log);
+            slot->write = NULL;
+        }
+
+        /* release a spare slot, the pending completions become stale */
+
+        if (slot - slots >= (ngx_int_t) connection_n) {
+            slot->connection = NULL;
+            slot->generation++;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int32_t                         res;
+    uint32_t                        head, tail, cflags;
+    uint64_t                        data;
+    ngx_err_t                       err;
+    ngx_uint_t                      level;
+    struct timespec                 ts;
+    struct io_uring_cqe            *cqe;
+    struct io_uring_getevents_arg   arg;
+
+    /* NGX_TIMER_INFINITE is passed as no timeout */
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M, submit: %ui", timer, ring.pending);
+
+    /*
+     * the changes are submitted and the events are waited for
+     * in a single syscall
+     */
+
+    err = 0;
+
+    if (ngx_iouring_submit(timer ? 1 : 0,
+                           IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                           &arg, sizeof(struct io_uring_getevents_arg))
+        != NGX_OK)
+    {
+        err = ngx_errno;
+    }
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else if (err == ETIME || err == NGX_EAGAIN || err == EBUSY) {
+
+            /* timed out or completions are to be reaped first */
+
+            level = 0;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        if (level) {
+            ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    head = *ring.cq_head;
+    tail = *ring.cq_tail;
+
+    ngx_memory_barrier();
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring events: %uD", tail - head);
+
+    while (head != tail) {
+        cqe = &ring.cqes[head & ring.cq_mask];
+
+        data = cqe->user_data;
+        res = cqe->res;
+        cflags = cqe->flags;
+
+        ngx_memory_barrier();
+
+        *ring.cq_head = ++head;
+
+        switch (data & NGX_IOURING_TAG) {
+
+        case NGX_IOURING_POLL:
+            ngx_iouring_poll_event(cycle, data, res, cflags, flags);
+            break;
+
+        case NGX_IOURING_EVENT:
+            ngx_iouring_event(cycle, data, res, cflags, flags);
+            break;
+
+        case NGX_IOURING_IO:
+            ngx_iouring_io_event(cycle, data, res, cflags, flags);
+            break;
+
+        default:
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: ignored %uL res:%D", data, res);
+            break;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_poll_event(ngx_cycle_t *cycle, uint64_t data, int32_t res,
+    uint32_t cflags, ngx_uint_t flags)
+{
+    uint32_t             revents;
+    ngx_uint_t           n;
+    ngx_event_t         *rev, *wev;
+    ngx_queue_t         *queue;
+    ngx_connection_t    *c;
+    ngx_iouring_slot_t  *slot;
+
+    n = (data & 0xffffffff) >> 2;
+
+    if (n >= slot_n
+        || slots[n].connection == NULL
+        || slots[n].generation != (uint32_t) (data >> 32))
+    {
+
+        /* the stale event of a removed or replaced poll request */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: stale event %uL res:%D", data, res);
+        return;
+    }
+
+    slot = &slots[n];
+    c = slot->connection;
+
+    rev = c->read;
+    wev = c->write;
+
+    if (c->fd == -1 || res == -ECANCELED) {
+        return;
+    }
+
+    if (res < 0) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                      "io_uring poll failed on fd:%d", c->fd);
+
+        revents = EPOLLERR;
+
+    } else {
+        revents = (uint32_t) res;
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+        revents = (revents << 16) | (revents >> 16);
+#endif
+
+        if (!(cflags & IORING_CQE_F_MORE) && (rev->active || wev->active)) {
+
+            /* a oneshot poll or a terminated multishot poll */
+
+            (void) ngx_iouring_poll_add(c, slot,
+                                        (rev->active ? EPOLLIN|EPOLLRDHUP : 0)
+                                        | (wev->active ? EPOLLOUT : 0));
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d ev:%04XD fl:%04XD",
+                   c->fd, revents, cflags);
+
+    if (revents & (EPOLLERR|EPOLLHUP)) {
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring poll error on fd:%d ev:%04XD",
+                       c->fd, revents);
+
+        /*
+         * if the error events were returned, add EPOLLIN and EPOLLOUT
+         * to handle the events at least in one active handler
+         */
+
+        revents |= EPOLLIN|EPOLLOUT;
+    }
+
+    /*
+     * while a socket operation is in progress, its completion
+     * reports the event instead
+     */
+
+    if ((revents & EPOLLIN) && rev->active
+        && !(slot->read && slot->read->active))
+    {
+
+        if (revents & EPOLLRDHUP) {
+            rev->pending_eof = 1;
+        }
+
+        rev->ready = 1;
+        rev->available = -1;
+
+        if (flags & NGX_POST_EVENTS) {
+            queue = rev->accept ? &ngx_posted_accept_events
+                                : &ngx_posted_events;
+
+            ngx_post_event(rev, queue);
+
+        } else {
+            rev->handler(rev);
+        }
+    }
+
+    if ((revents & EPOLLOUT) && wev->active
+        && !(slot->write && slot->write->active))
+    {
+
+        if (c->fd == -1 || slot->generation != (uint32_t) (data >> 32)) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in the read handler
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            return;
+        }
+
+        wev->ready = 1;
+#if (NGX_THREADS)
+        wev->complete = 1;
+#endif
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(wev, &ngx_posted_events);
+
+        } else {
+            wev->handler(wev);
+        }
+    }
+}
+
+
+static void
+ngx_iouring_event(ngx_cycle_t *cycle, uint64_t data, int32_t res,
+    uint32_t cflags, ngx_uint_t flags)
+{
+    ngx_event_t          *ev;
+#if (NGX_HAVE_EVENTFD)
+    struct io_uring_sqe  *sqe;
+#endif
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_aio_t      *aio;
+#endif
+
+    ev = (ngx_event_t *) (uintptr_t) (data & ~((uint64_t) NGX_IOURING_TAG));
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (ev == &notify_event) {
+
+        if (!(cflags & IORING_CQE_F_MORE) && res != -ECANCELED) {
+            sqe = ngx_iouring_get_sqe(cycle->log);
+
+            if (sqe) {
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = notify_fd;
+                sqe->len = IORING_POLL_ADD_MULTI;
+                sqe->poll32_events = EPOLLIN;
+                sqe->user_data = data;
+            }
+        }
+
+        if (res < 0) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                          "io_uring poll failed on eventfd %d", notify_fd);
+            return;
+        }
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(ev, &ngx_posted_events);
+
+        } else {
+            ev->handler(ev);
+        }
+
+        return;
+    }
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring aio event: %p res:%D", ev, res);
+
+    ev->complete = 1;
+    ev->active = 0;
+    ev->ready = 1;
+
+    aio = ev->data;
+    aio->res = res;
+
+    ngx_post_event(ev, &ngx_posted_events);
+
+#endif
+}
+
+
+static void
+ngx_iouring_io_event(ngx_cycle_t *cycle, uint64_t data, int32_t res,
+    uint32_t cflags, ngx_uint_t flags)
+{
+    ngx_event_t       *ev;
+    ngx_queue_t       *queue;
+    ngx_connection_t  *c;
+    ngx_iouring_op_t  *op;
+
+    op = (ngx_iouring_op_t *)
+             (uintptr_t) (data & ~((uint64_t) NGX_IOURING_TAG));
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring io event: %p t:%d res:%D", op, op->type, res);
+
+    if (cflags & IORING_CQE_F_BUFFER) {
+        op->buffer = 1;
+        op->bid = cflags >> IORING_CQE_BUFFER_SHIFT;
+    }
+
+    c = op->connection;
+
+    if (c == NULL) {
+
+        /* the connection was closed while the operation was in progress */
+
+        op->active = 0;
+        op->done = 1;
+        op->res = res;
+
+        ngx_iouring_free_op(op, cycle->log);
+        return;
+    }
+
+    if (op->type == NGX_IOURING_SEND) {
+
+        if (!ngx_iouring_send_done(c, op, res)) {
+            return;
+        }
+
+        ev = c->write;
+        queue = &ngx_posted_events;
+
+    } else {
+        op->active = 0;
+
+        if (op->type == NGX_IOURING_RECV && res > 0 && op->buffer) {
+            op->pos = buffers + op->bid * NGX_IOURING_BUFFER_SIZE;
+            op->last = op->pos + res;
+
+        } else {
+            op->done = 1;
+            op->res = res;
+
+            if (op->buffer) {
+                ngx_iouring_provide_buffer(op->bid, cycle->log);
+                op->buffer = 0;
+            }
+        }
+
+        ev = c->read;
+
+        if (op->type == NGX_IOURING_RECV && res == 0) {
+            ev->pending_eof = 1;
+        }
+
+        ev->ready = 1;
+        ev->available = -1;
+
+        queue = ev->accept ? &ngx_posted_accept_events : &ngx_posted_events;
+    }
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(ev, queue);
+
+    } else {
+        ev->handler(ev);
+    }
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_iouring_aio_read(ngx_event_aio_t *aio, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(aio->event.log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = aio->fd;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t) &aio->event | NGX_IOURING_EVENT;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_iouring_op_t *
+ngx_iouring_get_op(ngx_connection_t *c, ngx_iouring_slot_t *slot,
+    ngx_uint_t type)
+{
+    ngx_iouring_op_t  *op;
+
+    op = (type == NGX_IOURING_SEND) ? slot->write : slot->read;
+
+    if (op) {
+        return op;
+    }
+
+    op = free_ops;
+
+    if (op) {
+        free_ops = op->next;
+
+    } else {
+        op = ngx_alloc(sizeof(ngx_iouring_op_t), c->log);
+        if (op == NULL) {
+            return NULL;
+        }
+    }
+
+    op->connection = c;
+    op->next = NULL;
+    op->res = 0;
+    op->size = 0;
+    op->pos = NULL;
+    op->last = NULL;
+    op->type = type;
+    op->active = 0;
+    op->done = 0;
+    op->buffer = 0;
+
+    if (type == NGX_IOURING_SEND) {
+        slot->write = op;
+
+    } else {
+        slot->read = op;
+    }
+
+    return op;
+}
+
+
+static void
+ngx_iouring_release_op(ngx_iouring_op_t *op, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (op->active) {
+
+        if ((int32_t) (op->sqe - *ring.sq_head) >= 0) {
+
+            /*
+             * the entry is not yet consumed by a kernel and may refer
+             * to the memory being freed, so it is turned into a no-op
+             */
+
+            sqe = &ring.sqes[op->sqe & ring.sq_mask];
+
+            ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_NOP;
+
+        } else {
+
+            /* the operation is freed on its completion */
+
+            op->connection = NULL;
+
+            if (op->type == NGX_IOURING_SEND) {
+                return;
+            }
+
+            sqe = ngx_iouring_get_sqe(log);
+
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = (uintptr_t) op | NGX_IOURING_IO;
+                sqe->user_data = 0;
+            }
+
+            return;
+        }
+    }
+
+    ngx_iouring_free_op(op, log);
+}
+
+
+static void
+ngx_iouring_free_op(ngx_iouring_op_t *op, ngx_log_t *log)
+{
+    if (op->type == NGX_IOURING_ACCEPT && op->done && op->res >= 0) {
+
+        /* a connection accepted when the accept events were disabled */
+
+        if (ngx_close_socket(op->res) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                          ngx_close_socket_n " %d failed", op->res);
+        }
+    }
+
+    if (op->buffer) {
+        ngx_iouring_provide_buffer(op->bid, log);
+    }
+
+    op->connection = NULL;
+    op->next = free_ops;
+
+    free_ops = op;
+}
+
+
+static void
+ngx_iouring_provide_buffer(ngx_uint_t bid, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uintptr_t) (buffers + bid * NGX_IOURING_BUFFER_SIZE);
+    sqe->len = NGX_IOURING_BUFFER_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = NGX_IOURING_BUFFER_GROUP;
+}
+
+
+ngx_socket_t
+ngx_iouring_accept(ngx_connection_t *lc, struct sockaddr *sockaddr,
+    socklen_t *socklen)
+{
+    ngx_err_t             err;
+    ngx_socket_t          s;
+    ngx_iouring_op_t     *op;
+    ngx_iouring_slot_t   *slot;
+    struct io_uring_sqe  *sqe;
+
+    slot = ngx_iouring_slot(lc, 1);
+
+    if (slot && slot->read) {
+        op = slot->read;
+
+        if (op->active) {
+            ngx_set_socket_errno(NGX_EAGAIN);
+            return (ngx_socket_t) -1;
+        }
+
+        if (op->done) {
+            op->done = 0;
+
+            if (op->res < 0) {
+                ngx_set_socket_errno(-op->res);
+                return (ngx_socket_t) -1;
+            }
+
+            ngx_memcpy(sockaddr, &op->sockaddr,
+                       ngx_min(*socklen, op->socklen));
+            *socklen = op->socklen;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, lc->log, 0,
+                           "io_uring accept: fd:%d %d", lc->fd, op->res);
+
+            return op->res;
+        }
+    }
+
+    s = accept4(lc->fd, sockaddr, socklen, SOCK_NONBLOCK);
+
+    if (s != (ngx_socket_t) -1 || slot == NULL) {
+        return s;
+    }
+
+    err = ngx_socket_errno;
+
+    if (err != NGX_EAGAIN) {
+        return s;
+    }
+
+    /*
+     * instead of waiting for a poll notification to accept a connection,
+     * the connection is accepted with a single operation when it arrives
+     */
+
+    op = ngx_iouring_get_op(lc, slot, NGX_IOURING_ACCEPT);
+
+    if (op) {
+        sqe = ngx_iouring_get_sqe(lc->log);
+
+        if (sqe) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, lc->log, 0,
+                           "io_uring accept: fd:%d", lc->fd);
+
+            op->socklen = sizeof(ngx_sockaddr_t);
+
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = lc->fd;
+            sqe->addr = (uintptr_t) &op->sockaddr;
+            sqe->addr2 = (uintptr_t) &op->socklen;
+            sqe->accept_flags = SOCK_NONBLOCK;
+            sqe->user_data = (uintptr_t) op | NGX_IOURING_IO;
+
+            op->sqe = ring.tail - 1;
+            op->active = 1;
+        }
+    }
+
+    ngx_set_socket_errno(err);
+
+    return s;
+}
+
+
+static ssize_t
+ngx_iouring_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t              n;
+    ngx_iouring_op_t    *op;
+    ngx_iouring_slot_t  *slot;
+
+    slot = ngx_iouring_slot(c, 1);
+
+    if (slot && slot->read) {
+        op = slot->read;
+
+        if (op->pos < op->last) {
+            return ngx_iouring_recv_copy(op, buf, size, c->log);
+        }
+
+        n = ngx_iouring_recv_result(c, op);
+
+        if (n != NGX_DECLINED) {
+            return n;
+        }
+    }
+
+    n = ngx_os_io.recv(c, buf, size);
+
+    if (n == NGX_AGAIN && slot) {
+        ngx_iouring_recv_submit(c, slot, size);
+    }
+
+    return n;
+}
+
+
+static ssize_t
+ngx_iouring_recv_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    size_t               size;
+    ssize_t              n;
+    ngx_chain_t         *cl;
+    ngx_iouring_op_t    *op;
+    ngx_iouring_slot_t  *slot;
+
+    slot = ngx_iouring_slot(c, 1);
+
+    if (slot && slot->read) {
+        op = slot->read;
+
+        if (op->pos < op->last) {
+            n = 0;
+
+            for (cl = in; cl && op->pos < op->last; cl = cl->next) {
+                size = cl->buf->end - cl->buf->last;
+
+                if (limit) {
+                    if (n >= limit) {
+                        break;
+                    }
+
+                    if ((off_t) size > limit - n) {
+                        size = (size_t) (limit - n);
+                    }
+                }
+
+                n += ngx_iouring_recv_copy(op, cl->buf->last, size, c->log);
+            }
+
+            return n;
+        }
+
+        n = ngx_iouring_recv_result(c, op);
+
+        if (n != NGX_DECLINED) {
+            return n;
+        }
+    }
+
+    n = ngx_os_io.recv_chain(c, in, limit);
+
+    if (n == NGX_AGAIN && slot) {
+        size = 0;
+
+        for (cl = in; cl; cl = cl->next) {
+            size += cl->buf->end - cl->buf->last;
+        }
+
+        if (limit && (off_t) size > limit) {
+            size = (size_t) limit;
+        }
+
+        ngx_iouring_recv_submit(c, slot, size);
+    }
+
+    return n;
+}
+
+
+static ssize_t
+ngx_iouring_recv_result(ngx_connection_t *c, ngx_iouring_op_t *op)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_event_t  *rev;
+
+    rev = c->read;
+
+    if (op->active) {
+        rev->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (!op->done) {
+        return NGX_DECLINED;
+    }
+
+    op->done = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv: fd:%d %D", c->fd, op->res);
+
+    if (op->res == 0) {
+        rev->ready = 0;
+        rev->eof = 1;
+        return 0;
+    }
+
+    err = -op->res;
+
+    if (err == NGX_EAGAIN || err == NGX_EINTR || err == ENOBUFS) {
+
+        /* no buffers were left, the data are read directly */
+
+        return NGX_DECLINED;
+    }
+
+    n = ngx_connection_error(c, err, "recv() failed");
+
+    rev->ready = 0;
+
+    if (n == NGX_ERROR) {
+        rev->error = 1;
+    }
+
+    return n;
+}
+
+
+static size_t
+ngx_iouring_recv_copy(ngx_iouring_op_t *op, u_char *buf, size_t size,
+    ngx_log_t *log)
+{
+    size = ngx_min(size, (size_t) (op->last - op->pos));
+
+    ngx_memcpy(buf, op->pos, size);
+    op->pos += size;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring recv: %uz, left:%uz",
+                   size, (size_t) (op->last - op->pos));
+
+    /* the event stays ready, as with the greedy events */
+
+    if (op->pos == op->last) {
+        ngx_iouring_provide_buffer(op->bid, log);
+
+        op->buffer = 0;
+        op->pos = NULL;
+        op->last = NULL;
+    }
+
+    return size;
+}
+
+
+static void
+ngx_iouring_recv_submit(ngx_connection_t *c, ngx_iouring_slot_t *slot,
+    size_t size)
+{
+    ngx_iouring_op_t     *op;
+    struct io_uring_sqe  *sqe;
+
+    /*
+     * instead of waiting for a poll notification to read the data,
+     * the data are received with a single operation when they arrive
+     */
+
+    if (size == 0) {
+        return;
+    }
+
+    op = ngx_iouring_get_op(c, slot, NGX_IOURING_RECV);
+    if (op == NULL) {
+        return;
+    }
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return;
+    }
+
+    size = ngx_min(size, NGX_IOURING_BUFFER_SIZE);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv submit: fd:%d %uz", c->fd, size);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->len = size;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = NGX_IOURING_BUFFER_GROUP;
+    sqe->user_data = (uintptr_t) op | NGX_IOURING_IO;
+
+    op->sqe = ring.tail - 1;
+    op->active = 1;
+}
+
+
+static ssize_t
+ngx_iouring_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t               n;
+    uint32_t              head, tail;
+    uint64_t              data;
+    ngx_iouring_op_t     *op;
+    ngx_iouring_slot_t   *slot;
+    struct io_uring_cqe  *cqe;
+    struct io_uring_sqe  *sqe;
+
+    slot = ngx_iouring_slot(c, 1);
+    if (slot == NULL) {
+        return ngx_os_io.send(c, buf, size);
+    }
+
+    op = slot->write;
+
+    if (op) {
+        if (op->active) {
+            c->write->ready = 0;
+            return NGX_AGAIN;
+        }
+
+        if (op->done) {
+            n = ngx_iouring_send_result(c, op, buf);
+
+            if (n != NGX_DECLINED) {
+                return n;
+            }
+        }
+    }
+
+    op = ngx_iouring_get_op(c, slot, NGX_IOURING_SEND);
+    if (op == NULL) {
+        return ngx_os_io.send(c, buf, size);
+    }
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return ngx_os_io.send(c, buf, size);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring send: fd:%d %uz", c->fd, size);
+
+    data = (uintptr_t) op | NGX_IOURING_IO;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = size;
+    sqe->msg_flags = MSG_DONTWAIT;
+    sqe->user_data = data;
+
+    op->sqe = ring.tail - 1;
+    op->pos = buf;
+    op->size = size;
+    op->active = 1;
+
+    c->write->ready = 0;
+
+    /*
+     * unlike a chain, the data are submitted at once along with
+     * the queued entries, as the callers may expect short data to be
+     * sent in place; the send does not wait, so it is completed within
+     * io_uring_enter(), and its completion is taken out of order
+     */
+
+    if (ngx_iouring_submit(0, 0, NULL, 0) == NGX_OK) {
+
+        head = *ring.cq_head;
+        tail = *ring.cq_tail;
+
+        ngx_memory_barrier();
+
+        for ( /* void */ ; head != tail; head++) {
+            cqe = &ring.cqes[head & ring.cq_mask];
+
+            if (cqe->user_data == data) {
+                cqe->user_data = 0;
+                (void) ngx_iouring_send_done(c, op, cqe->res);
+                break;
+            }
+        }
+    }
+
+    if (op->active) {
+        return NGX_AGAIN;
+    }
+
+    n = ngx_iouring_send_result(c, op, buf);
+
+    return (n == NGX_DECLINED) ? NGX_AGAIN : n;
+}
+
+
+static ngx_chain_t *
+ngx_iouring_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    ssize_t               n;
+    ngx_chain_t          *cl;
+    ngx_iovec_t           vec;
+    ngx_event_t          *wev;
+    ngx_iouring_op_t     *op;
+    ngx_iouring_slot_t   *slot;
+    struct io_uring_sqe  *sqe;
+
+    wev = c->write;
+
+    slot = ngx_iouring_slot(c, 1);
+    if (slot == NULL) {
+        return ngx_os_io.send_chain(c, in, limit);
+    }
+
+    op = slot->write;
+
+    if (op) {
+        if (op->active) {
+            wev->ready = 0;
+            return in;
+        }
+
+        if (op->done) {
+
+            /*
+             * the result of the previous call, which returned the chain
+             * unchanged and is called again with it
+             */
+
+            for (cl = in; cl && ngx_buf_special(cl->buf); cl = cl->next) {
+                /* void */
+            }
+
+            n = ngx_iouring_send_result(c, op, cl ? cl->buf->pos : NULL);
+
+            if (n == NGX_ERROR) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (n > 0) {
+                in = ngx_chain_update_sent(in, n);
+            }
+        }
+    }
+
+    if (!wev->ready || in == NULL) {
+        return in;
+    }
+
+    /* the files are sent with sendfile() as usual */
+
+    for (cl = in; cl; cl = cl->next) {
+        if (cl->buf->in_file) {
+            return ngx_os_io.send_chain(c, in, limit);
+        }
+    }
+
+    /* the maximum limit size is the maximum size_t value - the page size */
+
+    if (limit == 0 || limit > (off_t) (NGX_MAX_SIZE_T_VALUE - ngx_pagesize)) {
+        limit = NGX_MAX_SIZE_T_VALUE - ngx_pagesize;
+    }
+
+    op = ngx_iouring_get_op(c, slot, NGX_IOURING_SEND);
+    if (op == NULL) {
+        return ngx_os_io.send_chain(c, in, limit);
+    }
+
+    vec.iovs = op->iovs;
+    vec.nalloc = NGX_IOVS_PREALLOCATE;
+
+    cl = ngx_output_chain_to_iovec(&vec, in, limit, c->log);
+
+    if (cl == NGX_CHAIN_ERROR) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (vec.size == 0) {
+        return ngx_chain_update_sent(in, 0);
+    }
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return ngx_os_io.send_chain(c, in, limit);
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring sendmsg: fd:%d %uz in %ui",
+                   c->fd, vec.size, vec.count);
+
+    ngx_memzero(&op->msg, sizeof(struct msghdr));
+
+    op->msg.msg_iov = op->iovs;
+    op->msg.msg_iovlen = vec.count;
+
+    /*
+     * the send is submitted with the next io_uring_enter() along with
+     * the other entries, and its result is returned by the next call
+     * with the same chain, when the completion posts the write event
+     */
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t) &op->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT;
+    sqe->user_data = (uintptr_t) op | NGX_IOURING_IO;
+
+    op->sqe = ring.tail - 1;
+    op->pos = op->iovs[0].iov_base;
+    op->size = vec.size;
+    op->active = 1;
+
+    wev->ready = 0;
+
+    return in;
+}
+
+
+static ngx_uint_t
+ngx_iouring_send_done(ngx_connection_t *c, ngx_iouring_op_t *op, int32_t res)
+{
+    op->active = 0;
+    op->done = 1;
+    op->res = res;
+
+    /*
+     * a short send leaves the event not ready, as the socket buffer is
+     * full and the poll request reports when the buffer is drained
+     */
+
+    if (res == -NGX_EAGAIN || (res >= 0 && (size_t) res < op->size)) {
+        return 0;
+    }
+
+    c->write->ready = 1;
+#if (NGX_THREADS)
+    c->write->complete = 1;
+#endif
+
+    return 1;
+}
+
+
+static ssize_t
+ngx_iouring_send_result(ngx_connection_t *c, ngx_iouring_op_t *op,
+    u_char *buf)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_event_t  *wev;
+
+    wev = c->write;
+
+    if (buf != op->pos) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "io_uring send of %p completed for %p", op->pos, buf);
+        wev->error = 1;
+        return NGX_ERROR;
+    }
+
+    op->done = 0;
+    n = op->res;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "send: fd:%d %z of %uz", c->fd, n, op->size);
+
+    if (n > 0) {
+        c->sent += n;
+        return n;
+    }
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0, "send() returned zero");
+        wev->ready = 0;
+        return n;
+    }
+
+    err = -n;
+
+    if (err == NGX_EAGAIN || err == NGX_EINTR) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err, "send() not ready");
+
+        /* the socket buffer may be drained since then */
+
+        return wev->ready ? NGX_DECLINED : NGX_AGAIN;
+    }
+
+    wev->error = 1;
+    (void) ngx_connection_error(c, err, "send() failed");
+
+    return NGX_ERROR;
+}
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iocf;
+
+    iocf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iocf == NULL) {
+        return NULL;
+    }
+
+    iocf->entries = NGX_CONF_UNSET;
+
+    return iocf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iocf = conf;
+
+    ngx_conf_init_uint_value(iocf->entries, 512);
+
+    return NGX_CONF_OK;
+}
@@ -23,6 +23,9 @@ extern ngx_module_t ngx_select_module;
 static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
+#if (NGX_STAT_STUB)
+static void ngx_event_stat_init(void);
+#endif
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -60,6 +63,8 @@ ngx_uint_t            ngx_use_exclusive_accept;
 
 #if (NGX_STAT_STUB)
 
+ngx_stat_t            ngx_stat_stub;
+
 static ngx_atomic_t   ngx_stat_accepted0;
 ngx_atomic_t         *ngx_stat_accepted = &ngx_stat_accepted0;
 static ngx_atomic_t   ngx_stat_handled0;
@@ -75,6 +80,26 @@ ngx_atomic_t         *ngx_stat_writing = &ngx_stat_writing0;
 static ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t         *ngx_stat_waiting = &ngx_stat_waiting0;
 
+#if (NGX_QUIC)
+static ngx_atomic_t   ngx_stat_quic_recv_batches0;
+ngx_atomic_t         *ngx_stat_quic_recv_batches =
+                                                 &ngx_stat_quic_recv_batches0;
+static ngx_atomic_t   ngx_stat_quic_recv_datagrams0;
+ngx_atomic_t         *ngx_stat_quic_recv_datagrams =
+                                               &ngx_stat_quic_recv_datagrams0;
+#endif
+
+#if (NGX_SSL)
+static ngx_atomic_t   ngx_stat_ssl_handshakes0;
+ngx_atomic_t         *ngx_stat_ssl_handshakes = &ngx_stat_ssl_handshakes0;
+static ngx_atomic_t   ngx_stat_ssl_handshakes_failed0;
+ngx_atomic_t         *ngx_stat_ssl_handshakes_failed =
+                                             &ngx_stat_ssl_handshakes_failed0;
+static ngx_atomic_t   ngx_stat_ssl_session_reuses0;
+ngx_atomic_t         *ngx_stat_ssl_session_reuses =
+                                                &ngx_stat_ssl_session_reuses0;
+#endif
+
 #endif
 
 
@@ -155,6 +180,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -557,19 +589,14 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #if (NGX_STAT_STUB)
 
-    size += cl           /* ngx_stat_accepted */
-           + cl          /* ngx_stat_handled */
-           + cl          /* ngx_stat_requests */
-           + cl          /* ngx_stat_active */
-           + cl          /* ngx_stat_reading */
-           + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+    size += ngx_stat_size(NGX_STAT_NCOUNTERS);
 
 #endif
 
     shm.size = size;
     ngx_str_set(&shm.name, "nginx_shared_zone");
     shm.log = cycle->log;
+    shm.hugepages = 0;
 
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -603,13 +630,8 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #if (NGX_STAT_STUB)
 
-    ngx_stat_accepted = (ngx_atomic_t *) (shared + 3 * cl);
-    ngx_stat_handled = (ngx_atomic_t *) (shared + 4 * cl);
-    ngx_stat_requests = (ngx_atomic_t *) (shared + 5 * cl);
-    ngx_stat_active = (ngx_atomic_t *) (shared + 6 * cl);
-    ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
-    ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
-    ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_init(&ngx_stat_stub, shared + 3 * cl, NGX_STAT_NCOUNTERS);
+    ngx_event_stat_init();
 
 #endif
 
@@ -632,6 +654,39 @@ ngx_timer_signal_handler(int signo)
 #endif
 
 
+#if (NGX_STAT_STUB)
+
+static void
+ngx_event_stat_init(void)
+{
+    ngx_stat_accepted = ngx_stat_counter(&ngx_stat_stub, NGX_STAT_ACCEPTED);
+    ngx_stat_handled = ngx_stat_counter(&ngx_stat_stub, NGX_STAT_HANDLED);
+    ngx_stat_requests = ngx_stat_counter(&ngx_stat_stub, NGX_STAT_REQUESTS);
+    ngx_stat_active = ngx_stat_counter(&ngx_stat_stub, NGX_STAT_ACTIVE);
+    ngx_stat_reading = ngx_stat_counter(&ngx_stat_stub, NGX_STAT_READING);
+    ngx_stat_writing = ngx_stat_counter(&ngx_stat_stub, NGX_STAT_WRITING);
+    ngx_stat_waiting = ngx_stat_counter(&ngx_stat_stub, NGX_STAT_WAITING);
+
+#if (NGX_QUIC)
+    ngx_stat_quic_recv_batches = ngx_stat_counter(&ngx_stat_stub,
+                                                NGX_STAT_QUIC_RECV_BATCHES);
+    ngx_stat_quic_recv_datagrams = ngx_stat_counter(&ngx_stat_stub,
+                                                NGX_STAT_QUIC_RECV_DATAGRAMS);
+#endif
+
+#if (NGX_SSL)
+    ngx_stat_ssl_handshakes = ngx_stat_counter(&ngx_stat_stub,
+                                               NGX_STAT_SSL_HANDSHAKES);
+    ngx_stat_ssl_handshakes_failed = ngx_stat_counter(&ngx_stat_stub,
+                                                NGX_STAT_SSL_HANDSHAKES_FAILED);
+    ngx_stat_ssl_session_reuses = ngx_stat_counter(&ngx_stat_stub,
+                                                NGX_STAT_SSL_SESSION_REUSES);
+#endif
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_event_process_init(ngx_cycle_t *cycle)
 {
@@ -668,10 +723,18 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
     ngx_use_exclusive_accept = 0;
 
+    ngx_stat_set_shard(ngx_worker);
+
+#if (NGX_STAT_STUB)
+    ngx_event_stat_init();
+#endif
+
     ngx_queue_init(&ngx_posted_accept_events);
     ngx_queue_init(&ngx_posted_next_events);
     ngx_queue_init(&ngx_posted_events);
 
+    ngx_use_timer_wheel = ecf->timer_wheel;
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
@@ -1269,6 +1332,7 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1368,6 +1432,7 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 0);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_value(ecf->timer_wheel, 0);
 
     return NGX_CONF_OK;
 }
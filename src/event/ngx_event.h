@@ -267,6 +267,17 @@ extern ngx_uint_t            ngx_use_epoll_rdhup;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter is io_uring, it also posts file aio operations.
+ */
+#define NGX_USE_IOURING_EVENT    0x00004000
+
+/*
+ * The event filter also accepts connections, receives and sends data
+ * with the io_uring operations.
+ */
+#define NGX_USE_IOURING_IO       0x00008000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -435,6 +446,8 @@ typedef struct {
 
     ngx_msec_t    accept_mutex_delay;
 
+    ngx_flag_t    timer_wheel;
+
     u_char       *name;
 
 #if (NGX_DEBUG)
@@ -467,6 +480,29 @@ extern ngx_uint_t             ngx_use_exclusive_accept;
 
 #if (NGX_STAT_STUB)
 
+#define NGX_STAT_ACCEPTED               0
+#define NGX_STAT_HANDLED                1
+#define NGX_STAT_REQUESTS               2
+#define NGX_STAT_ACTIVE                 3
+#define NGX_STAT_READING                4
+#define NGX_STAT_WRITING                5
+#define NGX_STAT_WAITING                6
+#define NGX_STAT_QUIC_RECV_BATCHES      7
+#define NGX_STAT_QUIC_RECV_DATAGRAMS    8
+#define NGX_STAT_SSL_HANDSHAKES         9
+#define NGX_STAT_SSL_HANDSHAKES_FAILED  10
+#define NGX_STAT_SSL_SESSION_REUSES     11
+
+#define NGX_STAT_NCOUNTERS              12
+
+
+#define ngx_stat_stub_value(i)  ngx_stat_value(&ngx_stat_stub, i)
+
+
+extern ngx_stat_t     ngx_stat_stub;
+
+/* counters of the current worker process shard */
+
 extern ngx_atomic_t  *ngx_stat_accepted;
 extern ngx_atomic_t  *ngx_stat_handled;
 extern ngx_atomic_t  *ngx_stat_requests;
@@ -475,6 +511,17 @@ extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
 
+#if (NGX_QUIC)
+extern ngx_atomic_t  *ngx_stat_quic_recv_batches;
+extern ngx_atomic_t  *ngx_stat_quic_recv_datagrams;
+#endif
+
+#if (NGX_SSL)
+extern ngx_atomic_t  *ngx_stat_ssl_handshakes;
+extern ngx_atomic_t  *ngx_stat_ssl_handshakes_failed;
+extern ngx_atomic_t  *ngx_stat_ssl_session_reuses;
+#endif
+
 #endif
 
 
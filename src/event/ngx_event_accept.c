@@ -10,6 +10,12 @@
 #include <ngx_event.h>
 
 
+#if (NGX_HAVE_IOURING)
+ngx_socket_t ngx_iouring_accept(ngx_connection_t *lc,
+    struct sockaddr *sockaddr, socklen_t *socklen);
+#endif
+
+
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
 #if (NGX_HAVE_EPOLLEXCLUSIVE)
 static void ngx_reorder_accept_events(ngx_listening_t *ls);
@@ -60,7 +66,16 @@ ngx_event_accept(ngx_event_t *ev)
 
 #if (NGX_HAVE_ACCEPT4)
         if (use_accept4) {
+#if (NGX_HAVE_IOURING)
+            if (ngx_event_flags & NGX_USE_IOURING_IO) {
+                s = ngx_iouring_accept(lc, &sa.sockaddr, &socklen);
+
+            } else {
+                s = accept4(lc->fd, &sa.sockaddr, &socklen, SOCK_NONBLOCK);
+            }
+#else
             s = accept4(lc->fd, &sa.sockaddr, &socklen, SOCK_NONBLOCK);
+#endif
         } else {
             s = accept(lc->fd, &sa.sockaddr, &socklen);
         }
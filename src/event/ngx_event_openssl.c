@@ -2234,6 +2234,16 @@ ngx_ssl_handshake(ngx_connection_t *c)
         ngx_ssl_handshake_log(c);
 #endif
 
+#if (NGX_STAT_STUB)
+        if (SSL_is_server(c->ssl->connection)) {
+            (void) ngx_atomic_fetch_add(ngx_stat_ssl_handshakes, 1);
+
+            if (SSL_session_reused(c->ssl->connection)) {
+                (void) ngx_atomic_fetch_add(ngx_stat_ssl_session_reuses, 1);
+            }
+        }
+#endif
+
         c->recv = ngx_ssl_recv;
         c->send = ngx_ssl_write;
         c->recv_chain = ngx_ssl_recv_chain;
@@ -2323,6 +2333,12 @@ ngx_ssl_handshake(ngx_connection_t *c)
     c->ssl->no_send_shutdown = 1;
     c->read->eof = 1;
 
+#if (NGX_STAT_STUB)
+    if (SSL_is_server(c->ssl->connection)) {
+        (void) ngx_atomic_fetch_add(ngx_stat_ssl_handshakes_failed, 1);
+    }
+#endif
+
     if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
         ngx_connection_error(c, err,
                              "peer closed connection in SSL handshake");
@@ -2384,6 +2400,16 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
         ngx_ssl_handshake_log(c);
 #endif
 
+#if (NGX_STAT_STUB)
+        if (SSL_is_server(c->ssl->connection)) {
+            (void) ngx_atomic_fetch_add(ngx_stat_ssl_handshakes, 1);
+
+            if (SSL_session_reused(c->ssl->connection)) {
+                (void) ngx_atomic_fetch_add(ngx_stat_ssl_session_reuses, 1);
+            }
+        }
+#endif
+
         c->ssl->try_early_data = 0;
 
         c->ssl->early_buf = buf;
@@ -2470,6 +2496,12 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
     c->ssl->no_send_shutdown = 1;
     c->read->eof = 1;
 
+#if (NGX_STAT_STUB)
+    if (SSL_is_server(c->ssl->connection)) {
+        (void) ngx_atomic_fetch_add(ngx_stat_ssl_handshakes_failed, 1);
+    }
+#endif
+
     if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
         ngx_connection_error(c, err,
                              "peer closed connection in SSL handshake");
@@ -10,9 +10,59 @@
 #include <ngx_event.h>
 
 
+/*
+ * the hierarchical timer wheel has 5 levels of 64 slots each, so timers
+ * up to 2^30 milliseconds (about 12 days) are placed exactly, and longer
+ * ones are placed in the farthest slot and are cascaded again later;
+ * ngx_msec_t is ngx_uint_t, so it wraps at 2^32 or at 2^64, and 2^30
+ * divides both, so slot indexes stay contiguous across either wrap
+ */
+
+#define NGX_TIMER_WHEEL_BITS    6
+#define NGX_TIMER_WHEEL_SIZE    (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SIZE - 1)
+#define NGX_TIMER_WHEEL_LEVELS  5
+#define NGX_TIMER_WHEEL_MAX                                                  \
+    ((ngx_msec_t) 1 << (NGX_TIMER_WHEEL_LEVELS * NGX_TIMER_WHEEL_BITS))
+
+#define ngx_timer_wheel_index(key, level)                                    \
+    (((key) >> ((level) * NGX_TIMER_WHEEL_BITS)) & NGX_TIMER_WHEEL_MASK)
+
+
+/*
+ * a timer in the wheel reuses its rbtree node: "left" and "right" link
+ * the node into a circular list, and "parent" points to the list head
+ */
+
+typedef struct {
+    ngx_msec_t                msec;
+    ngx_uint_t                count;
+    ngx_uint_t                expiring;
+    uint64_t                  map[NGX_TIMER_WHEEL_LEVELS];
+    ngx_rbtree_node_t         due;
+    ngx_rbtree_node_t         slots[NGX_TIMER_WHEEL_LEVELS]
+                                   [NGX_TIMER_WHEEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+static void ngx_event_timer_wheel_expire(void);
+static ngx_int_t ngx_event_timer_wheel_no_timers_left(void);
+static void ngx_event_timer_wheel_place(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_unlink(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_uint_t slot);
+static void ngx_event_timer_wheel_fire(ngx_rbtree_node_t *head);
+static ngx_uint_t ngx_event_timer_wheel_next(uint64_t map, ngx_uint_t slot);
+
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+ngx_uint_t                ngx_use_timer_wheel;
+
+static ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -22,9 +72,34 @@ static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t          i, n;
+    ngx_rbtree_node_t  *head;
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (!ngx_use_timer_wheel) {
+        return NGX_OK;
+    }
+
+    ngx_memzero(&ngx_event_timer_wheel, sizeof(ngx_event_timer_wheel_t));
+
+    ngx_event_timer_wheel.msec = ngx_current_msec;
+
+    head = &ngx_event_timer_wheel.due;
+    head->left = head;
+    head->right = head;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+            head = &ngx_event_timer_wheel.slots[i][n];
+            head->left = head;
+            head->right = head;
+        }
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, 0, "event timer wheel");
+
     return NGX_OK;
 }
 
@@ -35,6 +110,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_use_timer_wheel) {
+        return ngx_event_timer_wheel_find();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -56,6 +135,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_use_timer_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -102,6 +186,10 @@ ngx_event_no_timers_left(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_use_timer_wheel) {
+        return ngx_event_timer_wheel_no_timers_left();
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
 
@@ -124,3 +212,335 @@ ngx_event_no_timers_left(void)
 
     return NGX_OK;
 }
+
+
+void
+ngx_event_timer_wheel_add(ngx_rbtree_node_t *node)
+{
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    if (wheel->count++ == 0 && !wheel->expiring) {
+        /* do not walk over the time the wheel was empty */
+        wheel->msec = ngx_current_msec;
+    }
+
+    ngx_event_timer_wheel_place(node);
+}
+
+
+void
+ngx_event_timer_wheel_del(ngx_rbtree_node_t *node)
+{
+    ngx_event_timer_wheel_unlink(node);
+
+    ngx_event_timer_wheel.count--;
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    ngx_msec_t                msec, base;
+    ngx_uint_t                level, slot, next, shift, skip;
+    ngx_msec_int_t            timer, min;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    if (wheel->count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    if (wheel->due.right != &wheel->due) {
+        return 0;
+    }
+
+    msec = wheel->msec;
+    min = NGX_MAX_INT32_VALUE;
+
+    /*
+     * a level 0 slot holds timers of exactly one millisecond, while
+     * a slot of an upper level gives a lower bound of its timers only,
+     * that is, the moment the slot is cascaded down
+     */
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        if (wheel->map[level] == 0) {
+            continue;
+        }
+
+        shift = level * NGX_TIMER_WHEEL_BITS;
+        slot = ngx_timer_wheel_index(msec, level);
+
+        if (level == 0) {
+            next = ngx_event_timer_wheel_next(wheel->map[0], slot);
+            timer = (ngx_msec_int_t) (msec + next - ngx_current_msec);
+
+        } else {
+
+            /*
+             * the current slot is still to be cascaded only when
+             * the wheel stands exactly at the cascade boundary
+             */
+
+            skip = (msec & (((ngx_msec_t) 1 << shift) - 1)) ? 1 : 0;
+
+            next = ngx_event_timer_wheel_next(wheel->map[level],
+                                              (slot + skip)
+                                              & NGX_TIMER_WHEEL_MASK);
+            base = ((msec >> shift) + next + skip) << shift;
+            timer = (ngx_msec_int_t) (base - ngx_current_msec);
+        }
+
+        if (timer < min) {
+            min = timer;
+        }
+    }
+
+    return (ngx_msec_t) (min > 0 ? min : 0);
+}
+
+
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    ngx_uint_t                level, slot, next;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    wheel->expiring = 1;
+
+    for ( ;; ) {
+
+        ngx_event_timer_wheel_fire(&wheel->due);
+
+        if (wheel->count == 0) {
+            wheel->msec = ngx_current_msec + 1;
+            break;
+        }
+
+        if ((ngx_msec_int_t) (wheel->msec - ngx_current_msec) > 0) {
+            break;
+        }
+
+        slot = ngx_timer_wheel_index(wheel->msec, 0);
+
+        if (slot == 0) {
+            for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+                next = ngx_timer_wheel_index(wheel->msec, level);
+
+                ngx_event_timer_wheel_cascade(level, next);
+
+                if (next != 0) {
+                    break;
+                }
+            }
+        }
+
+        ngx_event_timer_wheel_fire(&wheel->slots[0][slot]);
+
+        /*
+         * skip empty slots up to the next occupied one,
+         * but do not step over the next cascade
+         */
+
+        next = ngx_event_timer_wheel_next(wheel->map[0], slot);
+
+        if (next == 0 || slot + next >= NGX_TIMER_WHEEL_SIZE) {
+            next = NGX_TIMER_WHEEL_SIZE - slot;
+        }
+
+        if ((ngx_msec_int_t) (wheel->msec + next - ngx_current_msec) > 0) {
+            next = ngx_current_msec + 1 - wheel->msec;
+        }
+
+        wheel->msec += next;
+    }
+
+    wheel->expiring = 0;
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_no_timers_left(void)
+{
+    ngx_uint_t          n;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *head, *node;
+
+    if (ngx_event_timer_wheel.count == 0) {
+        return NGX_OK;
+    }
+
+    for (n = 0; n <= NGX_TIMER_WHEEL_LEVELS * NGX_TIMER_WHEEL_SIZE; n++) {
+
+        head = (n == 0) ? &ngx_event_timer_wheel.due
+                        : &ngx_event_timer_wheel.slots[0][0] + n - 1;
+
+        for (node = head->right; node != head; node = node->right) {
+            ev = ngx_rbtree_data(node, ngx_event_t, timer);
+
+            if (!ev->cancelable) {
+                return NGX_AGAIN;
+            }
+        }
+    }
+
+    /* only cancelable timers left */
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_timer_wheel_place(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                n, level;
+    ngx_msec_t                key;
+    ngx_msec_int_t            delta;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = &ngx_event_timer_wheel;
+
+    key = node->key;
+    delta = (ngx_msec_int_t) (key - wheel->msec);
+
+    if (delta < 0) {
+        /* the slot has already been passed */
+        head = &wheel->due;
+        goto link;
+    }
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+        if ((ngx_msec_t) delta
+            < (ngx_msec_t) 1 << ((level + 1) * NGX_TIMER_WHEEL_BITS))
+        {
+            break;
+        }
+    }
+
+    if ((ngx_msec_t) delta >= NGX_TIMER_WHEEL_MAX) {
+        /* too far away, use the farthest slot and cascade it again */
+        key = wheel->msec + NGX_TIMER_WHEEL_MAX - 1;
+    }
+
+    n = ngx_timer_wheel_index(key, level);
+
+    head = &wheel->slots[level][n];
+    wheel->map[level] |= (uint64_t) 1 << n;
+
+link:
+
+    node->parent = head;
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+}
+
+
+static void
+ngx_event_timer_wheel_unlink(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          n;
+    ngx_rbtree_node_t  *head;
+
+    head = node->parent;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (head->right != head || head == &ngx_event_timer_wheel.due) {
+        return;
+    }
+
+    n = head - &ngx_event_timer_wheel.slots[0][0];
+
+    ngx_event_timer_wheel.map[n / NGX_TIMER_WHEEL_SIZE] &=
+                                 ~((uint64_t) 1 << (n % NGX_TIMER_WHEEL_SIZE));
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_uint_t slot)
+{
+    ngx_rbtree_node_t  *head, *node;
+
+    if (!(ngx_event_timer_wheel.map[level] & ((uint64_t) 1 << slot))) {
+        return;
+    }
+
+    head = &ngx_event_timer_wheel.slots[level][slot];
+
+    while (head->right != head) {
+        node = head->right;
+
+        ngx_event_timer_wheel_unlink(node);
+        ngx_event_timer_wheel_place(node);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_fire(ngx_rbtree_node_t *head)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node;
+
+    while (head->right != head) {
+        node = head->right;
+
+        ev = ngx_rbtree_data(node, ngx_event_t, timer);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_wheel_del(node);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->timedout = 1;
+
+        ev->handler(ev);
+    }
+}
+
+
+/*
+ * returns the distance from the slot to the next occupied slot,
+ * counting the slot itself as 0 and wrapping around the level
+ */
+
+static ngx_uint_t
+ngx_event_timer_wheel_next(uint64_t map, ngx_uint_t slot)
+{
+    uint64_t  bits;
+
+    static const u_char  index64[64] = {
+         0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+    };
+
+    bits = slot ? (map >> slot) | (map << (NGX_TIMER_WHEEL_SIZE - slot))
+                : map;
+
+    if (bits == 0) {
+        return 0;
+    }
+
+    return index64[((bits & (0 - bits)) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
@@ -312,12 +312,7 @@ ngx_quic_new_connection(ngx_connection_t *c, ngx_quic_conf_t *conf,
     qc->streams.client_max_streams_uni = qc->tp.initial_max_streams_uni;
     qc->streams.client_max_streams_bidi = qc->tp.initial_max_streams_bidi;
 
-    qc->congestion.window = ngx_min(10 * NGX_QUIC_MIN_INITIAL_SIZE,
-                                    ngx_max(2 * NGX_QUIC_MIN_INITIAL_SIZE,
-                                            14720));
-    qc->congestion.ssthresh = (size_t) -1;
-    qc->congestion.mtu = NGX_QUIC_MIN_INITIAL_SIZE;
-    qc->congestion.recovery_start = ngx_current_msec - 1;
+    ngx_quic_congestion_init(qc);
 
     qc->max_frames = (conf->max_concurrent_streams_uni
                       + conf->max_concurrent_streams_bidi)
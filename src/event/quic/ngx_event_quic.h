@@ -40,6 +40,9 @@
 
 #define NGX_QUIC_MIN_INITIAL_SIZE            1200
 
+#define NGX_QUIC_CC_CUBIC                    0
+#define NGX_QUIC_CC_BBR                      1
+
 #define NGX_QUIC_STREAM_SERVER_INITIATED     0x01
 #define NGX_QUIC_STREAM_UNIDIRECTIONAL       0x02
 
@@ -82,7 +85,9 @@ typedef struct {
 
     ngx_flag_t                     retry;
     ngx_flag_t                     gso_enabled;
+    ngx_flag_t                     sendmmsg_enabled;
     ngx_flag_t                     disable_active_migration;
+    ngx_uint_t                     congestion_control;
     ngx_msec_t                     handshake_timeout;
     ngx_msec_t                     idle_timeout;
     ngx_str_t                      host_key;
@@ -24,6 +24,10 @@
 #define NGX_QUIC_CUBIC_BETA                  7
 #define NGX_QUIC_CUBIC_C                     4
 
+/* pacing burst allowance */
+#define NGX_QUIC_PACING_BURST                10 /* packets */
+#define NGX_QUIC_PACING_QUANTUM              2  /* ms */
+
 
 /* send time of ACK'ed packets */
 typedef struct {
@@ -40,7 +44,10 @@ static void ngx_quic_rtt_sample(ngx_connection_t *c, ngx_quic_ack_frame_t *ack,
 static ngx_int_t ngx_quic_handle_ack_frame_range(ngx_connection_t *c,
     ngx_quic_send_ctx_t *ctx, uint64_t min, uint64_t max,
     ngx_quic_ack_stat_t *st);
+static void ngx_quic_cubic_init(ngx_quic_congestion_t *cg);
+static void ngx_quic_cubic_ack(ngx_connection_t *c, ngx_quic_frame_t *f);
 static size_t ngx_quic_congestion_cubic(ngx_connection_t *c);
+static void ngx_quic_cubic_idle(ngx_connection_t *c, ngx_uint_t idle);
 static void ngx_quic_drop_ack_ranges(ngx_connection_t *c,
     ngx_quic_send_ctx_t *ctx, uint64_t pn);
 static ngx_int_t ngx_quic_detect_lost(ngx_connection_t *c,
@@ -48,12 +55,29 @@ static ngx_int_t ngx_quic_detect_lost(ngx_connection_t *c,
 static ngx_msec_t ngx_quic_congestion_cubic_time(ngx_connection_t *c);
 static ngx_msec_t ngx_quic_pcg_duration(ngx_connection_t *c);
 static void ngx_quic_persistent_congestion(ngx_connection_t *c);
+static void ngx_quic_cubic_persistent(ngx_connection_t *c);
 static ngx_msec_t ngx_quic_oldest_sent_packet(ngx_connection_t *c);
 static void ngx_quic_congestion_lost(ngx_connection_t *c,
     ngx_quic_frame_t *frame);
+static void ngx_quic_cubic_lost(ngx_connection_t *c, ngx_quic_frame_t *f);
 static void ngx_quic_lost_handler(ngx_event_t *ev);
 
 
+static ngx_quic_congestion_ops_t  ngx_quic_cubic_ops = {
+    ngx_quic_cubic_init,
+    ngx_quic_cubic_ack,
+    ngx_quic_cubic_lost,
+    ngx_quic_cubic_idle,
+    ngx_quic_cubic_persistent
+};
+
+
+static ngx_quic_congestion_ops_t  *ngx_quic_congestion_ops[] = {
+    &ngx_quic_cubic_ops,                     /* NGX_QUIC_CC_CUBIC */
+    &ngx_quic_bbr_ops                        /* NGX_QUIC_CC_BBR */
+};
+
+
 /* RFC 9002, 6.1.2. Time Threshold: kTimeThreshold, kGranularity */
 static ngx_inline ngx_msec_t
 ngx_quic_time_threshold(ngx_quic_connection_t *qc)
@@ -341,12 +365,34 @@ ngx_quic_handle_ack_frame_range(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
 }
 
 
+void
+ngx_quic_congestion_init(ngx_quic_connection_t *qc)
+{
+    ngx_quic_congestion_t  *cg;
+
+    cg = &qc->congestion;
+
+    ngx_memzero(cg, sizeof(ngx_quic_congestion_t));
+
+    cg->ops = ngx_quic_congestion_ops[qc->conf->congestion_control];
+    cg->ops->init(cg);
+}
+
+
+static void
+ngx_quic_cubic_init(ngx_quic_congestion_t *cg)
+{
+    cg->window = NGX_QUIC_INITIAL_WINDOW;
+    cg->ssthresh = (size_t) -1;
+    cg->mtu = NGX_QUIC_MIN_INITIAL_SIZE;
+    cg->recovery_start = ngx_current_msec - 1;
+}
+
+
 void
 ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
 {
-    size_t                  w_cubic;
     ngx_uint_t              blocked;
-    ngx_msec_t              now, timer;
     ngx_quic_congestion_t  *cg;
     ngx_quic_connection_t  *qc;
 
@@ -361,12 +407,31 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
         return;
     }
 
-    now = ngx_current_msec;
-
     blocked = (cg->in_flight >= cg->window) ? 1 : 0;
 
     cg->in_flight -= f->plen;
 
+    cg->ops->ack(c, f);
+
+    if (blocked && cg->in_flight < cg->window) {
+        ngx_post_event(&qc->push, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_quic_cubic_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    size_t                  w_cubic;
+    ngx_msec_t              now, timer;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    now = ngx_current_msec;
+
     /* prevent recovery_start from wrapping */
 
     timer = now - cg->recovery_start;
@@ -382,7 +447,7 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion ack rec t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     if (cg->idle) {
@@ -390,7 +455,7 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion ack idle t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     if (cg->window < cg->ssthresh) {
@@ -442,12 +507,6 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
                            now, cg->window, w_cubic, cg->in_flight);
         }
     }
-
-done:
-
-    if (blocked && cg->in_flight < cg->window) {
-        ngx_post_event(&qc->push, &ngx_posted_events);
-    }
 }
 
 
@@ -462,7 +521,7 @@ ngx_quic_congestion_cubic(ngx_connection_t *c)
     qc = ngx_quic_get_connection(c);
     cg = &qc->congestion;
 
-    ngx_quic_congestion_idle(c, cg->idle);
+    ngx_quic_cubic_idle(c, cg->idle);
 
     now = ngx_current_msec;
     t = (ngx_msec_int_t) (now - cg->k);
@@ -506,16 +565,27 @@ done:
 void
 ngx_quic_congestion_idle(ngx_connection_t *c, ngx_uint_t idle)
 {
-    ngx_msec_t              now;
-    ngx_quic_congestion_t  *cg;
     ngx_quic_connection_t  *qc;
 
     qc = ngx_quic_get_connection(c);
-    cg = &qc->congestion;
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "quic congestion idle:%ui", idle);
 
+    qc->congestion.ops->idle(c, idle);
+}
+
+
+static void
+ngx_quic_cubic_idle(ngx_connection_t *c, ngx_uint_t idle)
+{
+    ngx_msec_t              now;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
     if (cg->window >= cg->ssthresh) {
         /* RFC 9438, 5.8. Behavior for Application-Limited Flows */
 
@@ -532,6 +602,69 @@ ngx_quic_congestion_idle(ngx_connection_t *c, ngx_uint_t idle)
 }
 
 
+ngx_msec_t
+ngx_quic_pacing_delay(ngx_connection_t *c, size_t size)
+{
+    size_t                  need;
+    uint64_t                burst, budget;
+    ngx_msec_t              now, elapsed;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    if (cg->pacing_rate == 0) {
+        return 0;
+    }
+
+    /* token bucket refilled at pacing rate, capped to a small burst */
+
+    now = ngx_current_msec;
+    elapsed = now - cg->pacing_time;
+    cg->pacing_time = now;
+
+    burst = ngx_max(NGX_QUIC_PACING_BURST * cg->mtu,
+                    cg->pacing_rate * NGX_QUIC_PACING_QUANTUM / 1000);
+
+    if (elapsed >= 1000) {
+        budget = burst;
+
+    } else {
+        budget = cg->pacing_budget + cg->pacing_rate * elapsed / 1000;
+    }
+
+    cg->pacing_budget = ngx_min(budget, burst);
+
+    need = size + cg->mtu;
+
+    if (cg->pacing_budget >= need) {
+        return 0;
+    }
+
+    return ((need - cg->pacing_budget) * 1000 + cg->pacing_rate - 1)
+           / cg->pacing_rate;
+}
+
+
+void
+ngx_quic_pacing_sent(ngx_connection_t *c, size_t size)
+{
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    if (cg->pacing_rate == 0) {
+        return;
+    }
+
+    cg->pacing_budget = (cg->pacing_budget > size)
+                        ? cg->pacing_budget - size : 0;
+}
+
+
 static void
 ngx_quic_drop_ack_ranges(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
     uint64_t pn)
@@ -714,9 +847,7 @@ ngx_quic_persistent_congestion(ngx_connection_t *c)
     qc = ngx_quic_get_connection(c);
     cg = &qc->congestion;
 
-    cg->mtu = qc->path->mtu;
-    cg->recovery_start = ngx_quic_oldest_sent_packet(c) - 1;
-    cg->window = cg->mtu * 2;
+    cg->ops->persistent(c);
 
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "quic congestion persistent t:%M win:%uz",
@@ -724,6 +855,21 @@ ngx_quic_persistent_congestion(ngx_connection_t *c)
 }
 
 
+static void
+ngx_quic_cubic_persistent(ngx_connection_t *c)
+{
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    cg->mtu = qc->path->mtu;
+    cg->recovery_start = ngx_quic_oldest_sent_packet(c) - 1;
+    cg->window = cg->mtu * 2;
+}
+
+
 static ngx_msec_t
 ngx_quic_oldest_sent_packet(ngx_connection_t *c)
 {
@@ -858,7 +1004,6 @@ static void
 ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
 {
     ngx_uint_t              blocked;
-    ngx_msec_t              now, timer;
     ngx_quic_congestion_t  *cg;
     ngx_quic_connection_t  *qc;
 
@@ -876,8 +1021,27 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
     blocked = (cg->in_flight >= cg->window) ? 1 : 0;
 
     cg->in_flight -= f->plen;
+
+    cg->ops->lost(c, f);
+
     f->plen = 0;
 
+    if (blocked && cg->in_flight < cg->window) {
+        ngx_post_event(&qc->push, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_quic_cubic_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    ngx_msec_t              now, timer;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
     timer = f->send_time - cg->recovery_start;
 
     now = ngx_current_msec;
@@ -887,7 +1051,7 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion lost rec t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     if (f->ignore_loss) {
@@ -895,7 +1059,7 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion lost ignore t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     /* RFC 9438, 4.6. Multiplicative Decrease */
@@ -915,12 +1079,6 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "quic congestion lost t:%M win:%uz if:%uz",
                    now, cg->window, cg->in_flight);
-
-done:
-
-    if (blocked && cg->in_flight < cg->window) {
-        ngx_post_event(&qc->push, &ngx_posted_events);
-    }
 }
 
 
@@ -12,12 +12,21 @@
 #include <ngx_core.h>
 
 
+/* RFC 9002, 7.2. Initial and Minimum Congestion Window */
+#define NGX_QUIC_INITIAL_WINDOW                                               \
+    ngx_min(10 * NGX_QUIC_MIN_INITIAL_SIZE,                                   \
+            ngx_max(2 * NGX_QUIC_MIN_INITIAL_SIZE, 14720))
+
+
 ngx_int_t ngx_quic_handle_ack_frame(ngx_connection_t *c,
     ngx_quic_header_t *pkt, ngx_quic_frame_t *f);
 
+void ngx_quic_congestion_init(ngx_quic_connection_t *qc);
 void ngx_quic_congestion_ack(ngx_connection_t *c,
     ngx_quic_frame_t *frame);
 void ngx_quic_congestion_idle(ngx_connection_t *c, ngx_uint_t idle);
+ngx_msec_t ngx_quic_pacing_delay(ngx_connection_t *c, size_t size);
+void ngx_quic_pacing_sent(ngx_connection_t *c, size_t size);
 void ngx_quic_resend_frames(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx);
 void ngx_quic_set_lost_timer(ngx_connection_t *c);
 void ngx_quic_pto_handler(ngx_event_t *ev);
@@ -0,0 +1,514 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_quic_connection.h>
+
+
+/*
+ * BBR congestion control, draft-cardwell-iccrg-bbr-congestion-control.
+ *
+ * The model is built from a windowed maximum of per-round delivery rate
+ * and a windowed minimum of RTT.  Loss response follows BBRv2: a round
+ * with loss rate above NGX_QUIC_BBR_LOSS_THRESH bounds the window with
+ * inflight_hi, which is then probed upwards again in PROBE_BW.
+ */
+
+
+#define NGX_QUIC_BBR_STARTUP                 0
+#define NGX_QUIC_BBR_DRAIN                   1
+#define NGX_QUIC_BBR_PROBE_BW                2
+#define NGX_QUIC_BBR_PROBE_RTT               3
+
+/* gains x100 */
+#define NGX_QUIC_BBR_HIGH_GAIN               277   /* 2 / ln(2) */
+#define NGX_QUIC_BBR_DRAIN_GAIN              36    /* 1 / high gain */
+#define NGX_QUIC_BBR_CWND_GAIN               200
+#define NGX_QUIC_BBR_PACING_MARGIN           99
+
+#define NGX_QUIC_BBR_FULL_BW_GROWTH          125
+#define NGX_QUIC_BBR_FULL_BW_ROUNDS          3
+
+#define NGX_QUIC_BBR_MIN_RTT_WIN             10000 /* ms */
+#define NGX_QUIC_BBR_PROBE_RTT_TIME          200   /* ms */
+
+/* percent */
+#define NGX_QUIC_BBR_LOSS_THRESH             2
+#define NGX_QUIC_BBR_BETA                    70
+
+#define NGX_QUIC_BBR_MIN_WINDOW(cg)          (4 * (cg)->mtu)
+
+
+static void ngx_quic_bbr_init(ngx_quic_congestion_t *cg);
+static void ngx_quic_bbr_ack(ngx_connection_t *c, ngx_quic_frame_t *f);
+static void ngx_quic_bbr_lost(ngx_connection_t *c, ngx_quic_frame_t *f);
+static void ngx_quic_bbr_idle(ngx_connection_t *c, ngx_uint_t idle);
+static void ngx_quic_bbr_persistent(ngx_connection_t *c);
+static void ngx_quic_bbr_enter(ngx_quic_congestion_t *cg, ngx_uint_t mode);
+static void ngx_quic_bbr_update_min_rtt(ngx_connection_t *c);
+static void ngx_quic_bbr_round(ngx_connection_t *c);
+static void ngx_quic_bbr_update_mode(ngx_connection_t *c);
+static size_t ngx_quic_bbr_bdp(ngx_quic_congestion_t *cg, ngx_uint_t gain);
+static void ngx_quic_bbr_set_window(ngx_connection_t *c, size_t acked);
+static void ngx_quic_bbr_set_pacing_rate(ngx_connection_t *c);
+
+
+ngx_quic_congestion_ops_t  ngx_quic_bbr_ops = {
+    ngx_quic_bbr_init,
+    ngx_quic_bbr_ack,
+    ngx_quic_bbr_lost,
+    ngx_quic_bbr_idle,
+    ngx_quic_bbr_persistent
+};
+
+
+/* PROBE_BW pacing gain cycle, x100 */
+static ngx_uint_t  ngx_quic_bbr_probe_gains[] = {
+    125, 75, 100, 100, 100, 100, 100, 100
+};
+
+#define NGX_QUIC_BBR_CYCLE_LEN                                                \
+    (sizeof(ngx_quic_bbr_probe_gains) / sizeof(ngx_uint_t))
+
+
+static void
+ngx_quic_bbr_init(ngx_quic_congestion_t *cg)
+{
+    ngx_quic_bbr_t  *bbr;
+
+    bbr = &cg->bbr;
+
+    cg->window = NGX_QUIC_INITIAL_WINDOW;
+    cg->ssthresh = (size_t) -1;
+    cg->mtu = NGX_QUIC_MIN_INITIAL_SIZE;
+    cg->recovery_start = ngx_current_msec - 1;
+
+    bbr->min_rtt = NGX_TIMER_INFINITE;
+    bbr->min_rtt_stamp = ngx_current_msec;
+    bbr->round_start = ngx_current_msec;
+
+    ngx_quic_bbr_enter(cg, NGX_QUIC_BBR_STARTUP);
+}
+
+
+static void
+ngx_quic_bbr_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    ngx_msec_t              now;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    now = ngx_current_msec;
+
+    cg->mtu = qc->path->mtu;
+    bbr->delivered += f->plen;
+
+    ngx_quic_bbr_update_min_rtt(c);
+
+    /* a round ends once a packet sent after its start is acknowledged */
+
+    if ((ngx_msec_int_t) (f->send_time - bbr->round_start) >= 0
+        && now != bbr->round_start)
+    {
+        ngx_quic_bbr_round(c);
+    }
+
+    ngx_quic_bbr_update_mode(c);
+    ngx_quic_bbr_set_window(c, f->plen);
+    ngx_quic_bbr_set_pacing_rate(c);
+
+    ngx_log_debug6(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic bbr ack t:%M mode:%ui bw:%uL win:%uz if:%uz pr:%uL",
+                   now, bbr->mode, bbr->bw, cg->window, cg->in_flight,
+                   cg->pacing_rate);
+}
+
+
+static void
+ngx_quic_bbr_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    size_t                  lost;
+    uint64_t                delivered;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    if (f->ignore_loss) {
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic bbr lost ignore t:%M win:%uz if:%uz",
+                       ngx_current_msec, cg->window, cg->in_flight);
+        return;
+    }
+
+    bbr->round_lost += f->plen;
+
+    lost = bbr->round_lost;
+    delivered = bbr->delivered - bbr->round_delivered;
+
+    if (bbr->loss_in_round
+        || lost * 100 <= (delivered + lost) * NGX_QUIC_BBR_LOSS_THRESH)
+    {
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic bbr lost t:%M win:%uz if:%uz",
+                       ngx_current_msec, cg->window, cg->in_flight);
+        return;
+    }
+
+    /* BBRv2: bound inflight below the level at which loss was observed */
+
+    bbr->loss_in_round = 1;
+
+    cg->mtu = qc->path->mtu;
+
+    bbr->inflight_hi = ngx_max((cg->in_flight + f->plen)
+                               * NGX_QUIC_BBR_BETA / 100,
+                               NGX_QUIC_BBR_MIN_WINDOW(cg));
+
+    cg->window = ngx_min(cg->window, bbr->inflight_hi);
+
+    if (bbr->mode == NGX_QUIC_BBR_STARTUP) {
+        bbr->full_bw_reached = 1;
+        ngx_quic_bbr_enter(cg, NGX_QUIC_BBR_DRAIN);
+
+    } else if (bbr->mode == NGX_QUIC_BBR_PROBE_BW && bbr->cycle == 0) {
+        /* stop probing up */
+        bbr->cycle = 1;
+        bbr->cycle_start = ngx_current_msec;
+        bbr->pacing_gain = ngx_quic_bbr_probe_gains[bbr->cycle];
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic bbr lost hi t:%M win:%uz hi:%uz if:%uz",
+                   ngx_current_msec, cg->window, bbr->inflight_hi,
+                   cg->in_flight);
+}
+
+
+static void
+ngx_quic_bbr_idle(ngx_connection_t *c, ngx_uint_t idle)
+{
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    /* rounds with idle periods provide application limited samples */
+
+    if (idle) {
+        cg->bbr.app_limited = 1;
+    }
+
+    cg->idle = idle;
+}
+
+
+static void
+ngx_quic_bbr_persistent(ngx_connection_t *c)
+{
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    cg->mtu = qc->path->mtu;
+    cg->window = NGX_QUIC_BBR_MIN_WINDOW(cg);
+}
+
+
+static void
+ngx_quic_bbr_enter(ngx_quic_congestion_t *cg, ngx_uint_t mode)
+{
+    ngx_quic_bbr_t  *bbr;
+
+    bbr = &cg->bbr;
+
+    bbr->mode = mode;
+
+    switch (mode) {
+
+    case NGX_QUIC_BBR_STARTUP:
+        bbr->pacing_gain = NGX_QUIC_BBR_HIGH_GAIN;
+        bbr->cwnd_gain = NGX_QUIC_BBR_CWND_GAIN;
+        break;
+
+    case NGX_QUIC_BBR_DRAIN:
+        bbr->pacing_gain = NGX_QUIC_BBR_DRAIN_GAIN;
+        bbr->cwnd_gain = NGX_QUIC_BBR_CWND_GAIN;
+        break;
+
+    case NGX_QUIC_BBR_PROBE_BW:
+
+        /* start cruising at a random phase to desynchronize flows */
+
+        bbr->cycle = 2 + ngx_random() % (NGX_QUIC_BBR_CYCLE_LEN - 2);
+        bbr->cycle_start = ngx_current_msec;
+        bbr->pacing_gain = ngx_quic_bbr_probe_gains[bbr->cycle];
+        bbr->cwnd_gain = NGX_QUIC_BBR_CWND_GAIN;
+        break;
+
+    default: /* NGX_QUIC_BBR_PROBE_RTT */
+        bbr->pacing_gain = 100;
+        bbr->cwnd_gain = 100;
+        bbr->probe_rtt_armed = 0;
+    }
+}
+
+
+static void
+ngx_quic_bbr_update_min_rtt(ngx_connection_t *c)
+{
+    ngx_msec_t              now;
+    ngx_uint_t              expired;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    if (qc->min_rtt == NGX_TIMER_INFINITE) {
+        /* no RTT samples yet */
+        return;
+    }
+
+    now = ngx_current_msec;
+
+    expired = (now - bbr->min_rtt_stamp > NGX_QUIC_BBR_MIN_RTT_WIN);
+
+    if (qc->latest_rtt <= bbr->min_rtt || expired) {
+        bbr->min_rtt = qc->latest_rtt;
+        bbr->min_rtt_stamp = now;
+    }
+
+    if (expired && bbr->mode != NGX_QUIC_BBR_PROBE_RTT && !cg->idle) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic bbr probe rtt t:%M", now);
+
+        ngx_quic_bbr_enter(cg, NGX_QUIC_BBR_PROBE_RTT);
+    }
+}
+
+
+static void
+ngx_quic_bbr_round(ngx_connection_t *c)
+{
+    uint64_t                bw;
+    ngx_uint_t              i;
+    ngx_msec_t              now, interval;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    now = ngx_current_msec;
+    interval = now - bbr->round_start;
+
+    bw = (bbr->delivered - bbr->round_delivered) * 1000 / interval;
+
+    /* application limited samples may only raise the estimate */
+
+    if (!bbr->app_limited || bw > bbr->bw) {
+        bbr->bw_samples[bbr->bw_round++ % NGX_QUIC_BBR_BW_ROUNDS] = bw;
+
+        bbr->bw = 0;
+
+        for (i = 0; i < NGX_QUIC_BBR_BW_ROUNDS; i++) {
+            bbr->bw = ngx_max(bbr->bw, bbr->bw_samples[i]);
+        }
+    }
+
+    if (bbr->mode == NGX_QUIC_BBR_STARTUP && !bbr->app_limited) {
+
+        if (bbr->bw >= bbr->full_bw * NGX_QUIC_BBR_FULL_BW_GROWTH / 100) {
+            bbr->full_bw = bbr->bw;
+            bbr->full_bw_count = 0;
+
+        } else if (++bbr->full_bw_count >= NGX_QUIC_BBR_FULL_BW_ROUNDS) {
+            bbr->full_bw_reached = 1;
+        }
+    }
+
+    if (bbr->mode == NGX_QUIC_BBR_PROBE_BW && bbr->cycle == 0
+        && bbr->inflight_hi && !bbr->loss_in_round)
+    {
+        /* probe for more inflight headroom */
+        bbr->inflight_hi += bbr->inflight_hi / 4;
+    }
+
+    ngx_log_debug5(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic bbr round t:%M bw:%uL max:%uL lost:%uz app:%ui",
+                   now, bw, bbr->bw, bbr->round_lost,
+                   (ngx_uint_t) bbr->app_limited);
+
+    bbr->round_start = now;
+    bbr->round_delivered = bbr->delivered;
+    bbr->round_lost = 0;
+    bbr->loss_in_round = 0;
+    bbr->app_limited = cg->idle ? 1 : 0;
+}
+
+
+static void
+ngx_quic_bbr_update_mode(ngx_connection_t *c)
+{
+    ngx_msec_t              now, rtt;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    now = ngx_current_msec;
+
+    switch (bbr->mode) {
+
+    case NGX_QUIC_BBR_STARTUP:
+        if (bbr->full_bw_reached) {
+            ngx_quic_bbr_enter(cg, NGX_QUIC_BBR_DRAIN);
+        }
+
+        break;
+
+    case NGX_QUIC_BBR_DRAIN:
+        if (cg->in_flight <= ngx_quic_bbr_bdp(cg, 100)) {
+            ngx_quic_bbr_enter(cg, NGX_QUIC_BBR_PROBE_BW);
+        }
+
+        break;
+
+    case NGX_QUIC_BBR_PROBE_BW:
+
+        /* each phase of the gain cycle lasts about one min_rtt */
+
+        rtt = (bbr->min_rtt == NGX_TIMER_INFINITE) ? qc->avg_rtt
+                                                    : bbr->min_rtt;
+
+        if (now - bbr->cycle_start > ngx_max(rtt, 1)) {
+            bbr->cycle = (bbr->cycle + 1) % NGX_QUIC_BBR_CYCLE_LEN;
+            bbr->cycle_start = now;
+            bbr->pacing_gain = ngx_quic_bbr_probe_gains[bbr->cycle];
+        }
+
+        break;
+
+    default: /* NGX_QUIC_BBR_PROBE_RTT */
+
+        if (!bbr->probe_rtt_armed) {
+            if (cg->in_flight <= NGX_QUIC_BBR_MIN_WINDOW(cg)) {
+                bbr->probe_rtt_armed = 1;
+                bbr->probe_rtt_done = now + NGX_QUIC_BBR_PROBE_RTT_TIME;
+            }
+
+        } else if ((ngx_msec_int_t) (now - bbr->probe_rtt_done) >= 0) {
+            bbr->min_rtt_stamp = now;
+            ngx_quic_bbr_enter(cg, bbr->full_bw_reached
+                                   ? NGX_QUIC_BBR_PROBE_BW
+                                   : NGX_QUIC_BBR_STARTUP);
+        }
+    }
+}
+
+
+static size_t
+ngx_quic_bbr_bdp(ngx_quic_congestion_t *cg, ngx_uint_t gain)
+{
+    ngx_quic_bbr_t  *bbr;
+
+    bbr = &cg->bbr;
+
+    if (bbr->bw == 0 || bbr->min_rtt == NGX_TIMER_INFINITE) {
+        return (size_t) NGX_QUIC_INITIAL_WINDOW * gain / 100;
+    }
+
+    return bbr->bw * ngx_max(bbr->min_rtt, 1) / 1000 * gain / 100;
+}
+
+
+static void
+ngx_quic_bbr_set_window(ngx_connection_t *c, size_t acked)
+{
+    size_t                  target;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    target = ngx_quic_bbr_bdp(cg, bbr->cwnd_gain) + 3 * cg->mtu;
+
+    if (bbr->inflight_hi) {
+        target = ngx_min(target, bbr->inflight_hi);
+    }
+
+    if (bbr->full_bw_reached) {
+        cg->window = ngx_min(cg->window + acked, target);
+
+    } else if (cg->window < target
+               || bbr->delivered < NGX_QUIC_INITIAL_WINDOW)
+    {
+        cg->window += acked;
+    }
+
+    cg->window = ngx_max(cg->window, NGX_QUIC_BBR_MIN_WINDOW(cg));
+
+    if (bbr->mode == NGX_QUIC_BBR_PROBE_RTT) {
+        cg->window = NGX_QUIC_BBR_MIN_WINDOW(cg);
+    }
+}
+
+
+static void
+ngx_quic_bbr_set_pacing_rate(ngx_connection_t *c)
+{
+    uint64_t                rate;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    if (bbr->bw) {
+        rate = bbr->bw;
+
+    } else if (qc->min_rtt != NGX_TIMER_INFINITE) {
+        /* no bandwidth samples yet, pace the window over smoothed RTT */
+        rate = (uint64_t) cg->window * 1000 / ngx_max(qc->avg_rtt, 1);
+
+    } else {
+        return;
+    }
+
+    rate = rate * bbr->pacing_gain / 100 * NGX_QUIC_BBR_PACING_MARGIN / 100;
+
+    /* do not slow down until the pipe is known to be full */
+
+    if (bbr->full_bw_reached || rate > cg->pacing_rate) {
+        cg->pacing_rate = rate;
+    }
+}
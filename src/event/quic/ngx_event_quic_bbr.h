@@ -0,0 +1,52 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_QUIC_BBR_H_INCLUDED_
+#define _NGX_EVENT_QUIC_BBR_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_QUIC_BBR_BW_ROUNDS               10
+
+
+typedef struct {
+    ngx_uint_t                        mode;
+    ngx_uint_t                        cycle;
+    ngx_uint_t                        pacing_gain;  /* x100 */
+    ngx_uint_t                        cwnd_gain;    /* x100 */
+
+    uint64_t                          delivered;
+    uint64_t                          round_delivered;
+    size_t                            round_lost;
+    ngx_msec_t                        round_start;
+
+    uint64_t                          bw;           /* bytes per second */
+    uint64_t                          bw_samples[NGX_QUIC_BBR_BW_ROUNDS];
+    ngx_uint_t                        bw_round;
+    uint64_t                          full_bw;
+    ngx_uint_t                        full_bw_count;
+
+    ngx_msec_t                        min_rtt;
+    ngx_msec_t                        min_rtt_stamp;
+    ngx_msec_t                        probe_rtt_done;
+    ngx_msec_t                        cycle_start;
+
+    size_t                            inflight_hi;
+
+    unsigned                          full_bw_reached:1;
+    unsigned                          app_limited:1;
+    unsigned                          loss_in_round:1;
+    unsigned                          probe_rtt_armed:1;
+} ngx_quic_bbr_t;
+
+
+extern ngx_quic_congestion_ops_t  ngx_quic_bbr_ops;
+
+
+#endif /* _NGX_EVENT_QUIC_BBR_H_INCLUDED_ */
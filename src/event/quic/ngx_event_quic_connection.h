@@ -34,6 +34,8 @@ typedef struct ngx_quic_socket_s      ngx_quic_socket_t;
 typedef struct ngx_quic_path_s        ngx_quic_path_t;
 typedef struct ngx_quic_keys_s        ngx_quic_keys_t;
 
+typedef struct ngx_quic_congestion_ops_s  ngx_quic_congestion_ops_t;
+
 #if (NGX_QUIC_OPENSSL_COMPAT)
 #include <ngx_event_quic_openssl_compat.h>
 #endif
@@ -46,6 +48,7 @@ typedef struct ngx_quic_keys_s        ngx_quic_keys_t;
 #include <ngx_event_quic_ssl.h>
 #include <ngx_event_quic_tokens.h>
 #include <ngx_event_quic_ack.h>
+#include <ngx_event_quic_bbr.h>
 #include <ngx_event_quic_output.h>
 #include <ngx_event_quic_socket.h>
 
@@ -172,6 +175,8 @@ typedef struct {
 
 
 typedef struct {
+    ngx_quic_congestion_ops_t        *ops;
+
     size_t                            in_flight;
     size_t                            window;
     size_t                            ssthresh;
@@ -183,9 +188,27 @@ typedef struct {
     ngx_msec_t                        idle_start;
     ngx_msec_t                        k;
     ngx_uint_t                        idle; /* unsigned  idle:1; */
+
+    uint64_t                          pacing_rate;   /* bytes per second */
+    size_t                            pacing_budget;
+    ngx_msec_t                        pacing_time;
+
+    ngx_quic_bbr_t                    bbr;
 } ngx_quic_congestion_t;
 
 
+struct ngx_quic_congestion_ops_s {
+    void                            (*init)(ngx_quic_congestion_t *cg);
+    void                            (*ack)(ngx_connection_t *c,
+                                           ngx_quic_frame_t *f);
+    void                            (*lost)(ngx_connection_t *c,
+                                            ngx_quic_frame_t *f);
+    void                            (*idle)(ngx_connection_t *c,
+                                            ngx_uint_t idle);
+    void                            (*persistent)(ngx_connection_t *c);
+};
+
+
 /*
  * RFC 9000, 12.3.  Packet Numbers
  *
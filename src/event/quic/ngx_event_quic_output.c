@@ -34,6 +34,9 @@
 
 #define NGX_QUIC_SOCKET_RETRY_DELAY      10 /* ms, for NGX_AGAIN on write */
 
+#define NGX_QUIC_TX_MAX_MSGS             64
+#define NGX_QUIC_TX_BUFFER_SIZE      262144
+
 
 #define ngx_quic_log_packet(log, pkt)                                         \
     ngx_log_debug6(NGX_LOG_DEBUG_EVENT, log, 0,                               \
@@ -44,6 +47,34 @@
                     (pkt)->trunc);
 
 
+#if (NGX_HAVE_SENDMMSG)
+
+typedef struct {
+    ngx_socket_t                fd;
+    u_char                     *data;
+    size_t                      len;
+    size_t                      segment;
+    ngx_sockaddr_t              sockaddr;
+    socklen_t                   socklen;
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    socklen_t                   local_socklen;
+    ngx_sockaddr_t              local_sockaddr;
+#endif
+} ngx_quic_tx_msg_t;
+
+
+typedef struct {
+    ngx_event_t                 event;
+    ngx_uint_t                  head;
+    ngx_uint_t                  nmsgs;
+    size_t                      used;
+    ngx_quic_tx_msg_t           msgs[NGX_QUIC_TX_MAX_MSGS];
+    u_char                      buffer[NGX_QUIC_TX_BUFFER_SIZE];
+} ngx_quic_tx_queue_t;
+
+#endif
+
+
 static ngx_int_t ngx_quic_create_datagrams(ngx_connection_t *c);
 static void ngx_quic_commit_send(ngx_connection_t *c);
 static void ngx_quic_revert_send(ngx_connection_t *c,
@@ -65,6 +96,27 @@ static ssize_t ngx_quic_send(ngx_connection_t *c, u_char *buf, size_t len,
 static void ngx_quic_set_packet_number(ngx_quic_header_t *pkt,
     ngx_quic_send_ctx_t *ctx);
 static ngx_int_t ngx_quic_stateless_reset_filter(ngx_connection_t *c);
+#if (NGX_HAVE_SENDMMSG)
+static ssize_t ngx_quic_tx_enqueue(ngx_connection_t *c, u_char *buf,
+    size_t len, struct sockaddr *sockaddr, socklen_t socklen, size_t segment);
+static void ngx_quic_tx_handler(ngx_event_t *ev);
+static void ngx_quic_tx_flush(ngx_log_t *log);
+static void ngx_quic_tx_init_msg(ngx_quic_tx_msg_t *m, struct msghdr *msg,
+    struct iovec *iov, u_char *control, size_t size);
+#endif
+
+
+#if (NGX_HAVE_SENDMMSG)
+
+/*
+ * datagrams of all connections with quic_sendmmsg enabled are gathered
+ * during an event loop iteration and sent with sendmmsg() from a posted
+ * event; a datagram which cannot be sent is treated as lost
+ */
+
+static ngx_quic_tx_queue_t  ngx_quic_tx_queue;
+
+#endif
 
 
 ngx_int_t
@@ -118,6 +170,7 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
     ssize_t                 n;
     u_char                 *p;
     uint64_t                preserved_pnum[NGX_QUIC_SEND_CTX_LAST];
+    ngx_msec_t              delay;
     ngx_uint_t              i, pad;
     ngx_quic_path_t        *path;
     ngx_quic_send_ctx_t    *ctx;
@@ -140,6 +193,9 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
 
         pad = ngx_quic_get_padding_level(c);
 
+        /* while paced, only acknowledgements are sent */
+        delay = ngx_quic_pacing_delay(c, 0);
+
         for (i = 0; i < NGX_QUIC_SEND_CTX_LAST; i++) {
 
             ctx = &qc->send_ctx[i];
@@ -160,7 +216,7 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
             }
 
             n = ngx_quic_output_packet(c, ctx, p, len, min,
-                                       cg->in_flight >= cg->window);
+                                       cg->in_flight >= cg->window || delay);
             if (n == NGX_ERROR) {
                 return NGX_ERROR;
             }
@@ -174,7 +230,15 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
             break;
         }
 
-        n = ngx_quic_send(c, dst, len, path->sockaddr, path->socklen);
+#if (NGX_HAVE_SENDMMSG)
+        if (qc->conf->sendmmsg_enabled) {
+            n = ngx_quic_tx_enqueue(c, dst, len, path->sockaddr,
+                                    path->socklen, 0);
+        } else
+#endif
+        {
+            n = ngx_quic_send(c, dst, len, path->sockaddr, path->socklen);
+        }
 
         if (n == NGX_ERROR) {
             return NGX_ERROR;
@@ -192,6 +256,10 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
 
     } while (cg->in_flight < cg->window);
 
+    if (delay && !qc->push.timer_set) {
+        ngx_add_timer(&qc->push, delay);
+    }
+
     return NGX_OK;
 }
 
@@ -199,6 +267,7 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
 static void
 ngx_quic_commit_send(ngx_connection_t *c)
 {
+    size_t                  in_flight;
     ngx_uint_t              i, idle;
     ngx_queue_t            *q;
     ngx_quic_frame_t       *f;
@@ -210,6 +279,7 @@ ngx_quic_commit_send(ngx_connection_t *c)
     cg = &qc->congestion;
 
     idle = 1;
+    in_flight = cg->in_flight;
 
     for (i = 0; i < NGX_QUIC_SEND_CTX_LAST; i++) {
         ctx = &qc->send_ctx[i];
@@ -239,6 +309,7 @@ ngx_quic_commit_send(ngx_connection_t *c)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "quic congestion send if:%uz", cg->in_flight);
 
+    ngx_quic_pacing_sent(c, cg->in_flight - in_flight);
     ngx_quic_congestion_idle(c, idle);
 }
 
@@ -338,6 +409,7 @@ ngx_quic_create_segments(ngx_connection_t *c)
     size_t                  len, segsize;
     ssize_t                 n;
     u_char                 *p, *end;
+    ngx_msec_t              delay;
     ngx_uint_t              nseg, level;
     ngx_quic_path_t        *path;
     ngx_quic_send_ctx_t    *ctx;
@@ -369,7 +441,9 @@ ngx_quic_create_segments(ngx_connection_t *c)
 
         len = ngx_min(segsize, (size_t) (end - p));
 
-        if (len && cg->in_flight + (p - dst) < cg->window) {
+        delay = ngx_quic_pacing_delay(c, p - dst);
+
+        if (len && cg->in_flight + (p - dst) < cg->window && delay == 0) {
 
             n = ngx_quic_output_packet(c, ctx, p, len, len, 0);
             if (n == NGX_ERROR) {
@@ -390,8 +464,16 @@ ngx_quic_create_segments(ngx_connection_t *c)
         }
 
         if (n == 0 || nseg == NGX_QUIC_MAX_SEGMENTS) {
-            n = ngx_quic_send_segments(c, dst, p - dst, path->sockaddr,
-                                       path->socklen, segsize);
+#if (NGX_HAVE_SENDMMSG)
+            if (qc->conf->sendmmsg_enabled) {
+                n = ngx_quic_tx_enqueue(c, dst, p - dst, path->sockaddr,
+                                        path->socklen, segsize);
+            } else
+#endif
+            {
+                n = ngx_quic_send_segments(c, dst, p - dst, path->sockaddr,
+                                           path->socklen, segsize);
+            }
             if (n == NGX_ERROR) {
                 return NGX_ERROR;
             }
@@ -412,6 +494,10 @@ ngx_quic_create_segments(ngx_connection_t *c)
         }
     }
 
+    if (delay && !qc->push.timer_set) {
+        ngx_add_timer(&qc->push, delay);
+    }
+
     return NGX_OK;
 }
 
@@ -762,6 +848,206 @@ ngx_quic_send(ngx_connection_t *c, u_char *buf, size_t len,
 }
 
 
+#if (NGX_HAVE_SENDMMSG)
+
+static ssize_t
+ngx_quic_tx_enqueue(ngx_connection_t *c, u_char *buf, size_t len,
+    struct sockaddr *sockaddr, socklen_t socklen, size_t segment)
+{
+    ngx_quic_tx_msg_t    *m;
+    ngx_quic_tx_queue_t  *tx;
+
+    tx = &ngx_quic_tx_queue;
+
+    if (tx->nmsgs == NGX_QUIC_TX_MAX_MSGS
+        || tx->used + len > NGX_QUIC_TX_BUFFER_SIZE)
+    {
+        ngx_quic_tx_flush(c->log);
+
+        if (tx->nmsgs) {
+            return NGX_AGAIN;
+        }
+    }
+
+    m = &tx->msgs[tx->nmsgs++];
+
+    m->fd = c->fd;
+    m->data = tx->buffer + tx->used;
+    m->len = len;
+    m->segment = segment;
+
+    ngx_memcpy(m->data, buf, len);
+    tx->used += len;
+
+    ngx_memcpy(&m->sockaddr, sockaddr, socklen);
+    m->socklen = socklen;
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    if (c->listening && c->listening->wildcard && c->local_sockaddr) {
+        ngx_memcpy(&m->local_sockaddr, c->local_sockaddr, c->local_socklen);
+        m->local_socklen = c->local_socklen;
+
+    } else {
+        m->local_socklen = 0;
+    }
+#endif
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic tx queue: %uz bytes, segment:%uz, msgs:%ui",
+                   len, segment, tx->nmsgs);
+
+    c->sent += len;
+
+    if (!tx->event.posted && !tx->event.timer_set) {
+        tx->event.handler = ngx_quic_tx_handler;
+        tx->event.log = ngx_cycle->log;
+        tx->event.cancelable = 1;
+
+        ngx_post_event(&tx->event, &ngx_posted_events);
+    }
+
+    return len;
+}
+
+
+static void
+ngx_quic_tx_handler(ngx_event_t *ev)
+{
+    ev->timedout = 0;
+
+    ngx_quic_tx_flush(ev->log);
+
+    if (ngx_quic_tx_queue.nmsgs) {
+        ngx_add_timer(ev, NGX_QUIC_SOCKET_RETRY_DELAY);
+    }
+}
+
+
+static void
+ngx_quic_tx_flush(ngx_log_t *log)
+{
+    int                     n;
+    ngx_err_t               err;
+    ngx_uint_t              i, k;
+    ngx_socket_t            fd;
+    ngx_quic_tx_queue_t    *tx;
+
+    static struct iovec     iov[NGX_QUIC_TX_MAX_MSGS];
+    static struct mmsghdr   msgs[NGX_QUIC_TX_MAX_MSGS];
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    static u_char           control[NGX_QUIC_TX_MAX_MSGS]
+                                   [CMSG_SPACE(sizeof(uint16_t))
+                                    + CMSG_SPACE(sizeof(ngx_addrinfo_t))];
+#else
+    static u_char           control[NGX_QUIC_TX_MAX_MSGS]
+                                   [CMSG_SPACE(sizeof(uint16_t))];
+#endif
+
+    tx = &ngx_quic_tx_queue;
+
+    while (tx->head < tx->nmsgs) {
+
+        /* a single sendmmsg() call is made per socket */
+
+        fd = tx->msgs[tx->head].fd;
+
+        for (i = tx->head, k = 0;
+             i < tx->nmsgs && tx->msgs[i].fd == fd;
+             i++, k++)
+        {
+            ngx_quic_tx_init_msg(&tx->msgs[i], &msgs[k].msg_hdr, &iov[k],
+                                 control[k], sizeof(control[k]));
+        }
+
+        n = sendmmsg(fd, msgs, k, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, err,
+                               "quic sendmmsg() not ready");
+                return;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ERR, log, err, "quic sendmmsg() failed");
+
+            /* the first message failed, drop it */
+            n = 1;
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "quic sendmmsg: fd:%d %d of %ui", fd, n, k);
+
+        tx->head += n;
+    }
+
+    tx->head = 0;
+    tx->nmsgs = 0;
+    tx->used = 0;
+}
+
+
+static void
+ngx_quic_tx_init_msg(ngx_quic_tx_msg_t *m, struct msghdr *msg,
+    struct iovec *iov, u_char *control, size_t size)
+{
+    size_t           clen;
+    struct cmsghdr  *cmsg;
+
+    ngx_memzero(msg, sizeof(struct msghdr));
+
+    iov->iov_base = (void *) m->data;
+    iov->iov_len = m->len;
+
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+
+    msg->msg_name = &m->sockaddr;
+    msg->msg_namelen = m->socklen;
+
+    ngx_memzero(control, size);
+
+    msg->msg_control = control;
+    msg->msg_controllen = size;
+
+    cmsg = CMSG_FIRSTHDR(msg);
+    clen = 0;
+
+#if (NGX_HAVE_UDP_SEGMENT)
+    if (m->segment) {
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+        *(uint16_t *) CMSG_DATA(cmsg) = m->segment;
+
+        clen += CMSG_SPACE(sizeof(uint16_t));
+        cmsg = CMSG_NXTHDR(msg, cmsg);
+    }
+#endif
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    if (m->local_socklen) {
+        clen += ngx_set_srcaddr_cmsg(cmsg, &m->local_sockaddr.sockaddr);
+    }
+#endif
+
+    if (clen == 0) {
+        msg->msg_control = NULL;
+    }
+
+    msg->msg_controllen = clen;
+}
+
+#endif
+
+
 static void
 ngx_quic_set_packet_number(ngx_quic_header_t *pkt, ngx_quic_send_ctx_t *ctx)
 {
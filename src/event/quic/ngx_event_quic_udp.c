@@ -1,4 +1,3 @@
-
 /*
  * Copyright (C) Roman Arutyunyan
  * Copyright (C) Nginx, Inc.
@@ -11,6 +10,34 @@
 #include <ngx_event_quic_connection.h>
 
 
+#if (NGX_HAVE_RECVMMSG)
+#define NGX_QUIC_RECV_BATCH  16
+#endif
+
+#if (NGX_HAVE_UDP_GRO && NGX_HAVE_RECVMMSG && NGX_HAVE_ADDRINFO_CMSG)
+#define NGX_QUIC_HAVE_GRO    1
+#endif
+
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+
+#if (NGX_QUIC_HAVE_GRO)
+#define NGX_QUIC_RECV_CMSG_SIZE                                               \
+    (CMSG_SPACE(sizeof(ngx_addrinfo_t)) + CMSG_SPACE(sizeof(int)))
+#else
+#define NGX_QUIC_RECV_CMSG_SIZE  CMSG_SPACE(sizeof(ngx_addrinfo_t))
+#endif
+
+#endif
+
+
+#if (NGX_HAVE_RECVMMSG)
+static void ngx_quic_recvmmsg(ngx_event_t *ev);
+#endif
+static ngx_int_t ngx_quic_recv_datagrams(ngx_event_t *ev, u_char *data,
+    size_t size, struct msghdr *msg);
+static ngx_int_t ngx_quic_recv_datagram(ngx_event_t *ev, u_char *data,
+    size_t n, struct msghdr *msg);
 static void ngx_quic_close_accepted_connection(ngx_connection_t *c);
 static ngx_connection_t *ngx_quic_lookup_connection(ngx_listening_t *ls,
     ngx_str_t *key, struct sockaddr *local_sockaddr, socklen_t local_socklen);
@@ -19,25 +46,20 @@ static ngx_connection_t *ngx_quic_lookup_connection(ngx_listening_t *ls,
 void
 ngx_quic_recvmsg(ngx_event_t *ev)
 {
+#if !(NGX_HAVE_RECVMMSG)
     ssize_t             n;
-    ngx_str_t           key;
-    ngx_buf_t           buf;
-    ngx_log_t          *log;
     ngx_err_t           err;
-    socklen_t           socklen, local_socklen;
-    ngx_event_t        *rev, *wev;
     struct iovec        iov[1];
     struct msghdr       msg;
-    ngx_sockaddr_t      sa, lsa;
-    struct sockaddr    *sockaddr, *local_sockaddr;
+    ngx_sockaddr_t      sa;
+    static u_char       buffer[NGX_QUIC_MAX_UDP_PAYLOAD_SIZE];
+#endif
     ngx_listening_t    *ls;
     ngx_event_conf_t   *ecf;
-    ngx_connection_t   *c, *lc;
-    ngx_quic_socket_t  *qsock;
-    static u_char       buffer[NGX_QUIC_MAX_UDP_PAYLOAD_SIZE];
+    ngx_connection_t   *lc;
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
-    u_char             msg_control[CMSG_SPACE(sizeof(ngx_addrinfo_t))];
+#if (NGX_HAVE_ADDRINFO_CMSG && !(NGX_HAVE_RECVMMSG))
+    u_char              msg_control[NGX_QUIC_RECV_CMSG_SIZE];
 #endif
 
     if (ev->timedout) {
@@ -62,6 +84,12 @@ ngx_quic_recvmsg(ngx_event_t *ev)
                    "quic recvmsg on %V, ready: %d",
                    &ls->addr_text, ev->available);
 
+#if (NGX_HAVE_RECVMMSG)
+
+    ngx_quic_recvmmsg(ev);
+
+#else
+
     do {
         ngx_memzero(&msg, sizeof(struct msghdr));
 
@@ -98,253 +126,428 @@ ngx_quic_recvmsg(ngx_event_t *ev)
             return;
         }
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
-        if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "quic recvmsg() truncated data");
-            continue;
-        }
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_quic_recv_batches, 1);
 #endif
 
-        sockaddr = msg.msg_name;
-        socklen = msg.msg_namelen;
+        if (ngx_quic_recv_datagrams(ev, buffer, n, &msg) != NGX_OK) {
+            return;
+        }
 
-        if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
-            socklen = sizeof(ngx_sockaddr_t);
+        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+            ev->available -= n;
         }
 
-#if (NGX_HAVE_UNIX_DOMAIN)
+    } while (ev->available);
 
-        if (sockaddr->sa_family == AF_UNIX) {
-            struct sockaddr_un *saun = (struct sockaddr_un *) sockaddr;
+#endif
+}
+
+
+#if (NGX_HAVE_RECVMMSG)
+
+static void
+ngx_quic_recvmmsg(ngx_event_t *ev)
+{
+    int                     i, n;
+    ngx_err_t               err;
+    struct msghdr          *msg;
+    ngx_connection_t       *lc;
+
+    static struct iovec     iov[NGX_QUIC_RECV_BATCH];
+    static struct mmsghdr   msgs[NGX_QUIC_RECV_BATCH];
+    static ngx_sockaddr_t   sa[NGX_QUIC_RECV_BATCH];
+    static u_char           buffer[NGX_QUIC_RECV_BATCH]
+                                  [NGX_QUIC_MAX_UDP_PAYLOAD_SIZE];
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    static u_char           msg_control[NGX_QUIC_RECV_BATCH]
+                                       [NGX_QUIC_RECV_CMSG_SIZE];
+#endif
 
-            if (socklen <= (socklen_t) offsetof(struct sockaddr_un, sun_path)
-                || saun->sun_path[0] == '\0')
+    lc = ev->data;
+
+    do {
+        for (i = 0; i < NGX_QUIC_RECV_BATCH; i++) {
+            msg = &msgs[i].msg_hdr;
+
+            ngx_memzero(msg, sizeof(struct msghdr));
+
+            iov[i].iov_base = (void *) buffer[i];
+            iov[i].iov_len = sizeof(buffer[i]);
+
+            msg->msg_name = &sa[i];
+            msg->msg_namelen = sizeof(ngx_sockaddr_t);
+            msg->msg_iov = &iov[i];
+            msg->msg_iovlen = 1;
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+
+#if !(NGX_QUIC_HAVE_GRO)
+            if (lc->listening->wildcard)
+#endif
             {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
-                               "unbound unix socket");
-                goto next;
+                msg->msg_control = msg_control[i];
+                msg->msg_controllen = sizeof(msg_control[i]);
+
+                ngx_memzero(msg_control[i], sizeof(msg_control[i]));
             }
-        }
 
 #endif
+        }
 
-        local_sockaddr = ls->sockaddr;
-        local_socklen = ls->socklen;
+        n = recvmmsg(lc->fd, msgs, NGX_QUIC_RECV_BATCH, 0, NULL);
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
+        if (n == -1) {
+            err = ngx_socket_errno;
 
-        if (ls->wildcard) {
-            struct cmsghdr  *cmsg;
+            if (err == NGX_EAGAIN) {
+                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
+                               "quic recvmmsg() not ready");
+                return;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "quic recvmmsg() failed");
+
+            return;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "quic recvmmsg: %d messages", n);
 
-            ngx_memcpy(&lsa, local_sockaddr, local_socklen);
-            local_sockaddr = &lsa.sockaddr;
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_quic_recv_batches, 1);
+#endif
 
-            for (cmsg = CMSG_FIRSTHDR(&msg);
-                 cmsg != NULL;
-                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+        for (i = 0; i < n; i++) {
+            if (ngx_quic_recv_datagrams(ev, buffer[i], msgs[i].msg_len,
+                                        &msgs[i].msg_hdr)
+                != NGX_OK)
             {
-                if (ngx_get_srcaddr_cmsg(cmsg, local_sockaddr) == NGX_OK) {
-                    break;
-                }
+                return;
             }
         }
 
+    } while (ev->available && n == NGX_QUIC_RECV_BATCH);
+}
+
 #endif
 
-        if (ngx_quic_get_packet_dcid(ev->log, buffer, n, &key) != NGX_OK) {
-            goto next;
-        }
 
-        c = ngx_quic_lookup_connection(ls, &key, local_sockaddr, local_socklen);
+static ngx_int_t
+ngx_quic_recv_datagrams(ngx_event_t *ev, u_char *data, size_t size,
+    struct msghdr *msg)
+{
+    size_t            n, segment;
+#if (NGX_QUIC_HAVE_GRO)
+    int               gso_size;
+    struct cmsghdr   *cmsg;
+#endif
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    if (msg->msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      "quic recvmsg() truncated data");
+        return NGX_OK;
+    }
+#endif
 
-        if (c) {
+    segment = size;
 
-#if (NGX_DEBUG)
-            if (c->log->log_level & NGX_LOG_DEBUG_EVENT) {
-                ngx_log_handler_pt  handler;
+#if (NGX_QUIC_HAVE_GRO)
 
-                handler = c->log->handler;
-                c->log->handler = NULL;
+    /* a coalesced buffer holds datagrams of equal size, the last can be less */
 
-                ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                               "quic recvmsg: fd:%d n:%z", c->fd, n);
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
 
-                c->log->handler = handler;
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            ngx_memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(int));
+
+            if (gso_size > 0) {
+                segment = gso_size;
             }
+
+            break;
+        }
+    }
+
 #endif
 
-            ngx_memzero(&buf, sizeof(ngx_buf_t));
+    do {
+        n = ngx_min(segment, size);
 
-            buf.pos = buffer;
-            buf.last = buffer + n;
-            buf.start = buf.pos;
-            buf.end = buffer + sizeof(buffer);
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_quic_recv_datagrams, 1);
+#endif
 
-            qsock = ngx_quic_get_socket(c);
+        if (ngx_quic_recv_datagram(ev, data, n, msg) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-            ngx_memcpy(&qsock->sockaddr, sockaddr, socklen);
-            qsock->socklen = socklen;
+        data += n;
+        size -= n;
 
-            c->udp->buffer = &buf;
+    } while (size);
 
-            rev = c->read;
-            rev->ready = 1;
-            rev->active = 0;
+    return NGX_OK;
+}
 
-            rev->handler(rev);
 
-            if (c->udp) {
-                c->udp->buffer = NULL;
-            }
+static ngx_int_t
+ngx_quic_recv_datagram(ngx_event_t *ev, u_char *data, size_t n,
+    struct msghdr *msg)
+{
+    ngx_str_t           key;
+    ngx_buf_t           buf;
+    ngx_log_t          *log;
+    socklen_t           socklen, local_socklen;
+    ngx_event_t        *rev, *wev;
+    ngx_sockaddr_t      lsa;
+    struct sockaddr    *sockaddr, *local_sockaddr;
+    ngx_listening_t    *ls;
+    ngx_connection_t   *c, *lc;
+    ngx_quic_socket_t  *qsock;
+
+    lc = ev->data;
+    ls = lc->listening;
 
-            rev->ready = 0;
-            rev->active = 1;
+    sockaddr = msg->msg_name;
+    socklen = msg->msg_namelen;
 
-            goto next;
+    if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
+        socklen = sizeof(ngx_sockaddr_t);
+    }
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+    if (sockaddr->sa_family == AF_UNIX) {
+        struct sockaddr_un *saun = (struct sockaddr_un *) sockaddr;
+
+        if (socklen <= (socklen_t) offsetof(struct sockaddr_un, sun_path)
+            || saun->sun_path[0] == '\0')
+        {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                           "unbound unix socket");
+            return NGX_OK;
         }
+    }
 
-#if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
 #endif
 
-        ngx_accept_disabled = ngx_cycle->connection_n / 8
-                              - ngx_cycle->free_connection_n;
+    local_sockaddr = ls->sockaddr;
+    local_socklen = ls->socklen;
 
-        c = ngx_get_connection(lc->fd, ev->log);
-        if (c == NULL) {
-            return;
-        }
+#if (NGX_HAVE_ADDRINFO_CMSG)
 
-        c->shared = 1;
-        c->type = SOCK_DGRAM;
-        c->socklen = socklen;
+    if (ls->wildcard) {
+        struct cmsghdr  *cmsg;
 
-#if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
-#endif
+        ngx_memcpy(&lsa, local_sockaddr, local_socklen);
+        local_sockaddr = &lsa.sockaddr;
 
-        c->pool = ngx_create_pool(ls->pool_size, ev->log);
-        if (c->pool == NULL) {
-            ngx_quic_close_accepted_connection(c);
-            return;
+        for (cmsg = CMSG_FIRSTHDR(msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(msg, cmsg))
+        {
+            if (ngx_get_srcaddr_cmsg(cmsg, local_sockaddr) == NGX_OK) {
+                break;
+            }
         }
+    }
 
-        c->sockaddr = ngx_palloc(c->pool, NGX_SOCKADDRLEN);
-        if (c->sockaddr == NULL) {
-            ngx_quic_close_accepted_connection(c);
-            return;
-        }
+#endif
 
-        ngx_memcpy(c->sockaddr, sockaddr, socklen);
+    if (ngx_quic_get_packet_dcid(ev->log, data, n, &key) != NGX_OK) {
+        return NGX_OK;
+    }
 
-        log = ngx_palloc(c->pool, sizeof(ngx_log_t));
-        if (log == NULL) {
-            ngx_quic_close_accepted_connection(c);
-            return;
-        }
+    c = ngx_quic_lookup_connection(ls, &key, local_sockaddr, local_socklen);
 
-        *log = ls->log;
+    if (c) {
 
-        c->log = log;
-        c->pool->log = log;
-        c->listening = ls;
+#if (NGX_DEBUG)
+        if (c->log->log_level & NGX_LOG_DEBUG_EVENT) {
+            ngx_log_handler_pt  handler;
 
-        if (local_sockaddr == &lsa.sockaddr) {
-            local_sockaddr = ngx_palloc(c->pool, local_socklen);
-            if (local_sockaddr == NULL) {
-                ngx_quic_close_accepted_connection(c);
-                return;
-            }
+            handler = c->log->handler;
+            c->log->handler = NULL;
 
-            ngx_memcpy(local_sockaddr, &lsa, local_socklen);
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "quic recvmsg: fd:%d n:%uz", c->fd, n);
+
+            c->log->handler = handler;
         }
+#endif
 
-        c->local_sockaddr = local_sockaddr;
-        c->local_socklen = local_socklen;
+        ngx_memzero(&buf, sizeof(ngx_buf_t));
 
-        c->buffer = ngx_create_temp_buf(c->pool, n);
-        if (c->buffer == NULL) {
-            ngx_quic_close_accepted_connection(c);
-            return;
-        }
+        buf.pos = data;
+        buf.last = data + n;
+        buf.start = buf.pos;
+        buf.end = buf.last;
+
+        qsock = ngx_quic_get_socket(c);
 
-        c->buffer->last = ngx_cpymem(c->buffer->last, buffer, n);
+        ngx_memcpy(&qsock->sockaddr, sockaddr, socklen);
+        qsock->socklen = socklen;
+
+        c->udp->buffer = &buf;
 
         rev = c->read;
-        wev = c->write;
+        rev->ready = 1;
+        rev->active = 0;
+
+        rev->handler(rev);
+
+        if (c->udp) {
+            c->udp->buffer = NULL;
+        }
 
+        rev->ready = 0;
         rev->active = 1;
-        wev->ready = 1;
 
-        rev->log = log;
-        wev->log = log;
+        return NGX_OK;
+    }
 
-        /*
-         * TODO: MT: - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         *
-         * TODO: MP: - allocated in a shared memory
-         *           - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         */
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+#endif
 
-        c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+    ngx_accept_disabled = ngx_cycle->connection_n / 8
+                          - ngx_cycle->free_connection_n;
 
-        c->start_time = ngx_current_msec;
+    c = ngx_get_connection(lc->fd, ev->log);
+    if (c == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->shared = 1;
+    c->type = SOCK_DGRAM;
+    c->socklen = socklen;
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
 #endif
 
-        if (ls->addr_ntop) {
-            c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
-            if (c->addr_text.data == NULL) {
-                ngx_quic_close_accepted_connection(c);
-                return;
-            }
+    c->pool = ngx_create_pool(ls->pool_size, ev->log);
+    if (c->pool == NULL) {
+        ngx_quic_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
 
-            c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
-                                             c->addr_text.data,
-                                             ls->addr_text_max_len, 0);
-            if (c->addr_text.len == 0) {
-                ngx_quic_close_accepted_connection(c);
-                return;
-            }
+    c->sockaddr = ngx_palloc(c->pool, NGX_SOCKADDRLEN);
+    if (c->sockaddr == NULL) {
+        ngx_quic_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(c->sockaddr, sockaddr, socklen);
+
+    log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (log == NULL) {
+        ngx_quic_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
+
+    *log = ls->log;
+
+    c->log = log;
+    c->pool->log = log;
+    c->listening = ls;
+
+    if (local_sockaddr == &lsa.sockaddr) {
+        local_sockaddr = ngx_palloc(c->pool, local_socklen);
+        if (local_sockaddr == NULL) {
+            ngx_quic_close_accepted_connection(c);
+            return NGX_ERROR;
         }
 
-#if (NGX_DEBUG)
-        {
-        ngx_str_t  addr;
-        u_char     text[NGX_SOCKADDR_STRLEN];
+        ngx_memcpy(local_sockaddr, &lsa, local_socklen);
+    }
+
+    c->local_sockaddr = local_sockaddr;
+    c->local_socklen = local_socklen;
+
+    c->buffer = ngx_create_temp_buf(c->pool, n);
+    if (c->buffer == NULL) {
+        ngx_quic_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
 
-        ngx_debug_accepted_connection(ecf, c);
+    c->buffer->last = ngx_cpymem(c->buffer->last, data, n);
 
-        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
-            addr.data = text;
-            addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
-                                     NGX_SOCKADDR_STRLEN, 1);
+    rev = c->read;
+    wev = c->write;
 
-            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
-                           "*%uA quic recvmsg: %V fd:%d n:%z",
-                           c->number, &addr, c->fd, n);
+    rev->active = 1;
+    wev->ready = 1;
+
+    rev->log = log;
+    wev->log = log;
+
+    /*
+     * TODO: MT: - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     *
+     * TODO: MP: - allocated in a shared memory
+     *           - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     */
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    c->start_time = ngx_current_msec;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+#endif
+
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_quic_close_accepted_connection(c);
+            return NGX_ERROR;
         }
 
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_quic_close_accepted_connection(c);
+            return NGX_ERROR;
         }
-#endif
+    }
 
-        log->data = NULL;
-        log->handler = NULL;
+#if (NGX_DEBUG)
+    {
+    ngx_str_t          addr;
+    ngx_event_conf_t  *ecf;
+    u_char             text[NGX_SOCKADDR_STRLEN];
 
-        ls->handler(c);
+    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
 
-    next:
+    ngx_debug_accepted_connection(ecf, c);
 
-        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
-            ev->available -= n;
-        }
+    if (log->log_level & NGX_LOG_DEBUG_EVENT) {
+        addr.data = text;
+        addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
+                                 NGX_SOCKADDR_STRLEN, 1);
 
-    } while (ev->available);
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "*%uA quic recvmsg: %V fd:%d n:%uz",
+                       c->number, &addr, c->fd, n);
+    }
+
+    }
+#endif
+
+    log->data = NULL;
+    log->handler = NULL;
+
+    ls->handler(c);
+
+    return NGX_OK;
 }
 
 
@@ -0,0 +1,1144 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_API_PROCESSING    0
+#define NGX_HTTP_API_REQUESTS      1
+#define NGX_HTTP_API_RESPONSES     2  /* total, 1xx .. 5xx */
+#define NGX_HTTP_API_DISCARDED     8
+#define NGX_HTTP_API_RECEIVED      9
+#define NGX_HTTP_API_SENT          10
+
+#define NGX_HTTP_API_NCOUNTERS     11
+
+
+/*
+ * the counters of the server zones are kept in the shared zone by name,
+ * so they survive reconfigurations, and the zones removed from
+ * the configuration stay in the shared zone for the old workers
+ */
+
+typedef struct {
+    ngx_queue_t                  queue;
+    ngx_stat_t                   stat;
+    ngx_str_t                    name;
+} ngx_http_api_zone_node_t;
+
+
+typedef struct {
+    ngx_queue_t                  zones;
+} ngx_http_api_shctx_t;
+
+
+typedef struct {
+    ngx_array_t                  groups[NGX_HTTP_API_NGROUPS];
+    ngx_array_t                  zones;       /* of ngx_str_t */
+
+    ngx_shm_zone_t              *shm_zone;
+    ngx_http_api_shctx_t        *sh;
+    ngx_stat_t                  *stats;
+
+    ngx_time_t                   load_time;
+} ngx_http_api_main_conf_t;
+
+
+typedef struct {
+    ngx_uint_t                   zone;
+} ngx_http_api_srv_conf_t;
+
+
+typedef struct {
+    int64_t                      accepted;
+    int64_t                      dropped;
+    int64_t                      active;
+    int64_t                      idle;
+} ngx_http_api_connections_t;
+
+
+typedef struct {
+    int64_t                      total;
+    int64_t                      current;
+} ngx_http_api_requests_t;
+
+
+typedef struct {
+    int64_t                      pages_used;
+    int64_t                      pages_free;
+    int64_t                      pages_max_free;
+    int64_t                      fails;
+    ngx_str_t                    hugepages;
+    ngx_uint_t                   best_fit;
+} ngx_http_api_slab_t;
+
+
+typedef struct {
+    int64_t                      used;
+    int64_t                      free;
+    int64_t                      reqs;
+    int64_t                      fails;
+    int64_t                      pages;
+} ngx_http_api_slab_slot_t;
+
+
+static ngx_int_t ngx_http_api_handler(ngx_http_request_t *r);
+static ngx_data_item_t *ngx_http_api_lookup(ngx_data_item_t *item,
+    ngx_str_t *path);
+
+static ngx_data_item_t *ngx_http_api_load_time_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_pid_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_connections_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_requests_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_stub_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_slabs_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_slab_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_group_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_api_server_zone_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+
+static ngx_int_t ngx_http_api_post_read_handler(ngx_http_request_t *r);
+static void ngx_http_api_cleanup(void *data);
+static ngx_int_t ngx_http_api_log_handler(ngx_http_request_t *r);
+
+static ngx_int_t ngx_http_api_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static void *ngx_http_api_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_api_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_http_api(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_api_status_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_api_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_api_commands[] = {
+
+    { ngx_string("api"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_api,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("status_zone"),
+      NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_http_api_status_zone,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_api_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_api_init,                     /* postconfiguration */
+
+    ngx_http_api_create_main_conf,         /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_api_create_srv_conf,          /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_api_module = {
+    NGX_MODULE_V1,
+    &ngx_http_api_module_ctx,              /* module context */
+    ngx_http_api_commands,                 /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_http_api_version = ngx_string(NGINX_VERSION);
+
+
+static ngx_data_decl_t  ngx_http_api_nginx_decls[] = {
+
+    { ngx_string("version"), ngx_data_string_handler,
+      (uintptr_t) &ngx_http_api_version },
+
+    { ngx_string("load_timestamp"), ngx_http_api_load_time_handler, 0 },
+
+    { ngx_string("pid"), ngx_http_api_pid_handler, 0 },
+
+    { ngx_string("ppid"), ngx_http_api_pid_handler, 1 },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_connections_decls[] = {
+
+    { ngx_string("accepted"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_connections_t, accepted) },
+
+    { ngx_string("dropped"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_connections_t, dropped) },
+
+    { ngx_string("active"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_connections_t, active) },
+
+    { ngx_string("idle"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_connections_t, idle) },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_requests_decls[] = {
+
+    { ngx_string("total"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_requests_t, total) },
+
+    { ngx_string("current"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_requests_t, current) },
+
+    ngx_data_null_decl
+};
+
+
+#if (NGX_SSL)
+
+static ngx_data_decl_t  ngx_http_api_ssl_decls[] = {
+
+    { ngx_string("handshakes"), ngx_data_stat_handler,
+      NGX_STAT_SSL_HANDSHAKES },
+
+    { ngx_string("handshakes_failed"), ngx_data_stat_handler,
+      NGX_STAT_SSL_HANDSHAKES_FAILED },
+
+    { ngx_string("session_reuses"), ngx_data_stat_handler,
+      NGX_STAT_SSL_SESSION_REUSES },
+
+    ngx_data_null_decl
+};
+
+#endif
+
+
+static ngx_data_decl_t  ngx_http_api_responses_decls[] = {
+
+    { ngx_string("1xx"), ngx_data_stat_handler,
+      NGX_HTTP_API_RESPONSES + 1 },
+
+    { ngx_string("2xx"), ngx_data_stat_handler,
+      NGX_HTTP_API_RESPONSES + 2 },
+
+    { ngx_string("3xx"), ngx_data_stat_handler,
+      NGX_HTTP_API_RESPONSES + 3 },
+
+    { ngx_string("4xx"), ngx_data_stat_handler,
+      NGX_HTTP_API_RESPONSES + 4 },
+
+    { ngx_string("5xx"), ngx_data_stat_handler,
+      NGX_HTTP_API_RESPONSES + 5 },
+
+    { ngx_string("total"), ngx_data_stat_handler,
+      NGX_HTTP_API_RESPONSES },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_server_zone_decls[] = {
+
+    { ngx_string("processing"), ngx_data_stat_handler,
+      NGX_HTTP_API_PROCESSING },
+
+    { ngx_string("requests"), ngx_data_stat_handler,
+      NGX_HTTP_API_REQUESTS },
+
+    { ngx_string("responses"), ngx_data_obj_handler,
+      (uintptr_t) ngx_http_api_responses_decls },
+
+    { ngx_string("discarded"), ngx_data_stat_handler,
+      NGX_HTTP_API_DISCARDED },
+
+    { ngx_string("received"), ngx_data_stat_handler,
+      NGX_HTTP_API_RECEIVED },
+
+    { ngx_string("sent"), ngx_data_stat_handler,
+      NGX_HTTP_API_SENT },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_http_decls[] = {
+
+    { ngx_string("requests"), ngx_http_api_requests_handler, 0 },
+
+    { ngx_string("server_zones"), ngx_http_api_group_handler,
+      NGX_HTTP_API_SERVER_ZONES },
+
+    { ngx_string("upstreams"), ngx_http_api_group_handler,
+      NGX_HTTP_API_UPSTREAMS },
+
+    { ngx_string("caches"), ngx_http_api_group_handler,
+      NGX_HTTP_API_CACHES },
+
+    { ngx_string("limit_reqs"), ngx_http_api_group_handler,
+      NGX_HTTP_API_LIMIT_REQS },
+
+    { ngx_string("limit_conns"), ngx_http_api_group_handler,
+      NGX_HTTP_API_LIMIT_CONNS },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_slab_pages_decls[] = {
+
+    { ngx_string("used"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_t, pages_used) },
+
+    { ngx_string("free"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_t, pages_free) },
+
+    { ngx_string("max_free"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_t, pages_max_free) },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_slab_slot_decls[] = {
+
+    { ngx_string("used"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_slot_t, used) },
+
+    { ngx_string("free"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_slot_t, free) },
+
+    { ngx_string("reqs"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_slot_t, reqs) },
+
+    { ngx_string("fails"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_slot_t, fails) },
+
+    { ngx_string("pages"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_slot_t, pages) },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_slab_decls[] = {
+
+    { ngx_string("pages"), ngx_data_obj_handler,
+      (uintptr_t) ngx_http_api_slab_pages_decls },
+
+    { ngx_string("fails"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_api_slab_t, fails) },
+
+    { ngx_string("hugepages"), ngx_data_struct_str_handler,
+      offsetof(ngx_http_api_slab_t, hugepages) },
+
+    { ngx_string("best_fit"), ngx_data_struct_boolean_handler,
+      offsetof(ngx_http_api_slab_t, best_fit) },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_api_decls[] = {
+
+    { ngx_string("nginx"), ngx_data_obj_handler,
+      (uintptr_t) ngx_http_api_nginx_decls },
+
+    { ngx_string("connections"), ngx_http_api_connections_handler, 0 },
+
+#if (NGX_SSL)
+    { ngx_string("ssl"), ngx_http_api_stub_handler,
+      (uintptr_t) ngx_http_api_ssl_decls },
+#endif
+
+    { ngx_string("http"), ngx_data_obj_handler,
+      (uintptr_t) ngx_http_api_http_decls },
+
+    { ngx_string("slabs"), ngx_http_api_slabs_handler, 0 },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_int_t
+ngx_http_api_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_str_t                  path;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_data_item_t           *root, *item;
+    ngx_http_api_main_conf_t  *amcf;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_api_module);
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    path = r->uri;
+
+#if (NGX_PCRE)
+    if (clcf->regex == NULL)
+#endif
+    {
+        if (path.len >= clcf->name.len
+            && ngx_strncmp(path.data, clcf->name.data, clcf->name.len) == 0)
+        {
+            path.data += clcf->name.len;
+            path.len -= clcf->name.len;
+        }
+    }
+
+    root = ngx_data_obj_handler((uintptr_t) ngx_http_api_decls, r->pool,
+                                amcf);
+    if (root == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    item = ngx_http_api_lookup(root, &path);
+    if (item == NULL) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    b = ngx_json_render(r->pool, item);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->headers_out.content_type_len = sizeof("application/json") - 1;
+    ngx_str_set(&r->headers_out.content_type, "application/json");
+    r->headers_out.content_type_lowcase = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_lookup(ngx_data_item_t *item, ngx_str_t *path)
+{
+    u_char           *p, *last, *end;
+    ngx_int_t         n;
+    ngx_str_t         name;
+    ngx_data_item_t  *child;
+
+    p = path->data;
+    last = p + path->len;
+
+    while (p < last) {
+
+        if (*p == '/') {
+            p++;
+            continue;
+        }
+
+        end = ngx_strlchr(p, last, '/');
+        if (end == NULL) {
+            end = last;
+        }
+
+        name.data = p;
+        name.len = end - p;
+
+        p = end;
+
+        if (item->type == NGX_DATA_OBJECT_TYPE) {
+
+            for (child = item->data.object.item; child; child = child->next) {
+                if (child->name.len == name.len
+                    && ngx_strncmp(child->name.data, name.data, name.len) == 0)
+                {
+                    break;
+                }
+            }
+
+        } else if (item->type == NGX_DATA_LIST_TYPE) {
+
+            n = ngx_atoi(name.data, name.len);
+            if (n == NGX_ERROR) {
+                return NULL;
+            }
+
+            for (child = item->data.object.item; child && n; n--) {
+                child = child->next;
+            }
+
+        } else {
+            return NULL;
+        }
+
+        if (child == NULL) {
+            return NULL;
+        }
+
+        item = child;
+    }
+
+    return item;
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_load_time_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_http_api_main_conf_t *amcf = ctx;
+
+    return ngx_data_time_handler((uintptr_t) &amcf->load_time, pool, NULL);
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_pid_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    return ngx_data_number_handler(data ? ngx_parent : ngx_pid, pool, NULL);
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_connections_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_atomic_int_t            ap, hn, ac, wa;
+    ngx_http_api_connections_t  conns;
+
+    ap = ngx_stat_stub_value(NGX_STAT_ACCEPTED);
+    hn = ngx_stat_stub_value(NGX_STAT_HANDLED);
+    ac = ngx_stat_stub_value(NGX_STAT_ACTIVE);
+    wa = ngx_stat_stub_value(NGX_STAT_WAITING);
+
+    conns.accepted = ap;
+    conns.dropped = ap - hn;
+    conns.active = (ac > wa) ? ac - wa : 0;
+    conns.idle = wa;
+
+    return ngx_data_obj_handler((uintptr_t) ngx_http_api_connections_decls,
+                                pool, &conns);
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_requests_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_http_api_requests_t  requests;
+
+    requests.total = ngx_stat_stub_value(NGX_STAT_REQUESTS);
+    requests.current = ngx_stat_stub_value(NGX_STAT_READING)
+                       + ngx_stat_stub_value(NGX_STAT_WRITING);
+
+    return ngx_data_obj_handler((uintptr_t) ngx_http_api_requests_decls,
+                                pool, &requests);
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_stub_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    return ngx_data_obj_handler(data, pool, &ngx_stat_stub);
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_slabs_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_data_item_t  *obj, *item;
+
+    obj = ngx_data_new_object(pool);
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        item = ngx_http_api_slab_handler((uintptr_t) &shm_zone[i], pool, ctx);
+        if (item == NULL) {
+            return NULL;
+        }
+
+        ngx_data_add_item(obj, &shm_zone[i].shm.name, item);
+    }
+
+    return obj;
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_slab_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_shm_zone_t *shm_zone = (ngx_shm_zone_t *) data;
+
+    u_char                    *p;
+    ngx_str_t                  name;
+    ngx_uint_t                 i, n, size, pages;
+    ngx_data_item_t           *obj, *slots, *item;
+    ngx_slab_stat_t           *stat;
+    ngx_slab_pool_t           *shpool;
+    ngx_http_api_slab_t        slab;
+    ngx_http_api_slab_slot_t  *slot;
+
+    static ngx_str_t  slots_name = ngx_string("slots");
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    pages = (shpool->end - shpool->start) / ngx_pagesize;
+    n = ngx_pagesize_shift - shpool->min_shift;
+
+    slot = ngx_palloc(pool, n * sizeof(ngx_http_api_slab_slot_t));
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    slab.pages_used = pages - shpool->pfree;
+    slab.pages_free = shpool->pfree;
+    slab.pages_max_free = ngx_slab_max_free_locked(shpool);
+    slab.fails = shpool->fails;
+    slab.best_fit = shpool->best_fit;
+
+    for (i = 0; i < n; i++) {
+        stat = &shpool->stats[i];
+
+        slot[i].used = stat->used;
+        slot[i].free = stat->total - stat->used;
+        slot[i].reqs = stat->reqs;
+        slot[i].fails = stat->fails;
+        slot[i].pages = stat->pages;
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    switch (shm_zone->shm.huge) {
+
+    case NGX_SHM_HUGEPAGES_TLB:
+        ngx_str_set(&slab.hugepages, "hugetlb");
+        break;
+
+    case NGX_SHM_HUGEPAGES_THP:
+        ngx_str_set(&slab.hugepages, "transparent");
+        break;
+
+    default:
+        ngx_str_set(&slab.hugepages, "off");
+    }
+
+    obj = ngx_data_obj_handler((uintptr_t) ngx_http_api_slab_decls, pool,
+                               &slab);
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    slots = ngx_data_new_object(pool);
+    if (slots == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+
+        /* slots are named by their chunk size */
+
+        p = ngx_pnalloc(pool, NGX_INT_T_LEN);
+        if (p == NULL) {
+            return NULL;
+        }
+
+        size = (ngx_uint_t) 1 << (shpool->min_shift + i);
+
+        name.data = p;
+        name.len = ngx_sprintf(p, "%ui", size) - p;
+
+        item = ngx_data_obj_handler((uintptr_t) ngx_http_api_slab_slot_decls,
+                                    pool, &slot[i]);
+        if (item == NULL) {
+            return NULL;
+        }
+
+        ngx_data_add_item(slots, &name, item);
+    }
+
+    ngx_data_add_item(obj, &slots_name, slots);
+
+    return obj;
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_group_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_http_api_main_conf_t *amcf = ctx;
+
+    ngx_uint_t        i;
+    ngx_array_t      *group;
+    ngx_data_item_t  *obj, *item;
+    ngx_data_decl_t  *decl;
+
+    obj = ngx_data_new_object(pool);
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    group = &amcf->groups[data];
+    decl = group->elts;
+
+    for (i = 0; i < group->nelts; i++) {
+
+        item = decl[i].handler(decl[i].data, pool, ctx);
+        if (item == NULL) {
+            return NULL;
+        }
+
+        if (item != NGX_DATA_DECLINE) {
+            ngx_data_add_item(obj, &decl[i].name, item);
+        }
+    }
+
+    return obj;
+}
+
+
+static ngx_data_item_t *
+ngx_http_api_server_zone_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_http_api_main_conf_t *amcf = ctx;
+
+    return ngx_data_obj_handler((uintptr_t) ngx_http_api_server_zone_decls,
+                                pool, &amcf->stats[data]);
+}
+
+
+ngx_int_t
+ngx_http_api_add(ngx_conf_t *cf, ngx_uint_t group, ngx_str_t *name,
+    ngx_http_api_handler_pt handler, uintptr_t data)
+{
+    ngx_data_decl_t           *decl;
+    ngx_http_api_main_conf_t  *amcf;
+
+    amcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_api_module);
+
+    decl = ngx_array_push(&amcf->groups[group]);
+    if (decl == NULL) {
+        return NGX_ERROR;
+    }
+
+    decl->name = *name;
+    decl->handler = handler;
+    decl->data = data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_api_post_read_handler(ngx_http_request_t *r)
+{
+    ngx_stat_t                *stat;
+    ngx_pool_cleanup_t        *cln;
+    ngx_http_api_srv_conf_t   *ascf;
+    ngx_http_api_main_conf_t  *amcf;
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
+    ascf = ngx_http_get_module_srv_conf(r, ngx_http_api_module);
+
+    if (ascf->zone == NGX_CONF_UNSET_UINT) {
+        return NGX_DECLINED;
+    }
+
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_api_module);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    stat = &amcf->stats[ascf->zone];
+
+    cln->handler = ngx_http_api_cleanup;
+    cln->data = stat;
+
+    ngx_stat_add(stat, NGX_HTTP_API_PROCESSING, 1);
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_api_cleanup(void *data)
+{
+    ngx_stat_t  *stat = data;
+
+    ngx_stat_add(stat, NGX_HTTP_API_PROCESSING, -1);
+}
+
+
+static ngx_int_t
+ngx_http_api_log_handler(ngx_http_request_t *r)
+{
+    ngx_uint_t                 status;
+    ngx_stat_t                *stat;
+    ngx_http_api_srv_conf_t   *ascf;
+    ngx_http_api_main_conf_t  *amcf;
+
+    ascf = ngx_http_get_module_srv_conf(r, ngx_http_api_module);
+
+    if (ascf->zone == NGX_CONF_UNSET_UINT) {
+        return NGX_OK;
+    }
+
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_api_module);
+
+    stat = &amcf->stats[ascf->zone];
+
+    ngx_stat_add(stat, NGX_HTTP_API_REQUESTS, 1);
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else {
+        status = r->headers_out.status;
+    }
+
+    if (status == NGX_HTTP_CLOSE || status == NGX_HTTP_CLIENT_CLOSED_REQUEST) {
+        ngx_stat_add(stat, NGX_HTTP_API_DISCARDED, 1);
+
+    } else {
+        ngx_stat_add(stat, NGX_HTTP_API_RESPONSES, 1);
+
+        if (status >= 100 && status < 600) {
+            ngx_stat_add(stat, NGX_HTTP_API_RESPONSES + status / 100, 1);
+        }
+    }
+
+    ngx_stat_add(stat, NGX_HTTP_API_RECEIVED,
+                 (ngx_atomic_int_t) r->request_length);
+    ngx_stat_add(stat, NGX_HTTP_API_SENT,
+                 (ngx_atomic_int_t) r->connection->sent);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_api_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_api_main_conf_t  *oamcf = data;
+
+    void                      *p;
+    size_t                     size;
+    ngx_str_t                 *name;
+    ngx_uint_t                 i;
+    ngx_queue_t               *q;
+    ngx_slab_pool_t           *shpool;
+    ngx_http_api_zone_node_t  *node;
+    ngx_http_api_main_conf_t  *amcf;
+
+    amcf = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (oamcf) {
+        amcf->sh = oamcf->sh;
+
+    } else if (shm_zone->shm.exists) {
+        amcf->sh = shpool->data;
+
+    } else {
+        amcf->sh = ngx_slab_alloc(shpool, sizeof(ngx_http_api_shctx_t));
+        if (amcf->sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        shpool->data = amcf->sh;
+
+        ngx_queue_init(&amcf->sh->zones);
+    }
+
+    size = ngx_stat_size(NGX_HTTP_API_NCOUNTERS);
+
+    name = amcf->zones.elts;
+
+    for (i = 0; i < amcf->zones.nelts; i++) {
+
+        for (q = ngx_queue_head(&amcf->sh->zones);
+             q != ngx_queue_sentinel(&amcf->sh->zones);
+             q = ngx_queue_next(q))
+        {
+            node = ngx_queue_data(q, ngx_http_api_zone_node_t, queue);
+
+            if (node->name.len == name[i].len
+                && ngx_strncmp(node->name.data, name[i].data, name[i].len)
+                   == 0)
+            {
+                goto found;
+            }
+        }
+
+        node = ngx_slab_alloc(shpool,
+                              sizeof(ngx_http_api_zone_node_t) + name[i].len);
+        if (node == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_slab_calloc(shpool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_stat_init(&node->stat, p, NGX_HTTP_API_NCOUNTERS);
+
+        node->name.len = name[i].len;
+        node->name.data = (u_char *) node + sizeof(ngx_http_api_zone_node_t);
+        ngx_memcpy(node->name.data, name[i].data, name[i].len);
+
+        ngx_queue_insert_tail(&amcf->sh->zones, &node->queue);
+
+    found:
+
+        amcf->stats[i] = node->stat;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_api_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_uint_t                 i;
+    ngx_http_api_main_conf_t  *amcf;
+
+    amcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_api_main_conf_t));
+    if (amcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     amcf->shm_zone = NULL;
+     *     amcf->sh = NULL;
+     *     amcf->stats = NULL;
+     */
+
+    for (i = 0; i < NGX_HTTP_API_NGROUPS; i++) {
+        if (ngx_array_init(&amcf->groups[i], cf->pool, 4,
+                           sizeof(ngx_data_decl_t))
+            != NGX_OK)
+        {
+            return NULL;
+        }
+    }
+
+    if (ngx_array_init(&amcf->zones, cf->pool, 4, sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    amcf->load_time = *ngx_timeofday();
+
+    return amcf;
+}
+
+
+static void *
+ngx_http_api_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_api_srv_conf_t  *ascf;
+
+    ascf = ngx_palloc(cf->pool, sizeof(ngx_http_api_srv_conf_t));
+    if (ascf == NULL) {
+        return NULL;
+    }
+
+    ascf->zone = NGX_CONF_UNSET_UINT;
+
+    return ascf;
+}
+
+
+static char *
+ngx_http_api(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_api_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_api_status_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_api_srv_conf_t *ascf = conf;
+
+    ngx_str_t                 *value, *name;
+    ngx_uint_t                 i;
+    ngx_http_api_main_conf_t  *amcf;
+
+    if (ascf->zone != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    amcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_api_module);
+
+    name = amcf->zones.elts;
+
+    for (i = 0; i < amcf->zones.nelts; i++) {
+        if (name[i].len == value[1].len
+            && ngx_strncmp(name[i].data, value[1].data, value[1].len) == 0)
+        {
+            ascf->zone = i;
+            return NGX_CONF_OK;
+        }
+    }
+
+    name = ngx_array_push(&amcf->zones);
+    if (name == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *name = value[1];
+    ascf->zone = i;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_api_init(ngx_conf_t *cf)
+{
+    size_t                      size;
+    ngx_str_t                  *name, zone;
+    ngx_uint_t                  i;
+    ngx_http_handler_pt        *h;
+    ngx_http_api_main_conf_t   *amcf;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    amcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_api_module);
+
+    if (amcf->zones.nelts == 0) {
+        return NGX_OK;
+    }
+
+    size = 8 * ngx_pagesize;
+
+    name = amcf->zones.elts;
+
+    for (i = 0; i < amcf->zones.nelts; i++) {
+        if (ngx_http_api_add(cf, NGX_HTTP_API_SERVER_ZONES, &name[i],
+                             ngx_http_api_server_zone_handler, i)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        size += sizeof(ngx_http_api_zone_node_t) + name[i].len
+                + ngx_align(ngx_stat_size(NGX_HTTP_API_NCOUNTERS),
+                            ngx_pagesize);
+    }
+
+    ngx_str_set(&zone, "ngx_http_api");
+
+    amcf->shm_zone = ngx_shared_memory_add(cf, &zone, size,
+                                           &ngx_http_api_module);
+    if (amcf->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    amcf->shm_zone->init = ngx_http_api_init_zone;
+    amcf->shm_zone->data = amcf;
+
+    amcf->stats = ngx_pcalloc(cf->pool,
+                              amcf->zones.nelts * sizeof(ngx_stat_t));
+    if (amcf->stats == NULL) {
+        return NGX_ERROR;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_POST_READ_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_api_post_read_handler;
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_api_log_handler;
+
+    return NGX_OK;
+}
@@ -0,0 +1,36 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_API_MODULE_H_INCLUDED_
+#define _NGX_HTTP_API_MODULE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_API_SERVER_ZONES  0
+#define NGX_HTTP_API_UPSTREAMS     1
+#define NGX_HTTP_API_CACHES        2
+#define NGX_HTTP_API_LIMIT_REQS    3
+#define NGX_HTTP_API_LIMIT_CONNS   4
+
+#define NGX_HTTP_API_NGROUPS       5
+
+
+typedef ngx_data_item_t *(*ngx_http_api_handler_pt)(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+
+
+ngx_int_t ngx_http_api_add(ngx_conf_t *cf, ngx_uint_t group, ngx_str_t *name,
+    ngx_http_api_handler_pt handler, uintptr_t data);
+
+
+extern ngx_module_t  ngx_http_api_module;
+
+
+#endif /* _NGX_HTTP_API_MODULE_H_INCLUDED_ */
@@ -14,6 +14,8 @@
 #define NGX_HTTP_LIMIT_CONN_REJECTED          2
 #define NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN  3
 
+#define NGX_HTTP_LIMIT_CONN_NSTATS            4
+
 
 typedef struct {
     u_char                        color;
@@ -32,6 +34,9 @@ typedef struct {
 typedef struct {
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
+#if (NGX_HTTP_API)
+    ngx_stat_t                    stats;
+#endif
 } ngx_http_limit_conn_shctx_t;
 
 
@@ -60,6 +65,12 @@ static ngx_rbtree_node_t *ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree,
     ngx_str_t *key, uint32_t hash);
 static void ngx_http_limit_conn_cleanup(void *data);
 static ngx_inline void ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool);
+static ngx_inline void ngx_http_limit_conn_stat(
+    ngx_http_limit_conn_ctx_t *ctx, ngx_uint_t status);
+#if (NGX_HTTP_API)
+static ngx_data_item_t *ngx_http_limit_conn_api_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+#endif
 
 static ngx_int_t ngx_http_limit_conn_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -91,7 +102,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_conn_status_bounds = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2|NGX_CONF_TAKE3|NGX_CONF_TAKE4,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -240,10 +251,13 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
                 if (lccf->dry_run) {
                     r->main->limit_conn_status =
                                           NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN;
+                    ngx_http_limit_conn_stat(ctx,
+                                         NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN);
                     return NGX_DECLINED;
                 }
 
                 r->main->limit_conn_status = NGX_HTTP_LIMIT_CONN_REJECTED;
+                ngx_http_limit_conn_stat(ctx, NGX_HTTP_LIMIT_CONN_REJECTED);
 
                 return lccf->status_code;
             }
@@ -275,10 +289,13 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
                 if (lccf->dry_run) {
                     r->main->limit_conn_status =
                                           NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN;
+                    ngx_http_limit_conn_stat(ctx,
+                                         NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN);
                     return NGX_DECLINED;
                 }
 
                 r->main->limit_conn_status = NGX_HTTP_LIMIT_CONN_REJECTED;
+                ngx_http_limit_conn_stat(ctx, NGX_HTTP_LIMIT_CONN_REJECTED);
 
                 return lccf->status_code;
             }
@@ -291,6 +308,8 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         ngx_shmtx_unlock(&ctx->shpool->mutex);
 
+        ngx_http_limit_conn_stat(ctx, NGX_HTTP_LIMIT_CONN_PASSED);
+
         cln = ngx_pool_cleanup_add(r->pool,
                                    sizeof(ngx_http_limit_conn_cleanup_t));
         if (cln == NULL) {
@@ -439,6 +458,9 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_http_limit_conn_ctx_t  *octx = data;
 
     size_t                      len;
+#if (NGX_HTTP_API)
+    void                       *p;
+#endif
     ngx_http_limit_conn_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -481,6 +503,16 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
                     ngx_http_limit_conn_rbtree_insert_value);
 
+#if (NGX_HTTP_API)
+    p = ngx_slab_calloc(ctx->shpool,
+                        ngx_stat_size(NGX_HTTP_LIMIT_CONN_NSTATS));
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_stat_init(&ctx->sh->stats, p, NGX_HTTP_LIMIT_CONN_NSTATS);
+#endif
+
     len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
 
     ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
@@ -495,6 +527,48 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 }
 
 
+static ngx_inline void
+ngx_http_limit_conn_stat(ngx_http_limit_conn_ctx_t *ctx, ngx_uint_t status)
+{
+#if (NGX_HTTP_API)
+    ngx_stat_add(&ctx->sh->stats, status, 1);
+#endif
+}
+
+
+#if (NGX_HTTP_API)
+
+static ngx_data_decl_t  ngx_http_limit_conn_api_decls[] = {
+
+    { ngx_string("passed"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_CONN_PASSED },
+
+    { ngx_string("rejected"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_CONN_REJECTED },
+
+    { ngx_string("rejected_dry_run"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_CONN_REJECTED_DRY_RUN },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_item_t *
+ngx_http_limit_conn_api_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_shm_zone_t *shm_zone = (ngx_shm_zone_t *) data;
+
+    ngx_http_limit_conn_ctx_t  *lctx;
+
+    lctx = shm_zone->data;
+
+    return ngx_data_obj_handler((uintptr_t) ngx_http_limit_conn_api_decls,
+                                pool, &lctx->sh->stats);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_limit_conn_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -564,7 +638,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                            *p;
     ssize_t                            size;
     ngx_str_t                         *value, name, s;
-    ngx_uint_t                         i;
+    ngx_uint_t                         i, hugepages, best_fit;
     ngx_shm_zone_t                    *shm_zone;
     ngx_http_limit_conn_ctx_t         *ctx;
     ngx_http_compile_complex_value_t   ccv;
@@ -587,6 +661,8 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     size = 0;
+    hugepages = 0;
+    best_fit = 0;
     name.len = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
@@ -625,6 +701,16 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[i].data, "hugepages") == 0) {
+            hugepages = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "best_fit") == 0) {
+            best_fit = 1;
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -652,9 +738,20 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    shm_zone->shm.hugepages = hugepages;
+    shm_zone->best_fit = best_fit;
     shm_zone->init = ngx_http_limit_conn_init_zone;
     shm_zone->data = ctx;
 
+#if (NGX_HTTP_API)
+    if (ngx_http_api_add(cf, NGX_HTTP_API_LIMIT_CONNS, &shm_zone->shm.name,
+                         ngx_http_limit_conn_api_handler, (uintptr_t) shm_zone)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     return NGX_CONF_OK;
 }
 
@@ -16,6 +16,8 @@
 #define NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN   4
 #define NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN  5
 
+#define NGX_HTTP_LIMIT_REQ_NSTATS            6
+
 
 typedef struct {
     u_char                       color;
@@ -34,6 +36,9 @@ typedef struct {
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
     ngx_queue_t                   queue;
+#if (NGX_HTTP_API)
+    ngx_stat_t                    stats;
+#endif
 } ngx_http_limit_req_shctx_t;
 
 
@@ -42,6 +47,7 @@ typedef struct {
     ngx_slab_pool_t             *shpool;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
+    ngx_uint_t                   hash;
     ngx_http_complex_value_t     key;
     ngx_http_limit_req_node_t   *node;
 } ngx_http_limit_req_ctx_t;
@@ -73,6 +79,12 @@ static void ngx_http_limit_req_unlock(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
     ngx_uint_t n);
+static ngx_inline void ngx_http_limit_req_stat(
+    ngx_http_limit_req_limit_t *limit, ngx_uint_t status);
+#if (NGX_HTTP_API)
+static ngx_data_item_t *ngx_http_limit_req_api_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+#endif
 
 static ngx_int_t ngx_http_limit_req_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -104,7 +116,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_2MORE,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -194,10 +206,9 @@ static ngx_str_t  ngx_http_limit_req_status[] = {
 static ngx_int_t
 ngx_http_limit_req_handler(ngx_http_request_t *r)
 {
-    uint32_t                     hash;
     ngx_str_t                    key;
     ngx_int_t                    rc;
-    ngx_uint_t                   n, excess;
+    ngx_uint_t                   n, hash, excess;
     ngx_msec_t                   delay;
     ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_conf_t   *lrcf;
@@ -241,7 +252,19 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
             continue;
         }
 
-        hash = ngx_crc32_short(key.data, key.len);
+        switch (ctx->hash) {
+
+        case NGX_HASH_FUNC_XXH3:
+            hash = (ngx_uint_t) ngx_xxh3_64(key.data, key.len, 0);
+            break;
+
+        case NGX_HASH_FUNC_CRC32C:
+            hash = ngx_crc32c_long(key.data, key.len);
+            break;
+
+        default: /* NGX_HASH_FUNC_CRC32 */
+            hash = ngx_crc32_short(key.data, key.len);
+        }
 
         ngx_shmtx_lock(&ctx->shpool->mutex);
 
@@ -277,10 +300,13 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         if (lrcf->dry_run) {
             r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN;
+            ngx_http_limit_req_stat(limit,
+                                    NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN);
             return NGX_DECLINED;
         }
 
         r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_REJECTED;
+        ngx_http_limit_req_stat(limit, NGX_HTTP_LIMIT_REQ_REJECTED);
 
         return lrcf->status_code;
     }
@@ -295,6 +321,7 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
     if (!delay) {
         r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_PASSED;
+        ngx_http_limit_req_stat(limit, NGX_HTTP_LIMIT_REQ_PASSED);
         return NGX_DECLINED;
     }
 
@@ -305,10 +332,13 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
     if (lrcf->dry_run) {
         r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN;
+        ngx_http_limit_req_stat(limit,
+                                NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN);
         return NGX_DECLINED;
     }
 
     r->main->limit_req_status = NGX_HTTP_LIMIT_REQ_DELAYED;
+    ngx_http_limit_req_stat(limit, NGX_HTTP_LIMIT_REQ_DELAYED);
 
     if (r->connection->read->ready) {
         ngx_post_event(r->connection->read, &ngx_posted_events);
@@ -701,6 +731,9 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_http_limit_req_ctx_t  *octx = data;
 
     size_t                     len;
+#if (NGX_HTTP_API)
+    void                      *p;
+#endif
     ngx_http_limit_req_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -719,6 +752,16 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->hash != octx->hash) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses the \"%V\" hash "
+                          "while previously it used the \"%V\" hash",
+                          &shm_zone->shm.name,
+                          &ngx_hash_func_names[ctx->hash],
+                          &ngx_hash_func_names[octx->hash]);
+            return NGX_ERROR;
+        }
+
         ctx->sh = octx->sh;
         ctx->shpool = octx->shpool;
 
@@ -745,6 +788,15 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ngx_queue_init(&ctx->sh->queue);
 
+#if (NGX_HTTP_API)
+    p = ngx_slab_calloc(ctx->shpool, ngx_stat_size(NGX_HTTP_LIMIT_REQ_NSTATS));
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_stat_init(&ctx->sh->stats, p, NGX_HTTP_LIMIT_REQ_NSTATS);
+#endif
+
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
     ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
@@ -757,10 +809,65 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ctx->shpool->log_nomem = 0;
 
+    /* keys of variable length make nodes of mixed sizes */
+
+
     return NGX_OK;
 }
 
 
+static ngx_inline void
+ngx_http_limit_req_stat(ngx_http_limit_req_limit_t *limit, ngx_uint_t status)
+{
+#if (NGX_HTTP_API)
+    ngx_http_limit_req_ctx_t  *ctx;
+
+    ctx = limit->shm_zone->data;
+
+    ngx_stat_add(&ctx->sh->stats, status, 1);
+#endif
+}
+
+
+#if (NGX_HTTP_API)
+
+static ngx_data_decl_t  ngx_http_limit_req_api_decls[] = {
+
+    { ngx_string("passed"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_REQ_PASSED },
+
+    { ngx_string("delayed"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_REQ_DELAYED },
+
+    { ngx_string("rejected"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_REQ_REJECTED },
+
+    { ngx_string("delayed_dry_run"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN },
+
+    { ngx_string("rejected_dry_run"), ngx_data_stat_handler,
+      NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_item_t *
+ngx_http_limit_req_api_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_shm_zone_t *shm_zone = (ngx_shm_zone_t *) data;
+
+    ngx_http_limit_req_ctx_t  *lctx;
+
+    lctx = shm_zone->data;
+
+    return ngx_data_obj_handler((uintptr_t) ngx_http_limit_req_api_decls,
+                                pool, &lctx->sh->stats);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_limit_req_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -836,8 +943,8 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                             len;
     ssize_t                            size;
     ngx_str_t                         *value, name, s;
-    ngx_int_t                          rate, scale;
-    ngx_uint_t                         i;
+    ngx_int_t                          rate, scale, hash;
+    ngx_uint_t                         i, hugepages, best_fit;
     ngx_shm_zone_t                    *shm_zone;
     ngx_http_limit_req_ctx_t          *ctx;
     ngx_http_compile_complex_value_t   ccv;
@@ -860,8 +967,11 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     size = 0;
+    hugepages = 0;
+    best_fit = 0;
     rate = 1;
     scale = 1;
+    hash = NGX_HASH_FUNC_CRC32;
     name.len = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
@@ -924,6 +1034,32 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[i].data, "hugepages") == 0) {
+            hugepages = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "best_fit") == 0) {
+            best_fit = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "hash=", 5) == 0) {
+
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            hash = ngx_hash_func(&s);
+
+            if (hash == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid hash \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -937,6 +1073,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->rate = rate * 1000 / scale;
+    ctx->hash = hash;
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
@@ -953,9 +1090,20 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    shm_zone->shm.hugepages = hugepages;
+    shm_zone->best_fit = best_fit;
     shm_zone->init = ngx_http_limit_req_init_zone;
     shm_zone->data = ctx;
 
+#if (NGX_HTTP_API)
+    if (ngx_http_api_add(cf, NGX_HTTP_API_LIMIT_REQS, &shm_zone->shm.name,
+                         ngx_http_limit_req_api_handler, (uintptr_t) shm_zone)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     return NGX_CONF_OK;
 }
 
@@ -26,11 +26,38 @@ typedef enum {
 } ngx_http_proxy_v2_state_e;
 
 
+#define NGX_HTTP_PROXY_V2_STREAM_WINDOW  (1 << 18)
+#define NGX_HTTP_PROXY_V2_BUFFER_SIZE    NGX_HTTP_V2_DEFAULT_FRAME_SIZE
+#define NGX_HTTP_PROXY_V2_MAX_STREAM_ID  0x7fffffff
+#define NGX_HTTP_PROXY_V2_MAX_INDEX      1024
+
+#define NGX_HTTP_PROXY_V2_CANCEL         0x8
+
+
+typedef struct ngx_http_proxy_v2_session_s  ngx_http_proxy_v2_session_t;
+typedef struct ngx_http_proxy_v2_stream_s   ngx_http_proxy_v2_stream_t;
+
+
+typedef struct {
+    ngx_uint_t                     max_sessions;
+    ngx_uint_t                     max_streams;
+    ngx_msec_t                     timeout;
+
+    ngx_uint_t                     nsessions;
+    ngx_queue_t                    sessions;
+
+    ngx_http_upstream_init_peer_pt  original_init_peer;
+} ngx_http_proxy_v2_srv_conf_t;
+
+
 typedef struct {
     size_t                         init_window;
     size_t                         send_window;
     size_t                         recv_window;
+    size_t                         stream_window;
     ngx_uint_t                     last_stream_id;
+    ngx_uint_t                     max_streams;
+    ngx_http_proxy_v2_session_t   *session;
 } ngx_http_proxy_v2_conn_t;
 
 
@@ -47,6 +74,7 @@ typedef struct {
     ngx_chain_t                   *busy;
 
     ngx_http_proxy_v2_conn_t      *connection;
+    ngx_http_proxy_v2_stream_t    *stream;
 
     ngx_uint_t                     id;
 
@@ -110,6 +138,76 @@ typedef struct {
 } ngx_http_proxy_v2_frame_t;
 
 
+struct ngx_http_proxy_v2_session_s {
+    ngx_http_proxy_v2_srv_conf_t  *conf;
+    ngx_queue_t                    queue;
+
+    ngx_connection_t              *connection;
+    ngx_pool_t                    *pool;
+    ngx_http_proxy_v2_conn_t      *conn;
+
+    ngx_http_upstream_conf_t      *tag;
+    socklen_t                      socklen;
+    ngx_sockaddr_t                 sockaddr;
+
+    ngx_queue_t                    streams;
+    ngx_uint_t                     nstreams;
+
+    ngx_http_proxy_v2_stream_t   **index;
+    ngx_uint_t                     index_mask;
+
+    ngx_buf_t                     *buffer;
+    ngx_chain_t                   *out;
+    ngx_chain_t                   *out_last;
+    ngx_chain_t                   *free;
+
+    ngx_http_proxy_v2_stream_t    *stream;
+    size_t                         rest;
+
+    unsigned                       payload:1;
+    unsigned                       goaway:1;
+};
+
+
+struct ngx_http_proxy_v2_stream_s {
+    ngx_connection_t               connection;
+    ngx_event_t                    read;
+    ngx_event_t                    write;
+
+    ngx_http_proxy_v2_session_t   *session;
+    ngx_http_proxy_v2_ctx_t       *ctx;
+    ngx_queue_t                    queue;
+    ngx_http_proxy_v2_stream_t    *index;
+
+    ngx_uint_t                     id;
+
+    ngx_chain_t                   *in;
+    ngx_chain_t                   *in_last;
+
+    unsigned                       error:1;
+};
+
+
+typedef struct {
+    ngx_http_proxy_v2_srv_conf_t  *conf;
+
+    ngx_http_request_t            *request;
+    ngx_http_proxy_v2_stream_t    *stream;
+
+    void                          *data;
+
+    ngx_event_get_peer_pt          original_get_peer;
+    ngx_event_free_peer_pt         original_free_peer;
+
+#if (NGX_HTTP_SSL)
+    ngx_event_set_peer_session_pt  original_set_session;
+    ngx_event_save_peer_session_pt original_save_session;
+#endif
+
+    ngx_event_notify_peer_pt       original_notify;
+} ngx_http_proxy_v2_peer_data_t;
+
+
 static ngx_int_t ngx_http_proxy_v2_create_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_proxy_v2_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_proxy_v2_body_output_filter(void *data,
@@ -168,15 +266,92 @@ static void ngx_http_proxy_v2_abort_request(ngx_http_request_t *r);
 static void ngx_http_proxy_v2_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
+static ngx_int_t ngx_http_proxy_v2_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_proxy_v2_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_proxy_v2_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+#if (NGX_HTTP_SSL)
+static ngx_int_t ngx_http_proxy_v2_set_session(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_proxy_v2_save_session(ngx_peer_connection_t *pc,
+    void *data);
+#endif
+static void ngx_http_proxy_v2_notify_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t type);
+
+static ngx_int_t ngx_http_proxy_v2_create_session(
+    ngx_http_proxy_v2_peer_data_t *pd, ngx_peer_connection_t *pc);
+static void ngx_http_proxy_v2_close_session(ngx_http_proxy_v2_session_t *s);
+static void ngx_http_proxy_v2_session_read_handler(ngx_event_t *rev);
+static void ngx_http_proxy_v2_session_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_proxy_v2_session_process(
+    ngx_http_proxy_v2_session_t *s);
+static ngx_int_t ngx_http_proxy_v2_session_control(
+    ngx_http_proxy_v2_session_t *s, u_char *p, size_t len);
+static ngx_int_t ngx_http_proxy_v2_session_frame(
+    ngx_http_proxy_v2_session_t *s, ngx_uint_t type, ngx_uint_t flags,
+    ngx_uint_t sid, u_char *payload, size_t len);
+static ngx_int_t ngx_http_proxy_v2_session_copy(
+    ngx_http_proxy_v2_session_t *s, ngx_chain_t **first, ngx_chain_t **last,
+    u_char *p, size_t len);
+static ngx_int_t ngx_http_proxy_v2_session_send(
+    ngx_http_proxy_v2_session_t *s);
+static void ngx_http_proxy_v2_session_wakeup(ngx_http_proxy_v2_session_t *s);
+static ngx_http_proxy_v2_stream_t *ngx_http_proxy_v2_get_stream_by_id(
+    ngx_http_proxy_v2_session_t *s, ngx_uint_t sid);
+static void ngx_http_proxy_v2_index_stream(ngx_http_proxy_v2_stream_t *st,
+    ngx_uint_t sid);
+
+static ngx_connection_t *ngx_http_proxy_v2_create_stream(
+    ngx_http_proxy_v2_session_t *s, ngx_http_proxy_v2_peer_data_t *pd,
+    ngx_peer_connection_t *pc);
+static void ngx_http_proxy_v2_close_stream(ngx_http_proxy_v2_stream_t *st,
+    ngx_uint_t reset);
+static ssize_t ngx_http_proxy_v2_stream_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_proxy_v2_stream_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ssize_t ngx_http_proxy_v2_stream_send(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ngx_chain_t *ngx_http_proxy_v2_stream_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+
+static void *ngx_http_proxy_v2_create_srv_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_proxy_v2_init(ngx_conf_t *cf);
+static char *ngx_http_proxy_v2_multiplex(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_proxy_v2_commands[] = {
+
+    { ngx_string("http2_multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_proxy_v2_multiplex,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("http2_multiplex_timeout"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_proxy_v2_srv_conf_t, timeout),
+      NULL },
+
+      ngx_null_command
+};
+
 
 static ngx_http_module_t  ngx_http_proxy_v2_module_ctx = {
     NULL,                                  /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_proxy_v2_init,                /* postconfiguration */
 
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
 
-    NULL,                                  /* create server configuration */
+    ngx_http_proxy_v2_create_srv_conf,     /* create server configuration */
     NULL,                                  /* merge server configuration */
 
     NULL,                                  /* create location configuration */
@@ -187,7 +362,7 @@ static ngx_http_module_t  ngx_http_proxy_v2_module_ctx = {
 ngx_module_t  ngx_http_proxy_v2_module = {
     NGX_MODULE_V1,
     &ngx_http_proxy_v2_module_ctx,         /* module context */
-    NULL,                                  /* module directives */
+    ngx_http_proxy_v2_commands,            /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
@@ -2203,19 +2378,29 @@ ngx_http_proxy_v2_process_frames(ngx_http_request_t *r,
                     return NGX_ERROR;
                 }
 
-                if (ctx->rest > ctx->connection->recv_window) {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                  "upstream violated connection flow control, "
-                                  "received %uz data frame with window %uz",
-                                  ctx->rest, ctx->connection->recv_window);
-                    return NGX_ERROR;
+                /*
+                 * on multiplexed connections the connection window
+                 * is accounted by the session for all streams
+                 */
+
+                if (ctx->connection->session == NULL) {
+
+                    if (ctx->rest > ctx->connection->recv_window) {
+                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                      "upstream violated connection flow "
+                                      "control, received %uz data frame "
+                                      "with window %uz",
+                                      ctx->rest, ctx->connection->recv_window);
+                        return NGX_ERROR;
+                    }
+
+                    ctx->connection->recv_window -= ctx->rest;
                 }
 
                 ctx->recv_window -= ctx->rest;
-                ctx->connection->recv_window -= ctx->rest;
 
                 if (ctx->connection->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4
-                    || ctx->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4)
+                    || ctx->recv_window < ctx->connection->stream_window / 4)
                 {
                     if (ngx_http_proxy_v2_send_window_update(r, ctx)
                         != NGX_OK)
@@ -3847,9 +4032,15 @@ ngx_http_proxy_v2_parse_settings(ngx_http_request_t *r,
              * SETTINGS_MAX_FRAME_SIZE, SETTINGS_MAX_HEADER_LIST_SIZE
              *
              * Only SETTINGS_INITIAL_WINDOW_SIZE seems to be needed in
-             * a simple client.
+             * a simple client, SETTINGS_MAX_CONCURRENT_STREAMS is saved
+             * to limit streams if the connection is multiplexed later.
              */
 
+            if (ctx->setting_id == 0x03) {
+                /* SETTINGS_MAX_CONCURRENT_STREAMS */
+                ctx->connection->max_streams = ctx->setting_value;
+            }
+
             if (ctx->setting_id == 0x04) {
                 /* SETTINGS_INITIAL_WINDOW_SIZE */
 
@@ -4087,26 +4278,28 @@ ngx_http_proxy_v2_send_window_update(ngx_http_request_t *r,
         return NGX_ERROR;
     }
 
-    f = (ngx_http_proxy_v2_frame_t *) cl->buf->last;
-    cl->buf->last += sizeof(ngx_http_proxy_v2_frame_t);
+    if (ctx->connection->session == NULL) {
+        f = (ngx_http_proxy_v2_frame_t *) cl->buf->last;
+        cl->buf->last += sizeof(ngx_http_proxy_v2_frame_t);
 
-    f->length_0 = 0;
-    f->length_1 = 0;
-    f->length_2 = 4;
-    f->type = NGX_HTTP_V2_WINDOW_UPDATE_FRAME;
-    f->flags = 0;
-    f->stream_id_0 = 0;
-    f->stream_id_1 = 0;
-    f->stream_id_2 = 0;
-    f->stream_id_3 = 0;
+        f->length_0 = 0;
+        f->length_1 = 0;
+        f->length_2 = 4;
+        f->type = NGX_HTTP_V2_WINDOW_UPDATE_FRAME;
+        f->flags = 0;
+        f->stream_id_0 = 0;
+        f->stream_id_1 = 0;
+        f->stream_id_2 = 0;
+        f->stream_id_3 = 0;
 
-    n = NGX_HTTP_V2_MAX_WINDOW - ctx->connection->recv_window;
-    ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+        n = NGX_HTTP_V2_MAX_WINDOW - ctx->connection->recv_window;
+        ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
 
-    *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
-    *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
-    *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
-    *cl->buf->last++ = (u_char) (n & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
+        *cl->buf->last++ = (u_char) (n & 0xff);
+    }
 
     f = (ngx_http_proxy_v2_frame_t *) cl->buf->last;
     cl->buf->last += sizeof(ngx_http_proxy_v2_frame_t);
@@ -4121,8 +4314,8 @@ ngx_http_proxy_v2_send_window_update(ngx_http_request_t *r,
     f->stream_id_2 = (u_char) ((ctx->id >> 8) & 0xff);
     f->stream_id_3 = (u_char) (ctx->id & 0xff);
 
-    n = NGX_HTTP_V2_MAX_WINDOW - ctx->recv_window;
-    ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    n = ctx->connection->stream_window - ctx->recv_window;
+    ctx->recv_window = ctx->connection->stream_window;
 
     *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
     *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
@@ -4217,6 +4410,23 @@ ngx_http_proxy_v2_get_connection_data(ngx_http_request_t *r,
         goto done;
     }
 
+    if (ctx->stream) {
+
+        /* multiplexed connection, see ngx_http_proxy_v2_get_peer() */
+
+        ctx->connection = ctx->stream->session->conn;
+
+        ctx->send_window = ctx->connection->init_window;
+        ctx->recv_window = ctx->connection->stream_window;
+
+        ctx->connection->last_stream_id += 2;
+        ctx->id = ctx->connection->last_stream_id;
+
+        ngx_http_proxy_v2_index_stream(ctx->stream, ctx->id);
+
+        return NGX_OK;
+    }
+
     c = pc->connection;
 
     if (pc->cached) {
@@ -4241,7 +4451,7 @@ ngx_http_proxy_v2_get_connection_data(ngx_http_request_t *r,
         }
 
         ctx->send_window = ctx->connection->init_window;
-        ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+        ctx->recv_window = ctx->connection->stream_window;
 
         ctx->connection->last_stream_id += 2;
         ctx->id = ctx->connection->last_stream_id;
@@ -4264,11 +4474,14 @@ done:
     ctx->connection->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->connection->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    ctx->connection->stream_window = NGX_HTTP_V2_MAX_WINDOW;
 
     ctx->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
 
     ctx->connection->last_stream_id = 1;
+    ctx->connection->max_streams = NGX_MAX_UINT32_VALUE;
+    ctx->connection->session = NULL;
 
     return NGX_OK;
 }
@@ -4312,3 +4525,1521 @@ ngx_http_proxy_v2_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
                    "finalize proxy http2 request");
     return;
 }
+
+
+static ngx_int_t
+ngx_http_proxy_v2_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_proxy_v2_peer_data_t  *pd;
+    ngx_http_proxy_v2_srv_conf_t   *pscf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init http2 multiplex peer");
+
+    pscf = ngx_http_conf_upstream_srv_conf(us, ngx_http_proxy_v2_module);
+
+    pd = ngx_palloc(r->pool, sizeof(ngx_http_proxy_v2_peer_data_t));
+    if (pd == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (pscf->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    pd->conf = pscf;
+    pd->request = r;
+    pd->stream = NULL;
+    pd->data = r->upstream->peer.data;
+    pd->original_get_peer = r->upstream->peer.get;
+    pd->original_free_peer = r->upstream->peer.free;
+
+    r->upstream->peer.data = pd;
+    r->upstream->peer.get = ngx_http_proxy_v2_get_peer;
+    r->upstream->peer.free = ngx_http_proxy_v2_free_peer;
+
+#if (NGX_HTTP_SSL)
+    pd->original_set_session = r->upstream->peer.set_session;
+    pd->original_save_session = r->upstream->peer.save_session;
+    r->upstream->peer.set_session = ngx_http_proxy_v2_set_session;
+    r->upstream->peer.save_session = ngx_http_proxy_v2_save_session;
+#endif
+
+    if (r->upstream->peer.notify) {
+        pd->original_notify = r->upstream->peer.notify;
+        r->upstream->peer.notify = ngx_http_proxy_v2_notify_peer;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_proxy_v2_peer_data_t  *pd = data;
+
+    ngx_int_t                     rc;
+    ngx_queue_t                  *q;
+    ngx_connection_t             *fc;
+    ngx_http_upstream_t          *u;
+    ngx_http_proxy_v2_ctx_t      *ctx;
+    ngx_http_proxy_v2_session_t  *s;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get http2 multiplex peer");
+
+    /* ask balancer */
+
+    rc = pd->original_get_peer(pc, pd->data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ctx = ngx_http_get_module_ctx(pd->request, ngx_http_proxy_v2_module);
+
+    if (ctx == NULL || !(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+        return NGX_OK;
+    }
+
+    /* search for a session with a free stream */
+
+    u = pd->request->upstream;
+
+    for (q = ngx_queue_head(&pd->conf->sessions);
+         q != ngx_queue_sentinel(&pd->conf->sessions);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_proxy_v2_session_t, queue);
+
+        if (s->goaway || s->tag != u->conf) {
+            continue;
+        }
+
+        if (s->nstreams >= pd->conf->max_streams
+            || s->nstreams >= s->conn->max_streams
+            || s->conn->last_stream_id + 2 * (s->nstreams + 1)
+               > NGX_HTTP_PROXY_V2_MAX_STREAM_ID)
+        {
+            continue;
+        }
+
+        if (ngx_memn2cmp((u_char *) &s->sockaddr, (u_char *) pc->sockaddr,
+                         s->socklen, pc->socklen)
+            == 0)
+        {
+            goto found;
+        }
+    }
+
+    return NGX_OK;
+
+found:
+
+    fc = ngx_http_proxy_v2_create_stream(s, pd, pc);
+    if (fc == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get http2 multiplex peer: using connection %p, "
+                   "streams: %ui", s->connection, s->nstreams);
+
+    pc->connection = fc;
+    pc->cached = 1;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_proxy_v2_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_proxy_v2_peer_data_t  *pd = data;
+
+    ngx_connection_t     *c;
+    ngx_http_upstream_t  *u;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free http2 multiplex peer");
+
+    u = pd->request->upstream;
+
+    if (pd->stream) {
+        ngx_http_proxy_v2_close_stream(pd->stream,
+                                       (state & NGX_PEER_FAILED)
+                                       || !u->keepalive);
+        pd->stream = NULL;
+        pc->connection = NULL;
+        goto done;
+    }
+
+    /* turn a connection which completed a request into a session */
+
+    c = pc->connection;
+
+    if (state & NGX_PEER_FAILED
+        || c == NULL
+        || c->read->eof
+        || c->read->error
+        || c->read->timedout
+        || c->write->error
+        || c->write->timedout)
+    {
+        goto done;
+    }
+
+    if (!u->keepalive || !u->request_body_sent) {
+        goto done;
+    }
+
+    if (ngx_terminate || ngx_exiting) {
+        goto done;
+    }
+
+    if (!(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+        goto done;
+    }
+
+    (void) ngx_http_proxy_v2_create_session(pd, pc);
+
+done:
+
+    pd->original_free_peer(pc, pd->data, state);
+}
+
+
+#if (NGX_HTTP_SSL)
+
+static ngx_int_t
+ngx_http_proxy_v2_set_session(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_proxy_v2_peer_data_t  *pd = data;
+
+    return pd->original_set_session(pc, pd->data);
+}
+
+
+static void
+ngx_http_proxy_v2_save_session(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_proxy_v2_peer_data_t  *pd = data;
+
+    pd->original_save_session(pc, pd->data);
+    return;
+}
+
+#endif
+
+
+static void
+ngx_http_proxy_v2_notify_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t type)
+{
+    ngx_http_proxy_v2_peer_data_t  *pd = data;
+
+    pd->original_notify(pc, pd->data, type);
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_create_session(ngx_http_proxy_v2_peer_data_t *pd,
+    ngx_peer_connection_t *pc)
+{
+    u_char                        settings[6];
+    ngx_uint_t                    n;
+    ngx_connection_t             *c;
+    ngx_http_proxy_v2_ctx_t      *ctx;
+    ngx_http_proxy_v2_conn_t     *conn;
+    ngx_http_proxy_v2_session_t  *s;
+
+    if (pd->conf->nsessions >= pd->conf->max_sessions) {
+        return NGX_DECLINED;
+    }
+
+    ctx = ngx_http_get_module_ctx(pd->request, ngx_http_proxy_v2_module);
+
+    if (ctx == NULL || ctx->connection == NULL || ctx->goaway) {
+        return NGX_DECLINED;
+    }
+
+    conn = ctx->connection;
+
+    if (conn->session
+        || conn->last_stream_id + 2 > NGX_HTTP_PROXY_V2_MAX_STREAM_ID)
+    {
+        return NGX_DECLINED;
+    }
+
+    c = pc->connection;
+
+    s = ngx_pcalloc(c->pool, sizeof(ngx_http_proxy_v2_session_t));
+    if (s == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->buffer = ngx_create_temp_buf(c->pool,
+                                    2 * NGX_HTTP_PROXY_V2_BUFFER_SIZE);
+    if (s->buffer == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->conf = pd->conf;
+    s->connection = c;
+    s->pool = c->pool;
+    s->conn = conn;
+    s->tag = pd->request->upstream->conf;
+
+    s->socklen = pc->socklen;
+    ngx_memcpy(&s->sockaddr, pc->sockaddr, pc->socklen);
+
+    ngx_queue_init(&s->streams);
+
+    /* frames are matched to streams by the index of stream ids */
+
+    for (n = 1; n < pd->conf->max_streams && n < NGX_HTTP_PROXY_V2_MAX_INDEX;
+         n <<= 1)
+    {
+        /* void */
+    }
+
+    s->index = ngx_pcalloc(c->pool, n * sizeof(ngx_http_proxy_v2_stream_t *));
+    if (s->index == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->index_mask = n - 1;
+
+    /*
+     * streams are limited to a smaller window, so a slow client
+     * cannot make the session buffer unlimited amount of data
+     */
+
+    conn->session = s;
+    conn->stream_window = NGX_HTTP_PROXY_V2_STREAM_WINDOW;
+
+    settings[0] = 0;
+    settings[1] = 0x04;
+    settings[2] = (u_char) ((NGX_HTTP_PROXY_V2_STREAM_WINDOW >> 24) & 0xff);
+    settings[3] = (u_char) ((NGX_HTTP_PROXY_V2_STREAM_WINDOW >> 16) & 0xff);
+    settings[4] = (u_char) ((NGX_HTTP_PROXY_V2_STREAM_WINDOW >> 8) & 0xff);
+    settings[5] = (u_char) (NGX_HTTP_PROXY_V2_STREAM_WINDOW & 0xff);
+
+    if (ngx_http_proxy_v2_session_frame(s, NGX_HTTP_V2_SETTINGS_FRAME, 0, 0,
+                                        settings, sizeof(settings))
+        != NGX_OK)
+    {
+        conn->session = NULL;
+        conn->stream_window = NGX_HTTP_V2_MAX_WINDOW;
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "http2 multiplex session: using connection %p", c);
+
+    ngx_queue_insert_head(&pd->conf->sessions, &s->queue);
+    pd->conf->nsessions++;
+
+    pc->connection = NULL;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->read->delayed = 0;
+    ngx_add_timer(c->read, pd->conf->timeout);
+
+    c->read->handler = ngx_http_proxy_v2_session_read_handler;
+    c->write->handler = ngx_http_proxy_v2_session_write_handler;
+
+    c->data = s;
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    c->pool->log = ngx_cycle->log;
+
+    if (ngx_http_proxy_v2_session_send(s) != NGX_OK) {
+        ngx_http_proxy_v2_close_session(s);
+        return NGX_OK;
+    }
+
+    if (c->read->ready) {
+        ngx_post_event(c->read, &ngx_posted_events);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_close_session(ngx_http_proxy_v2_session_t *s)
+{
+    ngx_queue_t                 *q;
+    ngx_connection_t            *c;
+    ngx_http_proxy_v2_stream_t  *st;
+
+    c = s->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "close http2 multiplex session: %p, streams: %ui",
+                   c, s->nstreams);
+
+    ngx_queue_remove(&s->queue);
+    s->conf->nsessions--;
+
+    /* streams see end of file once their buffered frames are read */
+
+    for (q = ngx_queue_head(&s->streams);
+         q != ngx_queue_sentinel(&s->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+        st->read.ready = 1;
+        ngx_post_event(&st->read, &ngx_posted_events);
+        ngx_post_event(&st->write, &ngx_posted_events);
+    }
+
+    s->connection = NULL;
+
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+
+#endif
+
+    ngx_close_connection(c);
+
+    /* the pool keeps buffers of attached streams */
+
+    if (s->nstreams == 0) {
+        ngx_destroy_pool(s->pool);
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_session_read_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_buf_t                    *b;
+    ngx_connection_t             *c;
+    ngx_http_proxy_v2_session_t  *s;
+
+    c = rev->data;
+    s = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplex session read handler");
+
+    if (c->close || rev->timedout) {
+        ngx_http_proxy_v2_close_session(s);
+        return;
+    }
+
+    b = s->buffer;
+
+    for ( ;; ) {
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "upstream closed multiplexed http2 connection");
+            ngx_http_proxy_v2_close_session(s);
+            return;
+        }
+
+        b->last += n;
+
+        if (ngx_http_proxy_v2_session_process(s) != NGX_OK) {
+            ngx_http_proxy_v2_close_session(s);
+            return;
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_proxy_v2_close_session(s);
+        return;
+    }
+
+    if (ngx_http_proxy_v2_session_send(s) != NGX_OK) {
+        ngx_http_proxy_v2_close_session(s);
+        return;
+    }
+
+    if (s->goaway && s->nstreams == 0) {
+        ngx_http_proxy_v2_close_session(s);
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_session_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t             *c;
+    ngx_http_proxy_v2_session_t  *s;
+
+    c = wev->data;
+    s = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 multiplex session write handler");
+
+    if (ngx_http_proxy_v2_session_send(s) != NGX_OK) {
+        ngx_http_proxy_v2_close_session(s);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_session_process(ngx_http_proxy_v2_session_t *s)
+{
+    u_char                      *p, window[4];
+    size_t                       len, size;
+    ngx_buf_t                   *b;
+    ngx_uint_t                   type, sid;
+    ngx_http_proxy_v2_conn_t    *conn;
+
+    b = s->buffer;
+    conn = s->conn;
+
+    for ( ;; ) {
+
+        if (!s->payload) {
+
+            if (b->last - b->pos < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+                break;
+            }
+
+            p = b->pos;
+
+            len = (p[0] << 16) + (p[1] << 8) + p[2];
+            type = p[3];
+            sid = ((ngx_uint_t) (p[5] & 0x7f) << 24)
+                  + (p[6] << 16) + (p[7] << 8) + p[8];
+
+            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, s->connection->log, 0,
+                           "http2 multiplex frame type:%ui l:%uz sid:%ui",
+                           type, len, sid);
+
+            if (sid == 0) {
+
+                /* connection control frames are processed as a whole */
+
+                if (len > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+                    ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                                  "upstream sent too large http2 frame: %uz",
+                                  len);
+                    return NGX_ERROR;
+                }
+
+                if ((size_t) (b->last - b->pos)
+                    < NGX_HTTP_V2_FRAME_HEADER_SIZE + len)
+                {
+                    break;
+                }
+
+                if (ngx_http_proxy_v2_session_control(s, p, len) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+                b->pos += NGX_HTTP_V2_FRAME_HEADER_SIZE + len;
+                continue;
+            }
+
+            if (type == NGX_HTTP_V2_DATA_FRAME) {
+
+                if (len > conn->recv_window) {
+                    ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                                  "upstream violated connection flow control, "
+                                  "received %uz data frame with window %uz",
+                                  len, conn->recv_window);
+                    return NGX_ERROR;
+                }
+
+                conn->recv_window -= len;
+
+                if (conn->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4) {
+                    size = NGX_HTTP_V2_MAX_WINDOW - conn->recv_window;
+                    conn->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+
+                    window[0] = (u_char) ((size >> 24) & 0xff);
+                    window[1] = (u_char) ((size >> 16) & 0xff);
+                    window[2] = (u_char) ((size >> 8) & 0xff);
+                    window[3] = (u_char) (size & 0xff);
+
+                    if (ngx_http_proxy_v2_session_frame(s,
+                                                NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                                0, 0, window, 4)
+                        != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+                }
+            }
+
+            /* frames of unknown streams are skipped */
+
+            s->stream = ngx_http_proxy_v2_get_stream_by_id(s, sid);
+
+            if (s->stream) {
+                if (ngx_http_proxy_v2_session_copy(s, &s->stream->in,
+                                               &s->stream->in_last, p,
+                                               NGX_HTTP_V2_FRAME_HEADER_SIZE)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+
+            b->pos += NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+            s->rest = len;
+            s->payload = 1;
+        }
+
+        size = ngx_min(s->rest, (size_t) (b->last - b->pos));
+
+        if (s->stream) {
+            if (size
+                && ngx_http_proxy_v2_session_copy(s, &s->stream->in,
+                                                  &s->stream->in_last,
+                                                  b->pos, size)
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            s->stream->read.ready = 1;
+            ngx_post_event(&s->stream->read, &ngx_posted_events);
+        }
+
+        b->pos += size;
+        s->rest -= size;
+
+        if (s->rest) {
+            break;
+        }
+
+        s->payload = 0;
+    }
+
+    if (b->pos == b->last) {
+        b->pos = b->start;
+        b->last = b->start;
+
+    } else if (b->pos != b->start) {
+        b->last = ngx_movemem(b->start, b->pos, b->last - b->pos);
+        b->pos = b->start;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_session_control(ngx_http_proxy_v2_session_t *s, u_char *p,
+    size_t len)
+{
+    u_char                      *pos;
+    ssize_t                      window_update;
+    ngx_uint_t                   type, flags, id, value;
+    ngx_queue_t                 *q;
+    ngx_connection_t            *c;
+    ngx_http_proxy_v2_conn_t    *conn;
+    ngx_http_proxy_v2_stream_t  *st;
+
+    c = s->connection;
+    conn = s->conn;
+
+    type = p[3];
+    flags = p[4];
+    pos = p + NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+    switch (type) {
+
+    case NGX_HTTP_V2_SETTINGS_FRAME:
+
+        if (flags & NGX_HTTP_V2_ACK_FLAG) {
+
+            if (len != 0) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream sent settings frame "
+                              "with ack flag and non-zero length: %uz",
+                              len);
+                return NGX_ERROR;
+            }
+
+            return NGX_OK;
+        }
+
+        if (len % 6 != 0) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent settings frame "
+                          "with invalid length: %uz",
+                          len);
+            return NGX_ERROR;
+        }
+
+        for ( /* void */ ; len; len -= 6, pos += 6) {
+
+            id = (pos[0] << 8) + pos[1];
+            value = ((ngx_uint_t) pos[2] << 24)
+                    + (pos[3] << 16) + (pos[4] << 8) + pos[5];
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "http2 multiplex setting: %ui %ui", id, value);
+
+            if (id == 0x03) {
+                /* SETTINGS_MAX_CONCURRENT_STREAMS */
+                conn->max_streams = value;
+                continue;
+            }
+
+            if (id != 0x04) {
+                continue;
+            }
+
+            /* SETTINGS_INITIAL_WINDOW_SIZE */
+
+            if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream sent settings frame "
+                              "with too large initial window size: %ui",
+                              value);
+                return NGX_ERROR;
+            }
+
+            window_update = (ssize_t) value - (ssize_t) conn->init_window;
+            conn->init_window = value;
+
+            for (q = ngx_queue_head(&s->streams);
+                 q != ngx_queue_sentinel(&s->streams);
+                 q = ngx_queue_next(q))
+            {
+                st = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+                if (st->id == 0) {
+                    continue;
+                }
+
+                if (st->ctx->send_window > 0
+                    && window_update > (ssize_t) NGX_HTTP_V2_MAX_WINDOW
+                                       - st->ctx->send_window)
+                {
+                    ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                                  "upstream sent settings frame "
+                                  "with too large initial window size: %ui",
+                                  value);
+                    return NGX_ERROR;
+                }
+
+                st->ctx->send_window += window_update;
+            }
+        }
+
+        ngx_http_proxy_v2_session_wakeup(s);
+
+        return ngx_http_proxy_v2_session_frame(s, NGX_HTTP_V2_SETTINGS_FRAME,
+                                               NGX_HTTP_V2_ACK_FLAG, 0,
+                                               NULL, 0);
+
+    case NGX_HTTP_V2_PING_FRAME:
+
+        if (len != 8) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent ping frame with invalid length: %uz",
+                          len);
+            return NGX_ERROR;
+        }
+
+        if (flags & NGX_HTTP_V2_ACK_FLAG) {
+            return NGX_OK;
+        }
+
+        return ngx_http_proxy_v2_session_frame(s, NGX_HTTP_V2_PING_FRAME,
+                                               NGX_HTTP_V2_ACK_FLAG, 0,
+                                               pos, 8);
+
+    case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+        if (len != 4) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent window update frame "
+                          "with invalid length: %uz",
+                          len);
+            return NGX_ERROR;
+        }
+
+        value = ((ngx_uint_t) (pos[0] & 0x7f) << 24)
+                + (pos[1] << 16) + (pos[2] << 8) + pos[3];
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http2 multiplex window update: %ui", value);
+
+        if (value == 0
+            || value > NGX_HTTP_V2_MAX_WINDOW - conn->send_window)
+        {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent invalid window update: %ui",
+                          value);
+            return NGX_ERROR;
+        }
+
+        conn->send_window += value;
+
+        ngx_http_proxy_v2_session_wakeup(s);
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_GOAWAY_FRAME:
+
+        if (len < 8) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream sent too short goaway frame: %uz", len);
+            return NGX_ERROR;
+        }
+
+        id = ((ngx_uint_t) (pos[0] & 0x7f) << 24)
+             + (pos[1] << 16) + (pos[2] << 8) + pos[3];
+        value = ((ngx_uint_t) pos[4] << 24)
+                + (pos[5] << 16) + (pos[6] << 8) + pos[7];
+
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "upstream sent goaway with error %ui, last stream %ui",
+                      value, id);
+
+        s->goaway = 1;
+
+        /* streams not processed by upstream are safe to retry */
+
+        for (q = ngx_queue_head(&s->streams);
+             q != ngx_queue_sentinel(&s->streams);
+             q = ngx_queue_next(q))
+        {
+            st = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+            if (st->id == 0 || st->id > id) {
+                st->error = 1;
+                st->read.ready = 1;
+                ngx_post_event(&st->read, &ngx_posted_events);
+                ngx_post_event(&st->write, &ngx_posted_events);
+            }
+        }
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_DATA_FRAME:
+    case NGX_HTTP_V2_HEADERS_FRAME:
+    case NGX_HTTP_V2_PRIORITY_FRAME:
+    case NGX_HTTP_V2_RST_STREAM_FRAME:
+    case NGX_HTTP_V2_PUSH_PROMISE_FRAME:
+    case NGX_HTTP_V2_CONTINUATION_FRAME:
+
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "upstream sent http2 frame %ui with zero stream id",
+                      type);
+        return NGX_ERROR;
+
+    default:
+
+        /* unknown frames */
+
+        return NGX_OK;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_session_frame(ngx_http_proxy_v2_session_t *s,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid, u_char *payload,
+    size_t len)
+{
+    ngx_http_proxy_v2_frame_t  f;
+
+    f.length_0 = (u_char) ((len >> 16) & 0xff);
+    f.length_1 = (u_char) ((len >> 8) & 0xff);
+    f.length_2 = (u_char) (len & 0xff);
+    f.type = (u_char) type;
+    f.flags = (u_char) flags;
+    f.stream_id_0 = (u_char) ((sid >> 24) & 0xff);
+    f.stream_id_1 = (u_char) ((sid >> 16) & 0xff);
+    f.stream_id_2 = (u_char) ((sid >> 8) & 0xff);
+    f.stream_id_3 = (u_char) (sid & 0xff);
+
+    if (ngx_http_proxy_v2_session_copy(s, &s->out, &s->out_last,
+                                       (u_char *) &f,
+                                       sizeof(ngx_http_proxy_v2_frame_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_proxy_v2_session_copy(s, &s->out, &s->out_last,
+                                          payload, len);
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_session_copy(ngx_http_proxy_v2_session_t *s,
+    ngx_chain_t **first, ngx_chain_t **last, u_char *p, size_t len)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    cl = *last;
+
+    while (len) {
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+
+            if (s->free) {
+                cl = s->free;
+                s->free = cl->next;
+
+                cl->buf->pos = cl->buf->start;
+                cl->buf->last = cl->buf->start;
+
+            } else {
+                cl = ngx_alloc_chain_link(s->pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                cl->buf = ngx_create_temp_buf(s->pool,
+                                              NGX_HTTP_PROXY_V2_BUFFER_SIZE);
+                if (cl->buf == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            cl->next = NULL;
+
+            if (*last) {
+                (*last)->next = cl;
+
+            } else {
+                *first = cl;
+            }
+
+            *last = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min(len, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, p, n);
+
+        p += n;
+        len -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_session_send(ngx_http_proxy_v2_session_t *s)
+{
+    ngx_chain_t       *cl;
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    if (s->out == NULL) {
+        return NGX_OK;
+    }
+
+    cl = c->send_chain(c, s->out, 0);
+
+    if (cl == NGX_CHAIN_ERROR) {
+        c->error = 1;
+        return NGX_ERROR;
+    }
+
+    while (s->out && s->out->buf->pos == s->out->buf->last) {
+        cl = s->out;
+        s->out = cl->next;
+
+        cl->next = s->free;
+        s->free = cl;
+    }
+
+    if (s->out == NULL) {
+        s->out_last = NULL;
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_session_wakeup(ngx_http_proxy_v2_session_t *s)
+{
+    ngx_queue_t                 *q;
+    ngx_http_proxy_v2_stream_t  *st;
+
+    /* flow control windows were updated, resume blocked request bodies */
+
+    for (q = ngx_queue_head(&s->streams);
+         q != ngx_queue_sentinel(&s->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+        if (st->id && st->ctx->in) {
+            ngx_post_event(&st->write, &ngx_posted_events);
+        }
+    }
+}
+
+
+static ngx_http_proxy_v2_stream_t *
+ngx_http_proxy_v2_get_stream_by_id(ngx_http_proxy_v2_session_t *s,
+    ngx_uint_t sid)
+{
+    ngx_http_proxy_v2_stream_t  *st;
+
+    /* stream ids are odd, so consecutive streams are in different buckets */
+
+    st = s->index[(sid >> 1) & s->index_mask];
+
+    while (st) {
+        if (st->id == sid) {
+            return st;
+        }
+
+        st = st->index;
+    }
+
+    return NULL;
+}
+
+
+/* sets the stream id and moves the stream in the index, 0 removes it */
+
+static void
+ngx_http_proxy_v2_index_stream(ngx_http_proxy_v2_stream_t *st, ngx_uint_t sid)
+{
+    ngx_uint_t                    n;
+    ngx_http_proxy_v2_stream_t  **next;
+    ngx_http_proxy_v2_session_t  *s;
+
+    s = st->session;
+
+    if (st->id) {
+        next = &s->index[(st->id >> 1) & s->index_mask];
+
+        while (*next != st) {
+            next = &(*next)->index;
+        }
+
+        *next = st->index;
+    }
+
+    st->id = sid;
+
+    if (sid) {
+        n = (sid >> 1) & s->index_mask;
+
+        st->index = s->index[n];
+        s->index[n] = st;
+    }
+}
+
+
+static ngx_connection_t *
+ngx_http_proxy_v2_create_stream(ngx_http_proxy_v2_session_t *s,
+    ngx_http_proxy_v2_peer_data_t *pd, ngx_peer_connection_t *pc)
+{
+    ngx_connection_t            *c, *fc;
+    ngx_http_proxy_v2_stream_t  *st;
+
+    st = ngx_pcalloc(pd->request->pool, sizeof(ngx_http_proxy_v2_stream_t));
+    if (st == NULL) {
+        return NULL;
+    }
+
+    c = s->connection;
+    fc = &st->connection;
+
+    /*
+     * the stream is a fake connection, the socket is only shared
+     * for ngx_http_upstream_test_connect()
+     */
+
+    fc->fd = c->fd;
+    fc->read = &st->read;
+    fc->write = &st->write;
+
+    fc->recv = ngx_http_proxy_v2_stream_recv;
+    fc->send = ngx_http_proxy_v2_stream_send;
+    fc->recv_chain = ngx_http_proxy_v2_stream_recv_chain;
+    fc->send_chain = ngx_http_proxy_v2_stream_send_chain;
+
+    fc->log = pc->log;
+    fc->pool = pd->request->pool;
+    fc->type = SOCK_STREAM;
+    fc->sockaddr = c->sockaddr;
+    fc->socklen = c->socklen;
+    fc->number = c->number;
+    fc->start_time = ngx_current_msec;
+    fc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+
+#if (NGX_HTTP_SSL)
+    fc->ssl = c->ssl;
+#endif
+
+    st->read.data = fc;
+    st->read.log = pc->log;
+    st->read.active = 1;
+
+    st->write.data = fc;
+    st->write.log = pc->log;
+    st->write.write = 1;
+    st->write.active = 1;
+    st->write.ready = 1;
+
+    st->session = s;
+    st->ctx = ngx_http_get_module_ctx(pd->request, ngx_http_proxy_v2_module);
+    st->ctx->stream = st;
+
+    ngx_queue_insert_tail(&s->streams, &st->queue);
+    s->nstreams++;
+
+    pd->stream = st;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    c->idle = 0;
+
+    return fc;
+}
+
+
+static void
+ngx_http_proxy_v2_close_stream(ngx_http_proxy_v2_stream_t *st,
+    ngx_uint_t reset)
+{
+    u_char                        error[4];
+    ngx_chain_t                  *cl;
+    ngx_connection_t             *c;
+    ngx_http_proxy_v2_session_t  *s;
+
+    s = st->session;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, st->connection.log, 0,
+                   "close http2 multiplex stream %ui, reset: %ui",
+                   st->id, reset);
+
+    if (st->read.timer_set) {
+        ngx_del_timer(&st->read);
+    }
+
+    if (st->read.posted) {
+        ngx_delete_posted_event(&st->read);
+    }
+
+    if (st->write.timer_set) {
+        ngx_del_timer(&st->write);
+    }
+
+    if (st->write.posted) {
+        ngx_delete_posted_event(&st->write);
+    }
+
+    while (st->in) {
+        cl = st->in;
+        st->in = cl->next;
+
+        cl->next = s->free;
+        s->free = cl;
+    }
+
+    if (s->stream == st) {
+        s->stream = NULL;
+    }
+
+    ngx_http_proxy_v2_index_stream(st, 0);
+
+    ngx_queue_remove(&st->queue);
+    s->nstreams--;
+
+    st->ctx->stream = NULL;
+
+    c = s->connection;
+
+    if (c == NULL) {
+        if (s->nstreams == 0) {
+            ngx_destroy_pool(s->pool);
+        }
+
+        return;
+    }
+
+    if (reset && st->id) {
+        error[0] = 0;
+        error[1] = 0;
+        error[2] = 0;
+        error[3] = NGX_HTTP_PROXY_V2_CANCEL;
+
+        if (ngx_http_proxy_v2_session_frame(s, NGX_HTTP_V2_RST_STREAM_FRAME,
+                                            0, st->id, error, 4)
+            != NGX_OK
+            || ngx_http_proxy_v2_session_send(s) != NGX_OK)
+        {
+            ngx_http_proxy_v2_close_session(s);
+            return;
+        }
+    }
+
+    if (s->nstreams) {
+        return;
+    }
+
+    if (s->goaway
+        || ngx_terminate
+        || ngx_exiting
+        || s->conn->last_stream_id + 2 > NGX_HTTP_PROXY_V2_MAX_STREAM_ID)
+    {
+        ngx_http_proxy_v2_close_session(s);
+        return;
+    }
+
+    c->idle = 1;
+    ngx_add_timer(c->read, s->conf->timeout);
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_stream_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    u_char                       *p;
+    size_t                        n;
+    ngx_buf_t                    *b;
+    ngx_chain_t                  *cl;
+    ngx_http_proxy_v2_stream_t   *st;
+    ngx_http_proxy_v2_session_t  *s;
+
+    st = (ngx_http_proxy_v2_stream_t *) c;
+    s = st->session;
+
+    p = buf;
+
+    while (st->in && size) {
+        b = st->in->buf;
+
+        n = ngx_min((size_t) (b->last - b->pos), size);
+
+        p = ngx_cpymem(p, b->pos, n);
+        b->pos += n;
+        size -= n;
+
+        if (b->pos == b->last) {
+            cl = st->in;
+            st->in = cl->next;
+
+            cl->next = s->free;
+            s->free = cl;
+        }
+    }
+
+    if (st->in == NULL) {
+        st->in_last = NULL;
+    }
+
+    if (p != buf) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http2 multiplex stream %ui recv: %z",
+                       st->id, p - buf);
+
+        return p - buf;
+    }
+
+    c->read->ready = 0;
+
+    if (st->error) {
+        c->read->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (s->connection == NULL) {
+        c->read->eof = 1;
+        return 0;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_stream_recv_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    size_t                       size;
+    ssize_t                      n, total;
+    ngx_buf_t                   *b;
+    ngx_http_proxy_v2_stream_t  *st;
+
+    st = (ngx_http_proxy_v2_stream_t *) c;
+
+    total = 0;
+
+    for ( /* void */ ; in && st->in; in = in->next) {
+        b = in->buf;
+
+        size = b->end - b->last;
+
+        if (limit && (off_t) size > limit - total) {
+            size = (size_t) (limit - total);
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        /* like ngx_readv_chain(), buffers are updated by the caller */
+
+        n = ngx_http_proxy_v2_stream_recv(c, b->last, size);
+
+        total += n;
+    }
+
+    if (total) {
+        return total;
+    }
+
+    return ngx_http_proxy_v2_stream_recv(c, NULL, 0);
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_stream_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_buf_t    b;
+    ngx_chain_t  cl, *rc;
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    b.pos = buf;
+    b.last = buf + size;
+    b.temporary = 1;
+
+    cl.buf = &b;
+    cl.next = NULL;
+
+    rc = ngx_http_proxy_v2_stream_send_chain(c, &cl, 0);
+
+    if (rc == NGX_CHAIN_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return size;
+}
+
+
+static ngx_chain_t *
+ngx_http_proxy_v2_stream_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    size_t                        size;
+    ngx_buf_t                    *b;
+    ngx_http_proxy_v2_stream_t   *st;
+    ngx_http_proxy_v2_session_t  *s;
+
+    st = (ngx_http_proxy_v2_stream_t *) c;
+    s = st->session;
+
+    if (st->error || s->connection == NULL) {
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    /*
+     * frames are copied to the session as a whole, so frames
+     * of different streams are never interleaved
+     */
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(b)) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                          "file buffer in multiplexed http2 stream");
+            return NGX_CHAIN_ERROR;
+        }
+
+        size = b->last - b->pos;
+
+        if (ngx_http_proxy_v2_session_copy(s, &s->out, &s->out_last,
+                                           b->pos, size)
+            != NGX_OK)
+        {
+            return NGX_CHAIN_ERROR;
+        }
+
+        b->pos = b->last;
+
+        if (b->in_file) {
+            b->file_pos = b->file_last;
+        }
+
+        c->sent += size;
+    }
+
+    if (ngx_http_proxy_v2_session_send(s) != NGX_OK) {
+        ngx_http_proxy_v2_close_session(s);
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    return NULL;
+}
+
+
+static void *
+ngx_http_proxy_v2_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_proxy_v2_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_proxy_v2_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->nsessions = 0;
+     *     conf->original_init_peer = NULL;
+     */
+
+    conf->max_sessions = NGX_CONF_UNSET_UINT;
+    conf->max_streams = NGX_CONF_UNSET_UINT;
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                      i;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_proxy_v2_srv_conf_t   *pscf;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    /*
+     * peers are wrapped after all init main configuration handlers,
+     * so connections are seen before ngx_http_upstream_keepalive_module
+     */
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        /* skip implicit upstreams */
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        pscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                               ngx_http_proxy_v2_module);
+
+        if (pscf->max_sessions == NGX_CONF_UNSET_UINT) {
+            continue;
+        }
+
+        ngx_conf_init_uint_value(pscf->max_streams, 128);
+        ngx_conf_init_msec_value(pscf->timeout, 60000);
+
+        ngx_queue_init(&pscf->sessions);
+
+        pscf->original_init_peer = uscfp[i]->peer.init;
+
+        uscfp[i]->peer.init = ngx_http_proxy_v2_init_peer;
+    }
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_proxy_v2_multiplex(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_proxy_v2_srv_conf_t  *pscf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value;
+
+    if (pscf->max_sessions != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    pscf->max_sessions = n;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "streams=", 8) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        n = ngx_atoi(value[2].data + 8, value[2].len - 8);
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid streams value \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        pscf->max_streams = n;
+    }
+
+    return NGX_CONF_OK;
+}
@@ -76,6 +76,16 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+#if (NGX_QUIC)
+
+    { ngx_string("quic_recv_batches"), NULL, ngx_http_stub_status_variable,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("quic_recv_datagrams"), NULL, ngx_http_stub_status_variable,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+#endif
+
       ngx_http_null_variable
 };
 
@@ -116,13 +126,13 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     out.buf = b;
     out.next = NULL;
 
-    ap = *ngx_stat_accepted;
-    hn = *ngx_stat_handled;
-    ac = *ngx_stat_active;
-    rq = *ngx_stat_requests;
-    rd = *ngx_stat_reading;
-    wr = *ngx_stat_writing;
-    wa = *ngx_stat_waiting;
+    ap = ngx_stat_stub_value(NGX_STAT_ACCEPTED);
+    hn = ngx_stat_stub_value(NGX_STAT_HANDLED);
+    ac = ngx_stat_stub_value(NGX_STAT_ACTIVE);
+    rq = ngx_stat_stub_value(NGX_STAT_REQUESTS);
+    rd = ngx_stat_stub_value(NGX_STAT_READING);
+    wr = ngx_stat_stub_value(NGX_STAT_WRITING);
+    wa = ngx_stat_stub_value(NGX_STAT_WAITING);
 
     b->last = ngx_sprintf(b->last, "Active connections: %uA \n", ac);
 
@@ -164,21 +174,33 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
 
     switch (data) {
     case 0:
-        value = *ngx_stat_active;
+        value = ngx_stat_stub_value(NGX_STAT_ACTIVE);
         break;
 
     case 1:
-        value = *ngx_stat_reading;
+        value = ngx_stat_stub_value(NGX_STAT_READING);
         break;
 
     case 2:
-        value = *ngx_stat_writing;
+        value = ngx_stat_stub_value(NGX_STAT_WRITING);
         break;
 
     case 3:
-        value = *ngx_stat_waiting;
+        value = ngx_stat_stub_value(NGX_STAT_WAITING);
+        break;
+
+#if (NGX_QUIC)
+
+    case 4:
+        value = ngx_stat_stub_value(NGX_STAT_QUIC_RECV_BATCHES);
         break;
 
+    case 5:
+        value = ngx_stat_stub_value(NGX_STAT_QUIC_RECV_DATAGRAMS);
+        break;
+
+#endif
+
     /* suppress warning */
     default:
         value = 0;
@@ -24,6 +24,7 @@ typedef struct {
 
 typedef struct {
     ngx_http_complex_value_t            key;
+    ngx_uint_t                          function;
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_uint_t                          config;
 #endif
@@ -49,6 +50,8 @@ static ngx_int_t ngx_http_upstream_init_hash_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us);
 static ngx_int_t ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc,
     void *data);
+static uint32_t ngx_http_upstream_hash_key(ngx_uint_t function, ngx_str_t *key,
+    ngx_uint_t rehash);
 
 static ngx_int_t ngx_http_upstream_init_chash(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us);
@@ -71,7 +74,7 @@ static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_upstream_hash_commands[] = {
 
     { ngx_string("hash"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE123,
       ngx_http_upstream_hash,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -170,8 +173,6 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
     ngx_http_upstream_hash_peer_data_t  *hp = data;
 
     time_t                        now;
-    u_char                        buf[NGX_INT_T_LEN];
-    size_t                        size;
     uint32_t                      hash;
     ngx_int_t                     w;
     uintptr_t                     m;
@@ -219,15 +220,8 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
          * with REHASH omitted at the first iteration.
          */
 
-        ngx_crc32_init(hash);
-
-        if (hp->rehash > 0) {
-            size = ngx_sprintf(buf, "%ui", hp->rehash) - buf;
-            ngx_crc32_update(&hash, buf, size);
-        }
-
-        ngx_crc32_update(&hash, hp->key.data, hp->key.len);
-        ngx_crc32_final(hash);
+        hash = ngx_http_upstream_hash_key(hp->conf->function, &hp->key,
+                                          hp->rehash);
 
         hash = (hash >> 16) & 0x7fff;
 
@@ -314,6 +308,42 @@ found:
 }
 
 
+static uint32_t
+ngx_http_upstream_hash_key(ngx_uint_t function, ngx_str_t *key,
+    ngx_uint_t rehash)
+{
+    u_char    buf[NGX_INT_T_LEN];
+    size_t    size;
+    uint32_t  hash;
+
+    if (function == NGX_HASH_FUNC_XXH3) {
+        return (uint32_t) ngx_xxh3_64(key->data, key->len, rehash);
+    }
+
+    size = 0;
+
+    if (rehash > 0) {
+        size = ngx_sprintf(buf, "%ui", rehash) - buf;
+    }
+
+    if (function == NGX_HASH_FUNC_CRC32C) {
+        ngx_crc32c_init(hash);
+        ngx_crc32c_update(&hash, buf, size);
+        ngx_crc32c_update(&hash, key->data, key->len);
+        ngx_crc32c_final(hash);
+
+        return hash;
+    }
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, buf, size);
+    ngx_crc32_update(&hash, key->data, key->len);
+    ngx_crc32_final(hash);
+
+    return hash;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
@@ -340,6 +370,7 @@ ngx_http_upstream_update_chash(ngx_pool_t *pool,
     u_char                             *host, *port, c;
     size_t                              host_len, port_len, size;
     uint32_t                            hash, base_hash;
+    uint64_t                            seed;
     ngx_str_t                          *server;
     ngx_uint_t                          npoints, i, j;
     ngx_http_upstream_rr_peer_t        *peer;
@@ -382,7 +413,8 @@ ngx_http_upstream_update_chash(ngx_pool_t *pool,
 
         /*
          * Hash expression is compatible with Cache::Memcached::Fast:
-         * crc32(HOST \0 PORT PREV_HASH).
+         * crc32(HOST \0 PORT PREV_HASH).  With xxh3, the hash of
+         * the server name is used as the seed: xxh3(PREV_HASH, SERVER).
          */
 
         if (server->len >= 5
@@ -418,19 +450,53 @@ ngx_http_upstream_update_chash(ngx_pool_t *pool,
 
     done:
 
-        ngx_crc32_init(base_hash);
-        ngx_crc32_update(&base_hash, host, host_len);
-        ngx_crc32_update(&base_hash, (u_char *) "", 1);
-        ngx_crc32_update(&base_hash, port, port_len);
+#if (NGX_SUPPRESS_WARN)
+        base_hash = 0;
+        seed = 0;
+#endif
+
+        switch (hcf->function) {
+
+        case NGX_HASH_FUNC_XXH3:
+            seed = ngx_xxh3_64(server->data, server->len, 0);
+            break;
+
+        case NGX_HASH_FUNC_CRC32C:
+            ngx_crc32c_init(base_hash);
+            ngx_crc32c_update(&base_hash, host, host_len);
+            ngx_crc32c_update(&base_hash, (u_char *) "", 1);
+            ngx_crc32c_update(&base_hash, port, port_len);
+            break;
+
+        default: /* NGX_HASH_FUNC_CRC32 */
+            ngx_crc32_init(base_hash);
+            ngx_crc32_update(&base_hash, host, host_len);
+            ngx_crc32_update(&base_hash, (u_char *) "", 1);
+            ngx_crc32_update(&base_hash, port, port_len);
+        }
 
         prev_hash.value = 0;
         npoints = peer->weight * 160;
 
         for (j = 0; j < npoints; j++) {
-            hash = base_hash;
 
-            ngx_crc32_update(&hash, prev_hash.byte, 4);
-            ngx_crc32_final(hash);
+            switch (hcf->function) {
+
+            case NGX_HASH_FUNC_XXH3:
+                hash = (uint32_t) ngx_xxh3_64(prev_hash.byte, 4, seed);
+                break;
+
+            case NGX_HASH_FUNC_CRC32C:
+                hash = base_hash;
+                ngx_crc32c_update(&hash, prev_hash.byte, 4);
+                ngx_crc32c_final(hash);
+                break;
+
+            default: /* NGX_HASH_FUNC_CRC32 */
+                hash = base_hash;
+                ngx_crc32_update(&hash, prev_hash.byte, 4);
+                ngx_crc32_final(hash);
+            }
 
             points->point[points->number].hash = hash;
             points->point[points->number].server = server;
@@ -535,7 +601,19 @@ ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
     hp = r->upstream->peer.data;
     hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
 
-    hash = ngx_crc32_long(hp->key.data, hp->key.len);
+    switch (hcf->function) {
+
+    case NGX_HASH_FUNC_XXH3:
+        hash = (uint32_t) ngx_xxh3_64(hp->key.data, hp->key.len, 0);
+        break;
+
+    case NGX_HASH_FUNC_CRC32C:
+        hash = ngx_crc32c_long(hp->key.data, hp->key.len);
+        break;
+
+    default: /* NGX_HASH_FUNC_CRC32 */
+        hash = ngx_crc32_long(hp->key.data, hp->key.len);
+    }
 
     ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
 
@@ -729,6 +807,7 @@ ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    conf->function = NGX_HASH_FUNC_CRC32;
     conf->points = NULL;
 
     return conf;
@@ -740,7 +819,9 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_upstream_hash_srv_conf_t  *hcf = conf;
 
-    ngx_str_t                         *value;
+    ngx_str_t                         *value, s;
+    ngx_int_t                          function;
+    ngx_uint_t                         i, consistent;
     ngx_http_upstream_srv_conf_t      *uscf;
     ngx_http_compile_complex_value_t   ccv;
 
@@ -771,17 +852,44 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
                   |NGX_HTTP_UPSTREAM_DOWN;
 
-    if (cf->args->nelts == 2) {
-        uscf->peer.init_upstream = ngx_http_upstream_init_hash;
+    consistent = 0;
 
-    } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
-        uscf->peer.init_upstream = ngx_http_upstream_init_chash;
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "consistent") == 0) {
+            consistent = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "function=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            function = ngx_hash_func(&s);
+
+            if (function == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid hash function \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            hcf->function = function;
+
+            continue;
+        }
 
-    } else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid parameter \"%V\"", &value[2]);
+                           "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
     }
 
+    if (consistent) {
+        uscf->peer.init_upstream = ngx_http_upstream_init_chash;
+
+    } else {
+        uscf->peer.init_upstream = ngx_http_upstream_init_hash;
+    }
+
     return NGX_CONF_OK;
 }
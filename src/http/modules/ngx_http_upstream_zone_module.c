@@ -12,6 +12,7 @@
 
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_int_t ngx_http_upstream_zone_init(ngx_conf_t *cf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
@@ -32,11 +33,39 @@ static ngx_int_t ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle);
 static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *event);
 static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
 
+#if (NGX_HTTP_API)
+static ngx_data_item_t *ngx_http_upstream_zone_api_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+static ngx_data_item_t *ngx_http_upstream_zone_api_peer(
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t backup, ngx_pool_t *pool);
+#endif
+
+
+#if (NGX_HTTP_API)
+
+typedef struct {
+    ngx_str_t                       server;
+    ngx_str_t                       name;
+    ngx_uint_t                      backup;
+    ngx_int_t                       weight;
+    ngx_str_t                       state;
+    ngx_int_t                       active;
+    ngx_int_t                       max_conns;
+    ngx_int_t                       fails;
+    ngx_int_t                       max_fails;
+#if (NGX_HTTP_UPSTREAM_LEAST_TIME)
+    ngx_int_t                       header_time;
+    ngx_int_t                       response_time;
+#endif
+} ngx_http_upstream_zone_api_peer_t;
+
+#endif
+
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
 
     { ngx_string("zone"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
       ngx_http_upstream_zone,
       0,
       0,
@@ -46,9 +75,60 @@ static ngx_command_t  ngx_http_upstream_zone_commands[] = {
 };
 
 
+#if (NGX_HTTP_API)
+
+static ngx_str_t  ngx_http_upstream_zone_api_peers = ngx_string("peers");
+static ngx_str_t  ngx_http_upstream_zone_api_zone = ngx_string("zone");
+
+
+static ngx_data_decl_t  ngx_http_upstream_zone_api_decls[] = {
+
+    { ngx_string("server"), ngx_data_struct_str_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, server) },
+
+    { ngx_string("name"), ngx_data_struct_str_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, name) },
+
+    { ngx_string("backup"), ngx_data_struct_boolean_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, backup) },
+
+    { ngx_string("weight"), ngx_data_struct_int_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, weight) },
+
+    { ngx_string("state"), ngx_data_struct_str_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, state) },
+
+    { ngx_string("active"), ngx_data_struct_int_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, active) },
+
+    { ngx_string("max_conns"), ngx_data_struct_int_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, max_conns) },
+
+    { ngx_string("fails"), ngx_data_struct_int_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, fails) },
+
+    { ngx_string("max_fails"), ngx_data_struct_int_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, max_fails) },
+
+#if (NGX_HTTP_UPSTREAM_LEAST_TIME)
+
+    { ngx_string("header_time"), ngx_data_struct_int_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, header_time) },
+
+    { ngx_string("response_time"), ngx_data_struct_int_handler,
+      offsetof(ngx_http_upstream_zone_api_peer_t, response_time) },
+
+#endif
+
+    ngx_data_null_decl
+};
+
+#endif
+
+
 static ngx_http_module_t  ngx_http_upstream_zone_module_ctx = {
     NULL,                                  /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_upstream_zone_init,           /* postconfiguration */
 
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
@@ -82,6 +162,7 @@ ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ssize_t                         size;
     ngx_str_t                      *value;
+    ngx_uint_t                      n, hugepages, best_fit;
     ngx_http_upstream_srv_conf_t   *uscf;
     ngx_http_upstream_main_conf_t  *umcf;
 
@@ -96,7 +177,40 @@ ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    if (cf->args->nelts == 3) {
+    n = cf->args->nelts;
+    hugepages = 0;
+    best_fit = 0;
+
+    while (n > 2) {
+
+        if (ngx_strcmp(value[n - 1].data, "lockless") == 0) {
+            uscf->lockless = 1;
+            n--;
+            continue;
+        }
+
+        if (ngx_strcmp(value[n - 1].data, "hugepages") == 0) {
+            hugepages = 1;
+            n--;
+            continue;
+        }
+
+        if (ngx_strcmp(value[n - 1].data, "best_fit") == 0) {
+            best_fit = 1;
+            n--;
+            continue;
+        }
+
+        break;
+    }
+
+    if (n > 3) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[3]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (n == 3) {
         size = ngx_parse_size(&value[2]);
 
         if (size == NGX_ERROR) {
@@ -121,6 +235,14 @@ ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (hugepages) {
+        uscf->shm_zone->shm.hugepages = 1;
+    }
+
+    if (best_fit) {
+        uscf->shm_zone->best_fit = 1;
+    }
+
     uscf->shm_zone->init = ngx_http_upstream_init_zone;
     uscf->shm_zone->data = umcf;
 
@@ -130,6 +252,70 @@ ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_zone_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                      i;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL) {
+            continue;
+        }
+
+#if (NGX_HTTP_API)
+        if (ngx_http_api_add(cf, NGX_HTTP_API_UPSTREAMS, &uscf->host,
+                             ngx_http_upstream_zone_api_handler,
+                             (uintptr_t) uscf)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+#endif
+
+        if (!uscf->lockless) {
+            continue;
+        }
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_LOCKLESS)) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "load balancing method does not support "
+                          "lockless zone in upstream \"%V\" in %s:%ui",
+                          &uscf->host, uscf->file_name, uscf->line);
+            return NGX_ERROR;
+        }
+
+        /* servers are not changed at runtime in the lockless mode */
+
+        peers = uscf->peer.data;
+
+        if (peers->resolve || (peers->next && peers->next->resolve)) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolvable servers are not supported with "
+                          "lockless zone in upstream \"%V\" in %s:%ui",
+                          &uscf->host, uscf->file_name, uscf->line);
+            return NGX_ERROR;
+        }
+
+        peers->lockless = 1;
+
+        if (peers->next) {
+            peers->next->lockless = 1;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
@@ -276,6 +462,11 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        if (peers->lockless) {
+            /* process memory, private to a worker after fork() */
+            peer->worker = *peerp;
+        }
+
         *peerp = peer;
         (*peers->config)++;
     }
@@ -323,6 +514,10 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        if (backup->lockless) {
+            peer->worker = *peerp;
+        }
+
         *peerp = peer;
         (*backup->config)++;
     }
@@ -1032,3 +1227,102 @@ done:
 
     ngx_add_timer(event, timer);
 }
+
+
+#if (NGX_HTTP_API)
+
+static ngx_data_item_t *
+ngx_http_upstream_zone_api_handler(uintptr_t data, ngx_pool_t *pool,
+    void *ctx)
+{
+    ngx_http_upstream_srv_conf_t *uscf = (ngx_http_upstream_srv_conf_t *) data;
+
+    ngx_uint_t                     backup;
+    ngx_data_item_t               *obj, *list, *item;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    obj = ngx_data_new_object(pool);
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    list = ngx_data_new_list(pool);
+    if (list == NULL) {
+        return NULL;
+    }
+
+    ngx_data_add_item(obj, &ngx_http_upstream_zone_api_peers, list);
+
+    backup = 0;
+
+    for (peers = uscf->peer.data; peers; peers = peers->next) {
+
+        ngx_http_upstream_rr_peers_rlock(peers);
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+
+            item = ngx_http_upstream_zone_api_peer(peer, backup, pool);
+            if (item == NULL) {
+                ngx_http_upstream_rr_peers_unlock(peers);
+                return NULL;
+            }
+
+            ngx_data_add_item(list, NULL, item);
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        backup = 1;
+    }
+
+    item = ngx_data_string_handler((uintptr_t) &uscf->shm_zone->shm.name,
+                                   pool, NULL);
+    if (item == NULL) {
+        return NULL;
+    }
+
+    ngx_data_add_item(obj, &ngx_http_upstream_zone_api_zone, item);
+
+    return obj;
+}
+
+
+static ngx_data_item_t *
+ngx_http_upstream_zone_api_peer(ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t backup, ngx_pool_t *pool)
+{
+    ngx_http_upstream_zone_api_peer_t  p;
+
+    p.server = peer->server;
+    p.name = peer->name;
+    p.backup = backup;
+    p.weight = peer->weight;
+    p.active = peer->conns;
+    p.max_conns = peer->max_conns;
+    p.fails = peer->fails;
+    p.max_fails = peer->max_fails;
+
+#if (NGX_HTTP_UPSTREAM_LEAST_TIME)
+    p.header_time = peer->header_time;
+    p.response_time = peer->response_time;
+#endif
+
+    if (peer->down) {
+        ngx_str_set(&p.state, "down");
+
+    } else if (peer->max_fails
+               && peer->fails >= peer->max_fails
+               && ngx_time() - peer->checked <= peer->fail_timeout)
+    {
+        ngx_str_set(&p.state, "unavail");
+
+    } else {
+        ngx_str_set(&p.state, "up");
+    }
+
+    return ngx_data_obj_handler((uintptr_t) ngx_http_upstream_zone_api_decls,
+                                pool, &p);
+}
+
+#endif
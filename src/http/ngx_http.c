@@ -299,6 +299,10 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_HTTP_V2 || NGX_HTTP_V3)
+    ngx_http_huff_decode_init();
+#endif
+
 
     for (m = 0; cf->cycle->modules[m]; m++) {
         if (cf->cycle->modules[m]->type != NGX_HTTP_MODULE) {
@@ -447,6 +451,15 @@ ngx_http_init_headers_in_hash(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
         return NGX_ERROR;
     }
 
+    /* known request headers are identified with a single probe */
+
+    if (ngx_hash_perfect_init(&cmcf->headers_in_phash, headers_in.elts,
+                              headers_in.nelts, cf->pool)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
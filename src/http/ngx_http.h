@@ -52,6 +52,9 @@ typedef u_char *(*ngx_http_log_handler_pt)(ngx_http_request_t *r,
 #if (NGX_HTTP_SSL)
 #include <ngx_http_ssl_module.h>
 #endif
+#if (NGX_HTTP_API)
+#include <ngx_http_api_module.h>
+#endif
 
 
 struct ngx_http_log_ctx_s {
@@ -181,6 +184,7 @@ ngx_uint_t  ngx_http_degraded(ngx_http_request_t *);
 
 
 #if (NGX_HTTP_V2 || NGX_HTTP_V3)
+void ngx_http_huff_decode_init(void);
 ngx_int_t ngx_http_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
 size_t ngx_http_huff_encode(u_char *src, size_t len, u_char *dst,
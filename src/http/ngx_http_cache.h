@@ -26,9 +26,26 @@
 #define NGX_HTTP_CACHE_KEY_LEN       16
 #define NGX_HTTP_CACHE_ETAG_LEN      128
 #define NGX_HTTP_CACHE_VARY_LEN      128
+#define NGX_HTTP_CACHE_MAX_DIRS      16
 
 #define NGX_HTTP_CACHE_VERSION       5
 
+/* files with xxh3 keys have a header version of their own */
+#define NGX_HTTP_CACHE_VERSION_XXH3  (0x100 | NGX_HTTP_CACHE_VERSION)
+
+#define NGX_HTTP_CACHE_KEY_MD5       0
+#define NGX_HTTP_CACHE_KEY_XXH3      1
+
+#define NGX_HTTP_CACHE_EVICTION_LRU     0
+#define NGX_HTTP_CACHE_EVICTION_S3FIFO  1
+
+#define NGX_HTTP_CACHE_ADMISSION_OFF     0
+#define NGX_HTTP_CACHE_ADMISSION_TINYLFU 1
+
+#define NGX_HTTP_CACHE_KEY_HASH_FILE ".key_hash"
+#define NGX_HTTP_CACHE_INDEX_FILE    ".index"
+#define NGX_HTTP_CACHE_XXH3_SEED     0x9e3779b97f4a7c15ULL
+
 
 typedef struct {
     ngx_uint_t                       status;
@@ -36,6 +53,15 @@ typedef struct {
 } ngx_http_cache_valid_t;
 
 
+typedef struct {
+    off_t                            length;
+    ngx_uint_t                       count;
+    unsigned                         done:1;
+    unsigned                         error:1;
+    u_char                           name[1];
+} ngx_http_file_cache_fill_t;
+
+
 typedef struct {
     ngx_rbtree_node_t                node;
     ngx_queue_t                      queue;
@@ -51,7 +77,11 @@ typedef struct {
     unsigned                         updating:1;
     unsigned                         deleting:1;
     unsigned                         purged:1;
-                                     /* 10 unused bits */
+    unsigned                         indexed:1;
+    unsigned                         dir:4;
+    unsigned                         freq:2;
+    unsigned                         probation:1;
+                                     /* 2 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -59,9 +89,24 @@ typedef struct {
     size_t                           body_start;
     off_t                            fs_size;
     ngx_msec_t                       lock_time;
+    ngx_http_file_cache_fill_t      *fill;
 } ngx_http_file_cache_node_t;
 
 
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_file_uniq_t                  uniq;
+    off_t                            fs_size;
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_mem_node_t;
+
+
 struct ngx_http_cache_s {
     ngx_file_t                       file;
     ngx_array_t                      keys;
@@ -90,11 +135,16 @@ struct ngx_http_cache_s {
     ngx_uint_t                       error;
     ngx_uint_t                       valid_msec;
     ngx_uint_t                       vary_tag;
+    ngx_uint_t                       dir;
 
     ngx_buf_t                       *buf;
 
     ngx_http_file_cache_t           *file_cache;
     ngx_http_file_cache_node_t      *node;
+    ngx_http_file_cache_fill_t      *fill;
+
+    ngx_chain_t                     *free;
+    ngx_chain_t                     *busy;
 
 #if (NGX_THREADS || NGX_COMPAT)
     ngx_thread_task_t               *thread_task;
@@ -119,6 +169,8 @@ struct ngx_http_cache_s {
     unsigned                         secondary:1;
     unsigned                         update_variant:1;
     unsigned                         background:1;
+    unsigned                         memory:1;
+    unsigned                         no_fill:1;
 
     unsigned                         stale_updating:1;
     unsigned                         stale_error:1;
@@ -153,15 +205,46 @@ typedef struct {
     off_t                            size;
     ngx_uint_t                       count;
     ngx_uint_t                       watermark;
+    off_t                            dir_size[NGX_HTTP_CACHE_MAX_DIRS];
+    ngx_queue_t                      probation;
+    ngx_uint_t                       probation_count;
+    uint32_t                        *ghost;
+    ngx_uint_t                       ghost_mask;
+    u_char                          *sketch;
+    ngx_uint_t                       sketch_mask;
+    ngx_uint_t                       sketch_ops;
+#if (NGX_HTTP_API)
+    ngx_stat_t                       stats;
+#endif
 } ngx_http_file_cache_sh_t;
 
 
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    size_t                           size;
+    ngx_uint_t                       count;
+} ngx_http_file_cache_mem_sh_t;
+
+
+typedef struct {
+    ngx_path_t                      *path;
+    off_t                            max_size;
+    ngx_uint_t                       weight;
+} ngx_http_file_cache_dir_t;
+
+
 struct ngx_http_file_cache_s {
     ngx_http_file_cache_sh_t        *sh;
     ngx_slab_pool_t                 *shpool;
 
     ngx_path_t                      *path;
 
+    ngx_http_file_cache_dir_t       *dirs;
+    ngx_uint_t                       ndirs;
+    ngx_uint_t                       weight;
+
     off_t                            min_free;
     off_t                            max_size;
     size_t                           bsize;
@@ -180,10 +263,33 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
 
+    ngx_uint_t                       loader_threads;
+
+    time_t                           index_interval;
+    time_t                           index_time;
+
     ngx_shm_zone_t                  *shm_zone;
 
+    ngx_http_file_cache_mem_sh_t    *mem_sh;
+    ngx_slab_pool_t                 *mem_shpool;
+    ngx_shm_zone_t                  *mem_zone;
+    size_t                           max_mem_object;
+
+    ngx_uint_t                       key_hash;
+    ngx_uint_t                       version;
+    ngx_uint_t                       eviction;
+    ngx_uint_t                       admission;
+    ngx_uint_t                       reformat;
+                                     /* unsigned reformat:1 */
+
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
+
+    ngx_uint_t                       read_while_write;
+                                     /* unsigned read_while_write:1 */
+
+    ngx_uint_t                       index;
+                                     /* unsigned index:1 */
 };
 
 
@@ -194,6 +300,8 @@ ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
+void ngx_http_file_cache_fill(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_account(ngx_http_request_t *r, ngx_int_t rc);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
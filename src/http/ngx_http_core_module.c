@@ -30,6 +30,8 @@ static ngx_int_t ngx_http_core_find_static_location(ngx_http_request_t *r,
 
 static ngx_int_t ngx_http_core_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_core_postconfiguration(ngx_conf_t *cf);
+static ngx_int_t ngx_http_core_init_process(ngx_cycle_t *cycle);
+static void ngx_http_core_exit_process(ngx_cycle_t *cycle);
 static void *ngx_http_core_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_core_create_srv_conf(ngx_conf_t *cf);
@@ -715,7 +717,7 @@ static ngx_command_t  ngx_http_core_commands[] = {
       NULL },
 
     { ngx_string("open_file_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1234,
       ngx_http_core_open_file_cache,
       NGX_HTTP_LOC_CONF_OFFSET,
       offsetof(ngx_http_core_loc_conf_t, open_file_cache),
@@ -832,10 +834,10 @@ ngx_module_t  ngx_http_core_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_core_init_process,            /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_http_core_exit_process,            /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -3472,6 +3474,39 @@ ngx_http_core_postconfiguration(ngx_conf_t *cf)
 }
 
 
+static ngx_int_t
+ngx_http_core_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                  s;
+    ngx_http_core_srv_conf_t  **cscfp;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    if (cmcf == NULL) {
+        return NGX_OK;
+    }
+
+    /* keep free blocks of the connection and request pools */
+
+    cscfp = cmcf->servers.elts;
+
+    for (s = 0; s < cmcf->servers.nelts; s++) {
+        ngx_pool_cache_add(cscfp[s]->connection_pool_size);
+        ngx_pool_cache_add(cscfp[s]->request_pool_size);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_core_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_pool_cache_done();
+}
+
+
 static void *
 ngx_http_core_create_main_conf(ngx_conf_t *cf)
 {
@@ -5076,10 +5111,12 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_core_loc_conf_t *clcf = conf;
 
+    u_char      *p;
     time_t       inactive;
-    ngx_str_t   *value, s;
+    ssize_t      size;
+    ngx_str_t   *value, s, name;
     ngx_int_t    max;
-    ngx_uint_t   i;
+    ngx_uint_t   i, best_fit;
 
     if (clcf->open_file_cache != NGX_CONF_UNSET_PTR) {
         return "is duplicate";
@@ -5090,6 +5127,10 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max = 0;
     inactive = 60;
 
+    ngx_str_null(&name);
+    size = 0;
+    best_fit = 0;
+
     for (i = 1; i < cf->args->nelts; i++) {
 
         if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
@@ -5115,6 +5156,48 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p) {
+                name.len = p - name.data;
+
+                s.data = p + 1;
+                s.len = value[i].data + value[i].len - s.data;
+
+                size = ngx_parse_size(&s);
+
+                if (size == NGX_ERROR) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "invalid zone size \"%V\"", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+                if (size < (ssize_t) (8 * ngx_pagesize)) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "zone \"%V\" is too small", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+            } else {
+                name.len = value[i].len - 5;
+            }
+
+            if (name.len == 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "best_fit") == 0) {
+            best_fit = 1;
+            continue;
+        }
+
         if (ngx_strcmp(value[i].data, "off") == 0) {
 
             clcf->open_file_cache = NULL;
@@ -5141,11 +5224,26 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     clcf->open_file_cache = ngx_open_file_cache_init(cf->pool, max, inactive);
-    if (clcf->open_file_cache) {
+    if (clcf->open_file_cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
         return NGX_CONF_OK;
     }
 
-    return NGX_CONF_ERROR;
+    if (ngx_open_file_cache_zone(cf, clcf->open_file_cache, &name, size,
+                                 &ngx_http_core_module)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (best_fit) {
+        clcf->open_file_cache->shm_zone->best_fit = 1;
+    }
+
+    return NGX_CONF_OK;
 }
 
 
@@ -158,6 +158,7 @@ typedef struct {
     ngx_http_phase_engine_t    phase_engine;
 
     ngx_hash_t                 headers_in_hash;
+    ngx_hash_perfect_t         headers_in_phash;
 
     ngx_hash_t                 variables_hash;
 
@@ -11,11 +11,96 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_FILE_CACHE_INDEX_MAGIC  "ngxindex"
+#define NGX_HTTP_FILE_CACHE_INDEX_BATCH  4096
+
+#define NGX_HTTP_FILE_CACHE_ANY_DIR      ((ngx_uint_t) -1)
+#define NGX_HTTP_FILE_CACHE_MAX_WEIGHT   65535
+
+#define NGX_HTTP_FILE_CACHE_MAX_FREQ     3
+#define NGX_HTTP_FILE_CACHE_MAX_STEPS    1000
+#define NGX_HTTP_FILE_CACHE_SKETCH_MAX   15
+#define NGX_HTTP_FILE_CACHE_SKETCH_ROWS  4
+
+#define NGX_HTTP_FILE_CACHE_FILL_WAIT    20
+
+#define NGX_HTTP_FILE_CACHE_HIT          1
+#define NGX_HTTP_FILE_CACHE_MISS         2
+#define NGX_HTTP_FILE_CACHE_EXPIRED      3
+#define NGX_HTTP_FILE_CACHE_UPDATING     4
+#define NGX_HTTP_FILE_CACHE_REVALIDATED  5
+#define NGX_HTTP_FILE_CACHE_STORED       6
+#define NGX_HTTP_FILE_CACHE_REJECTED     7
+#define NGX_HTTP_FILE_CACHE_EVICTED      8
+#define NGX_HTTP_FILE_CACHE_INACTIVE     9
+#define NGX_HTTP_FILE_CACHE_NSTATS       10
+
+
+#define ngx_http_file_cache_word(key, n)                                      \
+    ((uint32_t) (key)[4 * (n)] | ((uint32_t) (key)[4 * (n) + 1] << 8)         \
+     | ((uint32_t) (key)[4 * (n) + 2] << 16)                                  \
+     | ((uint32_t) (key)[4 * (n) + 3] << 24))
+
+
+typedef struct {
+    u_char                           magic[8];
+    ngx_uint_t                       version;
+    size_t                           bsize;
+    size_t                           size;
+    uint32_t                         dirs;
+    ngx_uint_t                       count;
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    off_t                            fs_size;
+    size_t                           body_start;
+    ngx_uint_t                       uses;
+    ngx_uint_t                       dir;
+} ngx_http_file_cache_index_t;
+
+
+typedef struct {
+    ngx_str_t                        name;
+    ngx_uint_t                       dir;
+} ngx_http_file_cache_subdir_t;
+
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    ngx_uint_t                       dir;
+    ngx_uint_t                       files;
+    ngx_msec_t                       last;
+    ngx_array_t                     *dirs;
+} ngx_http_file_cache_walk_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    ngx_array_t                     *dirs;
+    ngx_atomic_t                     next;
+    ngx_atomic_t                     abort;
+} ngx_http_file_cache_loader_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_file_cache_lock_wait(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_fill_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_fill_send(ngx_http_request_t *r);
+static void ngx_http_file_cache_fill_handler(ngx_http_request_t *r);
+static void ngx_http_file_cache_fill_wait_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_fill_free(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -32,10 +117,42 @@ static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
+static ngx_uint_t ngx_http_file_cache_place(ngx_http_file_cache_t *cache,
+    u_char *key);
 static ngx_http_file_cache_node_t *
     ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_insert(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *key);
+static void ngx_http_file_cache_remove(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_reinsert(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_queue_t *ngx_http_file_cache_victims(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_node_key(ngx_http_file_cache_node_t *fcn,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_admit(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *key);
+static void ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_sketch_get(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_inline void ngx_http_file_cache_stat(ngx_http_file_cache_t *cache,
+    ngx_uint_t i);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_file_cache_mem_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_mem_promote(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_mem_invalidate(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_http_file_cache_mem_node_t *
+    ngx_http_file_cache_mem_lookup(ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_mem_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_mem_node_t *mn);
+static void ngx_http_file_cache_mem_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary,
     size_t len, u_char *hash);
 static void ngx_http_file_cache_vary_header(ngx_http_request_t *r,
@@ -45,13 +162,24 @@ static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
-static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
-static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache,
+    ngx_uint_t dir);
+static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache,
+    ngx_queue_t *queue);
+static u_char *ngx_http_file_cache_alloc_name(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
     ngx_queue_t *q, u_char *name);
-static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_loader_tree(ngx_tree_ctx_t *tree,
+    ngx_http_file_cache_walk_t *walk);
+static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_walk_t *walk);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_file_cache_loader_threads(
+    ngx_http_file_cache_t *cache, ngx_array_t *dirs);
+static void *ngx_http_file_cache_loader_thread(void *data);
+#endif
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
+static ngx_uint_t ngx_http_file_cache_key_hash(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx,
@@ -59,10 +187,22 @@ static ngx_int_t ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx,
 static ngx_int_t ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
-    ngx_http_cache_t *c);
+    ngx_http_cache_t *c, ngx_uint_t dir);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+static ngx_http_file_cache_node_t *ngx_http_file_cache_next(
+    ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache,
+    ngx_log_t *log);
+static void ngx_http_file_cache_index_save(ngx_http_file_cache_t *cache);
+static uint32_t ngx_http_file_cache_index_dirs(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_index_sweep(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_saver(void *data);
+#if (NGX_HTTP_API)
+static ngx_data_item_t *ngx_http_file_cache_api_handler(uintptr_t data,
+    ngx_pool_t *pool, void *ctx);
+#endif
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -79,28 +219,104 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+#if (NGX_HTTP_API)
+
+typedef struct {
+    int64_t                          size;
+    int64_t                          max_size;
+    ngx_uint_t                       cold;
+} ngx_http_file_cache_api_t;
+
+
+static ngx_str_t  ngx_http_file_cache_api_max_size = ngx_string("max_size");
+
+
+static ngx_data_decl_t  ngx_http_file_cache_api_decls[] = {
+
+    { ngx_string("size"), ngx_data_struct_int64_handler,
+      offsetof(ngx_http_file_cache_api_t, size) },
+
+    { ngx_string("cold"), ngx_data_struct_boolean_handler,
+      offsetof(ngx_http_file_cache_api_t, cold) },
+
+    ngx_data_null_decl
+};
+
+
+static ngx_data_decl_t  ngx_http_file_cache_api_stat_decls[] = {
+
+    { ngx_string("hit"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_HIT },
+
+    { ngx_string("miss"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_MISS },
+
+    { ngx_string("expired"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_EXPIRED },
+
+    { ngx_string("updating"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_UPDATING },
+
+    { ngx_string("revalidated"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_REVALIDATED },
+
+    { ngx_string("stored"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_STORED },
+
+    { ngx_string("rejected"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_REJECTED },
+
+    { ngx_string("evicted"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_EVICTED },
+
+    { ngx_string("inactive"), ngx_data_stat_handler,
+      NGX_HTTP_FILE_CACHE_INACTIVE },
+
+    ngx_data_null_decl
+};
+
+#endif
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_file_cache_t  *ocache = data;
 
     size_t                  len;
-    ngx_uint_t              n;
+#if (NGX_HTTP_API)
+    void                   *p;
+#endif
+    ngx_uint_t              n, entries;
     ngx_http_file_cache_t  *cache;
 
     cache = shm_zone->data;
 
     if (ocache) {
-        if (ngx_strcmp(cache->path->name.data, ocache->path->name.data) != 0) {
+        if (cache->ndirs != ocache->ndirs) {
             ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
-                          "cache \"%V\" uses the \"%V\" cache path "
-                          "while previously it used the \"%V\" cache path",
-                          &shm_zone->shm.name, &cache->path->name,
-                          &ocache->path->name);
-
+                          "cache \"%V\" had previously different "
+                          "number of paths", &shm_zone->shm.name);
             return NGX_ERROR;
         }
 
+        /* the nodes refer to the directories by their numbers */
+
+        for (n = 0; n < cache->ndirs; n++) {
+            if (ngx_strcmp(cache->dirs[n].path->name.data,
+                           ocache->dirs[n].path->name.data)
+                != 0)
+            {
+                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                              "cache \"%V\" uses the \"%V\" cache path "
+                              "while previously it used the \"%V\" cache path",
+                              &shm_zone->shm.name, &cache->dirs[n].path->name,
+                              &ocache->dirs[n].path->name);
+
+                return NGX_ERROR;
+            }
+        }
+
         for (n = 0; n < NGX_MAX_PATH_LEVEL; n++) {
             if (cache->path->level[n] != ocache->path->level[n]) {
                 ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
@@ -110,6 +326,27 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->key_hash != ocache->key_hash) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different key_hash",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        if (cache->eviction != ocache->eviction) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different eviction",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        if (cache->admission != ocache->admission) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different admission",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
@@ -117,6 +354,10 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
         cache->max_size /= cache->bsize;
 
+        for (n = 0; n < cache->ndirs; n++) {
+            cache->dirs[n].max_size /= cache->bsize;
+        }
+
         if (!cache->sh->cold || cache->sh->loading) {
             cache->path->loader = NULL;
         }
@@ -131,6 +372,10 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         cache->bsize = ngx_fs_bsize(cache->path->name.data);
         cache->max_size /= cache->bsize;
 
+        for (n = 0; n < cache->ndirs; n++) {
+            cache->dirs[n].max_size /= cache->bsize;
+        }
+
         return NGX_OK;
     }
 
@@ -145,17 +390,71 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
                     ngx_http_file_cache_rbtree_insert_value);
 
     ngx_queue_init(&cache->sh->queue);
+    ngx_queue_init(&cache->sh->probation);
 
     cache->sh->cold = 1;
     cache->sh->loading = 0;
     cache->sh->size = 0;
     cache->sh->count = 0;
     cache->sh->watermark = (ngx_uint_t) -1;
+    cache->sh->probation_count = 0;
+
+    ngx_memzero(cache->sh->dir_size, sizeof(cache->sh->dir_size));
+
+    /*
+     * the ghost table and the sketch have an entry per node
+     * the zone is able to hold, rounded down to a power of two
+     */
+
+    n = shm_zone->shm.size / sizeof(ngx_http_file_cache_node_t);
+
+    for (entries = 64; entries * 2 <= n; entries *= 2) { /* void */ }
+
+    cache->sh->ghost = NULL;
+    cache->sh->ghost_mask = 0;
+
+    if (cache->eviction == NGX_HTTP_CACHE_EVICTION_S3FIFO) {
+        cache->sh->ghost = ngx_slab_calloc(cache->shpool,
+                                           entries * sizeof(uint32_t));
+        if (cache->sh->ghost == NULL) {
+            return NGX_ERROR;
+        }
+
+        cache->sh->ghost_mask = entries - 1;
+    }
+
+    cache->sh->sketch = NULL;
+    cache->sh->sketch_mask = 0;
+    cache->sh->sketch_ops = 0;
+
+    if (cache->admission == NGX_HTTP_CACHE_ADMISSION_TINYLFU) {
+        cache->sh->sketch = ngx_slab_calloc(cache->shpool,
+                                  NGX_HTTP_FILE_CACHE_SKETCH_ROWS * entries);
+        if (cache->sh->sketch == NULL) {
+            return NGX_ERROR;
+        }
+
+        cache->sh->sketch_mask = entries - 1;
+    }
+
+#if (NGX_HTTP_API)
+    p = ngx_slab_calloc(cache->shpool,
+                        ngx_stat_size(NGX_HTTP_FILE_CACHE_NSTATS));
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_stat_init(&cache->sh->stats, p, NGX_HTTP_FILE_CACHE_NSTATS);
+#endif
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
     cache->max_size /= cache->bsize;
 
+    for (n = 0; n < cache->ndirs; n++) {
+        cache->dirs[n].max_size /= cache->bsize;
+    }
+
     len = sizeof(" in cache keys zone \"\"") + shm_zone->shm.name.len;
 
     cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
@@ -168,6 +467,84 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->log_nomem = 0;
 
+    if (cache->index && !ngx_test_config) {
+        ngx_http_file_cache_index_load(cache, shm_zone->shm.log);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_mem_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    size_t                           len;
+    ngx_queue_t                     *q;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->mem_sh = ocache->mem_sh;
+        cache->mem_shpool = ocache->mem_shpool;
+
+        if (cache->sh == ocache->sh) {
+            return NGX_OK;
+        }
+
+        /*
+         * the memory zone now serves another keys zone,
+         * its objects cannot be validated against it
+         */
+
+        while (!ngx_queue_empty(&cache->mem_sh->queue)) {
+            q = ngx_queue_last(&cache->mem_sh->queue);
+            mn = ngx_queue_data(q, ngx_http_file_cache_mem_node_t, queue);
+
+            ngx_http_file_cache_mem_delete(cache, mn);
+        }
+
+        return NGX_OK;
+    }
+
+    cache->mem_shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->mem_sh = cache->mem_shpool->data;
+        return NGX_OK;
+    }
+
+    cache->mem_sh = ngx_slab_alloc(cache->mem_shpool,
+                                   sizeof(ngx_http_file_cache_mem_sh_t));
+    if (cache->mem_sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->mem_shpool->data = cache->mem_sh;
+
+    ngx_rbtree_init(&cache->mem_sh->rbtree, &cache->mem_sh->sentinel,
+                    ngx_http_file_cache_mem_rbtree_insert_value);
+
+    ngx_queue_init(&cache->mem_sh->queue);
+
+    cache->mem_sh->size = 0;
+    cache->mem_sh->count = 0;
+
+    len = sizeof(" in cache memory zone \"\"") + shm_zone->shm.name.len;
+
+    cache->mem_shpool->log_ctx = ngx_slab_alloc(cache->mem_shpool, len);
+    if (cache->mem_shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->mem_shpool->log_ctx, " in cache memory zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    cache->mem_shpool->log_nomem = 0;
+
     return NGX_OK;
 }
 
@@ -216,7 +593,7 @@ ngx_http_file_cache_create(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+    if (ngx_http_file_cache_name(r, cache->dirs[c->dir].path) != NGX_OK) {
         return NGX_ERROR;
     }
 
@@ -228,8 +605,9 @@ void
 ngx_http_file_cache_create_key(ngx_http_request_t *r)
 {
     size_t             len;
+    uint64_t           xxh[2];
     ngx_str_t         *key;
-    ngx_uint_t         i;
+    ngx_uint_t         i, xxh3;
     ngx_md5_t          md5;
     ngx_http_cache_t  *c;
 
@@ -237,8 +615,18 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 
     len = 0;
 
+    xxh3 = (c->file_cache
+            && c->file_cache->key_hash == NGX_HTTP_CACHE_KEY_XXH3);
+
     ngx_crc32_init(c->crc32);
-    ngx_md5_init(&md5);
+
+    if (xxh3) {
+        xxh[0] = 0;
+        xxh[1] = NGX_HTTP_CACHE_XXH3_SEED;
+
+    } else {
+        ngx_md5_init(&md5);
+    }
 
     key = c->keys.elts;
     for (i = 0; i < c->keys.nelts; i++) {
@@ -248,14 +636,29 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
         len += key[i].len;
 
         ngx_crc32_update(&c->crc32, key[i].data, key[i].len);
-        ngx_md5_update(&md5, key[i].data, key[i].len);
+
+        if (xxh3) {
+            /* two 64-bit lanes, each part is seeded with the previous hash */
+
+            xxh[0] = ngx_xxh3_64(key[i].data, key[i].len, xxh[0]);
+            xxh[1] = ngx_xxh3_64(key[i].data, key[i].len, xxh[1]);
+
+        } else {
+            ngx_md5_update(&md5, key[i].data, key[i].len);
+        }
     }
 
     c->header_start = sizeof(ngx_http_file_cache_header_t)
                       + sizeof(ngx_http_file_cache_key) + len + 1;
 
     ngx_crc32_final(c->crc32);
-    ngx_md5_final(c->key, &md5);
+
+    if (xxh3) {
+        ngx_memcpy(c->key, xxh, NGX_HTTP_CACHE_KEY_LEN);
+
+    } else {
+        ngx_md5_final(c->key, &md5);
+    }
 
     ngx_memcpy(c->main, c->key, NGX_HTTP_CACHE_KEY_LEN);
 }
@@ -264,6 +667,7 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
 {
+    size_t                     size;
     ngx_int_t                  rc, rv;
     ngx_uint_t                 test;
     ngx_http_cache_t          *c;
@@ -337,7 +741,7 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         }
     }
 
-    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+    if (ngx_http_file_cache_name(r, cache->dirs[c->dir].path) != NGX_OK) {
         return NGX_ERROR;
     }
 
@@ -345,6 +749,19 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (cache->mem_zone && c->exists && c->uniq) {
+
+        rc = ngx_http_file_cache_mem_open(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -384,7 +801,18 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     c->length = of.size;
     c->fs_size = (of.fs_size + cache->bsize - 1) / cache->bsize;
 
-    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    size = c->body_start;
+
+    /* an object which may be stored in memory is read at once */
+
+    if (cache->mem_zone
+        && c->length > (off_t) size
+        && c->length <= (off_t) cache->max_mem_object)
+    {
+        size = (size_t) c->length;
+    }
+
+    c->buf = ngx_create_temp_buf(r->pool, size);
     if (c->buf == NULL) {
         return NGX_ERROR;
     }
@@ -401,9 +829,46 @@ done:
 }
 
 
+void
+ngx_http_file_cache_account(ngx_http_request_t *r, ngx_int_t rc)
+{
+    ngx_uint_t  i;
+
+    switch (rc) {
+
+    case NGX_OK:
+        i = NGX_HTTP_FILE_CACHE_HIT;
+        break;
+
+    case NGX_DECLINED:
+    case NGX_HTTP_CACHE_SCARCE:
+        i = NGX_HTTP_FILE_CACHE_MISS;
+        break;
+
+    case NGX_HTTP_CACHE_STALE:
+        i = NGX_HTTP_FILE_CACHE_EXPIRED;
+        break;
+
+    case NGX_HTTP_CACHE_UPDATING:
+        i = NGX_HTTP_FILE_CACHE_UPDATING;
+        break;
+
+    case NGX_AGAIN:
+    case NGX_ERROR:
+        return;
+
+    default: /* cached error status */
+        i = NGX_HTTP_FILE_CACHE_HIT;
+    }
+
+    ngx_http_file_cache_stat(r->cache->file_cache, i);
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    ngx_int_t                  rc;
     ngx_msec_t                 now, timer;
     ngx_http_file_cache_t     *cache;
 
@@ -424,18 +889,34 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->node->lock_time = now + c->lock_age;
         c->updating = 1;
         c->lock_time = c->node->lock_time;
+
+    } else if (cache->read_while_write && c->node->fill) {
+        c->fill = c->node->fill;
+        c->fill->count++;
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache lock u:%d wt:%M",
-                   c->updating, c->wait_time);
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache lock u:%d f:%d wt:%M",
+                   c->updating, c->fill ? 1 : 0, c->wait_time);
 
     if (c->updating) {
         return NGX_DECLINED;
     }
 
+    if (c->fill) {
+        rc = ngx_http_file_cache_fill_open(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     if (c->lock_timeout == 0) {
         return NGX_HTTP_CACHE_SCARCE;
     }
@@ -452,6 +933,10 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     timer = c->wait_time - now;
 
+    if (cache->read_while_write) {
+        timer = ngx_min(timer, NGX_HTTP_FILE_CACHE_FILL_WAIT);
+    }
+
     ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
 
     r->main->blocked++;
@@ -525,12 +1010,19 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
     timer = c->node->lock_time - now;
 
     if (c->node->updating && (ngx_msec_int_t) timer > 0) {
-        wait = 1;
+
+        /* the response can be read while it is being written */
+
+        wait = (cache->read_while_write && c->node->fill) ? 0 : 1;
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
     if (wait) {
+        if (cache->read_while_write) {
+            timer = ngx_min(timer, NGX_HTTP_FILE_CACHE_FILL_WAIT);
+        }
+
         ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
         return NGX_AGAIN;
     }
@@ -540,53 +1032,117 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 
 
 static ngx_int_t
-ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+ngx_http_file_cache_fill_open(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    u_char                        *p;
-    time_t                         now;
-    ssize_t                        n;
-    ngx_str_t                     *key;
-    ngx_int_t                      rc;
-    ngx_uint_t                     i;
-    ngx_http_file_cache_t         *cache;
-    ngx_http_file_cache_header_t  *h;
+    ngx_fd_t                  fd;
+    ngx_pool_cleanup_t       *cln;
+    ngx_http_file_cache_t    *cache;
+    ngx_pool_cleanup_file_t  *clnf;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    cache = c->file_cache;
 
-    if (n < 0) {
-        return n;
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
     }
 
-    if ((size_t) n < c->header_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" is too small", c->file.name.data);
-        return NGX_DECLINED;
-    }
+    /* the name is not changed while the fill is referenced */
 
-    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+    fd = ngx_open_file(c->fill->name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
-    if (h->version != NGX_HTTP_CACHE_VERSION) {
-        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
-                      "cache file \"%s\" version mismatch", c->file.name.data);
-        return NGX_DECLINED;
-    }
+    if (fd == NGX_INVALID_FILE) {
+
+        /* the file was just renamed or deleted by the writer */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, ngx_errno,
+                       "http file cache fill \"%s\" is gone", c->fill->name);
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_http_file_cache_fill_free(cache, c);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    if (h->crc32 != c->crc32 || (size_t) h->header_start != c->header_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has md5 collision", c->file.name.data);
         return NGX_DECLINED;
     }
 
-    p = c->buf->pos + sizeof(ngx_http_file_cache_header_t)
-        + sizeof(ngx_http_file_cache_key);
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
 
-    key = c->keys.elts;
-    for (i = 0; i < c->keys.nelts; i++) {
-        if (ngx_memcmp(p, key[i].data, key[i].len) != 0) {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                          "cache file \"%s\" has md5 collision",
-                          c->file.name.data);
-            return NGX_DECLINED;
+    clnf->fd = fd;
+    clnf->name = c->file.name.data;
+    clnf->log = r->pool->log;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache fill \"%s\" fd: %d", c->fill->name, fd);
+
+    c->file.fd = fd;
+    c->file.log = r->connection->log;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+    c->length = c->fill->length;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    u_char                        *p;
+    time_t                         now;
+    ssize_t                        n;
+    ngx_str_t                     *key;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_header_t  *h;
+
+    if (c->memory) {
+        n = c->length;
+
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+
+        if (n < 0) {
+            return n;
+        }
+    }
+
+    if ((size_t) n < c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" is too small", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+
+    if (h->version != c->file_cache->version) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "cache file \"%s\" version mismatch", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    if (h->crc32 != c->crc32 || (size_t) h->header_start != c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has md5 collision", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    p = c->buf->pos + sizeof(ngx_http_file_cache_header_t)
+        + sizeof(ngx_http_file_cache_key);
+
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        if (ngx_memcmp(p, key[i].data, key[i].len) != 0) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                          "cache file \"%s\" has md5 collision",
+                          c->file.name.data);
+            return NGX_DECLINED;
         }
 
         p += key[i].len;
@@ -632,7 +1188,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     cache = c->file_cache;
 
-    if (cache->sh->cold) {
+    if (cache->sh->cold && c->fill == NULL) {
 
         ngx_shmtx_lock(&cache->shpool->mutex);
 
@@ -642,8 +1198,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             c->node->exists = 1;
             c->node->uniq = c->uniq;
             c->node->fs_size = c->fs_size;
+            c->node->dir = c->dir;
 
             cache->sh->size += c->fs_size;
+            cache->sh->dir_size[c->dir] += c->fs_size;
         }
 
         ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -676,6 +1234,12 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (cache->mem_zone && !c->memory && c->fill == NULL
+        && c->length <= (off_t) cache->max_mem_object)
+    {
+        ngx_http_file_cache_mem_promote(r, c);
+    }
+
     return NGX_OK;
 }
 
@@ -683,6 +1247,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 static ssize_t
 ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    size_t                     size;
 #if (NGX_HAVE_FILE_AIO || NGX_THREADS)
     ssize_t                    n;
     ngx_http_core_loc_conf_t  *clcf;
@@ -690,10 +1255,12 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 #endif
 
+    size = c->buf->end - c->buf->pos;
+
 #if (NGX_HAVE_FILE_AIO)
 
     if (clcf->aio == NGX_HTTP_AIO_ON && ngx_file_aio) {
-        n = ngx_file_aio_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
+        n = ngx_file_aio_read(&c->file, c->buf->pos, size, 0, r->pool);
 
         if (n != NGX_AGAIN) {
             c->reading = 0;
@@ -722,7 +1289,7 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->file.thread_handler = ngx_http_cache_thread_handler;
         c->file.thread_ctx = r;
 
-        n = ngx_thread_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
+        n = ngx_thread_read(&c->file, c->buf->pos, size, 0, r->pool);
 
         c->thread_task = c->file.thread_task;
         c->reading = (n == NGX_AGAIN);
@@ -732,7 +1299,7 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
 #endif
 
-    return ngx_read_file(&c->file, c->buf->pos, c->body_start, 0);
+    return ngx_read_file(&c->file, c->buf->pos, size, 0);
 }
 
 
@@ -889,14 +1456,26 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     if (fcn == NULL) {
         fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+        if (cache->admission == NGX_HTTP_CACHE_ADMISSION_TINYLFU) {
+            ngx_http_file_cache_sketch_add(cache, c->key);
+        }
     }
 
     if (fcn) {
-        ngx_queue_remove(&fcn->queue);
+
+        if (cache->eviction == NGX_HTTP_CACHE_EVICTION_LRU) {
+            ngx_queue_remove(&fcn->queue);
+            ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        }
 
         if (c->node == NULL) {
             fcn->uses++;
             fcn->count++;
+
+            if (fcn->freq < NGX_HTTP_FILE_CACHE_MAX_FREQ) {
+                fcn->freq++;
+            }
         }
 
         if (fcn->error) {
@@ -912,6 +1491,15 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
         if (fcn->exists || fcn->uses >= c->min_uses) {
 
+            if (!fcn->exists
+                && fcn->count == 1
+                && !ngx_http_file_cache_admit(cache, fcn, c->key))
+            {
+                rc = NGX_AGAIN;
+
+                goto done;
+            }
+
             c->exists = fcn->exists;
             if (fcn->body_start && !c->update_variant) {
                 c->body_start = fcn->body_start;
@@ -934,7 +1522,8 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
         ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        (void) ngx_http_file_cache_forced_expire(cache);
+        (void) ngx_http_file_cache_forced_expire(cache,
+                                                 NGX_HTTP_FILE_CACHE_ANY_DIR);
 
         ngx_shmtx_lock(&cache->shpool->mutex);
 
@@ -959,6 +1548,14 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     fcn->uses = 1;
     fcn->count = 1;
+    fcn->dir = ngx_http_file_cache_place(cache, c->key);
+
+    ngx_http_file_cache_insert(cache, fcn, c->key);
+
+    if (c->min_uses == 1 && !ngx_http_file_cache_admit(cache, fcn, c->key)) {
+        rc = NGX_AGAIN;
+        goto done;
+    }
 
 renew:
 
@@ -976,10 +1573,9 @@ done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
     c->uniq = fcn->uniq;
     c->error = fcn->error;
+    c->dir = fcn->dir;
     c->node = fcn;
 
 failed:
@@ -1025,6 +1621,34 @@ ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
 }
 
 
+static ngx_uint_t
+ngx_http_file_cache_place(ngx_http_file_cache_t *cache, u_char *key)
+{
+    uint32_t    hash;
+    ngx_uint_t  n;
+
+    if (cache->ndirs == 1) {
+        return 0;
+    }
+
+    /*
+     * the directory is chosen by the leading bytes of the key,
+     * the levels use the trailing ones
+     */
+
+    hash = ((uint32_t) key[0] << 24) | ((uint32_t) key[1] << 16)
+           | ((uint32_t) key[2] << 8) | key[3];
+
+    hash %= cache->weight;
+
+    for (n = 0; hash >= cache->dirs[n].weight; n++) {
+        hash -= cache->dirs[n].weight;
+    }
+
+    return n;
+}
+
+
 static ngx_http_file_cache_node_t *
 ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
 {
@@ -1114,1238 +1738,3061 @@ ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
 
 
 static void
-ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary, size_t len,
-    u_char *hash)
+ngx_http_file_cache_insert(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *key)
 {
-    u_char     *p, *last;
-    ngx_str_t   name;
-    ngx_md5_t   md5;
-    u_char      buf[NGX_HTTP_CACHE_VARY_LEN];
+    uint32_t  *ghost;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache vary: \"%*s\"", len, vary);
+    if (cache->eviction == NGX_HTTP_CACHE_EVICTION_LRU) {
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        return;
+    }
 
-    ngx_md5_init(&md5);
-    ngx_md5_update(&md5, r->cache->main, NGX_HTTP_CACHE_KEY_LEN);
+    /*
+     * S3-FIFO: new keys are placed into the probationary queue,
+     * except for the keys recently evicted from it, which are
+     * remembered in the ghost table and go to the main queue
+     */
 
-    ngx_strlow(buf, vary, len);
+    ghost = &cache->sh->ghost[ngx_http_file_cache_word(key, 1)
+                              & cache->sh->ghost_mask];
 
-    p = buf;
-    last = buf + len;
+    if (*ghost == (ngx_http_file_cache_word(key, 2) | 1)) {
+        *ghost = 0;
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        return;
+    }
 
-    while (p < last) {
+    fcn->probation = 1;
+    cache->sh->probation_count++;
 
-        while (p < last && (*p == ' ' || *p == ',')) { p++; }
+    ngx_queue_insert_head(&cache->sh->probation, &fcn->queue);
+}
 
-        name.data = p;
 
-        while (p < last && *p != ',' && *p != ' ') { p++; }
+static void
+ngx_http_file_cache_remove(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    if (fcn->probation) {
+        fcn->probation = 0;
+        cache->sh->probation_count--;
+    }
 
-        name.len = p - name.data;
+    ngx_queue_remove(&fcn->queue);
+}
 
-        if (name.len == 0) {
-            break;
-        }
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache vary: %V", &name);
+static void
+ngx_http_file_cache_reinsert(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    /*
+     * S3-FIFO: a node accessed while in the probationary queue
+     * is promoted to the main queue, a node accessed while in
+     * the main queue is moved to its head with lower frequency
+     */
 
-        ngx_md5_update(&md5, name.data, name.len);
-        ngx_md5_update(&md5, (u_char *) ":", sizeof(":") - 1);
+    if (fcn->probation) {
+        fcn->freq = 0;
 
-        ngx_http_file_cache_vary_header(r, &md5, &name);
+    } else {
+        fcn->freq--;
+    }
 
-        ngx_md5_update(&md5, (u_char *) CRLF, sizeof(CRLF) - 1);
+    ngx_http_file_cache_remove(cache, fcn);
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+}
+
+
+static ngx_queue_t *
+ngx_http_file_cache_victims(ngx_http_file_cache_t *cache)
+{
+    /* S3-FIFO: the probationary queue is kept at 10% of nodes */
+
+    if (cache->eviction == NGX_HTTP_CACHE_EVICTION_S3FIFO
+        && cache->sh->probation_count
+        && cache->sh->probation_count >= cache->sh->count / 10)
+    {
+        return &cache->sh->probation;
     }
 
-    ngx_md5_final(hash, &md5);
+    return &cache->sh->queue;
 }
 
 
 static void
-ngx_http_file_cache_vary_header(ngx_http_request_t *r, ngx_md5_t *md5,
-    ngx_str_t *name)
+ngx_http_file_cache_node_key(ngx_http_file_cache_node_t *fcn, u_char *key)
 {
-    size_t            len;
-    u_char           *p, *start, *last;
-    ngx_uint_t        i, multiple, normalize;
-    ngx_list_part_t  *part;
-    ngx_table_elt_t  *header;
-
-    multiple = 0;
-    normalize = 0;
+    ngx_memcpy(key, (u_char *) &fcn->node.key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+}
 
-    if (name->len == sizeof("Accept-Charset") - 1
-        && ngx_strncasecmp(name->data, (u_char *) "Accept-Charset",
-                           sizeof("Accept-Charset") - 1) == 0)
-    {
-        normalize = 1;
 
-    } else if (name->len == sizeof("Accept-Encoding") - 1
-        && ngx_strncasecmp(name->data, (u_char *) "Accept-Encoding",
-                           sizeof("Accept-Encoding") - 1) == 0)
-    {
-        normalize = 1;
+static ngx_uint_t
+ngx_http_file_cache_admit(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *key)
+{
+    off_t                        max_size;
+    ngx_queue_t                 *queue;
+    ngx_http_file_cache_node_t  *victim;
+    u_char                       victim_key[NGX_HTTP_CACHE_KEY_LEN];
 
-    } else if (name->len == sizeof("Accept-Language") - 1
-        && ngx_strncasecmp(name->data, (u_char *) "Accept-Language",
-                           sizeof("Accept-Language") - 1) == 0)
-    {
-        normalize = 1;
+    if (cache->admission == NGX_HTTP_CACHE_ADMISSION_OFF) {
+        return 1;
     }
 
-    part = &r->headers_in.headers.part;
-    header = part->elts;
-
-    for (i = 0; /* void */ ; i++) {
+    /*
+     * TinyLFU: any key is admitted until the cache is nearly full,
+     * then a key is only admitted if it is requested more often than
+     * the key which is to be evicted next
+     */
 
-        if (i >= part->nelts) {
-            if (part->next == NULL) {
-                break;
-            }
+    max_size = cache->dirs[fcn->dir].max_size;
 
-            part = part->next;
-            header = part->elts;
-            i = 0;
-        }
+    if (cache->sh->count < cache->sh->watermark
+        && cache->sh->dir_size[fcn->dir] < max_size - max_size / 16)
+    {
+        return 1;
+    }
 
-        if (header[i].hash == 0) {
-            continue;
-        }
+    queue = ngx_http_file_cache_victims(cache);
 
-        if (header[i].key.len != name->len) {
-            continue;
-        }
+    if (ngx_queue_empty(queue)) {
+        return 1;
+    }
 
-        if (ngx_strncasecmp(header[i].key.data, name->data, name->len) != 0) {
-            continue;
-        }
+    victim = ngx_queue_data(ngx_queue_last(queue), ngx_http_file_cache_node_t,
+                            queue);
 
-        if (!normalize) {
+    if (victim == fcn) {
+        return 1;
+    }
 
-            if (multiple) {
-                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
-            }
+    ngx_http_file_cache_node_key(victim, victim_key);
 
-            ngx_md5_update(md5, header[i].value.data, header[i].value.len);
+    if (ngx_http_file_cache_sketch_get(cache, key)
+        > ngx_http_file_cache_sketch_get(cache, victim_key))
+    {
+        return 1;
+    }
 
-            multiple = 1;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache admission rejected");
 
-            continue;
-        }
+    ngx_http_file_cache_stat(cache, NGX_HTTP_FILE_CACHE_REJECTED);
 
-        /* normalize spaces */
+    return 0;
+}
 
-        p = header[i].value.data;
-        last = p + header[i].value.len;
 
-        while (p < last) {
+static void
+ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache, u_char *key)
+{
+    u_char      *counter[NGX_HTTP_FILE_CACHE_SKETCH_ROWS];
+    uint64_t    *p, *last;
+    ngx_uint_t   i, min, width;
 
-            while (p < last && (*p == ' ' || *p == ',')) { p++; }
+    /*
+     * a count-min sketch with a row per 32-bit word of the key;
+     * only the smallest counters are incremented
+     */
 
-            start = p;
+    width = cache->sh->sketch_mask + 1;
+    min = NGX_HTTP_FILE_CACHE_SKETCH_MAX;
 
-            while (p < last && *p != ',' && *p != ' ') { p++; }
+    for (i = 0; i < NGX_HTTP_FILE_CACHE_SKETCH_ROWS; i++) {
+        counter[i] = &cache->sh->sketch[i * width
+                                        + (ngx_http_file_cache_word(key, i)
+                                           & cache->sh->sketch_mask)];
 
-            len = p - start;
+        min = ngx_min(min, *counter[i]);
+    }
 
-            if (len == 0) {
-                break;
+    if (min < NGX_HTTP_FILE_CACHE_SKETCH_MAX) {
+        for (i = 0; i < NGX_HTTP_FILE_CACHE_SKETCH_ROWS; i++) {
+            if (*counter[i] == min) {
+                (*counter[i])++;
             }
+        }
+    }
 
-            if (multiple) {
-                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
-            }
+    if (++cache->sh->sketch_ops < 10 * width) {
+        return;
+    }
 
-            ngx_md5_update(md5, start, len);
+    /* all counters are halved from time to time to age out old keys */
 
-            multiple = 1;
-        }
+    cache->sh->sketch_ops /= 2;
+
+    p = (uint64_t *) cache->sh->sketch;
+    last = p + NGX_HTTP_FILE_CACHE_SKETCH_ROWS * width / sizeof(uint64_t);
+
+    while (p < last) {
+        *p = (*p >> 1) & 0x7f7f7f7f7f7f7f7fULL;
+        p++;
     }
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
+static ngx_uint_t
+ngx_http_file_cache_sketch_get(ngx_http_file_cache_t *cache, u_char *key)
 {
-    ngx_http_file_cache_t  *cache;
+    ngx_uint_t  i, n, min, width;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache reopen");
+    width = cache->sh->sketch_mask + 1;
+    min = NGX_HTTP_FILE_CACHE_SKETCH_MAX;
 
-    if (c->secondary) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has incorrect vary hash",
-                      c->file.name.data);
-        return NGX_DECLINED;
-    }
-
-    cache = c->file_cache;
-
-    ngx_shmtx_lock(&cache->shpool->mutex);
-
-    c->node->count--;
-    c->node = NULL;
-
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    c->secondary = 1;
-    c->file.name.len = 0;
-    c->body_start = c->buffer_size;
+    for (i = 0; i < NGX_HTTP_FILE_CACHE_SKETCH_ROWS; i++) {
+        n = cache->sh->sketch[i * width
+                              + (ngx_http_file_cache_word(key, i)
+                                 & cache->sh->sketch_mask)];
 
-    ngx_memcpy(c->key, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+        min = ngx_min(min, n);
+    }
 
-    return ngx_http_file_cache_open(r);
+    return min;
 }
 
 
-ngx_int_t
-ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
+static ngx_int_t
+ngx_http_file_cache_mem_open(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_header_t  *h = (ngx_http_file_cache_header_t *) buf;
-
-    u_char            *p;
-    ngx_str_t         *key;
-    ngx_uint_t         i;
-    ngx_http_cache_t  *c;
-
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache set header");
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_mem_node_t  *mn;
 
-    c = r->cache;
+    cache = c->file_cache;
 
-    ngx_memzero(h, sizeof(ngx_http_file_cache_header_t));
+    ngx_shmtx_lock(&cache->mem_shpool->mutex);
 
-    h->version = NGX_HTTP_CACHE_VERSION;
-    h->valid_sec = c->valid_sec;
-    h->updating_sec = c->updating_sec;
-    h->error_sec = c->error_sec;
-    h->last_modified = c->last_modified;
-    h->date = c->date;
-    h->crc32 = c->crc32;
-    h->valid_msec = (u_short) c->valid_msec;
-    h->header_start = (u_short) c->header_start;
-    h->body_start = (u_short) c->body_start;
+    mn = ngx_http_file_cache_mem_lookup(cache, c->key);
 
-    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
-        h->etag_len = (u_char) c->etag.len;
-        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
+    if (mn == NULL) {
+        ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+        return NGX_DECLINED;
     }
 
-    if (c->vary.len) {
-        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
-            /* should not happen */
-            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
-        }
-
-        h->vary_len = (u_char) c->vary.len;
-        ngx_memcpy(h->vary, c->vary.data, c->vary.len);
-
-        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
-        ngx_memcpy(h->variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+    if (mn->uniq != c->uniq) {
+        ngx_http_file_cache_mem_delete(cache, mn);
+        ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+        return NGX_DECLINED;
     }
 
-    if (ngx_http_file_cache_update_variant(r, c) != NGX_OK) {
+    c->buf = ngx_create_temp_buf(r->pool, mn->len);
+    if (c->buf == NULL) {
+        ngx_shmtx_unlock(&cache->mem_shpool->mutex);
         return NGX_ERROR;
     }
 
-    p = buf + sizeof(ngx_http_file_cache_header_t);
+    ngx_memcpy(c->buf->pos, mn->data, mn->len);
 
-    p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
+    c->length = mn->len;
+    c->fs_size = mn->fs_size;
 
-    key = c->keys.elts;
-    for (i = 0; i < c->keys.nelts; i++) {
-        p = ngx_copy(p, key[i].data, key[i].len);
-    }
+    ngx_queue_remove(&mn->queue);
+    ngx_queue_insert_head(&cache->mem_sh->queue, &mn->queue);
 
-    *p = LF;
+    ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache memory: %O", c->length);
+
+    c->memory = 1;
 
     return NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
+static void
+ngx_http_file_cache_mem_promote(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_t  *cache;
+    size_t                           len, size;
+    ngx_queue_t                     *q;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_mem_node_t  *mn;
 
-    if (!c->secondary) {
-        return NGX_OK;
-    }
+    cache = c->file_cache;
 
-    if (c->vary.len
-        && ngx_memcmp(c->variant, c->key, NGX_HTTP_CACHE_KEY_LEN) == 0)
-    {
-        return NGX_OK;
-    }
+    len = (size_t) c->length;
 
     /*
-     * if the variant hash doesn't match one we used as a secondary
-     * cache key, switch back to the original key
+     * the whole object is read along with its header,
+     * see ngx_http_file_cache_open()
      */
 
-    cache = c->file_cache;
+    if ((size_t) (c->buf->last - c->buf->pos) < len) {
+        return;
+    }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache main key");
+    /*
+     * the keys zone is locked first, so the object cannot be
+     * replaced or deleted on disk before it is stored in memory
+     */
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    c->node->count--;
-    c->node->updating = 0;
-    c->node = NULL;
+    if (!c->node->exists || c->node->deleting) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    if (c->node->uniq == 0) {
+        /* nodes added by the cache loader */
+        c->node->uniq = c->uniq;
+
+    } else if (c->node->uniq != c->uniq) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
 
+    ngx_shmtx_lock(&cache->mem_shpool->mutex);
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    c->file.name.len = 0;
-    c->update_variant = 1;
+    mn = ngx_http_file_cache_mem_lookup(cache, c->key);
 
-    ngx_memcpy(c->key, c->main, NGX_HTTP_CACHE_KEY_LEN);
+    if (mn) {
+        if (mn->uniq == c->uniq) {
+            goto done;
+        }
 
-    if (ngx_http_file_cache_exists(cache, c) == NGX_ERROR) {
-        return NGX_ERROR;
+        ngx_http_file_cache_mem_delete(cache, mn);
     }
 
-    if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
-        return NGX_ERROR;
-    }
+    size = offsetof(ngx_http_file_cache_mem_node_t, data) + len;
 
-    return NGX_OK;
-}
+    for ( ;; ) {
+        mn = ngx_slab_alloc_locked(cache->mem_shpool, size);
 
+        if (mn) {
+            break;
+        }
 
-void
-ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
-{
-    off_t                   fs_size;
-    ngx_int_t               rc;
-    ngx_file_uniq_t         uniq;
-    ngx_file_info_t         fi;
-    ngx_http_cache_t        *c;
-    ngx_ext_rename_file_t   ext;
-    ngx_http_file_cache_t  *cache;
+        if (ngx_queue_empty(&cache->mem_sh->queue)) {
+            goto done;
+        }
 
-    c = r->cache;
+        q = ngx_queue_last(&cache->mem_sh->queue);
 
-    if (c->updated) {
-        return;
+        ngx_http_file_cache_mem_delete(cache,
+                     ngx_queue_data(q, ngx_http_file_cache_mem_node_t, queue));
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache update");
+    ngx_memcpy((u_char *) &mn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
-    cache = c->file_cache;
+    ngx_memcpy(mn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    c->updated = 1;
-    c->updating = 0;
+    mn->uniq = c->uniq;
+    mn->fs_size = c->fs_size;
+    mn->len = len;
 
-    uniq = 0;
-    fs_size = 0;
+    ngx_memcpy(mn->data, c->buf->pos, len);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache rename: \"%s\" to \"%s\"",
-                   tf->file.name.data, c->file.name.data);
+    ngx_rbtree_insert(&cache->mem_sh->rbtree, &mn->node);
+    ngx_queue_insert_head(&cache->mem_sh->queue, &mn->queue);
 
-    ext.access = NGX_FILE_OWNER_ACCESS;
-    ext.path_access = NGX_FILE_OWNER_ACCESS;
-    ext.time = -1;
-    ext.create_path = 1;
-    ext.delete_file = 1;
-    ext.log = r->connection->log;
+    cache->mem_sh->size += len;
+    cache->mem_sh->count++;
 
-    rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache promote: %uz", len);
 
-    if (rc == NGX_OK) {
+done:
 
-        if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
-                          ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+    ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+}
 
-            rc = NGX_ERROR;
 
-        } else {
-            uniq = ngx_file_uniq(&fi);
-            fs_size = (ngx_file_fs_size(&fi) + cache->bsize - 1) / cache->bsize;
-        }
-    }
+static void
+ngx_http_file_cache_mem_invalidate(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_http_file_cache_mem_node_t  *mn;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    /* the keys zone is expected to be locked */
 
-    c->node->count--;
-    c->node->error = 0;
-    c->node->uniq = uniq;
-    c->node->body_start = c->body_start;
+    ngx_memcpy(key, (u_char *) &fcn->node.key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    cache->sh->size += fs_size - c->node->fs_size;
-    c->node->fs_size = fs_size;
+    ngx_shmtx_lock(&cache->mem_shpool->mutex);
 
-    if (rc == NGX_OK) {
-        c->node->exists = 1;
-    }
+    mn = ngx_http_file_cache_mem_lookup(cache, key);
 
-    c->node->updating = 0;
+    if (mn) {
+        ngx_http_file_cache_mem_delete(cache, mn);
+    }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&cache->mem_shpool->mutex);
 }
 
 
-void
-ngx_http_file_cache_update_header(ngx_http_request_t *r)
+static ngx_http_file_cache_mem_node_t *
+ngx_http_file_cache_mem_lookup(ngx_http_file_cache_t *cache, u_char *key)
 {
-    ssize_t                        n;
-    ngx_err_t                      err;
-    ngx_file_t                     file;
-    ngx_file_info_t                fi;
-    ngx_http_cache_t              *c;
-    ngx_http_file_cache_header_t   h;
+    ngx_int_t                        rc;
+    ngx_rbtree_key_t                 node_key;
+    ngx_rbtree_node_t               *node, *sentinel;
+    ngx_http_file_cache_mem_node_t  *mn;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache update header");
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    c = r->cache;
+    node = cache->mem_sh->rbtree.root;
+    sentinel = cache->mem_sh->rbtree.sentinel;
 
-    ngx_memzero(&file, sizeof(ngx_file_t));
+    while (node != sentinel) {
 
-    file.name = c->file.name;
-    file.log = r->connection->log;
-    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
 
-    if (file.fd == NGX_INVALID_FILE) {
-        err = ngx_errno;
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
 
-        /* cache file may have been deleted */
+        /* node_key == node->key */
 
-        if (err == NGX_ENOENT) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "http file cache \"%s\" not found",
-                           file.name.data);
-            return;
+        mn = (ngx_http_file_cache_mem_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], mn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return mn;
         }
 
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                      ngx_open_file_n " \"%s\" failed", file.name.data);
-        return;
+        node = (rc < 0) ? node->left : node->right;
     }
 
-    /*
-     * make sure cache file wasn't replaced;
-     * if it was, do nothing
-     */
+    /* not found */
 
-    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
-                      ngx_fd_info_n " \"%s\" failed", file.name.data);
-        goto done;
-    }
+    return NULL;
+}
 
-    if (c->uniq != ngx_file_uniq(&fi)
-        || c->length != ngx_file_size(&fi))
-    {
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache \"%s\" changed",
-                       file.name.data);
-        goto done;
-    }
 
-    n = ngx_read_file(&file, (u_char *) &h,
-                      sizeof(ngx_http_file_cache_header_t), 0);
+static void
+ngx_http_file_cache_mem_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_mem_node_t *mn)
+{
+    ngx_queue_remove(&mn->queue);
+    ngx_rbtree_delete(&cache->mem_sh->rbtree, &mn->node);
 
-    if (n == NGX_ERROR) {
-        goto done;
-    }
+    cache->mem_sh->size -= mn->len;
+    cache->mem_sh->count--;
 
-    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      ngx_read_file_n " read only %z of %z from \"%s\"",
-                      n, sizeof(ngx_http_file_cache_header_t), file.name.data);
+    ngx_slab_free_locked(cache->mem_shpool, mn);
+}
+
+
+static void
+ngx_http_file_cache_mem_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t               **p;
+    ngx_http_file_cache_mem_node_t   *mn, *mnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            mn = (ngx_http_file_cache_mem_node_t *) node;
+            mnt = (ngx_http_file_cache_mem_node_t *) temp;
+
+            p = (ngx_memcmp(mn->key, mnt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary, size_t len,
+    u_char *hash)
+{
+    u_char     *p, *last;
+    ngx_str_t   name;
+    ngx_md5_t   md5;
+    u_char      buf[NGX_HTTP_CACHE_VARY_LEN];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache vary: \"%*s\"", len, vary);
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, r->cache->main, NGX_HTTP_CACHE_KEY_LEN);
+
+    ngx_strlow(buf, vary, len);
+
+    p = buf;
+    last = buf + len;
+
+    while (p < last) {
+
+        while (p < last && (*p == ' ' || *p == ',')) { p++; }
+
+        name.data = p;
+
+        while (p < last && *p != ',' && *p != ' ') { p++; }
+
+        name.len = p - name.data;
+
+        if (name.len == 0) {
+            break;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache vary: %V", &name);
+
+        ngx_md5_update(&md5, name.data, name.len);
+        ngx_md5_update(&md5, (u_char *) ":", sizeof(":") - 1);
+
+        ngx_http_file_cache_vary_header(r, &md5, &name);
+
+        ngx_md5_update(&md5, (u_char *) CRLF, sizeof(CRLF) - 1);
+    }
+
+    ngx_md5_final(hash, &md5);
+}
+
+
+static void
+ngx_http_file_cache_vary_header(ngx_http_request_t *r, ngx_md5_t *md5,
+    ngx_str_t *name)
+{
+    size_t            len;
+    u_char           *p, *start, *last;
+    ngx_uint_t        i, multiple, normalize;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    multiple = 0;
+    normalize = 0;
+
+    if (name->len == sizeof("Accept-Charset") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Accept-Charset",
+                           sizeof("Accept-Charset") - 1) == 0)
+    {
+        normalize = 1;
+
+    } else if (name->len == sizeof("Accept-Encoding") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Accept-Encoding",
+                           sizeof("Accept-Encoding") - 1) == 0)
+    {
+        normalize = 1;
+
+    } else if (name->len == sizeof("Accept-Language") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Accept-Language",
+                           sizeof("Accept-Language") - 1) == 0)
+    {
+        normalize = 1;
+    }
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        if (header[i].key.len != name->len) {
+            continue;
+        }
+
+        if (ngx_strncasecmp(header[i].key.data, name->data, name->len) != 0) {
+            continue;
+        }
+
+        if (!normalize) {
+
+            if (multiple) {
+                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
+            }
+
+            ngx_md5_update(md5, header[i].value.data, header[i].value.len);
+
+            multiple = 1;
+
+            continue;
+        }
+
+        /* normalize spaces */
+
+        p = header[i].value.data;
+        last = p + header[i].value.len;
+
+        while (p < last) {
+
+            while (p < last && (*p == ' ' || *p == ',')) { p++; }
+
+            start = p;
+
+            while (p < last && *p != ',' && *p != ' ') { p++; }
+
+            len = p - start;
+
+            if (len == 0) {
+                break;
+            }
+
+            if (multiple) {
+                ngx_md5_update(md5, (u_char *) ",", sizeof(",") - 1);
+            }
+
+            ngx_md5_update(md5, start, len);
+
+            multiple = 1;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t  *cache;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache reopen");
+
+    if (c->secondary) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has incorrect vary hash",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->count--;
+    c->node = NULL;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->secondary = 1;
+    c->memory = 0;
+    c->file.name.len = 0;
+    c->body_start = c->buffer_size;
+
+    ngx_memcpy(c->key, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+
+    return ngx_http_file_cache_open(r);
+}
+
+
+ngx_int_t
+ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
+{
+    ngx_http_file_cache_header_t  *h = (ngx_http_file_cache_header_t *) buf;
+
+    u_char            *p;
+    ngx_str_t         *key;
+    ngx_uint_t         i;
+    ngx_http_cache_t  *c;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache set header");
+
+    c = r->cache;
+
+    ngx_memzero(h, sizeof(ngx_http_file_cache_header_t));
+
+    h->version = c->file_cache->version;
+    h->valid_sec = c->valid_sec;
+    h->updating_sec = c->updating_sec;
+    h->error_sec = c->error_sec;
+    h->last_modified = c->last_modified;
+    h->date = c->date;
+    h->crc32 = c->crc32;
+    h->valid_msec = (u_short) c->valid_msec;
+    h->header_start = (u_short) c->header_start;
+    h->body_start = (u_short) c->body_start;
+
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h->etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
+    }
+
+    if (c->vary.len) {
+        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
+            /* should not happen */
+            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
+        }
+
+        h->vary_len = (u_char) c->vary.len;
+        ngx_memcpy(h->vary, c->vary.data, c->vary.len);
+
+        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
+        ngx_memcpy(h->variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    if (ngx_http_file_cache_update_variant(r, c) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    p = buf + sizeof(ngx_http_file_cache_header_t);
+
+    p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
+
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        p = ngx_copy(p, key[i].data, key[i].len);
+    }
+
+    *p = LF;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t  *cache;
+
+    if (!c->secondary) {
+        return NGX_OK;
+    }
+
+    if (c->vary.len
+        && ngx_memcmp(c->variant, c->key, NGX_HTTP_CACHE_KEY_LEN) == 0)
+    {
+        return NGX_OK;
+    }
+
+    /*
+     * if the variant hash doesn't match one we used as a secondary
+     * cache key, switch back to the original key
+     */
+
+    cache = c->file_cache;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache main key");
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->count--;
+    c->node->updating = 0;
+    c->node = NULL;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->file.name.len = 0;
+    c->update_variant = 1;
+
+    ngx_memcpy(c->key, c->main, NGX_HTTP_CACHE_KEY_LEN);
+
+    if (ngx_http_file_cache_exists(cache, c) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_file_cache_name(r, cache->dirs[c->dir].path) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_file_cache_fill(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    size_t                       len;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_fill_t  *fill;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    if (!cache->read_while_write || !c->updating || c->updated || c->no_fill) {
+        return;
+    }
+
+    if (tf->file.fd == NGX_INVALID_FILE || tf->offset < (off_t) c->body_start) {
+        return;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (c->fill == NULL) {
+
+        /*
+         * variants are not published, and neither is a response
+         * whose lock was taken over by another request
+         */
+
+        if (c->vary.len || c->node->lock_time != c->lock_time) {
+            c->no_fill = 1;
+            goto done;
+        }
+
+        len = offsetof(ngx_http_file_cache_fill_t, name)
+              + tf->file.name.len + 1;
+
+        fill = ngx_slab_alloc_locked(cache->shpool, len);
+        if (fill == NULL) {
+            c->no_fill = 1;
+            goto done;
+        }
+
+        fill->count = 1;
+        fill->done = 0;
+        fill->error = 0;
+        (void) ngx_cpystrn(fill->name, tf->file.name.data,
+                           tf->file.name.len + 1);
+
+        c->fill = fill;
+        c->node->fill = fill;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache fill: \"%s\"", fill->name);
+    }
+
+    c->fill->length = tf->offset;
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+void
+ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    off_t                   fs_size;
+    ngx_int_t               rc;
+    ngx_uint_t              updating;
+    ngx_file_uniq_t         uniq;
+    ngx_file_info_t         fi;
+    ngx_http_cache_t        *c;
+    ngx_ext_rename_file_t   ext;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+
+    if (c->updated) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update");
+
+    cache = c->file_cache;
+
+    updating = c->updating;
+
+    c->updated = 1;
+    c->updating = 0;
+
+    uniq = 0;
+    fs_size = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache rename: \"%s\" to \"%s\"",
+                   tf->file.name.data, c->file.name.data);
+
+    ext.access = NGX_FILE_OWNER_ACCESS;
+    ext.path_access = NGX_FILE_OWNER_ACCESS;
+    ext.time = -1;
+    ext.create_path = 1;
+    ext.delete_file = 1;
+    ext.log = r->connection->log;
+
+    rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
+
+    if (rc == NGX_OK) {
+
+        if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+
+            rc = NGX_ERROR;
+
+        } else {
+            uniq = ngx_file_uniq(&fi);
+            fs_size = (ngx_file_fs_size(&fi) + cache->bsize - 1) / cache->bsize;
+        }
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->count--;
+    c->node->error = 0;
+    c->node->indexed = 0;
+    c->node->uniq = uniq;
+    c->node->body_start = c->body_start;
+
+    cache->sh->size += fs_size - c->node->fs_size;
+    cache->sh->dir_size[c->node->dir] -= c->node->fs_size;
+    cache->sh->dir_size[c->dir] += fs_size;
+    c->node->fs_size = fs_size;
+    c->node->dir = c->dir;
+
+    if (rc == NGX_OK) {
+        c->node->exists = 1;
+        ngx_http_file_cache_stat(cache, NGX_HTTP_FILE_CACHE_STORED);
+    }
+
+    if (c->fill) {
+
+        if (updating) {
+            c->fill->length = tf->offset;
+
+            if (rc == NGX_OK) {
+                c->fill->done = 1;
+
+            } else {
+                c->fill->error = 1;
+            }
+        }
+
+        ngx_http_file_cache_fill_free(cache, c);
+    }
+
+    c->node->updating = 0;
+
+    if (cache->mem_zone) {
+        ngx_http_file_cache_mem_invalidate(cache, c->node);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+void
+ngx_http_file_cache_update_header(ngx_http_request_t *r)
+{
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_file_t                     file;
+    ngx_file_info_t                fi;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_header_t   h;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update header");
+
+    c = r->cache;
+
+    ngx_http_file_cache_stat(c->file_cache, NGX_HTTP_FILE_CACHE_REVALIDATED);
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = c->file.name;
+    file.log = r->connection->log;
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        /* cache file may have been deleted */
+
+        if (err == NGX_ENOENT) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache \"%s\" not found",
+                           file.name.data);
+            return;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        return;
+    }
+
+    /*
+     * make sure cache file wasn't replaced;
+     * if it was, do nothing
+     */
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    if (c->uniq != ngx_file_uniq(&fi)
+        || c->length != ngx_file_size(&fi))
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" changed",
+                       file.name.data);
+        goto done;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &h,
+                      sizeof(ngx_http_file_cache_header_t), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " read only %z of %z from \"%s\"",
+                      n, sizeof(ngx_http_file_cache_header_t), file.name.data);
+        goto done;
+    }
+
+    if (h.version != c->file_cache->version
+        || h.last_modified != c->last_modified
+        || h.crc32 != c->crc32
+        || (size_t) h.header_start != c->header_start
+        || (size_t) h.body_start != c->body_start)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" content changed",
+                       file.name.data);
+        goto done;
+    }
+
+    /*
+     * update cache file header with new data,
+     * notably h.valid_sec and h.date
+     */
+
+    ngx_memzero(&h, sizeof(ngx_http_file_cache_header_t));
+
+    h.version = c->file_cache->version;
+    h.valid_sec = c->valid_sec;
+    h.updating_sec = c->updating_sec;
+    h.error_sec = c->error_sec;
+    h.last_modified = c->last_modified;
+    h.date = c->date;
+    h.crc32 = c->crc32;
+    h.valid_msec = (u_short) c->valid_msec;
+    h.header_start = (u_short) c->header_start;
+    h.body_start = (u_short) c->body_start;
+
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h.etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h.etag, c->etag.data, c->etag.len);
+    }
+
+    if (c->vary.len) {
+        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
+            /* should not happen */
+            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
+        }
+
+        h.vary_len = (u_char) c->vary.len;
+        ngx_memcpy(h.vary, c->vary.data, c->vary.len);
+
+        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
+        ngx_memcpy(h.variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    (void) ngx_write_file(&file, (u_char *) &h,
+                          sizeof(ngx_http_file_cache_header_t), 0);
+
+    cache = c->file_cache;
+
+    if (cache->mem_zone && c->node) {
+        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_http_file_cache_mem_invalidate(cache, c->node);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+    }
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+}
+
+
+ngx_int_t
+ngx_http_cache_send(ngx_http_request_t *r)
+{
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache send: %s", c->file.name.data);
+
+    if (c->fill) {
+
+        /* the response is still being written by another request */
+
+        r->single_range = 1;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+
+        c->length = c->body_start;
+
+        c->wait_event.handler = ngx_http_file_cache_fill_wait_handler;
+        c->wait_event.data = r;
+        c->wait_event.log = r->connection->log;
+
+        r->write_event_handler = ngx_http_file_cache_fill_handler;
+
+        return ngx_http_file_cache_fill_send(r);
+    }
+
+    /* we need to allocate all before the header would be sent */
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!c->memory) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    if (c->memory) {
+        b->pos = c->buf->start + c->body_start;
+        b->last = c->buf->start + c->length;
+
+        b->memory = (c->length - c->body_start) ? 1 : 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+
+        b->in_file = (c->length - c->body_start) ? 1 : 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+    b->sync = (b->last_buf || b->in_file || b->memory) ? 0 : 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_fill_send(ngx_http_request_t *r)
+{
+    off_t                      length;
+    ngx_int_t                  rc;
+    ngx_uint_t                 done, error;
+    ngx_buf_t                 *b;
+    ngx_chain_t               *out;
+    ngx_event_t               *wev;
+    ngx_http_cache_t          *c;
+    ngx_http_file_cache_t     *cache;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    if (r->aio) {
+        return NGX_DONE;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    length = c->fill->length;
+    done = c->fill->done;
+    error = c->fill->error;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache fill send: %O-%O d:%ui",
+                   c->length, length, done);
+
+    if (error) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache file \"%s\" was not completely written",
+                      c->file.name.data);
+        return NGX_ERROR;
+    }
+
+    out = NULL;
+
+    if (done || (length > c->length && c->busy == NULL)) {
+
+        out = ngx_chain_get_free_buf(r->pool, &c->free);
+        if (out == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = out->buf;
+
+        if (b->file == NULL) {
+            b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+            if (b->file == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+
+        b->file_pos = c->length;
+        b->file_last = length;
+        b->in_file = (length > c->length) ? 1 : 0;
+
+        b->last_buf = (done && r == r->main) ? 1 : 0;
+        b->last_in_chain = done;
+        b->flush = done ? 0 : 1;
+        b->sync = (b->last_buf || b->in_file) ? 0 : 1;
+        b->tag = (ngx_buf_tag_t) &ngx_http_file_cache_fill_send;
+
+        c->length = length;
+    }
+
+    rc = ngx_http_output_filter(r, out);
+
+    ngx_chain_update_chains(r->pool, &c->free, &c->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_file_cache_fill_send);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (done) {
+        return rc;
+    }
+
+    wev = r->connection->write;
+
+    if (r->connection->data == r && !wev->delayed) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (wev->active && !wev->ready) {
+            ngx_add_timer(wev, clcf->send_timeout);
+
+        } else if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+    }
+
+    ngx_add_timer(&c->wait_event, NGX_HTTP_FILE_CACHE_FILL_WAIT);
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_file_cache_fill_handler(ngx_http_request_t *r)
+{
+    ngx_int_t     rc;
+    ngx_event_t  *wev;
+
+    wev = r->connection->write;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        r->connection->timedout = 1;
+
+        rc = NGX_HTTP_REQUEST_TIME_OUT;
+
+    } else {
+        rc = ngx_http_file_cache_fill_send(r);
+
+        if (rc == NGX_DONE) {
+            return;
+        }
+    }
+
+    if (r->cache->wait_event.timer_set) {
+        ngx_del_timer(&r->cache->wait_event);
+    }
+
+    ngx_http_finalize_request(r, rc);
+}
+
+
+static void
+ngx_http_file_cache_fill_wait_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http file cache fill wait: \"%V?%V\"", &r->uri, &r->args);
+
+    ngx_http_file_cache_fill_handler(r);
+    ngx_http_run_posted_requests(c);
+}
+
+
+void
+ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+{
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    if (c->updated || c->node == NULL) {
+        return;
+    }
+
+    cache = c->file_cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache free, fd: %d", c->file.fd);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = c->node;
+    fcn->count--;
+
+    if (c->fill) {
+
+        if (c->updating) {
+            c->fill->error = 1;
+        }
+
+        ngx_http_file_cache_fill_free(cache, c);
+    }
+
+    if (c->updating && fcn->lock_time == c->lock_time) {
+        fcn->updating = 0;
+    }
+
+    if (c->error) {
+        fcn->error = c->error;
+
+        if (c->valid_sec) {
+            fcn->valid_sec = c->valid_sec;
+            fcn->valid_msec = c->valid_msec;
+        }
+
+    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
+        ngx_http_file_cache_remove(cache, fcn);
+        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(cache->shpool, fcn);
+        cache->sh->count--;
+        c->node = NULL;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->updated = 1;
+    c->updating = 0;
+
+    if (c->temp_file) {
+        if (tf && tf->file.fd != NGX_INVALID_FILE) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                           "http file cache incomplete: \"%s\"",
+                           tf->file.name.data);
+
+            if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
+                ngx_log_error(NGX_LOG_CRIT, c->file.log, ngx_errno,
+                              ngx_delete_file_n " \"%s\" failed",
+                              tf->file.name.data);
+            }
+        }
+    }
+
+    if (c->wait_event.timer_set) {
+        ngx_del_timer(&c->wait_event);
+    }
+}
+
+
+static void
+ngx_http_file_cache_fill_free(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_fill_t  *fill;
+
+    fill = c->fill;
+    c->fill = NULL;
+
+    /* a completed fill is not offered to new readers */
+
+    if (c->node->fill == fill && (fill->done || fill->error)) {
+        c->node->fill = NULL;
+    }
+
+    if (--fill->count == 0) {
+        ngx_slab_free_locked(cache->shpool, fill);
+    }
+}
+
+
+static void
+ngx_http_file_cache_cleanup(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    if (c->updated) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache cleanup");
+
+    if (c->updating && !c->background) {
+        ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
+                      "stalled cache updating, error:%ui", c->error);
+    }
+
+    ngx_http_file_cache_free(c, NULL);
+}
+
+
+static time_t
+ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache, ngx_uint_t dir)
+{
+    u_char                      *name, *p;
+    size_t                       len;
+    time_t                       wait;
+    ngx_uint_t                   tries, steps;
+    ngx_queue_t                 *queue, *q, *prev, *sentinel;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache forced expire: %i", (ngx_int_t) dir);
+
+    name = ngx_http_file_cache_alloc_name(cache);
+    if (name == NULL) {
+        return 10;
+    }
+
+    wait = 10;
+    tries = 20;
+    steps = NGX_HTTP_FILE_CACHE_MAX_STEPS;
+    sentinel = NULL;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    queue = ngx_http_file_cache_victims(cache);
+    q = ngx_queue_last(queue);
+
+    for ( ;; ) {
+        if (q == ngx_queue_sentinel(queue) || q == sentinel) {
+
+            if (queue == &cache->sh->probation) {
+
+                /* nothing to evict from the probationary queue */
+
+                queue = &cache->sh->queue;
+                q = ngx_queue_last(queue);
+                sentinel = NULL;
+                continue;
+            }
+
+            break;
+        }
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        /*
+         * space is freed in the given directory only; the nodes of other
+         * directories are not moved, so if the walk runs out of steps,
+         * the next attempt is postponed rather than repeated at once
+         */
+
+        if (dir != NGX_HTTP_FILE_CACHE_ANY_DIR && fcn->dir != dir) {
+
+            if (--steps == 0) {
+                wait = 1;
+                break;
+            }
+
+            q = ngx_queue_prev(q);
+            continue;
+        }
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
+                  fcn->count, fcn->exists,
+                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        /*
+         * nodes in use are skipped unless they were not accessed
+         * for the inactive time, as such nodes may be left locked
+         * by abnormally exited workers
+         */
+
+        if (cache->eviction == NGX_HTTP_CACHE_EVICTION_S3FIFO
+            && !fcn->deleting
+            && (fcn->freq || (fcn->count && fcn->expire >= ngx_time())))
+        {
+            if (--steps == 0) {
+                wait = 0;
+                break;
+            }
+
+            prev = ngx_queue_prev(q);
+
+            if (fcn->freq) {
+                ngx_http_file_cache_reinsert(cache, fcn);
+            }
+
+            q = prev;
+            continue;
+        }
+
+        if (fcn->count == 0) {
+
+            if (fcn->probation) {
+                ngx_http_file_cache_node_key(fcn, key);
+
+                cache->sh->ghost[ngx_http_file_cache_word(key, 1)
+                                 & cache->sh->ghost_mask]
+                    = ngx_http_file_cache_word(key, 2) | 1;
+            }
+
+            if (fcn->exists) {
+                ngx_http_file_cache_stat(cache, NGX_HTTP_FILE_CACHE_EVICTED);
+            }
+
+            ngx_http_file_cache_delete(cache, q, name);
+            wait = 0;
+            break;
+        }
+
+        if (fcn->deleting) {
+            wait = 1;
+            break;
+        }
+
+        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        (void) ngx_hex_dump(p, fcn->key, len);
+
+        /*
+         * abnormally exited workers may leave locked cache entries,
+         * and although it may be safe to remove them completely,
+         * we prefer to just move them to the top of the inactive queue
+         */
+
+        prev = ngx_queue_prev(q);
+
+        ngx_queue_remove(q);
+        fcn->expire = ngx_time() + cache->inactive;
+        ngx_queue_insert_head(queue, &fcn->queue);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "ignore long locked inactive cache entry %*s, count:%d",
+                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+
+        if (sentinel == NULL) {
+            sentinel = q;
+        }
+
+        if (--tries) {
+            q = prev;
+            continue;
+        }
+
+        wait = 1;
+        break;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_expire(ngx_http_file_cache_t *cache, ngx_queue_t *queue)
+{
+    u_char                      *name, *p;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_msec_t                   elapsed;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache expire");
+
+    name = ngx_http_file_cache_alloc_name(cache);
+    if (name == NULL) {
+        return 10;
+    }
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for ( ;; ) {
+
+        if (ngx_quit || ngx_terminate) {
+            wait = 1;
+            break;
+        }
+
+        if (ngx_queue_empty(queue)) {
+            wait = 10;
+            break;
+        }
+
+        q = ngx_queue_last(queue);
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        wait = fcn->expire - now;
+
+        if (wait > 0) {
+
+            /*
+             * S3-FIFO queues are not ordered by access time,
+             * so accessed nodes are moved out of the way
+             */
+
+            if (cache->eviction == NGX_HTTP_CACHE_EVICTION_S3FIFO
+                && fcn->freq)
+            {
+                ngx_http_file_cache_reinsert(cache, fcn);
+                goto next;
+            }
+
+            wait = wait > 10 ? 10 : wait;
+            break;
+        }
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
+                       fcn->count, fcn->exists,
+                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) {
+
+            if (fcn->exists) {
+                ngx_http_file_cache_stat(cache, NGX_HTTP_FILE_CACHE_INACTIVE);
+            }
+
+            ngx_http_file_cache_delete(cache, q, name);
+            goto next;
+        }
+
+        if (fcn->deleting) {
+            wait = 1;
+            break;
+        }
+
+        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        (void) ngx_hex_dump(p, fcn->key, len);
+
+        /*
+         * abnormally exited workers may leave locked cache entries,
+         * and although it may be safe to remove them completely,
+         * we prefer to just move them to the top of the inactive queue
+         */
+
+        ngx_queue_remove(q);
+        fcn->expire = ngx_time() + cache->inactive;
+        ngx_queue_insert_head(queue, &fcn->queue);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "ignore long locked inactive cache entry %*s, count:%d",
+                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+
+next:
+
+        if (++cache->files >= cache->manager_files) {
+            wait = 0;
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            wait = 0;
+            break;
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static u_char *
+ngx_http_file_cache_alloc_name(ngx_http_file_cache_t *cache)
+{
+    size_t       len;
+    ngx_uint_t   n;
+    ngx_path_t  *path;
+
+    /* a buffer for the file names in any of the cache directories */
+
+    len = 0;
+
+    for (n = 0; n < cache->ndirs; n++) {
+        path = cache->dirs[n].path;
+        len = ngx_max(len, path->name.len + 1 + path->len
+                           + 2 * NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    return ngx_alloc(len + 1, ngx_cycle->log);
+}
+
+
+static void
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
+    u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    ngx_path_t                  *path;
+    ngx_http_file_cache_node_t  *fcn;
+
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    if (fcn->exists) {
+        cache->sh->size -= fcn->fs_size;
+        cache->sh->dir_size[fcn->dir] -= fcn->fs_size;
+
+        if (cache->mem_zone) {
+            ngx_http_file_cache_mem_invalidate(cache, fcn);
+        }
+
+        path = cache->dirs[fcn->dir].path;
+        ngx_memcpy(name, path->name.data, path->name.len);
+
+        p = name + path->name.len + 1 + path->len;
+        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        p = ngx_hex_dump(p, fcn->key, len);
+        *p = '\0';
+
+        fcn->count++;
+        fcn->deleting = 1;
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        ngx_create_hashed_filename(path, name, len);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: \"%s\"", name);
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+        fcn->count--;
+        fcn->deleting = 0;
+    }
+
+    if (fcn->count == 0) {
+        ngx_http_file_cache_remove(cache, fcn);
+        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(cache->shpool, fcn);
+        cache->sh->count--;
+    }
+}
+
+
+static ngx_msec_t
+ngx_http_file_cache_manager(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t       size, free;
+    time_t      wait;
+    ngx_msec_t  elapsed, next;
+    ngx_uint_t  count, watermark, dir;
+
+    if (cache->index && !cache->sh->cold) {
+
+        /* the index is first saved an interval after the cache is loaded */
+
+        if (cache->index_time == 0) {
+            cache->index_time = ngx_time();
+
+        } else if (ngx_time() - cache->index_time >= cache->index_interval) {
+            ngx_http_file_cache_index_save(cache);
+            ngx_time_update();
+            cache->index_time = ngx_time();
+        }
+    }
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+
+    next = (ngx_msec_t) ngx_http_file_cache_expire(cache, &cache->sh->queue)
+           * 1000;
+
+    if (next && cache->eviction == NGX_HTTP_CACHE_EVICTION_S3FIFO) {
+        wait = ngx_http_file_cache_expire(cache, &cache->sh->probation);
+        next = ngx_min(next, (ngx_msec_t) wait * 1000);
+    }
+
+    if (next == 0) {
+        next = cache->manager_sleep;
+        goto done;
+    }
+
+    for ( ;; ) {
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        count = cache->sh->count;
+        watermark = cache->sh->watermark;
+
+        /* each directory is limited by its own max_size */
+
+        for (dir = 0; dir < cache->ndirs; dir++) {
+            size = cache->sh->dir_size[dir];
+
+            if (size >= cache->dirs[dir].max_size) {
+                break;
+            }
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache size: c:%ui w:%i d:%ui",
+                       count, (ngx_int_t) watermark, dir);
+
+        if (dir == cache->ndirs && count < watermark) {
+
+            if (!cache->min_free) {
+                break;
+            }
+
+            for (dir = 0; dir < cache->ndirs; dir++) {
+                free = ngx_fs_available(cache->dirs[dir].path->name.data);
+
+                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                               "http file cache free: %O d:%ui", free, dir);
+
+                if (free <= cache->min_free) {
+                    break;
+                }
+            }
+
+            if (dir == cache->ndirs) {
+                break;
+            }
+        }
+
+        if (dir == cache->ndirs) {
+            dir = NGX_HTTP_FILE_CACHE_ANY_DIR;
+        }
+
+        wait = ngx_http_file_cache_forced_expire(cache, dir);
+
+        if (wait > 0) {
+            next = (ngx_msec_t) wait * 1000;
+            break;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        if (++cache->files >= cache->manager_files) {
+            next = cache->manager_sleep;
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            next = cache->manager_sleep;
+            break;
+        }
+    }
+
+done:
+
+    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache manager: %ui e:%M n:%M",
+                   cache->files, elapsed, next);
+
+    return next;
+}
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    ngx_int_t                    rc;
+    ngx_uint_t                   n;
+    ngx_pool_t                  *pool;
+    ngx_tree_ctx_t               tree;
+    ngx_http_file_cache_walk_t   walk;
+
+    if (!cache->sh->cold || cache->sh->loading) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
+
+    if (ngx_http_file_cache_key_hash(cache) != cache->key_hash) {
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V has keys of other hash, "
+                      "removing files", &cache->path->name);
+
+        cache->reformat = 1;
+    }
+
+    walk.cache = cache;
+    walk.dir = 0;
+    walk.dirs = NULL;
+
+    ngx_http_file_cache_loader_tree(&tree, &walk);
+
+    pool = NULL;
+
+#if (NGX_THREADS)
+
+    if (cache->loader_threads > 1 && cache->path->level[0]) {
+
+        /* the first level directories are collected for the threads */
+
+        pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+
+        if (pool) {
+            walk.dirs = ngx_array_create(pool, 256,
+                                         sizeof(ngx_http_file_cache_subdir_t));
+        }
+    }
+
+#endif
+
+    rc = NGX_OK;
+
+    for (n = 0; n < cache->ndirs && rc != NGX_ABORT; n++) {
+        walk.dir = n;
+        rc = ngx_walk_tree(&tree, &cache->dirs[n].path->name);
+    }
+
+#if (NGX_THREADS)
+
+    if (rc != NGX_ABORT && walk.dirs) {
+        rc = ngx_http_file_cache_loader_threads(cache, walk.dirs);
+    }
+
+#endif
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+    }
+
+    if (rc == NGX_ABORT) {
+        cache->sh->loading = 0;
+        return;
+    }
+
+    if (cache->index) {
+        ngx_http_file_cache_index_sweep(cache);
+    }
+
+    cache->sh->cold = 0;
+    cache->sh->loading = 0;
+    cache->reformat = 0;
+
+    for (n = 0; n < cache->ndirs; n++) {
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V %.3fM, bsize: %uz",
+                      &cache->dirs[n].path->name,
+                      ((double) cache->sh->dir_size[n] * cache->bsize)
+                      / (1024 * 1024),
+                      cache->bsize);
+    }
+}
+
+
+/*
+ * The hash of the keys which name the files in the cache directory is
+ * recorded in the NGX_HTTP_CACHE_KEY_HASH_FILE file.  There is no such
+ * file for md5, so older caches are md5.  The file is updated before
+ * the files are loaded, and the files of the previous hash are removed
+ * while loading.
+ */
+
+static ngx_uint_t
+ngx_http_file_cache_key_hash(ngx_http_file_cache_t *cache)
+{
+    u_char      buf[16];
+    ssize_t     n;
+    ngx_err_t   err;
+    ngx_str_t   name;
+    ngx_uint_t  key_hash;
+    ngx_file_t  file;
+
+    name.len = cache->path->name.len + sizeof(NGX_HTTP_CACHE_KEY_HASH_FILE);
+
+    name.data = ngx_alloc(name.len + 1, ngx_cycle->log);
+    if (name.data == NULL) {
+        return cache->key_hash;
+    }
+
+    ngx_sprintf(name.data, "%V/%s%Z", &cache->path->name,
+                NGX_HTTP_CACHE_KEY_HASH_FILE);
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = name;
+    file.log = ngx_cycle->log;
+
+    key_hash = NGX_HTTP_CACHE_KEY_MD5;
+
+    file.fd = ngx_open_file(name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd != NGX_INVALID_FILE) {
+        n = ngx_read_file(&file, buf, sizeof(buf), 0);
+
+        if (n == 4 && ngx_strncmp(buf, "xxh3", 4) == 0) {
+            key_hash = NGX_HTTP_CACHE_KEY_XXH3;
+        }
+
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name.data);
+        }
+
+    } else {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                          ngx_open_file_n " \"%s\" failed", name.data);
+            key_hash = cache->key_hash;
+            goto done;
+        }
+    }
+
+    if (key_hash == cache->key_hash) {
         goto done;
     }
 
-    if (h.version != NGX_HTTP_CACHE_VERSION
-        || h.last_modified != c->last_modified
-        || h.crc32 != c->crc32
-        || (size_t) h.header_start != c->header_start
-        || (size_t) h.body_start != c->body_start)
-    {
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache \"%s\" content changed",
-                       file.name.data);
+    if (cache->key_hash == NGX_HTTP_CACHE_KEY_MD5) {
+        if (ngx_delete_file(name.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name.data);
+        }
+
         goto done;
     }
 
-    /*
-     * update cache file header with new data,
-     * notably h.valid_sec and h.date
-     */
+    file.fd = ngx_open_file(name.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                            NGX_FILE_DEFAULT_ACCESS);
 
-    ngx_memzero(&h, sizeof(ngx_http_file_cache_header_t));
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name.data);
+        goto done;
+    }
 
-    h.version = NGX_HTTP_CACHE_VERSION;
-    h.valid_sec = c->valid_sec;
-    h.updating_sec = c->updating_sec;
-    h.error_sec = c->error_sec;
-    h.last_modified = c->last_modified;
-    h.date = c->date;
-    h.crc32 = c->crc32;
-    h.valid_msec = (u_short) c->valid_msec;
-    h.header_start = (u_short) c->header_start;
-    h.body_start = (u_short) c->body_start;
+    (void) ngx_write_file(&file, (u_char *) "xxh3", 4, 0);
 
-    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
-        h.etag_len = (u_char) c->etag.len;
-        ngx_memcpy(h.etag, c->etag.data, c->etag.len);
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name.data);
     }
 
-    if (c->vary.len) {
-        if (c->vary.len > NGX_HTTP_CACHE_VARY_LEN) {
-            /* should not happen */
-            c->vary.len = NGX_HTTP_CACHE_VARY_LEN;
-        }
+done:
 
-        h.vary_len = (u_char) c->vary.len;
-        ngx_memcpy(h.vary, c->vary.data, c->vary.len);
+    ngx_free(name.data);
 
-        ngx_http_file_cache_vary(r, c->vary.data, c->vary.len, c->variant);
-        ngx_memcpy(h.variant, c->variant, NGX_HTTP_CACHE_KEY_LEN);
+    return key_hash;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t                   elapsed;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_walk_t  *walk;
+
+    walk = ctx->data;
+    cache = walk->cache;
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
     }
 
-    (void) ngx_write_file(&file, (u_char *) &h,
-                          sizeof(ngx_http_file_cache_header_t), 0);
+    if (++walk->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(walk);
 
-done:
+    } else {
+        ngx_time_update();
 
-    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                      ngx_close_file_n " \"%s\" failed", file.name.data);
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - walk->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(walk);
+        }
     }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
 }
 
 
-ngx_int_t
-ngx_http_cache_send(ngx_http_request_t *r)
+static ngx_int_t
+ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
-
-    c = r->cache;
+    ngx_path_t                    *cp;
+    ngx_http_file_cache_walk_t    *walk;
+    ngx_http_file_cache_subdir_t  *dir;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache send: %s", c->file.name.data);
+    if (path->len >= 5
+        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    {
+        return NGX_DECLINED;
+    }
 
-    /* we need to allocate all before the header would be sent */
+    walk = ctx->data;
+    cp = walk->cache->dirs[walk->dir].path;
 
-    b = ngx_calloc_buf(r->pool);
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (walk->dirs == NULL || path->len != cp->name.len + 1 + cp->level[0]) {
+        return NGX_OK;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    dir = ngx_array_push(walk->dirs);
+    if (dir == NULL) {
+        return NGX_OK;
     }
 
-    rc = ngx_http_send_header(r);
+    dir->name.len = path->len;
+    dir->name.data = ngx_pnalloc(walk->dirs->pool, path->len + 1);
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+    if (dir->name.data == NULL) {
+        walk->dirs->nelts--;
+        return NGX_OK;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    ngx_memcpy(dir->name.data, path->data, path->len + 1);
 
-    b->in_file = (c->length - c->body_start) ? 1 : 0;
-    b->last_buf = (r == r->main) ? 1 : 0;
-    b->last_in_chain = 1;
-    b->sync = (b->last_buf || b->in_file) ? 0 : 1;
+    dir->dir = walk->dir;
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    return NGX_DECLINED;
+}
 
-    out.buf = b;
-    out.next = NULL;
 
-    return ngx_http_output_filter(r, &out);
+static void
+ngx_http_file_cache_loader_tree(ngx_tree_ctx_t *tree,
+    ngx_http_file_cache_walk_t *walk)
+{
+    tree->init_handler = NULL;
+    tree->file_handler = ngx_http_file_cache_manage_file;
+    tree->pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree->post_tree_handler = ngx_http_file_cache_noop;
+    tree->spec_handler = ngx_http_file_cache_delete_file;
+    tree->data = walk;
+    tree->alloc = 0;
+    tree->log = ngx_cycle->log;
+
+    walk->last = ngx_current_msec;
+    walk->files = 0;
 }
 
 
-void
-ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_walk_t *walk)
 {
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_msleep(walk->cache->loader_sleep);
 
-    if (c->updated || c->node == NULL) {
-        return;
-    }
+    ngx_time_update();
 
-    cache = c->file_cache;
+    walk->last = ngx_current_msec;
+    walk->files = 0;
+}
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache free, fd: %d", c->file.fd);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+#if (NGX_THREADS)
 
-    fcn = c->node;
-    fcn->count--;
+static ngx_int_t
+ngx_http_file_cache_loader_threads(ngx_http_file_cache_t *cache,
+    ngx_array_t *dirs)
+{
+    int                            err;
+    sigset_t                       set, old;
+    pthread_t                     *tids;
+    ngx_uint_t                     i, n;
+    ngx_http_file_cache_loader_t   ld;
 
-    if (c->updating && fcn->lock_time == c->lock_time) {
-        fcn->updating = 0;
+    if (dirs->nelts == 0) {
+        return NGX_OK;
     }
 
-    if (c->error) {
-        fcn->error = c->error;
+    ld.cache = cache;
+    ld.dirs = dirs;
+    ld.next = 0;
+    ld.abort = 0;
 
-        if (c->valid_sec) {
-            fcn->valid_sec = c->valid_sec;
-            fcn->valid_msec = c->valid_msec;
-        }
+    n = ngx_min(cache->loader_threads, dirs->nelts) - 1;
 
-    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
-        ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
-        c->node = NULL;
+    tids = ngx_palloc(dirs->pool, n * sizeof(pthread_t));
+    if (tids == NULL) {
+        n = 0;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    /* signals are handled by the loader process itself */
 
-    c->updated = 1;
-    c->updating = 0;
+    sigfillset(&set);
 
-    if (c->temp_file) {
-        if (tf && tf->file.fd != NGX_INVALID_FILE) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                           "http file cache incomplete: \"%s\"",
-                           tf->file.name.data);
+    sigdelset(&set, SIGILL);
+    sigdelset(&set, SIGFPE);
+    sigdelset(&set, SIGSEGV);
+    sigdelset(&set, SIGBUS);
 
-            if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
-                ngx_log_error(NGX_LOG_CRIT, c->file.log, ngx_errno,
-                              ngx_delete_file_n " \"%s\" failed",
-                              tf->file.name.data);
+    err = pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                      "pthread_sigmask() failed");
+        n = 0;
+
+    } else {
+        for (i = 0; i < n; i++) {
+            err = pthread_create(&tids[i], NULL,
+                                 ngx_http_file_cache_loader_thread, &ld);
+            if (err) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                              "pthread_create() failed");
+                break;
             }
         }
+
+        n = i;
+
+        (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
     }
 
-    if (c->wait_event.timer_set) {
-        ngx_del_timer(&c->wait_event);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader threads: %ui, dirs: %ui",
+                   n + 1, dirs->nelts);
+
+    (void) ngx_http_file_cache_loader_thread(&ld);
+
+    for (i = 0; i < n; i++) {
+        err = pthread_join(tids[i], NULL);
+        if (err) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                          "pthread_join() failed");
+        }
     }
+
+    return ld.abort ? NGX_ABORT : NGX_OK;
 }
 
 
-static void
-ngx_http_file_cache_cleanup(void *data)
+static void *
+ngx_http_file_cache_loader_thread(void *data)
 {
-    ngx_http_cache_t  *c = data;
+    ngx_http_file_cache_loader_t  *ld = data;
 
-    if (c->updated) {
-        return;
-    }
+    ngx_uint_t                     i;
+    ngx_tree_ctx_t                 tree;
+    ngx_http_file_cache_walk_t     walk;
+    ngx_http_file_cache_subdir_t  *dir;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache cleanup");
+    walk.cache = ld->cache;
+    walk.dir = 0;
+    walk.dirs = NULL;
 
-    if (c->updating && !c->background) {
-        ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
-                      "stalled cache updating, error:%ui", c->error);
+    ngx_http_file_cache_loader_tree(&tree, &walk);
+
+    dir = ld->dirs->elts;
+
+    for ( ;; ) {
+        i = ngx_atomic_fetch_add(&ld->next, 1);
+
+        if (i >= ld->dirs->nelts || ld->abort) {
+            break;
+        }
+
+        walk.dir = dir[i].dir;
+
+        if (ngx_walk_tree(&tree, &dir[i].name) == NGX_ABORT) {
+            ld->abort = 1;
+            break;
+        }
     }
 
-    ngx_http_file_cache_free(c, NULL);
+    return NULL;
 }
 
+#endif
+
 
-static time_t
-ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       wait;
-    ngx_uint_t                   tries;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q, *sentinel;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    u_char                      *p;
+    ngx_int_t                    n;
+    ngx_uint_t                   i;
+    ngx_http_cache_t             c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_walk_t  *walk;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache forced expire");
+    /*
+     * the files starting with a dot, such as NGX_HTTP_CACHE_KEY_HASH_FILE
+     * and NGX_HTTP_CACHE_INDEX_FILE, are not cache files
+     */
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    p = name->data + name->len;
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    while (p > name->data && p[-1] != '/') {
+        p--;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+    if (*p == '.') {
+        return NGX_OK;
+    }
 
-    wait = 10;
-    tries = 20;
-    sentinel = NULL;
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    /*
+     * Temporary files in cache have a suffix consisting of a dot
+     * followed by 10 digits.
+     */
 
-    for ( ;; ) {
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            break;
-        }
+    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
+        && name->data[name->len - 10 - 1] == '.')
+    {
+        return NGX_OK;
+    }
 
-        q = ngx_queue_last(&cache->sh->queue);
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
 
-        if (q == sentinel) {
-            break;
-        }
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
 
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    walk = ctx->data;
+    cache = walk->cache;
+
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
-                  fcn->count, fcn->exists,
-                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
-            break;
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
         }
 
-        if (fcn->deleting) {
-            wait = 1;
-            break;
-        }
+        p += 2;
 
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        (void) ngx_hex_dump(p, fcn->key, len);
+        c.key[i] = (u_char) n;
+    }
+
+    if (cache->reformat) {
 
         /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
+         * while files of the previous hash are removed, only the files
+         * created since start are kept, their nodes are already known
          */
 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
-
-        if (sentinel == NULL) {
-            sentinel = q;
-        }
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
-        if (--tries) {
-            continue;
+        if (ngx_http_file_cache_lookup(cache, c.key) == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
         }
 
-        wait = 1;
-        break;
+        ngx_shmtx_unlock(&cache->shpool->mutex);
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    ngx_free(name);
-
-    return wait;
+    return ngx_http_file_cache_add(cache, &c, walk->dir);
 }
 
 
-static time_t
-ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
+static ngx_int_t
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c,
+    ngx_uint_t dir)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_msec_t                   elapsed;
-    ngx_queue_t                 *q;
     ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache expire");
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    fcn = ngx_http_file_cache_lookup(cache, c->key);
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
-    }
+    if (fcn == NULL) {
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+        fcn = ngx_slab_calloc_locked(cache->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_http_file_cache_set_watermark(cache);
 
-    now = ngx_time();
+            if (cache->fail_time != ngx_time()) {
+                cache->fail_time = ngx_time();
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                           "could not allocate node%s", cache->shpool->log_ctx);
+            }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
 
-    for ( ;; ) {
+        cache->sh->count++;
 
-        if (ngx_quit || ngx_terminate) {
-            wait = 1;
-            break;
-        }
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            wait = 10;
-            break;
-        }
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        q = ngx_queue_last(&cache->sh->queue);
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
 
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+        fcn->uses = 1;
+        fcn->exists = 1;
+        fcn->fs_size = c->fs_size;
+        fcn->dir = dir;
 
-        wait = fcn->expire - now;
+        cache->sh->size += c->fs_size;
+        cache->sh->dir_size[dir] += c->fs_size;
 
-        if (wait > 0) {
-            wait = wait > 10 ? 10 : wait;
-            break;
-        }
+    } else if (fcn->indexed) {
+        ngx_http_file_cache_remove(cache, fcn);
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
-                       fcn->count, fcn->exists,
-                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+        cache->sh->size += c->fs_size - fcn->fs_size;
+        cache->sh->dir_size[fcn->dir] -= fcn->fs_size;
+        cache->sh->dir_size[dir] += c->fs_size;
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            goto next;
-        }
+        fcn->fs_size = c->fs_size;
+        fcn->dir = dir;
+        fcn->indexed = 0;
 
-        if (fcn->deleting) {
-            wait = 1;
-            break;
-        }
+    } else if (fcn->dir == dir) {
+        ngx_http_file_cache_remove(cache, fcn);
 
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        (void) ngx_hex_dump(p, fcn->key, len);
+    } else {
 
         /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
+         * the file of the key is in another directory, e.g., after
+         * the weights were changed, so this one is removed
          */
 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
 
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+    fcn->expire = ngx_time() + cache->inactive;
 
-next:
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
 
-        if (++cache->files >= cache->manager_files) {
-            wait = 0;
-            break;
-        }
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        ngx_time_update();
+    return NGX_OK;
+}
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
-        if (elapsed >= cache->manager_threshold) {
-            wait = 0;
-            break;
-        }
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    return NGX_OK;
+}
 
-    ngx_free(name);
 
-    return wait;
+static void
+ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+{
+    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache watermark: %ui", cache->sh->watermark);
 }
 
 
-static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_next(ngx_http_file_cache_t *cache, u_char *key)
 {
-    u_char                      *p;
-    size_t                       len;
-    ngx_path_t                  *path;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn, *next;
 
-    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    /* the first node with a key greater than the key, if any */
 
-    if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+    node_key = 0;
 
-        path = cache->path;
-        p = name + path->name.len + 1 + path->len;
-        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        p = ngx_hex_dump(p, fcn->key, len);
-        *p = '\0';
+    if (key) {
+        ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+    }
 
-        fcn->count++;
-        fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
 
-        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
-        ngx_create_hashed_filename(path, name, len);
+    next = NULL;
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: \"%s\"", name);
+    while (node != sentinel) {
 
-        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
-                          ngx_delete_file_n " \"%s\" failed", name);
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        if (key == NULL || node_key < node->key) {
+            rc = -1;
+
+        } else if (node_key > node->key) {
+            rc = 1;
+
+        } else {
+            rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
-        fcn->count--;
-        fcn->deleting = 0;
-    }
+        if (rc < 0) {
+            next = fcn;
+            node = node->left;
 
-    if (fcn->count == 0) {
-        ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+        } else {
+            node = node->right;
+        }
     }
+
+    return next;
 }
 
 
-static ngx_msec_t
-ngx_http_file_cache_manager(void *data)
+/*
+ * The index is a snapshot of the cache nodes which have files.  It is saved
+ * by the cache manager periodically and on exit, and is loaded when the keys
+ * zone is created, so the cache is usable at once.  The cache loader still
+ * walks the cache directory, and removes the nodes whose files are not found.
+ */
+
+static void
+ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache, ngx_log_t *log)
 {
-    ngx_http_file_cache_t  *cache = data;
+    size_t                               size;
+    off_t                                offset;
+    time_t                               now;
+    ssize_t                              n;
+    ngx_err_t                            err;
+    ngx_str_t                            name;
+    ngx_uint_t                           i, j, k, count;
+    ngx_file_t                           file;
+    ngx_http_file_cache_node_t          *fcn;
+    ngx_http_file_cache_index_t         *index;
+    ngx_http_file_cache_index_header_t   header;
+
+    name.len = cache->path->name.len + sizeof(NGX_HTTP_CACHE_INDEX_FILE);
+
+    name.data = ngx_alloc(name.len + 1, log);
+    if (name.data == NULL) {
+        return;
+    }
 
-    off_t       size, free;
-    time_t      wait;
-    ngx_msec_t  elapsed, next;
-    ngx_uint_t  count, watermark;
+    ngx_sprintf(name.data, "%V/%s%Z", &cache->path->name,
+                NGX_HTTP_CACHE_INDEX_FILE);
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    index = NULL;
+    count = 0;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = name;
+    file.log = log;
+
+    file.fd = ngx_open_file(name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_open_file_n " \"%s\" failed", name.data);
+        }
+
+        ngx_free(name.data);
+        return;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &header, sizeof(header), 0);
+
+    if (n != sizeof(header)
+        || ngx_memcmp(header.magic, NGX_HTTP_FILE_CACHE_INDEX_MAGIC,
+                      sizeof(header.magic))
+           != 0
+        || header.size != sizeof(ngx_http_file_cache_index_t))
+    {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      "cache index \"%s\" is invalid", name.data);
+        goto done;
+    }
 
-    next = (ngx_msec_t) ngx_http_file_cache_expire(cache) * 1000;
+    if (header.version != cache->version
+        || header.bsize != cache->bsize
+        || header.dirs != ngx_http_file_cache_index_dirs(cache))
+    {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "cache index \"%s\" is outdated, ignored", name.data);
+        goto done;
+    }
 
-    if (next == 0) {
-        next = cache->manager_sleep;
+    index = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                      * sizeof(ngx_http_file_cache_index_t), log);
+    if (index == NULL) {
         goto done;
     }
 
-    for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    now = ngx_time();
+    offset = sizeof(header);
 
-        size = cache->sh->size;
-        count = cache->sh->count;
-        watermark = cache->sh->watermark;
+    for (i = 0; i < header.count; i += k) {
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        k = ngx_min(header.count - i, NGX_HTTP_FILE_CACHE_INDEX_BATCH);
+        size = k * sizeof(ngx_http_file_cache_index_t);
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O c:%ui w:%i",
-                       size, count, (ngx_int_t) watermark);
+        n = ngx_read_file(&file, (u_char *) index, size, offset);
 
-        if (size < cache->max_size && count < watermark) {
+        if (n == NGX_ERROR) {
+            break;
+        }
 
-            if (!cache->min_free) {
-                break;
-            }
+        if ((size_t) n != size) {
+            ngx_log_error(NGX_LOG_CRIT, log, 0,
+                          "cache index \"%s\" is truncated", name.data);
+            break;
+        }
 
-            free = ngx_fs_available(cache->path->name.data);
+        offset += n;
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                           "http file cache free: %O", free);
+        for (j = 0; j < k; j++) {
 
-            if (free > cache->min_free) {
-                break;
+            if (index[j].dir >= cache->ndirs
+                || ngx_http_file_cache_lookup(cache, index[j].key))
+            {
+                continue;
             }
-        }
 
-        wait = ngx_http_file_cache_forced_expire(cache);
+            fcn = ngx_slab_calloc_locked(cache->shpool,
+                                         sizeof(ngx_http_file_cache_node_t));
+            if (fcn == NULL) {
+                ngx_log_error(NGX_LOG_ALERT, log, 0,
+                              "could not allocate node%s",
+                              cache->shpool->log_ctx);
+                goto done;
+            }
 
-        if (wait > 0) {
-            next = (ngx_msec_t) wait * 1000;
-            break;
-        }
+            ngx_memcpy((u_char *) &fcn->node.key, index[j].key,
+                       sizeof(ngx_rbtree_key_t));
 
-        if (ngx_quit || ngx_terminate) {
-            break;
-        }
+            ngx_memcpy(fcn->key, &index[j].key[sizeof(ngx_rbtree_key_t)],
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        if (++cache->files >= cache->manager_files) {
-            next = cache->manager_sleep;
-            break;
-        }
+            ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
 
-        ngx_time_update();
+            fcn->uses = index[j].uses;
+            fcn->exists = 1;
+            fcn->indexed = 1;
+            fcn->uniq = index[j].uniq;
+            fcn->body_start = index[j].body_start;
+            fcn->fs_size = index[j].fs_size;
+            fcn->dir = index[j].dir;
+            fcn->expire = now + cache->inactive;
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+            ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
 
-        if (elapsed >= cache->manager_threshold) {
-            next = cache->manager_sleep;
-            break;
+            cache->sh->size += fcn->fs_size;
+            cache->sh->dir_size[fcn->dir] += fcn->fs_size;
+            cache->sh->count++;
+
+            count++;
         }
     }
 
 done:
 
-    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    if (count) {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "http file cache: %V %ui nodes loaded from index",
+                      &cache->path->name, count);
+    }
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache manager: %ui e:%M n:%M",
-                   cache->files, elapsed, next);
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name.data);
+    }
 
-    return next;
+    if (index) {
+        ngx_free(index);
+    }
+
+    ngx_free(name.data);
 }
 
 
 static void
-ngx_http_file_cache_loader(void *data)
+ngx_http_file_cache_index_save(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t  *cache = data;
-
-    ngx_tree_ctx_t  tree;
-
-    if (!cache->sh->cold || cache->sh->loading) {
-        return;
-    }
-
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+    u_char                              *last;
+    off_t                                offset;
+    size_t                               len;
+    ssize_t                              n;
+    ngx_str_t                            name, temp;
+    ngx_uint_t                           i;
+    ngx_file_t                           file;
+    ngx_http_file_cache_node_t          *fcn, *next;
+    ngx_http_file_cache_index_t         *index;
+    ngx_http_file_cache_index_header_t   header;
+    u_char                               key[NGX_HTTP_CACHE_KEY_LEN];
+
+    len = cache->path->name.len + sizeof("/" NGX_HTTP_CACHE_INDEX_FILE ".tmp");
+
+    name.data = ngx_alloc(2 * len, ngx_cycle->log);
+    if (name.data == NULL) {
         return;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    temp.data = name.data + len;
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+    name.len = ngx_sprintf(name.data, "%V/%s%Z", &cache->path->name,
+                           NGX_HTTP_CACHE_INDEX_FILE)
+               - name.data - 1;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    temp.len = ngx_sprintf(temp.data, "%V/%s.tmp%Z", &cache->path->name,
+                           NGX_HTTP_CACHE_INDEX_FILE)
+               - temp.data - 1;
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
-        cache->sh->loading = 0;
+    index = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                      * sizeof(ngx_http_file_cache_index_t), ngx_cycle->log);
+    if (index == NULL) {
+        ngx_free(name.data);
         return;
     }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
-}
+    file.name = temp;
+    file.log = ngx_cycle->log;
 
+    file.fd = ngx_open_file(temp.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                            NGX_FILE_DEFAULT_ACCESS);
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    return NGX_OK;
-}
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp.data);
+        goto done;
+    }
 
+    ngx_memzero(&header, sizeof(header));
 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+    ngx_memcpy(header.magic, NGX_HTTP_FILE_CACHE_INDEX_MAGIC,
+               sizeof(header.magic));
+    header.version = cache->version;
+    header.bsize = cache->bsize;
+    header.size = sizeof(ngx_http_file_cache_index_t);
+    header.dirs = ngx_http_file_cache_index_dirs(cache);
 
-    cache = ctx->data;
+    offset = sizeof(header);
+    last = NULL;
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
-    }
+    /* the nodes are copied in batches to not hold the mutex for long */
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+    for ( ;; ) {
 
-    } else {
-        ngx_time_update();
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+        fcn = ngx_http_file_cache_next(cache, last);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+        for (i = 0; fcn && i < NGX_HTTP_FILE_CACHE_INDEX_BATCH; fcn = next) {
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
-        }
-    }
+            next = (ngx_http_file_cache_node_t *)
+                       ngx_rbtree_next(&cache->sh->rbtree, &fcn->node);
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
-}
+            ngx_memcpy(key, (u_char *) &fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
+            if (!fcn->exists || fcn->deleting) {
+                continue;
+            }
 
-static ngx_int_t
-ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    if (path->len >= 5
-        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
-    {
-        return NGX_DECLINED;
-    }
+            ngx_memcpy(index[i].key, key, NGX_HTTP_CACHE_KEY_LEN);
 
-    return NGX_OK;
-}
+            index[i].uniq = fcn->uniq;
+            index[i].fs_size = fcn->fs_size;
+            index[i].body_start = fcn->body_start;
+            index[i].uses = fcn->uses;
+            index[i].dir = fcn->dir;
 
+            i++;
+        }
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
-{
-    ngx_msleep(cache->loader_sleep);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    ngx_time_update();
+        last = key;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
-}
+        if (i) {
+            len = i * sizeof(ngx_http_file_cache_index_t);
 
+            n = ngx_write_file(&file, (u_char *) index, len, offset);
 
-static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
-{
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+            if (n == NGX_ERROR) {
+                goto failed;
+            }
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
-    }
+            offset += n;
+            header.count += i;
+        }
 
-    /*
-     * Temporary files in cache have a suffix consisting of a dot
-     * followed by 10 digits.
-     */
+        if (fcn == NULL) {
+            break;
+        }
+    }
 
-    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
-        && name->data[name->len - 10 - 1] == '.')
+    if (ngx_write_file(&file, (u_char *) &header, sizeof(header), 0)
+        == NGX_ERROR)
     {
-        return NGX_OK;
+        goto failed;
     }
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
-        return NGX_ERROR;
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp.data);
     }
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
+    if (ngx_rename_file(temp.data, name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp.data, name.data);
+        goto delete;
+    }
 
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "http file cache: %V %ui nodes saved to index",
+                  &cache->path->name, header.count);
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+    goto done;
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+failed:
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp.data);
+    }
 
-        p += 2;
+delete:
 
-        c.key[i] = (u_char) n;
+    if (ngx_delete_file(temp.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", temp.data);
     }
 
-    return ngx_http_file_cache_add(cache, &c);
+done:
+
+    ngx_free(index);
+    ngx_free(name.data);
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+static uint32_t
+ngx_http_file_cache_index_dirs(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_node_t  *fcn;
+    uint32_t     crc;
+    ngx_uint_t   n;
+    ngx_path_t  *path;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_crc32_init(crc);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    for (n = 0; n < cache->ndirs; n++) {
+        path = cache->dirs[n].path;
+        ngx_crc32_update(&crc, path->name.data, path->name.len);
+        ngx_crc32_update(&crc, (u_char *) "", 1);
+    }
 
-    if (fcn == NULL) {
+    ngx_crc32_final(crc);
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+    return crc;
+}
 
-            if (cache->fail_time != ngx_time()) {
-                cache->fail_time = ngx_time();
-                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
-            }
 
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
-        }
+static void
+ngx_http_file_cache_index_sweep(ngx_http_file_cache_t *cache)
+{
+    u_char                      *last;
+    ngx_uint_t                   i, count;
+    ngx_http_file_cache_node_t  *fcn, *next;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
-        cache->sh->count++;
+    /* the nodes restored from the index whose files were not found */
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    last = NULL;
+    count = 0;
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    for ( ;; ) {
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
-        fcn->uses = 1;
-        fcn->exists = 1;
-        fcn->fs_size = c->fs_size;
+        fcn = ngx_http_file_cache_next(cache, last);
 
-        cache->sh->size += c->fs_size;
+        for (i = 0; fcn && i < NGX_HTTP_FILE_CACHE_INDEX_BATCH; fcn = next) {
 
-    } else {
-        ngx_queue_remove(&fcn->queue);
-    }
+            next = (ngx_http_file_cache_node_t *)
+                       ngx_rbtree_next(&cache->sh->rbtree, &fcn->node);
 
-    fcn->expire = ngx_time() + cache->inactive;
+            ngx_memcpy(key, (u_char *) &fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+            i++;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+            if (!fcn->indexed) {
+                continue;
+            }
 
-    return NGX_OK;
-}
+            fcn->indexed = 0;
 
+            if (fcn->count) {
+                continue;
+            }
 
-static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+            if (cache->mem_zone) {
+                ngx_http_file_cache_mem_invalidate(cache, fcn);
+            }
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+            cache->sh->size -= fcn->fs_size;
+            cache->sh->dir_size[fcn->dir] -= fcn->fs_size;
+            cache->sh->count--;
+
+            ngx_http_file_cache_remove(cache, fcn);
+            ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+            ngx_slab_free_locked(cache->shpool, fcn);
+
+            count++;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        last = key;
+
+        if (fcn == NULL) {
+            break;
+        }
     }
 
-    return NGX_OK;
+    if (count) {
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V %ui indexed nodes without files",
+                      &cache->path->name, count);
+    }
 }
 
 
 static void
-ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_saver(void *data)
 {
-    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+    ngx_http_file_cache_t  *cache = data;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache watermark: %ui", cache->sh->watermark);
+    if (cache->sh->cold) {
+        return;
+    }
+
+    ngx_http_file_cache_index_save(cache);
 }
 
 
@@ -2371,26 +4818,88 @@ ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
         }
     }
 
-    return 0;
+    return 0;
+}
+
+
+static ngx_inline void
+ngx_http_file_cache_stat(ngx_http_file_cache_t *cache, ngx_uint_t i)
+{
+#if (NGX_HTTP_API)
+    ngx_stat_add(&cache->sh->stats, i, 1);
+#endif
+}
+
+
+#if (NGX_HTTP_API)
+
+static ngx_data_item_t *
+ngx_http_file_cache_api_handler(uintptr_t data, ngx_pool_t *pool, void *ctx)
+{
+    ngx_http_file_cache_t *cache = (ngx_http_file_cache_t *) data;
+
+    ngx_data_item_t            *obj, *item;
+    ngx_data_decl_t            *decl;
+    ngx_http_file_cache_api_t   stat;
+
+    stat.size = cache->sh->size * cache->bsize;
+    stat.max_size = cache->max_size * cache->bsize;
+    stat.cold = cache->sh->cold;
+
+    obj = ngx_data_obj_handler((uintptr_t) ngx_http_file_cache_api_decls,
+                               pool, &stat);
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    if (cache->max_size != NGX_MAX_OFF_T_VALUE / (off_t) cache->bsize) {
+        item = ngx_data_struct_int64_handler(
+                         offsetof(ngx_http_file_cache_api_t, max_size), pool,
+                         &stat);
+        if (item == NULL) {
+            return NULL;
+        }
+
+        ngx_data_add_item(obj, &ngx_http_file_cache_api_max_size, item);
+    }
+
+    for (decl = ngx_http_file_cache_api_stat_decls; decl->name.len; decl++) {
+
+        item = decl->handler(decl->data, pool, &cache->sh->stats);
+        if (item == NULL) {
+            return NULL;
+        }
+
+        ngx_data_add_item(obj, &decl->name, item);
+    }
+
+    return obj;
 }
 
+#endif
+
 
 char *
 ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     char  *confp = conf;
 
-    off_t                   max_size, min_free;
-    u_char                 *last, *p;
-    time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
-    ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
-                            manager_threshold;
-    ngx_uint_t              i, n, use_temp_path;
-    ngx_array_t            *caches;
-    ngx_http_file_cache_t  *cache, **ce;
+    off_t                       max_size, min_free;
+    u_char                     *last, *p;
+    time_t                      inactive, index_interval;
+    size_t                      max_mem_object;
+    ssize_t                     size, mem_size;
+    ngx_str_t                   s, name, mem_name, *value;
+    ngx_int_t                   loader_files, loader_threads, manager_files,
+                                weight;
+    ngx_msec_t                  loader_sleep, manager_sleep, loader_threshold,
+                                manager_threshold;
+    ngx_uint_t                  i, n, use_temp_path, hugepages, best_fit,
+                                key_hash, index, eviction, admission,
+                                read_while_write;
+    ngx_array_t                *caches, *dirs;
+    ngx_http_file_cache_t      *cache, **ce;
+    ngx_http_file_cache_dir_t  *dir;
 
     cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
     if (cache == NULL) {
@@ -2403,12 +4912,22 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     use_temp_path = 1;
+    read_while_write = 0;
+    hugepages = 0;
+    best_fit = 0;
+    key_hash = NGX_HTTP_CACHE_KEY_MD5;
+    eviction = NGX_HTTP_CACHE_EVICTION_LRU;
+    admission = NGX_HTTP_CACHE_ADMISSION_OFF;
 
     inactive = 600;
 
+    index = 0;
+    index_interval = 600;
+
     loader_files = 100;
     loader_sleep = 50;
     loader_threshold = 200;
+    loader_threads = 1;
 
     manager_files = 100;
     manager_sleep = 50;
@@ -2416,8 +4935,23 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     name.len = 0;
     size = 0;
+    mem_name.len = 0;
+    mem_size = 0;
+    max_mem_object = NGX_CONF_UNSET_SIZE;
     max_size = NGX_MAX_OFF_T_VALUE;
     min_free = 0;
+    weight = 1;
+
+    /* the first directory is the one of the cache path itself */
+
+    dirs = ngx_array_create(cf->pool, 1, sizeof(ngx_http_file_cache_dir_t));
+    if (dirs == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_array_push(dirs) == NULL) {
+        return NGX_CONF_ERROR;
+    }
 
     value = cf->args->elts;
 
@@ -2489,6 +5023,25 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "read_while_write=", 17) == 0) {
+
+            if (ngx_strcmp(&value[i].data[17], "on") == 0) {
+                read_while_write = 1;
+
+            } else if (ngx_strcmp(&value[i].data[17], "off") == 0) {
+                read_while_write = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid read_while_write value \"%V\", "
+                                   "it must be \"on\" or \"off\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "keys_zone=", 10) == 0) {
 
             name.data = value[i].data + 10;
@@ -2523,6 +5076,58 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "mem_zone=", 9) == 0) {
+
+            mem_name.data = value[i].data + 9;
+
+            p = (u_char *) ngx_strchr(mem_name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid memory zone size \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            mem_name.len = p - mem_name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            mem_size = ngx_parse_size(&s);
+
+            if (mem_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid memory zone size \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (mem_size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "memory zone \"%V\" is too small",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_mem_object=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            max_mem_object = ngx_parse_size(&s);
+            if (max_mem_object == (size_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid max_mem_object value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -2553,6 +5158,122 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "weight=", 7) == 0) {
+
+            weight = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (weight == NGX_ERROR || weight == 0
+                || weight > NGX_HTTP_FILE_CACHE_MAX_WEIGHT)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid weight value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "path=", 5) == 0) {
+
+            if (dirs->nelts == NGX_HTTP_CACHE_MAX_DIRS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "too many paths, at most %d are allowed",
+                                   NGX_HTTP_CACHE_MAX_DIRS);
+                return NGX_CONF_ERROR;
+            }
+
+            dir = ngx_array_push(dirs);
+            if (dir == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            dir->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+            if (dir->path == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            dir->max_size = NGX_MAX_OFF_T_VALUE;
+            dir->weight = 1;
+
+            p = value[i].data + 5;
+            last = value[i].data + value[i].len;
+
+            s.data = p;
+
+            p = ngx_strlchr(p, last, ':');
+            if (p == NULL) {
+                p = last;
+            }
+
+            s.len = p - s.data;
+
+            if (s.len && s.data[s.len - 1] == '/') {
+                s.len--;
+            }
+
+            if (s.len == 0) {
+                goto invalid_path;
+            }
+
+            dir->path->name.len = s.len;
+            dir->path->name.data = ngx_pnalloc(cf->pool, s.len + 1);
+            if (dir->path->name.data == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            (void) ngx_cpystrn(dir->path->name.data, s.data, s.len + 1);
+
+            if (ngx_conf_full_name(cf->cycle, &dir->path->name, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            while (p < last) {
+                s.data = ++p;
+
+                p = ngx_strlchr(p, last, ':');
+                if (p == NULL) {
+                    p = last;
+                }
+
+                s.len = p - s.data;
+
+                if (s.len > 7 && ngx_strncmp(s.data, "weight=", 7) == 0) {
+
+                    dir->weight = ngx_atoi(s.data + 7, s.len - 7);
+                    if (dir->weight == (ngx_uint_t) NGX_ERROR
+                        || dir->weight == 0
+                        || dir->weight > NGX_HTTP_FILE_CACHE_MAX_WEIGHT)
+                    {
+                        goto invalid_path;
+                    }
+
+                    continue;
+                }
+
+                if (s.len > 9 && ngx_strncmp(s.data, "max_size=", 9) == 0) {
+
+                    s.len -= 9;
+                    s.data += 9;
+
+                    dir->max_size = ngx_parse_offset(&s);
+                    if (dir->max_size < 0) {
+                        goto invalid_path;
+                    }
+
+                    continue;
+                }
+
+                goto invalid_path;
+            }
+
+            continue;
+
+        invalid_path:
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid path \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
         if (ngx_strncmp(value[i].data, "min_free=", 9) == 0) {
 
 #if (NGX_WIN32 || NGX_HAVE_STATFS || NGX_HAVE_STATVFS)
@@ -2618,6 +5339,26 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "loader_threads=", 15) == 0) {
+
+#if (NGX_THREADS)
+
+            loader_threads = ngx_atoi(value[i].data + 15, value[i].len - 15);
+            if (loader_threads == NGX_ERROR || loader_threads == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid loader_threads value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#else
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                               "loader_threads is not supported "
+                               "without threads, ignored");
+#endif
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "manager_files=", 14) == 0) {
 
             manager_files = ngx_atoi(value[i].data + 14, value[i].len - 14);
@@ -2660,6 +5401,107 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            if (ngx_strcmp(&value[i].data[6], "on") == 0) {
+                index = 1;
+
+            } else if (ngx_strcmp(&value[i].data[6], "off") == 0) {
+                index = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid index value \"%V\", "
+                                   "it must be \"on\" or \"off\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index_interval=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            index_interval = ngx_parse_time(&s, 1);
+            if (index_interval == (time_t) NGX_ERROR || index_interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid index_interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "hugepages") == 0) {
+            hugepages = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "best_fit") == 0) {
+            best_fit = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "key_hash=", 9) == 0) {
+
+            if (ngx_strcmp(&value[i].data[9], "md5") == 0) {
+                key_hash = NGX_HTTP_CACHE_KEY_MD5;
+
+            } else if (ngx_strcmp(&value[i].data[9], "xxh3") == 0) {
+                key_hash = NGX_HTTP_CACHE_KEY_XXH3;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid key_hash value \"%V\", "
+                                   "it must be \"md5\" or \"xxh3\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "eviction=", 9) == 0) {
+
+            if (ngx_strcmp(&value[i].data[9], "lru") == 0) {
+                eviction = NGX_HTTP_CACHE_EVICTION_LRU;
+
+            } else if (ngx_strcmp(&value[i].data[9], "s3fifo") == 0) {
+                eviction = NGX_HTTP_CACHE_EVICTION_S3FIFO;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid eviction value \"%V\", "
+                                   "it must be \"lru\" or \"s3fifo\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "admission=", 10) == 0) {
+
+            if (ngx_strcmp(&value[i].data[10], "off") == 0) {
+                admission = NGX_HTTP_CACHE_ADMISSION_OFF;
+
+            } else if (ngx_strcmp(&value[i].data[10], "tinylfu") == 0) {
+                admission = NGX_HTTP_CACHE_ADMISSION_TINYLFU;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid admission value \"%V\", "
+                                   "it must be \"off\" or \"tinylfu\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -2680,6 +5522,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->loader_files = loader_files;
     cache->loader_sleep = loader_sleep;
     cache->loader_threshold = loader_threshold;
+    cache->loader_threads = loader_threads;
     cache->manager_files = manager_files;
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
@@ -2688,6 +5531,60 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    dir = dirs->elts;
+
+    dir[0].path = cache->path;
+    dir[0].max_size = max_size;
+    dir[0].weight = weight;
+
+    cache->max_size = 0;
+
+    for (i = 0; i < dirs->nelts; i++) {
+
+        cache->weight += dir[i].weight;
+
+        if (cache->max_size > NGX_MAX_OFF_T_VALUE - dir[i].max_size) {
+            cache->max_size = NGX_MAX_OFF_T_VALUE;
+
+        } else {
+            cache->max_size += dir[i].max_size;
+        }
+
+        if (i == 0) {
+            continue;
+        }
+
+        for (n = 0; n < i; n++) {
+            if (dir[n].path->name.len == dir[i].path->name.len
+                && ngx_strncmp(dir[n].path->name.data, dir[i].path->name.data,
+                               dir[i].path->name.len)
+                   == 0)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate path \"%V\"",
+                                   &dir[i].path->name);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        /* the files are managed and loaded with the first directory */
+
+        dir[i].path->len = cache->path->len;
+        ngx_memcpy(dir[i].path->level, cache->path->level,
+                   sizeof(cache->path->level));
+
+        dir[i].path->data = cache;
+        dir[i].path->conf_file = cf->conf_file->file.name.data;
+        dir[i].path->line = cf->conf_file->line;
+
+        if (ngx_add_path(cf, &dir[i].path) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    cache->dirs = dir;
+    cache->ndirs = dirs->nelts;
+
     cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
     if (cache->shm_zone == NULL) {
         return NGX_CONF_ERROR;
@@ -2699,14 +5596,75 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-
+    cache->shm_zone->shm.hugepages = hugepages;
+    cache->shm_zone->best_fit = best_fit;
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    if (mem_name.len) {
+        cache->mem_zone = ngx_shared_memory_add(cf, &mem_name, mem_size,
+                                                cmd->post);
+        if (cache->mem_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (cache->mem_zone->data) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate zone \"%V\"", &mem_name);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->mem_zone->shm.hugepages = hugepages;
+        cache->mem_zone->best_fit = best_fit;
+        cache->mem_zone->init = ngx_http_file_cache_mem_init;
+        cache->mem_zone->data = cache;
+
+        if (max_mem_object == NGX_CONF_UNSET_SIZE) {
+            max_mem_object = 16 * 1024;
+        }
+
+        if (max_mem_object > (size_t) mem_size / 8) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"max_mem_object\" must be less than "
+                               "1/8 of the memory zone size");
+            return NGX_CONF_ERROR;
+        }
+
+        cache->max_mem_object = max_mem_object;
+
+    } else if (max_mem_object != NGX_CONF_UNSET_SIZE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"max_mem_object\" requires \"mem_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_HTTP_API)
+    if (ngx_http_api_add(cf, NGX_HTTP_API_CACHES,
+                         &cache->shm_zone->shm.name,
+                         ngx_http_file_cache_api_handler, (uintptr_t) cache)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     cache->use_temp_path = use_temp_path;
+    cache->read_while_write = read_while_write;
+
+    if (index) {
+        cache->index = 1;
+        cache->index_interval = index_interval;
+        cache->path->saver = ngx_http_file_cache_saver;
+    }
+
+    cache->key_hash = key_hash;
+    cache->version = (key_hash == NGX_HTTP_CACHE_KEY_XXH3)
+                     ? NGX_HTTP_CACHE_VERSION_XXH3 : NGX_HTTP_CACHE_VERSION;
+
+    cache->eviction = eviction;
+    cache->admission = admission;
 
     cache->inactive = inactive;
-    cache->max_size = max_size;
     cache->min_free = min_free;
 
     caches = (ngx_array_t *) (confp + cmd->offset);
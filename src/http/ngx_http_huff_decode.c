@@ -18,6 +18,26 @@ typedef struct {
 } ngx_http_huff_decode_code_t;
 
 
+/*
+ * A whole input byte is decoded with one lookup in a table which is
+ * built from the nibble table at startup.  A byte completes at most
+ * two symbols, as the shortest code is 5 bits long.
+ */
+
+typedef struct {
+    u_char  next;
+    u_char  flags;
+    u_char  sym[2];
+} ngx_http_huff_decode_byte_t;
+
+
+#define NGX_HTTP_HUFF_DECODE_EMIT    0x03
+#define NGX_HTTP_HUFF_DECODE_ENDING  0x04
+#define NGX_HTTP_HUFF_DECODE_ERROR   0x08
+
+
+static ngx_int_t ngx_http_huff_decode_nibbles(u_char *state, u_char *src,
+    size_t len, u_char **dst, ngx_uint_t last, ngx_log_t *log);
 static ngx_inline ngx_int_t ngx_http_huff_decode_bits(u_char *state,
     u_char *ending, ngx_uint_t bits, u_char **dst);
 
@@ -2639,9 +2659,144 @@ static ngx_http_huff_decode_code_t  ngx_http_huff_decode_codes[256][16] =
 };
 
 
+static ngx_http_huff_decode_byte_t  ngx_http_huff_decode_bytes[256][256];
+static ngx_uint_t                   ngx_http_huff_decode_bytes_ready;
+
+
+void
+ngx_http_huff_decode_init(void)
+{
+    u_char                        state, ending, sym[2], *p;
+    ngx_uint_t                    s, ch;
+    ngx_http_huff_decode_byte_t  *code;
+
+    if (ngx_http_huff_decode_bytes_ready) {
+        return;
+    }
+
+    for (s = 0; s < 256; s++) {
+        for (ch = 0; ch < 256; ch++) {
+
+            code = &ngx_http_huff_decode_bytes[s][ch];
+
+            state = (u_char) s;
+            ending = 0;
+            p = sym;
+
+            if (ngx_http_huff_decode_bits(&state, &ending, ch >> 4, &p)
+                != NGX_OK
+                || ngx_http_huff_decode_bits(&state, &ending, ch & 0xf, &p)
+                   != NGX_OK)
+            {
+                code->next = (u_char) s;
+                code->flags = NGX_HTTP_HUFF_DECODE_ERROR;
+                continue;
+            }
+
+            code->next = state;
+            code->flags = (u_char) (p - sym);
+
+            if (ending) {
+                code->flags |= NGX_HTTP_HUFF_DECODE_ENDING;
+            }
+
+            code->sym[0] = sym[0];
+            code->sym[1] = sym[1];
+        }
+    }
+
+    ngx_http_huff_decode_bytes_ready = 1;
+}
+
+
 ngx_int_t
 ngx_http_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
     ngx_uint_t last, ngx_log_t *log)
+{
+    u_char                        *end, *d, ch, st;
+    ngx_http_huff_decode_byte_t    code;
+
+    if (!ngx_http_huff_decode_bytes_ready) {
+        return ngx_http_huff_decode_nibbles(state, src, len, dst, last, log);
+    }
+
+    ch = 0;
+    st = *state;
+    code.flags = NGX_HTTP_HUFF_DECODE_ENDING;
+
+    d = *dst;
+    end = src + len;
+
+    while (src != end) {
+        ch = *src++;
+
+        code = ngx_http_huff_decode_bytes[st][ch];
+
+        if (code.flags & NGX_HTTP_HUFF_DECODE_ERROR) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "http huffman decoding error at state %d: "
+                           "bad code 0x%Xd", st, ch);
+
+            *state = st;
+            *dst = d;
+
+            return NGX_ERROR;
+        }
+
+        if (src != end) {
+
+            /*
+             * both symbols are stored and the second one may be
+             * overwritten: the output is at least len * 8 / 5 bytes,
+             * so there is room for it while more input follows
+             */
+
+            d[0] = code.sym[0];
+            d[1] = code.sym[1];
+            d += code.flags & NGX_HTTP_HUFF_DECODE_EMIT;
+
+        } else {
+            switch (code.flags & NGX_HTTP_HUFF_DECODE_EMIT) {
+
+            case 2:
+                *d++ = code.sym[0];
+                *d++ = code.sym[1];
+                break;
+
+            case 1:
+                *d++ = code.sym[0];
+                break;
+            }
+        }
+
+        st = code.next;
+    }
+
+    *dst = d;
+
+    if (last) {
+        if (!(code.flags & NGX_HTTP_HUFF_DECODE_ENDING)) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "http huffman decoding error: "
+                           "incomplete code 0x%Xd", ch);
+
+            *state = st;
+
+            return NGX_ERROR;
+        }
+
+        st = 0;
+    }
+
+    *state = st;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_huff_decode_nibbles(u_char *state, u_char *src, size_t len,
+    u_char **dst, ngx_uint_t last, ngx_log_t *log)
 {
     u_char  *end, ch, ending;
 
@@ -102,6 +102,174 @@ static uint32_t  usual[] = {
 #endif
 
 
+#if (NGX_HAVE_SSE42 || NGX_HAVE_AVX2)
+
+/*
+ * Runs of bytes which do not change the parser state are skipped
+ * 16 or 32 bytes at a time.  The byte ranges which stop a run are
+ * padded to 16 bytes for the SSE4.2 string instructions.
+ */
+
+typedef struct {
+    u_char                    ranges[16];
+    int                       len;
+} ngx_http_parse_stop_t;
+
+
+static ngx_inline u_char *ngx_http_parse_skip(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop);
+#if (NGX_HAVE_SSE42)
+static u_char *ngx_http_parse_skip_sse42(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop);
+#endif
+#if (NGX_HAVE_AVX2)
+static u_char *ngx_http_parse_skip_avx2(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop);
+#endif
+static ngx_uint_t ngx_http_parse_name_hash(ngx_http_request_t *r,
+    ngx_uint_t hash, ngx_uint_t *index, u_char *p, u_char *last);
+#if (NGX_HAVE_SSE42)
+static u_char *ngx_http_parse_name_hash_sse2(u_char *lc, ngx_uint_t *hash,
+    ngx_uint_t *index, u_char *p, u_char *last);
+#endif
+#if (NGX_HAVE_AVX2)
+static u_char *ngx_http_parse_name_hash_avx2(u_char *lc, ngx_uint_t *hash,
+    ngx_uint_t *index, u_char *p, u_char *last);
+#endif
+
+
+/* the "usual" characters of sw_check_uri */
+
+static ngx_http_parse_stop_t  ngx_http_parse_check_uri_stop = {
+    "\x00\x20##%%++./??\x7f\x7f", 14
+};
+
+/* sw_uri */
+
+static ngx_http_parse_stop_t  ngx_http_parse_uri_stop = {
+    "\x00\x20##\x7f\x7f", 6
+};
+
+/* sw_name, letters, digits and "-" */
+
+static ngx_http_parse_stop_t  ngx_http_parse_name_stop = {
+    "\x00\x2c\x2e\x2f\x3a\x40\x5b\x60\x7b\xff", 10
+};
+
+/* sw_value, spaces are handled after a run */
+
+static ngx_http_parse_stop_t  ngx_http_parse_value_stop = {
+    "\x00\x00\n\n\r\r", 6
+};
+
+
+static ngx_inline u_char *
+ngx_http_parse_skip(u_char *p, u_char *last, ngx_http_parse_stop_t *stop)
+{
+    if (last - p < 16) {
+        return p;
+    }
+
+#if (NGX_HAVE_AVX2)
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        return ngx_http_parse_skip_avx2(p, last, stop);
+    }
+#endif
+
+#if (NGX_HAVE_SSE42)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        return ngx_http_parse_skip_sse42(p, last, stop);
+    }
+#endif
+
+    return p;
+}
+
+
+/*
+ * Lowercases and hashes a run of letters, digits and "-", which are all
+ * lowercased by setting 0x20.  Four characters are hashed per step as
+ *
+ *     hash * 31^4 + c0 * 31^3 + c1 * 31^2 + c2 * 31 + c3,
+ *
+ * which is equal to four ngx_hash() steps, so that the key matches
+ * ngx_hash_key_lc().  The vector code does the same for 32 or 16 bytes,
+ * the rest of a run is handled here.
+ */
+
+static ngx_uint_t
+ngx_http_parse_name_hash(ngx_http_request_t *r, ngx_uint_t hash,
+    ngx_uint_t *index, u_char *p, u_char *last)
+{
+    u_char      c0, c1, c2, c3, *lc;
+    ngx_uint_t  i;
+
+    lc = r->lowcase_header;
+    i = *index;
+
+#if (NGX_HAVE_AVX2)
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        p = ngx_http_parse_name_hash_avx2(lc, &hash, &i, p, last);
+    }
+#endif
+
+#if (NGX_HAVE_SSE42)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        p = ngx_http_parse_name_hash_sse2(lc, &hash, &i, p, last);
+    }
+#endif
+
+    while (last - p >= 4) {
+        c0 = p[0] | 0x20;
+        c1 = p[1] | 0x20;
+        c2 = p[2] | 0x20;
+        c3 = p[3] | 0x20;
+
+        hash = hash * 923521 + c0 * 29791 + c1 * 961 + c2 * 31 + c3;
+
+        if (i + 4 <= NGX_HTTP_LC_HEADER_LEN) {
+            lc[i] = c0;
+            lc[i + 1] = c1;
+            lc[i + 2] = c2;
+            lc[i + 3] = c3;
+
+            i = (i + 4) & (NGX_HTTP_LC_HEADER_LEN - 1);
+
+        } else {
+            lc[i] = c0;
+            i = (i + 1) & (NGX_HTTP_LC_HEADER_LEN - 1);
+            lc[i] = c1;
+            i = (i + 1) & (NGX_HTTP_LC_HEADER_LEN - 1);
+            lc[i] = c2;
+            i = (i + 1) & (NGX_HTTP_LC_HEADER_LEN - 1);
+            lc[i] = c3;
+            i = (i + 1) & (NGX_HTTP_LC_HEADER_LEN - 1);
+        }
+
+        p += 4;
+    }
+
+    while (p < last) {
+        c0 = *p++ | 0x20;
+
+        hash = ngx_hash(hash, c0);
+        lc[i] = c0;
+        i = (i + 1) & (NGX_HTTP_LC_HEADER_LEN - 1);
+    }
+
+    *index = i;
+
+    return hash;
+}
+
+#else
+
+#define ngx_http_parse_skip(p, last, stop)  (p)
+#define ngx_http_parse_name_hash(r, hash, index, p, last)  (hash)
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
@@ -583,6 +751,8 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_check_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+                p = ngx_http_parse_skip(p + 1, b->last,
+                                        &ngx_http_parse_check_uri_stop) - 1;
                 break;
             }
 
@@ -647,6 +817,8 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+                p = ngx_http_parse_skip(p + 1, b->last,
+                                        &ngx_http_parse_uri_stop) - 1;
                 break;
             }
 
@@ -871,7 +1043,7 @@ ngx_int_t
 ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
     ngx_uint_t allow_underscores)
 {
-    u_char      c, ch, *p;
+    u_char      c, ch, *p, *q, *e;
     ngx_uint_t  hash, i;
     enum {
         sw_start = 0,
@@ -967,6 +1139,15 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 hash = ngx_hash(hash, c);
                 r->lowcase_header[i++] = c;
                 i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+
+                q = ngx_http_parse_skip(p + 1, b->last,
+                                        &ngx_http_parse_name_stop);
+
+                if (q != p + 1) {
+                    hash = ngx_http_parse_name_hash(r, hash, &i, p + 1, q);
+                    p = q - 1;
+                }
+
                 break;
             }
 
@@ -1064,6 +1245,25 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
             case '\0':
                 r->header_end = p;
                 return NGX_HTTP_PARSE_INVALID_HEADER;
+            default:
+                q = ngx_http_parse_skip(p + 1, b->last,
+                                        &ngx_http_parse_value_stop);
+
+                if (q == p + 1) {
+                    break;
+                }
+
+                /* trailing spaces of a run, as sw_space_after_value does */
+
+                for (e = q; e[-1] == ' '; e--) { /* void */ }
+
+                if (e != q) {
+                    r->header_end = e;
+                    state = sw_space_after_value;
+                }
+
+                p = q - 1;
+                break;
             }
             break;
 
@@ -2483,3 +2683,191 @@ invalid:
 
     return NGX_ERROR;
 }
+
+
+#if (NGX_HAVE_SSE42)
+
+static NGX_TARGET_SSE42 u_char *
+ngx_http_parse_skip_sse42(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop)
+{
+    int      n;
+    __m128i  ranges, v;
+
+    ranges = _mm_loadu_si128((__m128i *) stop->ranges);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        n = _mm_cmpestri(ranges, stop->len, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+/*
+ * Only SSE2 instructions are used, so the name hashing goes with the
+ * SSE4.2 scanning which finds the run.  _mm_madd_epi16() gives the sums
+ * c0 * 31^3 + c1 * 31^2 and c2 * 31 + c3, a pair of them is a step of
+ * ngx_http_parse_name_hash().
+ */
+
+static NGX_TARGET_SSE42 u_char *
+ngx_http_parse_name_hash_sse2(u_char *lc, ngx_uint_t *hash,
+    ngx_uint_t *index, u_char *p, u_char *last)
+{
+    u_char      buf[16];
+    uint32_t    s[8];
+    ngx_uint_t  h, i, n;
+    __m128i     v, w, zero, bit;
+
+    h = *hash;
+    i = *index;
+
+    w = _mm_setr_epi16(29791, 961, 31, 1, 29791, 961, 31, 1);
+    zero = _mm_setzero_si128();
+    bit = _mm_set1_epi8(0x20);
+
+    while (last - p >= 16) {
+        v = _mm_or_si128(_mm_loadu_si128((__m128i *) p), bit);
+
+        if (i <= NGX_HTTP_LC_HEADER_LEN - 16) {
+            _mm_storeu_si128((__m128i *) &lc[i], v);
+
+        } else {
+            _mm_storeu_si128((__m128i *) buf, v);
+
+            n = NGX_HTTP_LC_HEADER_LEN - i;
+            ngx_memcpy(&lc[i], buf, n);
+            ngx_memcpy(lc, &buf[n], 16 - n);
+        }
+
+        i = (i + 16) & (NGX_HTTP_LC_HEADER_LEN - 1);
+
+        _mm_storeu_si128((__m128i *) &s[0],
+                         _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), w));
+        _mm_storeu_si128((__m128i *) &s[4],
+                         _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), w));
+
+        h = h * 923521 + s[0] + s[1];
+        h = h * 923521 + s[2] + s[3];
+        h = h * 923521 + s[4] + s[5];
+        h = h * 923521 + s[6] + s[7];
+
+        p += 16;
+    }
+
+    *hash = h;
+    *index = i;
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_HAVE_AVX2)
+
+static NGX_TARGET_AVX2 u_char *
+ngx_http_parse_skip_avx2(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop)
+{
+    int       i, n;
+    uint32_t  mask;
+    __m256i   lo[8], hi[8], v, m;
+
+    n = stop->len / 2;
+
+    for (i = 0; i < n; i++) {
+        lo[i] = _mm256_set1_epi8((char) stop->ranges[2 * i]);
+        hi[i] = _mm256_set1_epi8((char) stop->ranges[2 * i + 1]);
+    }
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((__m256i *) p);
+        m = _mm256_setzero_si256();
+
+        /* lo <= v <= hi as unsigned bytes */
+
+        for (i = 0; i < n; i++) {
+            m = _mm256_or_si256(m, _mm256_and_si256(
+                    _mm256_cmpeq_epi8(_mm256_max_epu8(v, lo[i]), v),
+                    _mm256_cmpeq_epi8(_mm256_min_epu8(v, hi[i]), v)));
+        }
+
+        mask = (uint32_t) _mm256_movemask_epi8(m);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    return p;
+}
+
+
+/*
+ * _mm256_maddubs_epi16() gives c0 * 31 + c1, and _mm256_madd_epi16()
+ * combines two of them into a step of ngx_http_parse_name_hash().
+ * A 32-byte block fills the whole lowcase_header rotated by the index,
+ * which is not changed.
+ */
+
+static NGX_TARGET_AVX2 u_char *
+ngx_http_parse_name_hash_avx2(u_char *lc, ngx_uint_t *hash,
+    ngx_uint_t *index, u_char *p, u_char *last)
+{
+    u_char      buf[32];
+    uint32_t    s[8];
+    ngx_uint_t  h, i, k;
+    __m256i     v, w8, w16, bit;
+
+    h = *hash;
+    i = *index;
+
+    w8 = _mm256_set1_epi16(31 | 1 << 8);
+    w16 = _mm256_set1_epi32(961 | 1 << 16);
+    bit = _mm256_set1_epi8(0x20);
+
+    while (last - p >= 32) {
+        v = _mm256_or_si256(_mm256_loadu_si256((__m256i *) p), bit);
+
+        if (i == 0) {
+            _mm256_storeu_si256((__m256i *) lc, v);
+
+        } else {
+            _mm256_storeu_si256((__m256i *) buf, v);
+
+            ngx_memcpy(&lc[i], buf, NGX_HTTP_LC_HEADER_LEN - i);
+            ngx_memcpy(lc, &buf[NGX_HTTP_LC_HEADER_LEN - i], i);
+        }
+
+        _mm256_storeu_si256((__m256i *) s,
+                            _mm256_madd_epi16(_mm256_maddubs_epi16(v, w8),
+                                              w16));
+
+        for (k = 0; k < 8; k++) {
+            h = h * 923521 + s[k];
+        }
+
+        p += 32;
+    }
+
+    *hash = h;
+
+    return p;
+}
+
+#endif
+
@@ -586,6 +586,11 @@ ngx_http_alloc_request(ngx_connection_t *c)
         return NULL;
     }
 
+    if (ngx_pool_enable_free_lists(pool) != NGX_OK) {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
+
     r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
     if (r == NULL) {
         ngx_destroy_pool(pool);
@@ -1538,8 +1543,8 @@ ngx_http_process_request_headers(ngx_event_t *rev)
                 ngx_strlow(h->lowcase_key, h->key.data, h->key.len);
             }
 
-            hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
-                               h->lowcase_key, h->key.len);
+            hh = ngx_hash_perfect_find(&cmcf->headers_in_phash, h->hash,
+                                        h->lowcase_key, h->key.len);
 
             if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
                 break;
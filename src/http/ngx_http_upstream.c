@@ -894,6 +894,8 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return NGX_ERROR;
         }
 
+        r->cache->file_cache = cache;
+
         if (u->create_key(r) != NGX_OK) {
             return NGX_ERROR;
         }
@@ -919,7 +921,6 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         c->body_start = u->conf->buffer_size;
         c->min_uses = u->conf->cache_min_uses;
-        c->file_cache = cache;
 
         switch (ngx_http_test_predicates(r, u->conf->cache_bypass)) {
 
@@ -946,6 +947,8 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http upstream cache: %i", rc);
 
+    ngx_http_file_cache_account(r, rc);
+
     switch (rc) {
 
     case NGX_HTTP_CACHE_STALE:
@@ -3519,7 +3522,8 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
 #if (NGX_HTTP_CACHE)
         if (r->cache && !r->cache->file_cache->use_temp_path) {
-            p->temp_file->path = r->cache->file_cache->path;
+            p->temp_file->path =
+                             r->cache->file_cache->dirs[r->cache->dir].path;
             p->temp_file->file.name = r->cache->file.name;
         }
 #endif
@@ -4465,6 +4469,9 @@ ngx_http_upstream_process_request(ngx_http_request_t *r,
 
             } else if (p->upstream_error) {
                 ngx_http_file_cache_free(r->cache, p->temp_file);
+
+            } else {
+                ngx_http_file_cache_fill(r, p->temp_file);
             }
         }
 
@@ -6376,7 +6383,8 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
                                          |NGX_HTTP_UPSTREAM_MAX_FAILS
                                          |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
                                          |NGX_HTTP_UPSTREAM_DOWN
-                                         |NGX_HTTP_UPSTREAM_BACKUP);
+                                         |NGX_HTTP_UPSTREAM_BACKUP
+                                         |NGX_HTTP_UPSTREAM_LOCKLESS);
     if (uscf == NULL) {
         return NGX_CONF_ERROR;
     }
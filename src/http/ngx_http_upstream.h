@@ -130,6 +130,7 @@ typedef struct {
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
 #define NGX_HTTP_UPSTREAM_MODIFY        0x0040
 #define NGX_HTTP_UPSTREAM_MAX_CONNS     0x0100
+#define NGX_HTTP_UPSTREAM_LOCKLESS      0x0200
 
 
 struct ngx_http_upstream_srv_conf_s {
@@ -149,6 +150,7 @@ struct ngx_http_upstream_srv_conf_s {
     ngx_shm_zone_t                  *shm_zone;
     ngx_resolver_t                  *resolver;
     ngx_msec_t                       resolver_timeout;
+    ngx_uint_t                       lockless;  /* unsigned lockless:1 */
 #endif
 };
 
@@ -22,6 +22,10 @@ static ngx_int_t ngx_http_upstream_create_sid(ngx_conf_t *cf,
 
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp, ngx_peer_connection_t *pc);
+static ngx_int_t ngx_http_upstream_rr_peer_acquire(
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *peer);
+static void ngx_http_upstream_rr_peer_release(
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *peer);
 
 #if (NGX_HTTP_SSL)
 
@@ -737,6 +741,10 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
         }
 #endif
 
+        if (ngx_http_upstream_rr_peer_acquire(peers, peer) != NGX_OK) {
+            goto failed;
+        }
+
         rrp->current = peer;
         ngx_http_upstream_rr_peer_ref(peers, peer);
 
@@ -744,15 +752,25 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
 
         /* there are several peers */
 
-        peer = ngx_http_upstream_get_peer(rrp, pc);
+        for ( ;; ) {
+            peer = ngx_http_upstream_get_peer(rrp, pc);
 
-        if (peer == NULL) {
-            goto failed;
+            if (peer == NULL) {
+                goto failed;
+            }
+
+            if (ngx_http_upstream_rr_peer_acquire(peers, peer) == NGX_OK) {
+                break;
+            }
+
+            /* max_conns was reached by another worker process */
+
+            (void) ngx_http_upstream_rr_peer_unref(peers, peer);
         }
 
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                       "get rr peer, current: %p %i",
-                       peer, peer->current_weight);
+                       "get rr peer, current: %p %i", peer,
+                       ngx_http_upstream_rr_peer_worker(peer)->current_weight);
     }
 
     pc->sockaddr = peer->sockaddr;
@@ -763,8 +781,6 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     pc->sid = &peer->sid;
 #endif
 
-    peer->conns++;
-
     ngx_http_upstream_rr_peers_unlock(peers);
 
     return NGX_OK;
@@ -815,7 +831,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp,
     uintptr_t                     m;
     ngx_int_t                     total;
     ngx_uint_t                    i, n, p;
-    ngx_http_upstream_rr_peer_t  *peer, *best;
+    ngx_http_upstream_rr_peer_t  *peer, *best, *w, *bw;
 
 #if (NGX_HTTP_UPSTREAM_SID)
     ngx_int_t                     low_limit;
@@ -830,6 +846,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp,
 
 #if (NGX_SUPPRESS_WARN)
     p = 0;
+    bw = NULL;
 #endif
 
 #if (NGX_HTTP_UPSTREAM_SID)
@@ -843,7 +860,9 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp,
          * note: current code accounts only one sticky request in a row, if it
          *       is required to account more, multiply low_limit by N below
          */
-        if (st_peer->current_weight <= low_limit) {
+        if (ngx_http_upstream_rr_peer_worker(st_peer)->current_weight
+            <= low_limit)
+        {
 
             /* do not update weights if the limit exceeded */
             best = st_peer;
@@ -881,15 +900,18 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp,
             continue;
         }
 
-        peer->current_weight += peer->effective_weight;
-        total += peer->effective_weight;
+        w = ngx_http_upstream_rr_peer_worker(peer);
 
-        if (peer->effective_weight < peer->weight) {
-            peer->effective_weight++;
+        w->current_weight += w->effective_weight;
+        total += w->effective_weight;
+
+        if (w->effective_weight < peer->weight) {
+            w->effective_weight++;
         }
 
-        if (best == NULL || peer->current_weight > best->current_weight) {
+        if (best == NULL || w->current_weight > bw->current_weight) {
             best = peer;
+            bw = w;
             p = i;
         }
     }
@@ -899,6 +921,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp,
 
     if (st_peer) {
         best = st_peer;
+        bw = ngx_http_upstream_rr_peer_worker(st_peer);
         p = st_p;
     }
 #endif
@@ -907,7 +930,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp,
         return NULL;
     }
 
-    best->current_weight -= total;
+    bw->current_weight -= total;
 
 #if (NGX_HTTP_UPSTREAM_SID)
 best_chosen:
@@ -1026,7 +1049,7 @@ ngx_http_upstream_free_round_robin_peer_locked(ngx_peer_connection_t *pc,
     ngx_http_upstream_rr_peer_data_t  *rrp = data;
 
     time_t                       now;
-    ngx_http_upstream_rr_peer_t  *peer;
+    ngx_http_upstream_rr_peer_t  *peer, *w;
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free rr peer %ui %ui", pc->tries, state);
@@ -1041,7 +1064,7 @@ ngx_http_upstream_free_round_robin_peer_locked(ngx_peer_connection_t *pc,
             peer->fails = 0;
         }
 
-        peer->conns--;
+        ngx_http_upstream_rr_peer_release(rrp->peers, peer);
 
         if (ngx_http_upstream_rr_peer_unref(rrp->peers, peer) == NGX_OK) {
             ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
@@ -1056,12 +1079,24 @@ ngx_http_upstream_free_round_robin_peer_locked(ngx_peer_connection_t *pc,
     if (state & NGX_PEER_FAILED) {
         now = ngx_time();
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (rrp->peers->lockless) {
+            (void) ngx_atomic_fetch_add((ngx_atomic_t *) &peer->fails, 1);
+
+        } else {
+            peer->fails++;
+        }
+#else
         peer->fails++;
+#endif
+
         peer->accessed = now;
         peer->checked = now;
 
+        w = ngx_http_upstream_rr_peer_worker(peer);
+
         if (peer->max_fails) {
-            peer->effective_weight -= peer->weight / peer->max_fails;
+            w->effective_weight -= peer->weight / peer->max_fails;
 
             if (peer->fails >= peer->max_fails) {
                 ngx_log_error(NGX_LOG_WARN, pc->log, 0,
@@ -1071,10 +1106,10 @@ ngx_http_upstream_free_round_robin_peer_locked(ngx_peer_connection_t *pc,
 
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                        "free rr peer failed: %p %i",
-                       peer, peer->effective_weight);
+                       peer, w->effective_weight);
 
-        if (peer->effective_weight < 0) {
-            peer->effective_weight = 0;
+        if (w->effective_weight < 0) {
+            w->effective_weight = 0;
         }
 
     } else {
@@ -1086,7 +1121,7 @@ ngx_http_upstream_free_round_robin_peer_locked(ngx_peer_connection_t *pc,
         }
     }
 
-    peer->conns--;
+    ngx_http_upstream_rr_peer_release(rrp->peers, peer);
 
     if (ngx_http_upstream_rr_peer_unref(rrp->peers, peer) == NGX_OK) {
         ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
@@ -1100,6 +1135,55 @@ ngx_http_upstream_free_round_robin_peer_locked(ngx_peer_connection_t *pc,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_rr_peer_acquire(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_atomic_uint_t  conns;
+
+    if (peers->lockless) {
+
+        if (peer->max_conns == 0) {
+            (void) ngx_atomic_fetch_add((ngx_atomic_t *) &peer->conns, 1);
+            return NGX_OK;
+        }
+
+        do {
+            conns = *(ngx_atomic_t *) &peer->conns;
+
+            if (conns >= peer->max_conns) {
+                return NGX_BUSY;
+            }
+
+        } while (!ngx_atomic_cmp_set((ngx_atomic_t *) &peer->conns,
+                                     conns, conns + 1));
+
+        return NGX_OK;
+    }
+#endif
+
+    peer->conns++;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_rr_peer_release(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->lockless) {
+        (void) ngx_atomic_fetch_add((ngx_atomic_t *) &peer->conns, -1);
+        return;
+    }
+#endif
+
+    peer->conns--;
+}
+
+
 #if (NGX_HTTP_SSL)
 
 ngx_int_t
@@ -1122,7 +1206,12 @@ ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
 #if (NGX_HTTP_UPSTREAM_ZONE)
     peers = rrp->peers;
 
-    if (peers->shpool) {
+    /* in the lockless mode sessions are cached per worker process */
+
+    if (peers->lockless) {
+        peer = ngx_http_upstream_rr_peer_worker(peer);
+
+    } else if (peers->shpool) {
         ngx_http_upstream_rr_peers_rlock(peers);
         ngx_http_upstream_rr_peer_lock(peers, peer);
 
@@ -1178,10 +1267,15 @@ ngx_http_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
     ngx_http_upstream_rr_peers_t  *peers;
 #endif
 
+    peer = rrp->current;
+
 #if (NGX_HTTP_UPSTREAM_ZONE)
     peers = rrp->peers;
 
-    if (peers->shpool) {
+    if (peers->lockless) {
+        peer = ngx_http_upstream_rr_peer_worker(peer);
+
+    } else if (peers->shpool) {
 
         ssl_session = ngx_ssl_get0_session(pc->connection);
 
@@ -1203,8 +1297,6 @@ ngx_http_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
         p = ngx_ssl_session_buffer;
         (void) i2d_SSL_SESSION(ssl_session, &p);
 
-        peer = rrp->current;
-
         ngx_http_upstream_rr_peers_rlock(peers);
         ngx_http_upstream_rr_peer_lock(peers, peer);
 
@@ -1248,8 +1340,6 @@ ngx_http_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "save session: %p", ssl_session);
 
-    peer = rrp->current;
-
     old_ssl_session = peer->ssl_session;
     peer->ssl_session = ssl_session;
 
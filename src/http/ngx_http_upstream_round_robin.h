@@ -83,6 +83,9 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_atomic_t                    lock;
     ngx_uint_t                      refs;
     ngx_http_upstream_host_t       *host;
+
+    /* worker process private weights in the lockless mode */
+    ngx_http_upstream_rr_peer_t    *worker;
 #endif
 
 #if (NGX_HTTP_UPSTREAM_SID || NGX_COMPAT)
@@ -121,6 +124,7 @@ struct ngx_http_upstream_rr_peers_s {
 
     unsigned                        single:1;
     unsigned                        weighted:1;
+    unsigned                        lockless:1;
 
     ngx_str_t                      *name;
 
@@ -132,40 +136,51 @@ struct ngx_http_upstream_rr_peers_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
 
+/*
+ * in the lockless mode peers cannot be changed, so the locks are not used:
+ * weights are kept per worker process, counters are updated atomically
+ */
+
 #define ngx_http_upstream_rr_peers_rlock(peers)                               \
                                                                               \
-    if (peers->shpool) {                                                      \
+    if (peers->shpool && !peers->lockless) {                                  \
         ngx_rwlock_rlock(&peers->rwlock);                                     \
     }
 
 #define ngx_http_upstream_rr_peers_wlock(peers)                               \
                                                                               \
-    if (peers->shpool) {                                                      \
+    if (peers->shpool && !peers->lockless) {                                  \
         ngx_rwlock_wlock(&peers->rwlock);                                     \
     }
 
 #define ngx_http_upstream_rr_peers_unlock(peers)                              \
                                                                               \
-    if (peers->shpool) {                                                      \
+    if (peers->shpool && !peers->lockless) {                                  \
         ngx_rwlock_unlock(&peers->rwlock);                                    \
     }
 
 
 #define ngx_http_upstream_rr_peer_lock(peers, peer)                           \
                                                                               \
-    if (peers->shpool) {                                                      \
+    if (peers->shpool && !peers->lockless) {                                  \
         ngx_rwlock_wlock(&peer->lock);                                        \
     }
 
 #define ngx_http_upstream_rr_peer_unlock(peers, peer)                         \
                                                                               \
-    if (peers->shpool) {                                                      \
+    if (peers->shpool && !peers->lockless) {                                  \
         ngx_rwlock_unlock(&peer->lock);                                       \
     }
 
 
 #define ngx_http_upstream_rr_peer_ref(peers, peer)                            \
-    (peer)->refs++;
+                                                                              \
+    if (!peers->lockless) {                                                   \
+        (peer)->refs++;                                                       \
+    }
+
+#define ngx_http_upstream_rr_peer_worker(peer)                                \
+    ((peer)->worker ? (peer)->worker : (peer))
 
 
 static ngx_inline void
@@ -211,6 +226,10 @@ static ngx_inline ngx_int_t
 ngx_http_upstream_rr_peer_unref(ngx_http_upstream_rr_peers_t *peers,
     ngx_http_upstream_rr_peer_t *peer)
 {
+    if (peers->lockless) {
+        return NGX_OK;
+    }
+
     peer->refs--;
 
     if (peers->shpool == NULL) {
@@ -234,6 +253,7 @@ ngx_http_upstream_rr_peer_unref(ngx_http_upstream_rr_peers_t *peers,
 #define ngx_http_upstream_rr_peer_unlock(peers, peer)
 #define ngx_http_upstream_rr_peer_ref(peers, peer)
 #define ngx_http_upstream_rr_peer_unref(peers, peer)  NGX_OK
+#define ngx_http_upstream_rr_peer_worker(peer)  (peer)
 
 #endif
 
@@ -1858,8 +1858,8 @@ ngx_http_v2_state_process_header(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
-        hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
-                           h->lowcase_key, h->key.len);
+        hh = ngx_hash_perfect_find(&cmcf->headers_in_phash, h->hash,
+                                    h->lowcase_key, h->key.len);
 
         if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
             goto error;
@@ -3740,8 +3740,8 @@ ngx_http_v2_construct_cookie_header(ngx_http_request_t *r)
 
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
-    hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
-                       h->lowcase_key, h->key.len);
+    hh = ngx_hash_perfect_find(&cmcf->headers_in_phash, h->hash,
+                                h->lowcase_key, h->key.len);
 
     if (hh == NULL) {
         ngx_http_v2_close_stream(r->stream, NGX_HTTP_INTERNAL_SERVER_ERROR);
@@ -3787,8 +3787,8 @@ ngx_http_v2_construct_host_header(ngx_http_request_t *r)
 
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
-    hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
-                       h->lowcase_key, h->key.len);
+    hh = ngx_hash_perfect_find(&cmcf->headers_in_phash, h->hash,
+                                h->lowcase_key, h->key.len);
 
     if (hh == NULL) {
         ngx_http_v2_close_stream(r->stream, NGX_HTTP_INTERNAL_SERVER_ERROR);
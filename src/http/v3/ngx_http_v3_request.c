@@ -687,8 +687,8 @@ ngx_http_v3_process_header(ngx_http_request_t *r, ngx_str_t *name,
 
         cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
-        hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
-                           h->lowcase_key, h->key.len);
+        hh = ngx_hash_perfect_find(&cmcf->headers_in_phash, h->hash,
+                                    h->lowcase_key, h->key.len);
 
         if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
             return NGX_ERROR;
@@ -1256,8 +1256,8 @@ ngx_http_v3_construct_cookie_header(ngx_http_request_t *r)
 
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
-    hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
-                       h->lowcase_key, h->key.len);
+    hh = ngx_hash_perfect_find(&cmcf->headers_in_phash, h->hash,
+                                h->lowcase_key, h->key.len);
 
     if (hh == NULL) {
         ngx_http_close_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
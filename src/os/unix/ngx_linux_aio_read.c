@@ -13,6 +13,11 @@
 extern int            ngx_eventfd;
 extern aio_context_t  ngx_aio_ctx;
 
+#if (NGX_HAVE_IOURING)
+ngx_int_t ngx_iouring_aio_read(ngx_event_aio_t *aio, u_char *buf, size_t size,
+    off_t offset);
+#endif
+
 
 static void ngx_file_aio_event_handler(ngx_event_t *ev);
 
@@ -93,6 +98,25 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_IOURING)
+
+    if (ngx_event_flags & NGX_USE_IOURING_EVENT) {
+
+        ev->handler = ngx_file_aio_event_handler;
+
+        if (ngx_iouring_aio_read(aio, buf, size, offset) == NGX_OK) {
+            ev->active = 1;
+            ev->ready = 0;
+            ev->complete = 0;
+
+            return NGX_AGAIN;
+        }
+
+        return ngx_read_file(file, buf, size, offset);
+    }
+
+#endif
+
     ngx_memzero(&aio->aiocb, sizeof(struct iocb));
 
     aio->aiocb.aio_data = (uint64_t) (uintptr_t) ev;
@@ -75,6 +75,11 @@
 #endif
 
 
+#if (NGX_HAVE_INOTIFY)
+#include <sys/inotify.h>
+#endif
+
+
 #if (NGX_HAVE_SENDFILE64)
 #include <sys/sendfile.h>
 #else
@@ -93,6 +98,11 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IOURING)
+#include <linux/io_uring.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
@@ -107,7 +117,7 @@ typedef struct iocb  ngx_aiocb_t;
 #include <linux/capability.h>
 #endif
 
-#if (NGX_HAVE_UDP_SEGMENT)
+#if (NGX_HAVE_UDP_SEGMENT || NGX_HAVE_UDP_GRO)
 #include <netinet/udp.h>
 #endif
 
@@ -13,6 +13,11 @@ u_char  ngx_linux_kern_ostype[50];
 u_char  ngx_linux_kern_osrelease[50];
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+static size_t ngx_linux_hugepage_size(ngx_log_t *log);
+#endif
+
+
 static ngx_os_io_t ngx_linux_io = {
     ngx_unix_recv,
     ngx_readv_chain,
@@ -48,10 +53,80 @@ ngx_os_specific_init(ngx_log_t *log)
 
     ngx_os_io = ngx_linux_io;
 
+#if (NGX_HAVE_MAP_HUGETLB)
+    ngx_shm_hugepage_size = ngx_linux_hugepage_size(log);
+#endif
+
     return NGX_OK;
 }
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+
+/*
+ * the default huge page size, which is used by MAP_HUGETLB, may be 2M,
+ * 1G on x86, or 512M on arm64 with 64K pages
+ */
+
+static size_t
+ngx_linux_hugepage_size(ngx_log_t *log)
+{
+    u_char     *p, *last, buf[4096];
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_int_t   size;
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_NOTICE, log, ngx_errno,
+                      ngx_open_file_n " \"/proc/meminfo\" failed");
+        return 0;
+    }
+
+    n = read(fd, buf, sizeof(buf) - 1);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_NOTICE, log, ngx_errno,
+                      "read() \"/proc/meminfo\" failed");
+        n = 0;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    buf[n] = '\0';
+
+    /* "Hugepagesize:       2048 kB" */
+
+    p = (u_char *) ngx_strstr(buf, "Hugepagesize:");
+
+    if (p == NULL) {
+        return 0;
+    }
+
+    p += sizeof("Hugepagesize:") - 1;
+
+    while (*p == ' ') {
+        p++;
+    }
+
+    for (last = p; *last >= '0' && *last <= '9'; last++) { /* void */ }
+
+    size = ngx_atoi(p, last - p);
+
+    if (size <= 0 || ngx_strncmp(last, " kB", 3) != 0) {
+        return 0;
+    }
+
+    return (size_t) size * 1024;
+}
+
+#endif
+
+
 void
 ngx_os_specific_status(ngx_log_t *log)
 {
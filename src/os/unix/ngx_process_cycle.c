@@ -25,6 +25,7 @@ static void ngx_worker_process_exit(ngx_cycle_t *cycle);
 static void ngx_channel_handler(ngx_event_t *ev);
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
+static void ngx_cache_manager_process_exit(ngx_cycle_t *cycle);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
 
 
@@ -1122,6 +1123,11 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 
         if (ngx_terminate || ngx_quit) {
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
+
+            if (ctx == &ngx_cache_manager_ctx) {
+                ngx_cache_manager_process_exit(cycle);
+            }
+
             exit(0);
         }
 
@@ -1165,6 +1171,23 @@ ngx_cache_manager_process_handler(ngx_event_t *ev)
 }
 
 
+static void
+ngx_cache_manager_process_exit(ngx_cycle_t *cycle)
+{
+    ngx_uint_t    i;
+    ngx_path_t  **path;
+
+    path = cycle->paths.elts;
+    for (i = 0; i < cycle->paths.nelts; i++) {
+
+        if (path[i]->saver) {
+            path[i]->saver(path[i]->data);
+            ngx_time_update();
+        }
+    }
+}
+
+
 static void
 ngx_cache_loader_process_handler(ngx_event_t *ev)
 {
@@ -9,11 +9,50 @@
 #include <ngx_core.h>
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+
+/* the default size of the hugetlb pages, set by ngx_os_specific_init() */
+
+size_t  ngx_shm_hugepage_size;
+
+#endif
+
+
 #if (NGX_HAVE_MAP_ANON)
 
+/*
+ * with the "hugepages" parameter a zone is mapped from the hugetlb
+ * pool, and if there are no reserved huge pages, the regular mapping
+ * is advised to be backed by transparent huge pages; MAP_HUGETLB uses
+ * the default huge page size, and the length of the mapping is aligned
+ * to it, as the kernel does
+ */
+
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
+    shm->huge = NGX_SHM_HUGEPAGES_OFF;
+
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    if (shm->hugepages && ngx_shm_hugepage_size) {
+        shm->addr = (u_char *) mmap(NULL,
+                                    ngx_align(shm->size, ngx_shm_hugepage_size),
+                                    PROT_READ|PROT_WRITE,
+                                    MAP_ANON|MAP_SHARED|MAP_HUGETLB, -1, 0);
+
+        if (shm->addr != MAP_FAILED) {
+            shm->huge = NGX_SHM_HUGEPAGES_TLB;
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, shm->log, ngx_errno,
+                      "mmap(MAP_HUGETLB, %uz) failed for zone \"%V\", "
+                      "using regular pages", shm->size, &shm->name);
+    }
+
+#endif
+
     shm->addr = (u_char *) mmap(NULL, shm->size,
                                 PROT_READ|PROT_WRITE,
                                 MAP_ANON|MAP_SHARED, -1, 0);
@@ -24,6 +63,21 @@ ngx_shm_alloc(ngx_shm_t *shm)
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_MADV_HUGEPAGE)
+
+    if (shm->hugepages) {
+        if (madvise(shm->addr, shm->size, MADV_HUGEPAGE) == -1) {
+            ngx_log_error(NGX_LOG_NOTICE, shm->log, ngx_errno,
+                          "madvise(MADV_HUGEPAGE) failed for zone \"%V\"",
+                          &shm->name);
+
+        } else {
+            shm->huge = NGX_SHM_HUGEPAGES_THP;
+        }
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -31,9 +85,19 @@ ngx_shm_alloc(ngx_shm_t *shm)
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    size_t  size;
+
+    size = shm->size;
+
+#if (NGX_HAVE_MAP_HUGETLB)
+    if (shm->huge == NGX_SHM_HUGEPAGES_TLB) {
+        size = ngx_align(size, ngx_shm_hugepage_size);
+    }
+#endif
+
+    if (munmap((void *) shm->addr, size) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, size);
     }
 }
 
@@ -13,12 +13,19 @@
 #include <ngx_core.h>
 
 
+#define NGX_SHM_HUGEPAGES_OFF   0
+#define NGX_SHM_HUGEPAGES_TLB   1
+#define NGX_SHM_HUGEPAGES_THP   2
+
+
 typedef struct {
     u_char      *addr;
     size_t       size;
     ngx_str_t    name;
     ngx_log_t   *log;
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+    ngx_uint_t   hugepages;   /* unsigned  hugepages:1;  */
+    ngx_uint_t   huge;     /* NGX_SHM_HUGEPAGES_OFF, _TLB, _THP */
 } ngx_shm_t;
 
 
@@ -26,4 +33,9 @@ ngx_int_t ngx_shm_alloc(ngx_shm_t *shm);
 void ngx_shm_free(ngx_shm_t *shm);
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+extern size_t  ngx_shm_hugepage_size;
+#endif
+
+
 #endif /* _NGX_SHMEM_H_INCLUDED_ */
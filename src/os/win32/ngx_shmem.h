@@ -13,6 +13,11 @@
 #include <ngx_core.h>
 
 
+#define NGX_SHM_HUGEPAGES_OFF   0
+#define NGX_SHM_HUGEPAGES_TLB   1
+#define NGX_SHM_HUGEPAGES_THP   2
+
+
 typedef struct {
     u_char      *addr;
     size_t       size;
@@ -20,6 +25,8 @@ typedef struct {
     HANDLE       handle;
     ngx_log_t   *log;
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+    ngx_uint_t   hugepages;   /* unsigned  hugepages:1;  */
+    ngx_uint_t   huge;     /* always NGX_SHM_HUGEPAGES_OFF */
 } ngx_shm_t;
 
 